@@ -0,0 +1,87 @@
+#!/usr/bin/perl -w
+
+# Generate a large, deterministic DCPU-16 assembly source for benchmarking
+# das. Mixes the constructs real programs use: labels in both styles,
+# register, literal, symbolic and stack operands, strings, .equ and
+# comments.
+#
+# Usage: gensrc.pl [lines] > bench.s
+
+use strict;
+
+my $lines = shift || 100000;
+my @ops2 = qw(SET ADD SUB MUL AND BOR XOR SHL SHR IFE IFN IFG set add sub);
+my @ops1 = qw(JSR INT IAS HWI);
+my @regs = qw(A B C X Y Z I J a b c x y z i j);
+my $seed = 12345;
+
+# tiny LCG so every perl gives the same program
+sub rnd
+{
+	my $n = shift;
+	$seed = ($seed * 1103515245 + 12345) % 2147483648;
+	return int($seed / 65536) % $n;
+}
+
+sub pick { return $_[rnd(scalar @_)]; }
+
+my $nlabels = 0;
+sub label_ref
+{
+	# mostly backward references, some forward
+	return "L" . ($nlabels ? rnd($nlabels + 20) : 0);
+}
+
+sub operand
+{
+	my $r = rnd(12);
+	return pick(@regs) if $r < 4;
+	return rnd(0x1f) if $r == 4;
+	return sprintf("0x%x", rnd(0x10000)) if $r == 5;
+	return label_ref() if $r == 6;
+	return "[" . pick(@regs) . "]" if $r == 7;
+	return "[" . pick(@regs) . " + " . rnd(100) . "]" if $r == 8;
+	return "[" . label_ref() . " + " . pick(@regs) . "]" if $r == 9;
+	return "(" . label_ref() . " + BASE) * 2 - " . rnd(10) if $r == 10;
+	return "PEEK";
+}
+
+print "; generated benchmark source, $lines lines\n";
+print "\t.equ BASE, 0x100\n";
+my $n = 2;
+while ($n < $lines) {
+	my $r = rnd(20);
+	if ($r < 2) {
+		# label, notch or trailing colon style
+		print rnd(2) ? ":L$nlabels\n" : "L$nlabels:\n";
+		$nlabels++;
+	} elsif ($r < 12) {
+		my $b = operand();
+		$b = pick(@regs) if $b =~ /^\d|^0x|^\(|^L|PEEK/;
+		printf "\t%s %s, %s", pick(@ops2), $b, operand();
+		print "\t\t; comment on an instruction" if rnd(4) == 0;
+		print "\n";
+	} elsif ($r < 13) {
+		printf "\t%s %s\n", pick(@ops1), operand();
+	} elsif ($r < 14) {
+		print "\tSET PUSH, " . pick(@regs) . "\n";
+		print "\tSET [--SP], " . pick(@regs) . "\n";
+		print "\tSET " . pick(@regs) . ", [SP++]\n";
+		$n += 2;
+	} elsif ($r < 15) {
+		print "\tDAT \"string number $n\\n\", 0\n";
+	} elsif ($r < 16) {
+		print "\tDAT " . join(", ", map { rnd(0x10000) } 1 .. 8) . "\n";
+	} elsif ($r < 18) {
+		print "; a comment line, of typical length for commented source\n";
+	} elsif ($r < 19) {
+		print "\n";
+	} else {
+		print "\tSET " . pick(@regs) . ", PICK " . rnd(8) . "\n";
+	}
+	$n++;
+}
+# define any forward-referenced labels that never got emitted
+for (my $i = $nlabels; $i < $nlabels + 20; $i++) {
+	print ":L$i\n";
+}
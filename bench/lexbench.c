@@ -0,0 +1,92 @@
+/*
+ * das scanner benchmark: tokens per second over a source file.
+ * "make bench" links this once against each scanner engine.
+ *
+ * Usage: lexbench [-d] file.s
+ *   -d   dump the token stream instead, for comparing engines
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dasdefs.h"
+#include "output.h"
+#include "y.tab.h"
+
+extern FILE *yyin;
+extern int yylineno;
+int yylex(void);
+
+/* normally provided by the parser and main() */
+YYSTYPE yylval;
+YYLTYPE yylloc;
+int das_error;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void dump_token(int tok)
+{
+	printf("%d %d %d", yylloc.line, yylineno, tok);
+	switch (tok) {
+	case SYMBOL:
+	case LABEL:
+	case STRING:
+		printf(" %s", yylval.string);
+		break;
+	case CONSTANT:
+	case REG:
+	case OP1:
+	case OP2:
+	case PACKDIR:
+		printf(" %d", yylval.integer);
+		break;
+	}
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	int dump = 0;
+	long tokens = 0;
+	double start, secs;
+	int tok;
+
+	if (argc > 1 && !strcmp(argv[1], "-d")) {
+		dump = 1;
+		argv++;
+		argc--;
+	}
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s [-d] file.s\n", argv[0]);
+		return 1;
+	}
+	yyin = fopen(argv[1], "r");
+	if (!yyin) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	start = now();
+	while ((tok = yylex())) {
+		if (dump)
+			dump_token(tok);
+		tokens++;
+	}
+	secs = now() - start;
+
+	if (!dump) {
+		printf("%-24s %9ld tokens %8.3f s %8.2f Mtokens/s\n", argv[0],
+			tokens, secs, tokens / secs / 1e6);
+	}
+	return 0;
+}
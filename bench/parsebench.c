@@ -0,0 +1,199 @@
+/*
+ * das parser benchmark: source lines per second through the hand-written
+ * parser and through the bison one alone.
+ *
+ * Usage: parsebench [-b] [-j jobs] [-r runs] file.s
+ *   -b   the bison parser only
+ *   -j   jobs for the hand-written parser, as das -j, default 1
+ *   -r   times to parse with each, default 21
+ *
+ * Each parse is timed in a process of its own, the two parsers taking
+ * turns, so that both see the same machine. For each parser the median
+ * of the runs is given with the quartiles around it. The comparison is
+ * per round: each bison run against the hand-written one next to it, so
+ * that a slow patch of the machine slows both. It gives the median ratio,
+ * its quartiles and in how many rounds the hand-written parser was faster.
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "das.h"
+#include "dasdefs.h"
+#include "output.h"
+#include "parse.h"
+
+#define MAX_RUNS	101
+
+extern FILE *yyin;
+int yyparse(void);
+
+/* normally provided by main() */
+int das_error;
+struct options options;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* seconds one parse of path takes, in a child; < 0 on error */
+static double time_parse(const char *path, int bison)
+{
+	double secs = -1;
+	int fd[2], status;
+	pid_t pid;
+
+	if (pipe(fd)) {
+		perror("pipe");
+		return -1;
+	}
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return -1;
+	}
+	if (!pid) {
+		close(fd[0]);
+		yyin = fopen(path, "r");
+		if (!yyin) {
+			perror(path);
+			_exit(1);
+		}
+		secs = now();
+		if (bison)
+			yyparse();
+		else
+			parse_source();
+		secs = now() - secs;
+		if (das_error) {
+			fprintf(stderr, "Parse error\n");
+			_exit(1);
+		}
+		if (write(fd[1], &secs, sizeof secs) != sizeof secs)
+			_exit(1);
+		_exit(0);
+	}
+	close(fd[1]);
+	if (read(fd[0], &secs, sizeof secs) != sizeof secs)
+		secs = -1;
+	close(fd[0]);
+	waitpid(pid, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		secs = -1;
+	return secs;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	const double *x = a, *y = b;
+
+	return *x < *y ? -1 : *x > *y;
+}
+
+/* the value a fraction q of the way through sorted v[n], interpolated */
+static double quantile(const double *v, int n, double q)
+{
+	double at = q * (n - 1);
+	int i = at;
+
+	if (i >= n - 1)
+		return v[n - 1];
+	return v[i] + (at - i) * (v[i + 1] - v[i]);
+}
+
+/* sort the runs and print their median, quartiles and best */
+static void report(const char *name, long lines, double *secs, int runs)
+{
+	double median;
+
+	qsort(secs, runs, sizeof *secs, cmp_double);
+	median = quantile(secs, runs, 0.5);
+	printf("%-24s %9ld lines %8.3f s %8.2f Mlines/s  "
+		"(quartiles %.3f-%.3f s, best %.3f s)\n",
+		name, lines, median, lines / median / 1e6,
+		quantile(secs, runs, 0.25), quantile(secs, runs, 0.75), secs[0]);
+}
+
+int main(int argc, char **argv)
+{
+	double hand[MAX_RUNS], bison[MAX_RUNS], ratio[MAX_RUNS];
+	int bison_only = 0, runs = 21, wins = 0;
+	long lines = 0;
+	char name[32];
+	FILE *f;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "bj:r:")) != -1) {
+		switch (c) {
+		case 'b':
+			bison_only = 1;
+			break;
+		case 'j':
+			options.jobs = atoi(optarg);
+			break;
+		case 'r':
+			runs = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1 || runs < 1 || runs > MAX_RUNS)
+		goto usage;
+	/* threads would measure the machine more than the parser */
+	if (!options.jobs)
+		options.jobs = 1;
+
+	f = fopen(argv[optind], "r");
+	if (!f) {
+		perror(argv[optind]);
+		return 1;
+	}
+	while ((c = getc(f)) != EOF)
+		lines += c == '\n';
+	fclose(f);
+
+	for (i = 0; i < runs; i++) {
+		if (!bison_only) {
+			hand[i] = time_parse(argv[optind], 0);
+			if (hand[i] < 0)
+				return 1;
+		}
+		bison[i] = time_parse(argv[optind], 1);
+		if (bison[i] < 0)
+			return 1;
+		if (!bison_only) {
+			ratio[i] = bison[i] / hand[i];
+			wins += ratio[i] > 1;
+		}
+	}
+
+	report("bison", lines, bison, runs);
+	if (!bison_only) {
+		if (options.jobs > 1)
+			sprintf(name, "hand-written, %d jobs", options.jobs);
+		else
+			sprintf(name, "hand-written");
+		report(name, lines, hand, runs);
+		qsort(ratio, runs, sizeof *ratio, cmp_double);
+		printf("%-24s %.2f times the lines/s of bison (quartiles "
+			"%.2f-%.2f), faster in %d of %d rounds\n", "",
+			quantile(ratio, runs, 0.5), quantile(ratio, runs, 0.25),
+			quantile(ratio, runs, 0.75), wins, runs);
+	}
+	return 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-b] [-j jobs] [-r runs] file.s\n", argv[0]);
+	return 1;
+}
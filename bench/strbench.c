@@ -0,0 +1,270 @@
+/*
+ * das string benchmark: C string unescaping for DAT strings and re-escaping
+ * for the listing, against the byte at a time versions they replaced.
+ * Checks both give the same results first.
+ *
+ * Usage: strbench [kilobytes]
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dasdefs.h"
+
+#define ROUNDS		200
+#define CHECKS		20000
+
+int isoctal(int c);
+
+/* normally provided by main() */
+int das_error;
+
+/* the originals, for checking and timing against */
+static int ref_unescape(const char *src, unsigned char *dest)
+{
+	int n = 0;
+	unsigned char c;
+	char tmphex[3];
+
+	while (*src) {
+		c = 0;
+		if (*src != '\\') {
+			*dest++ = *src++;
+			n++;
+			continue;
+		}
+
+		/* escape sequence? */
+		src++;
+		if (!*src) {
+			/* end of string was a backslash by itself. How? */
+			fprintf(stderr, "string ends in backslash?\n");
+			*dest++ = '\\';
+			n++;
+			break;
+		}
+
+		/* yes, it's an escape sequence */
+		if (*src >= '0' && *src <= '3') {
+			/* maybe start octal sequence? */
+			if (isoctal(src[1]) && isoctal(src[2])) {
+				c = (src[0] - '0') << 6 |
+					(src[1] - '0') << 3 |
+					(src[2] - '0');
+				src += 2;				/* one more will be added shortly */
+			} else if (*src == '0') {
+				/* not followed by octal, treat as plain NULL */
+				c = 0;
+			} else {
+				/* bad octal escape, treat as character */
+				c = *src;
+			}
+		} else if (*src == 'x' && isxdigit(src[1]) && isxdigit(src[2])) {
+			/* it's hex */
+			tmphex[0] = src[1];
+			tmphex[1] = src[2];
+			tmphex[2] = 0;
+			c = (char)strtol(tmphex, NULL, 16);
+			src += 2;		/* one more will be added shortly */
+		} else {
+			/* escape sequence, not hex or octal or \0 NULL */
+			switch (*src) {
+			case 'a': c = '\a'; break;
+			case 'b': c = '\b'; break;
+			case 'f': c = '\f'; break;
+			case 'n': c = '\n'; break;
+			case 'r': c = '\r'; break;
+			case 't': c = '\t'; break;
+			case 'v': c = '\v'; break;
+			default:
+				/* this covers [\?'"] */
+				c = *src;
+			}
+		}
+		*dest++ = c;
+		src++;
+		n++;
+	}
+	*dest = 0;	// terminate in case we want to print it unescaped
+	return n;
+}
+
+static int ref_sprint(char *buf, const unsigned char *in, int bytes)
+{
+	char *start = buf;
+	char hexdigit[] = "0123456789abcdef";
+	char c;
+
+	while (bytes--) {
+		int esc = 1;
+
+		switch (*in) {
+		case '\"':
+		case '\\':
+			c = *in;	/* escape as themselves */
+			break;
+		case '\n': c = 'n'; break;
+		case '\t': c = 't'; break;
+		case '\r': c = 'r'; break;
+		default:
+			esc = 0;
+		}
+
+		if (esc) {
+			*buf++ = '\\';
+			*buf++ = c;
+			in++;
+			continue;
+		}
+
+		if (*in > 0x1f && *in < 0x7f) {
+			/* printable 7-bit ASCII */
+			*buf++ = *in++;
+		} else if (!*in) {
+			*buf++ = '\\';
+			*buf++ = '0';
+			in++;
+		} else {
+			*buf++ = '\\';
+			*buf++ = 'x';
+			*buf++ = hexdigit[*in >> 4];
+			*buf++ = hexdigit[*in & 0xf];
+			in++;
+		}
+	}
+	return buf - start;
+}
+
+static unsigned seed = 12345;
+
+/* tiny LCG so every run checks the same strings */
+static int rnd(int n)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) % n;
+}
+
+/*
+ * source text of a string literal: mostly plain text, with escapes of
+ * every kind (good, bad and half-finished octal and hex) one time in
+ * every escapes
+ */
+static void gen_literal(char *p, int len, int escapes)
+{
+	static const char esc[] = "abfnrtv?'\"\\0123x7";
+	static const char tail[] = "0123456789abcdefxyz\"";
+	int i = 0;
+
+	while (i < len - 3) {
+		if (!rnd(escapes)) {
+			p[i++] = '\\';
+			p[i++] = esc[rnd(sizeof esc - 1)];
+			p[i++] = tail[rnd(sizeof tail - 1)];
+		} else {
+			p[i++] = 32 + rnd(95);
+			if (p[i - 1] == '\\')
+				p[i - 1] = '/';
+		}
+	}
+	p[i] = 0;
+}
+
+/* unescaped bytes to re-escape: text, or anything at all */
+static void gen_bytes(unsigned char *p, int len, int binary)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		p[i] = binary ? rnd(256) : 32 + rnd(95);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* both versions of both functions give the same, at odd lengths and offsets */
+static int check(void)
+{
+	char src[256], out[1100], ref[1100];
+	unsigned char a[256], b[256];
+	int i, len, off, n, m, bad = 0;
+
+	for (i = 0; i < CHECKS; i++) {
+		len = 4 + rnd(200);
+		off = rnd(16);
+		gen_literal(src + off, len, 1 + rnd(20));
+		n = unescape_c_string(src + off, a);
+		m = ref_unescape(src + off, b);
+		if (n != m || memcmp(a, b, n + 1)) {
+			fprintf(stderr, "unescape mismatch: \"%s\"\n", src + off);
+			bad++;
+		}
+
+		len = rnd(200);
+		gen_bytes(a + off, len, rnd(2));
+		n = sprint_cstring(out, a + off, len);
+		m = ref_sprint(ref, a + off, len);
+		if (n != m || memcmp(out, ref, n)) {
+			fprintf(stderr, "sprint mismatch at check %d\n", i);
+			bad++;
+		}
+	}
+	return bad;
+}
+
+static void report(const char *what, double secs, long bytes)
+{
+	printf("%-26s %8.3f s %8.1f MB/s\n", what, secs, bytes / secs / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+	int kb = argc > 1 ? atoi(argv[1]) : 64;
+	int len = kb * 1024, n = 0, r;
+	char *src = malloc(len + 1), *out = malloc(len * 4 + 1);
+	unsigned char *bytes = malloc(len + 1);
+	double start;
+
+	if (kb < 1) {
+		fprintf(stderr, "Usage: %s [kilobytes]\n", argv[0]);
+		return 1;
+	}
+	if (check()) {
+		fprintf(stderr, "strbench: results differ from the originals\n");
+		return 1;
+	}
+	printf("Strings of %d KB, %d rounds, results match:\n", kb, ROUNDS);
+
+	gen_literal(src, len, 40);
+	start = now();
+	for (r = 0; r < ROUNDS; r++)
+		n = ref_unescape(src, bytes);
+	report("unescape, bytewise", now() - start, (long)len * ROUNDS);
+	start = now();
+	for (r = 0; r < ROUNDS; r++)
+		n = unescape_c_string(src, bytes);
+	report("unescape", now() - start, (long)len * ROUNDS);
+
+	start = now();
+	for (r = 0; r < ROUNDS; r++)
+		ref_sprint(out, bytes, n);
+	report("re-escape, bytewise", now() - start, (long)n * ROUNDS);
+	start = now();
+	for (r = 0; r < ROUNDS; r++)
+		sprint_cstring(out, bytes, n);
+	report("re-escape", now() - start, (long)n * ROUNDS);
+
+	free(src);
+	free(out);
+	free(bytes);
+	return 0;
+}
@@ -0,0 +1,210 @@
+/*
+ * dasemu: run a das flat binary image on an emulated DCPU-16
+ *
+ * Usage: dasemu [OPTIONS] image.bin
+ *        dasemu [OPTIONS] --restore snapshot
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "dbt.h"
+#include "dcpu.h"
+#include "fleet.h"
+#include "lockstep.h"
+#include "snapshot.h"
+
+#define DEFAULT_CYCLES		100000000ull
+#define DEFAULT_BATCH		10000		/* a tenth of a second */
+
+/* normally provided by main() */
+int das_error;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * the whole fleet's outcome on stdout, the same for the same seed however
+ * many threads ran it; and how fast
+ */
+static int run_fleet(const struct dcpu *image, int n, uint64_t seed,
+		int jobs, int lanes, uint64_t cycles, uint64_t batch, int verbose)
+{
+	int count[DCPU_BAD_OP + 1] = { }, i;
+	struct fleet *f;
+	double start;
+
+	f = fleet_new(image, n, seed, jobs, lanes);
+	if (!f) {
+		fprintf(stderr, "No memory for %d instances\n", n);
+		return 1;
+	}
+	start = now();
+	fleet_run(f, image->cycles + cycles, batch);
+	fleet_print_stats(stderr, f, now() - start);
+
+	for (i = 0; i < n; i++) {
+		if (verbose) {
+			printf("Instance %d:\n", i);
+			dcpu_print(stdout, fleet_cpu(f, i));
+		}
+		count[fleet_cpu(f, i)->state]++;
+	}
+	printf("%d instances: %d running, %d on fire, %d stopped on a bad "
+			"instruction; state hash %016llx\n", n, count[DCPU_RUNNING],
+			count[DCPU_ON_FIRE], count[DCPU_BAD_OP],
+			(unsigned long long)fleet_hash(f));
+	fleet_free(f);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [OPTIONS] image.bin\n"
+		"       %s [OPTIONS] --restore snapshot\n"
+		"\n"
+		"OPTIONS:\n"
+		"  -c, --cycles n     Run for n cycles (default %llu), less if it\n"
+		"                     catches fire or reaches a bad instruction\n"
+		"  --restore file     Start from a snapshot, not an image\n"
+		"  --save file        Snapshot the machine to file at the end\n"
+		"  -i, --interpret    Use the reference interpreter, not translation\n"
+		"  --le               Image is little-endian (default big-endian)\n"
+		"  -v, --verbose      Say how it ran\n"
+		"\n"
+		"  -n, --instances n  Run a fleet of n copies, interpreted, each with\n"
+		"                     its own 32-bit seed in A (low) and B (high)\n"
+		"  --seed s           Fleet seed the instance seeds come from (default 1)\n"
+		"  -j, --jobs n       Fleet threads (default one per CPU)\n"
+		"  --batch n          Cycles the fleet runs between meeting (default %d)\n"
+		"  --lanes n          Instances a thread runs in lockstep, 1 to %d\n"
+		"                     (default %d)\n",
+		prog, prog, DEFAULT_CYCLES, DEFAULT_BATCH, LOCKSTEP_LANES,
+		LOCKSTEP_LANES);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "cycles", required_argument, NULL, 'c' },
+		{ "interpret", no_argument, NULL, 'i' },
+		{ "le", no_argument, NULL, 'l' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "instances", required_argument, NULL, 'n' },
+		{ "seed", required_argument, NULL, 's' },
+		{ "jobs", required_argument, NULL, 'j' },
+		{ "batch", required_argument, NULL, 'b' },
+		{ "lanes", required_argument, NULL, 'L' },
+		{ "restore", required_argument, NULL, 'r' },
+		{ "save", required_argument, NULL, 'S' },
+		{ }
+	};
+	uint64_t cycles = DEFAULT_CYCLES, seed = 1, batch = DEFAULT_BATCH, from;
+	int big_endian = 1, interpret = 0, verbose = 0, opt, ret;
+	int instances = 0, jobs = 0, lanes = LOCKSTEP_LANES;
+	const char *restore = NULL, *save = NULL;
+	struct dbt *t = NULL;
+	struct dcpu *c;
+	double start, secs;
+
+	while ((opt = getopt_long(argc, argv, "c:ivn:j:", long_options,
+					NULL)) != -1) {
+		switch (opt) {
+		case 'c':
+			cycles = strtoull(optarg, NULL, 0);
+			break;
+		case 'i':
+			interpret = 1;
+			break;
+		case 'l':
+			big_endian = 0;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'n':
+			instances = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'b':
+			batch = strtoull(optarg, NULL, 0);
+			break;
+		case 'L':
+			lanes = atoi(optarg);
+			break;
+		case 'r':
+			restore = optarg;
+			break;
+		case 'S':
+			save = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - !restore || instances < 0 || jobs < 0 || !batch ||
+			lanes < 1 || lanes > LOCKSTEP_LANES || (instances && save))
+		usage(argv[0]);
+
+	if (restore) {
+		c = snapshot_map(restore);
+		if (!c)
+			return 1;
+	} else {
+		c = malloc(sizeof *c);
+		dcpu_init(c);
+		if (dcpu_load(c, argv[optind], big_endian) < 0)
+			return 1;
+	}
+	if (instances)
+		return run_fleet(c, instances, seed, jobs, lanes, cycles, batch,
+				verbose);
+	if (!interpret) {
+		t = dbt_new(c);
+		if (!t)
+			fprintf(stderr, "Can't translate on this host, interpreting\n");
+	}
+
+	start = now();
+	from = c->cycles;
+	if (t)
+		dbt_run(t, from + cycles);
+	else
+		dcpu_run(c, from + cycles);
+	secs = now() - start;
+
+	dcpu_print(stdout, c);
+	if (verbose) {
+		fprintf(stderr, "%llu cycles in %.3f s, %.1f MHz\n",
+				(unsigned long long)(c->cycles - from), secs,
+				secs > 0 ? (c->cycles - from) / secs / 1e6 : 0);
+		if (t)
+			dbt_print_stats(stderr, t);
+	}
+	ret = c->state != DCPU_RUNNING;
+	if (t)
+		dbt_free(t);
+	if (save && snapshot_save(c, save))
+		ret = 1;
+	if (restore)
+		snapshot_free(c);
+	else
+		free(c);
+	return ret;
+}
@@ -0,0 +1,820 @@
+/*
+ * dasemu: translation of DCPU-16 code to x86-64
+ *
+ * A block is translated the first time its address is run: instructions in
+ * a line, decoded through the same table as the interpreter, up to one that
+ * writes PC, one that only the interpreter does (interrupts, hardware, bad
+ * words) or BLOCK_MAX_INSNS. A failed IF leaves by a side exit to where the
+ * skip lands, worked out when translating. Machine registers stay in struct
+ * dcpu; the translated code keeps it in rbx, the address a written operand
+ * is at in r12 and the map of translated words in r13. Arithmetic with more
+ * to it than add, subtract or multiply calls dcpu_alu(), so the answers
+ * can't differ from the interpreter's.
+ *
+ * Cycles: every way out of a block adds the cycles up to that point, from
+ * the decode table. On the way in, a block checks that the most it could
+ * take still leaves the count at or below the limit: the next device event
+ * or the end of the run. Otherwise, and while an interrupt is waiting, the
+ * dispatcher steps the interpreter instead. No interrupt or device work can
+ * fall due inside a block, so the count matches the interpreter's at every
+ * instruction.
+ *
+ * Chaining: a way out to a known address ends in a jump to the dispatcher
+ * and leaves its own address in c->link. The dispatcher points the jump at
+ * the next block, translating it if need be, so loops then run without
+ * coming back out.
+ *
+ * Self-modifying code: a write to a word in code_map marks c->smc. The
+ * block leaves after that instruction and the dispatcher drops every
+ * translation; writes by the interpreter or interrupts mark it the same way.
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dbt.h"
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#include <sys/mman.h>
+
+#define CODE_SIZE			(32 << 20)
+#define BLOCK_MAX_INSNS		32
+#define BLOCK_MAX_CODE		8192		/* free space to start a block in */
+#define BLOCK_MAX_STUBS		(2 * BLOCK_MAX_INSNS)
+
+/* x86-64 */
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15 };
+enum { CC_B = 0x2, CC_AE, CC_E, CC_NE, CC_BE, CC_A,
+	CC_L = 0xc, CC_GE, CC_LE, CC_G };
+
+#define REX_W			1
+#define OPSIZE_16		2
+
+#define ADD_RM			0x01
+#define OR_RM			0x09
+#define AND_RM			0x21
+#define SUB_RM			0x29
+#define XOR_RM			0x31
+#define CMP_RM			0x39
+#define CMP_R			0x3b
+#define GROUP1_8		0x80	/* /7 cmp r/m8, imm8 */
+#define GROUP1			0x81	/* /0 add, /5 sub r/m, imm */
+#define TEST_RM			0x85
+#define MOV_RM			0x89
+#define MOV_R			0x8b
+#define SHIFT_IMM		0xc1	/* /5 shr */
+#define MOV_IMM_8		0xc6
+#define MOV_IMM			0xc7
+#define GROUP5			0xff	/* /2 call, /4 jmp */
+#define IMUL_R			0x0faf
+#define MOVZX_16		0x0fb7
+#define MOVSX_16		0x0fbf
+
+#define OFF(field)		((int32_t)offsetof(struct dcpu, field))
+#define OFF_REG(r)		(OFF(reg) + 2 * (r))
+
+struct block {
+	unsigned char *code;
+	unsigned cost;			/* most cycles it can take, however it leaves */
+};
+
+/* a way out from the middle of a block, emitted after its end */
+struct stub {
+	unsigned char *jump;	/* rel32 of the jcc to it */
+	u16 pc;
+	unsigned cost;
+	int smc;				/* else a failed IF */
+	int pc_stored;
+};
+
+struct dbt {
+	struct dcpu *cpu;
+	unsigned char *code, *cur, *end;
+	unsigned char *first_block;	/* code before this lives through a flush */
+	unsigned char *exit;
+	void (*enter)(struct dcpu *c, const void *code);
+	unsigned generation;
+
+	struct block *map[DCPU_RAM_WORDS];
+	struct block *blocks;
+	int nblocks;
+	unsigned char code_map[DCPU_RAM_WORDS];
+
+	/* the block being translated */
+	struct stub stubs[BLOCK_MAX_STUBS];
+	int nstubs;
+	unsigned cost, maxcost;
+
+	unsigned long long translated, flushes, chained, entries, steps;
+};
+
+/* where the first instruction is one only the interpreter does */
+static struct block no_block;
+
+/* where a written operand is */
+enum { LOC_FIELD, LOC_RAM, LOC_LITERAL, LOC_PC };
+
+struct loc {
+	int kind;
+	int32_t off;			/* LOC_FIELD */
+	u16 literal;
+};
+
+static void emit8(struct dbt *t, unsigned v)
+{
+	*t->cur++ = v;
+}
+
+static void emit16(struct dbt *t, unsigned v)
+{
+	emit8(t, v);
+	emit8(t, v >> 8);
+}
+
+static void emit32(struct dbt *t, uint32_t v)
+{
+	memcpy(t->cur, &v, 4);
+	t->cur += 4;
+}
+
+static void emit_opcode(struct dbt *t, int flags, int reg, int index,
+		int base, unsigned opcode)
+{
+	int rex = (flags & REX_W ? 8 : 0) | (reg & 8) >> 1 | (index & 8) >> 2 |
+		(base & 8) >> 3;
+
+	if (flags & OPSIZE_16)
+		emit8(t, 0x66);
+	if (rex)
+		emit8(t, 0x40 | rex);
+	if (opcode > 0xff)
+		emit8(t, opcode >> 8);
+	emit8(t, opcode);
+}
+
+/* opcode reg, [base + index * scale + disp32]; index -1 for none */
+static void emit_mem(struct dbt *t, int flags, unsigned opcode, int reg,
+		int base, int index, int scale, int32_t disp)
+{
+	emit_opcode(t, flags, reg, index < 0 ? 0 : index, base, opcode);
+	if (index < 0 && (base & 7) != RSP) {
+		emit8(t, 0x80 | (reg & 7) << 3 | (base & 7));
+	} else {
+		emit8(t, 0x84 | (reg & 7) << 3);
+		emit8(t, (scale == 2 ? 0x40 : 0) |
+				(index < 0 ? RSP : index & 7) << 3 | (base & 7));
+	}
+	emit32(t, disp);
+}
+
+/* opcode reg, a member of struct dcpu */
+static void emit_field(struct dbt *t, int flags, unsigned opcode, int reg,
+		int32_t off)
+{
+	emit_mem(t, flags, opcode, reg, RBX, -1, 1, off);
+}
+
+/* opcode reg, ram[index] */
+static void emit_ram(struct dbt *t, int flags, unsigned opcode, int reg,
+		int index)
+{
+	emit_mem(t, flags, opcode, reg, RBX, index, 2, OFF(ram));
+}
+
+/* opcode reg, rm between registers */
+static void emit_rr(struct dbt *t, int flags, unsigned opcode, int reg,
+		int rm)
+{
+	emit_opcode(t, flags, reg, 0, rm, opcode);
+	emit8(t, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+static void emit_mov_imm(struct dbt *t, int reg, uint32_t v)
+{
+	if (reg & 8)
+		emit8(t, 0x41);
+	emit8(t, 0xb8 + (reg & 7));
+	emit32(t, v);
+}
+
+/* mov rax, imm64; return where the immediate is */
+static unsigned char* emit_mov_rax_imm64(struct dbt *t, uint64_t v)
+{
+	emit8(t, 0x48);
+	emit8(t, 0xb8);
+	memcpy(t->cur, &v, 8);
+	t->cur += 8;
+	return t->cur - 8;
+}
+
+/* add or sub word [rbx + off], imm16 */
+static void emit_field_add16(struct dbt *t, int32_t off, int v)
+{
+	emit_field(t, OPSIZE_16, GROUP1, v < 0 ? 5 : 0, off);
+	emit16(t, v < 0 ? -v : v);
+}
+
+/* reg = (reg + v) & 0xffff */
+static void emit_add16(struct dbt *t, int reg, u16 v)
+{
+	emit_rr(t, 0, GROUP1, 0, reg);
+	emit32(t, v);
+	emit_rr(t, 0, MOVZX_16, reg, reg);
+}
+
+/* jmp or jcc rel32; return where rel32 is, to patch */
+static unsigned char* emit_jump(struct dbt *t, int cc)
+{
+	if (cc < 0) {
+		emit8(t, 0xe9);
+	} else {
+		emit8(t, 0x0f);
+		emit8(t, 0x80 | cc);
+	}
+	emit32(t, 0);
+	return t->cur - 4;
+}
+
+static void patch(unsigned char *rel, const void *to)
+{
+	int32_t v = (const unsigned char*)to - (rel + 4);
+
+	memcpy(rel, &v, 4);
+}
+
+static void emit_call(struct dbt *t, const void *fn)
+{
+	emit_mov_rax_imm64(t, (uintptr_t)fn);
+	emit_rr(t, 0, GROUP5, 2, RAX);
+}
+
+/*
+ * enter(c, code): save the registers the ABI wants kept (five, which also
+ * aligns the stack for calls), set up rbx and r13, and jump in. Blocks
+ * leave by jumping to exit.
+ */
+static void emit_enter_exit(struct dbt *t)
+{
+	static const int saved[] = { RBX, R12, R13, R14, R15 };
+	int i;
+
+	t->enter = (void (*)(struct dcpu*, const void*))t->cur;
+	for (i = 0; i < ARRAY_SIZE(saved); i++) {
+		if (saved[i] & 8)
+			emit8(t, 0x41);
+		emit8(t, 0x50 + (saved[i] & 7));
+	}
+	emit_rr(t, REX_W, MOV_RM, RDI, RBX);
+	emit_field(t, REX_W, MOV_R, R13, OFF(code_map));
+	emit_rr(t, 0, GROUP5, 4, RSI);
+
+	t->exit = t->cur;
+	for (i = ARRAY_SIZE(saved) - 1; i >= 0; i--) {
+		if (saved[i] & 8)
+			emit8(t, 0x41);
+		emit8(t, 0x58 + (saved[i] & 7));
+	}
+	emit8(t, 0xc3);
+}
+
+static void emit_cycles(struct dbt *t, unsigned cost)
+{
+	if (cost > t->maxcost)
+		t->maxcost = cost;
+	emit_field(t, REX_W, GROUP1, 0, OFF(cycles));
+	emit32(t, cost);
+}
+
+/* leave for a known address, by a jump that can be chained to its block */
+static void exit_static(struct dbt *t, u16 pc, unsigned cost)
+{
+	unsigned char *imm, *site;
+
+	emit_cycles(t, cost);
+	emit_field(t, OPSIZE_16, MOV_IMM, 0, OFF(pc));
+	emit16(t, pc);
+	imm = emit_mov_rax_imm64(t, 0);
+	emit_field(t, REX_W, MOV_RM, RAX, OFF(link));
+	site = emit_jump(t, -1);
+	patch(site, t->exit);
+	memcpy(imm, &(uint64_t){ (uintptr_t)site }, 8);
+}
+
+/* leave with PC already stored */
+static void exit_dynamic(struct dbt *t, unsigned cost)
+{
+	emit_cycles(t, cost);
+	emit_field(t, REX_W, MOV_IMM, 0, OFF(link));
+	emit32(t, 0);
+	patch(emit_jump(t, -1), t->exit);
+}
+
+static void add_stub(struct dbt *t, unsigned char *jump, u16 pc,
+		unsigned cost, int smc, int pc_stored)
+{
+	struct stub *s = &t->stubs[t->nstubs++];
+
+	s->jump = jump;
+	s->pc = pc;
+	s->cost = cost;
+	s->smc = smc;
+	s->pc_stored = pc_stored;
+}
+
+static void emit_stubs(struct dbt *t)
+{
+	struct stub *s;
+
+	for (s = t->stubs; s < t->stubs + t->nstubs; s++) {
+		patch(s->jump, t->cur);
+		if (!s->smc) {
+			exit_static(t, s->pc, s->cost);
+			continue;
+		}
+		emit_field(t, 0, MOV_IMM, 0, OFF(smc));
+		emit32(t, 1);
+		if (!s->pc_stored) {
+			emit_field(t, OPSIZE_16, MOV_IMM, 0, OFF(pc));
+			emit16(t, s->pc);
+		}
+		exit_dynamic(t, s->cost);
+	}
+}
+
+/* after a write to ram[r12]: leave if it hit translated code */
+static void emit_smc_check(struct dbt *t, u16 pc, int pc_stored)
+{
+	emit_mem(t, 0, GROUP1_8, 7, R13, R12, 1, 0);
+	emit8(t, 0);
+	add_stub(t, emit_jump(t, CC_NE), pc, t->cost, 1, pc_stored);
+}
+
+static int is_literal(int field)
+{
+	return field == OPND_NEXT || field >= OPND_SHORT;
+}
+
+static u16 literal(int field, u16 next)
+{
+	return field == OPND_NEXT ? next : field - OPND_SHORT - 1;
+}
+
+/* value of operand a into eax; pc is the address after the first word */
+static void gen_a(struct dbt *t, int field, u16 next, u16 pc)
+{
+	switch (field) {
+	case OPND_A ... OPND_J:
+		emit_field(t, 0, MOVZX_16, RAX, OFF_REG(field));
+		return;
+	case OPND_MEM_REG ... OPND_MEM_REG + 7:
+		emit_field(t, 0, MOVZX_16, RCX, OFF_REG(field & 7));
+		break;
+	case OPND_MEM_REG_NEXT ... OPND_MEM_REG_NEXT + 7:
+		emit_field(t, 0, MOVZX_16, RCX, OFF_REG(field & 7));
+		emit_add16(t, RCX, next);
+		break;
+	case OPND_POP:
+		emit_field(t, 0, MOVZX_16, RCX, OFF(sp));
+		emit_ram(t, 0, MOVZX_16, RAX, RCX);
+		emit_field_add16(t, OFF(sp), 1);
+		return;
+	case OPND_PEEK:
+		emit_field(t, 0, MOVZX_16, RCX, OFF(sp));
+		break;
+	case OPND_PICK:
+		emit_field(t, 0, MOVZX_16, RCX, OFF(sp));
+		emit_add16(t, RCX, next);
+		break;
+	case OPND_SP:
+		emit_field(t, 0, MOVZX_16, RAX, OFF(sp));
+		return;
+	case OPND_PC:
+		emit_mov_imm(t, RAX, pc);
+		return;
+	case OPND_EX:
+		emit_field(t, 0, MOVZX_16, RAX, OFF(ex));
+		return;
+	case OPND_MEM_NEXT:
+		emit_field(t, 0, MOVZX_16, RAX, OFF(ram) + 2 * next);
+		return;
+	default:
+		emit_mov_imm(t, RAX, literal(field, next));
+		return;
+	}
+	emit_ram(t, 0, MOVZX_16, RAX, RCX);
+}
+
+/* where operand b is; a memory address goes in r12 */
+static void gen_b_loc(struct dbt *t, int field, u16 next, struct loc *l)
+{
+	l->kind = LOC_RAM;
+	switch (field) {
+	case OPND_A ... OPND_J:
+		l->kind = LOC_FIELD;
+		l->off = OFF_REG(field);
+		break;
+	case OPND_MEM_REG ... OPND_MEM_REG + 7:
+		emit_field(t, 0, MOVZX_16, R12, OFF_REG(field & 7));
+		break;
+	case OPND_MEM_REG_NEXT ... OPND_MEM_REG_NEXT + 7:
+		emit_field(t, 0, MOVZX_16, R12, OFF_REG(field & 7));
+		emit_add16(t, R12, next);
+		break;
+	case OPND_PUSH:
+		emit_field_add16(t, OFF(sp), -1);
+		/* fall through */
+	case OPND_PEEK:
+		emit_field(t, 0, MOVZX_16, R12, OFF(sp));
+		break;
+	case OPND_PICK:
+		emit_field(t, 0, MOVZX_16, R12, OFF(sp));
+		emit_add16(t, R12, next);
+		break;
+	case OPND_SP:
+		l->kind = LOC_FIELD;
+		l->off = OFF(sp);
+		break;
+	case OPND_PC:
+		l->kind = LOC_PC;
+		break;
+	case OPND_EX:
+		l->kind = LOC_FIELD;
+		l->off = OFF(ex);
+		break;
+	case OPND_MEM_NEXT:
+		emit_mov_imm(t, R12, next);
+		break;
+	default:
+		l->kind = LOC_LITERAL;
+		l->literal = literal(field, next);
+		break;
+	}
+}
+
+/* value of operand b into ecx; pc is the address after the instruction */
+static void gen_b_read(struct dbt *t, const struct loc *l, u16 pc)
+{
+	switch (l->kind) {
+	case LOC_FIELD:
+		emit_field(t, 0, MOVZX_16, RCX, l->off);
+		break;
+	case LOC_RAM:
+		emit_ram(t, 0, MOVZX_16, RCX, R12);
+		break;
+	case LOC_LITERAL:
+		emit_mov_imm(t, RCX, l->literal);
+		break;
+	case LOC_PC:
+		emit_mov_imm(t, RCX, pc);
+		break;
+	}
+}
+
+/* ax to operand b */
+static void gen_b_write(struct dbt *t, const struct loc *l)
+{
+	switch (l->kind) {
+	case LOC_FIELD:
+		emit_field(t, OPSIZE_16, MOV_RM, RAX, l->off);
+		break;
+	case LOC_RAM:
+		emit_ram(t, OPSIZE_16, MOV_RM, RAX, R12);
+		break;
+	case LOC_PC:
+		emit_field(t, OPSIZE_16, MOV_RM, RAX, OFF(pc));
+		break;
+	}
+}
+
+/* EX is the high half of the 32-bit result in eax */
+static void gen_ex(struct dbt *t)
+{
+	emit_rr(t, 0, MOV_RM, RAX, RDX);
+	emit_rr(t, 0, SHIFT_IMM, 5, RDX);
+	emit8(t, 16);
+	emit_field(t, OPSIZE_16, MOV_RM, RDX, OFF(ex));
+}
+
+/*
+ * b in ecx, a in eax: on failure leave for past the skipped instructions.
+ * The skipped words count as translated, so changing them drops the block.
+ */
+static void gen_if(struct dbt *t, int op, u16 pc)
+{
+	const struct decode *d;
+	int cc, skipped = 0, i;
+
+	do {
+		d = &decode_table[t->cpu->ram[pc]];
+		for (i = 0; i < d->len; i++)
+			t->code_map[(u16)(pc + i)] = 1;
+		pc += d->len;
+		skipped++;
+	} while (IS_IF(d->op));
+
+	switch (op) {
+	case OP_IFB:
+	case OP_IFC:
+		emit_rr(t, 0, TEST_RM, RAX, RCX);
+		cc = op == OP_IFB ? CC_E : CC_NE;
+		break;
+	case OP_IFA:
+	case OP_IFU:
+		emit_rr(t, 0, MOVSX_16, RAX, RAX);
+		emit_rr(t, 0, MOVSX_16, RCX, RCX);
+		emit_rr(t, 0, CMP_RM, RAX, RCX);
+		cc = op == OP_IFA ? CC_LE : CC_GE;
+		break;
+	default:
+		emit_rr(t, 0, CMP_RM, RAX, RCX);
+		cc = op == OP_IFE ? CC_NE : op == OP_IFN ? CC_E :
+			op == OP_IFG ? CC_BE : CC_AE;
+		break;
+	}
+	add_stub(t, emit_jump(t, cc), pc, t->cost + skipped, 0, 0);
+}
+
+/* translate the instruction at *pcp. Return nonzero if it ends the block */
+static int gen_insn(struct dbt *t, u16 *pcp)
+{
+	const struct decode *d;
+	const u16 *ram = t->cpu->ram;
+	u16 pc = *pcp, w, anext = 0, bnext = 0;
+	int op, a, i;
+	struct loc b;
+
+	w = ram[pc];
+	d = &decode_table[w];
+	op = d->op;
+	a = FIELD_A(w);
+	for (i = 0; i < d->len; i++)
+		t->code_map[(u16)(pc + i)] = 1;
+	pc++;
+	if (operand_nextword(a))
+		anext = ram[pc++];
+	if (!(op & SPECIAL_OPCODE) && operand_nextword(FIELD_B(w)))
+		bnext = ram[pc++];
+	t->cost += d->cycles;
+	gen_a(t, a, anext, *pcp + 1);
+	*pcp = pc;
+
+	if (op == OP_JSR) {
+		emit_field_add16(t, OFF(sp), -1);
+		emit_field(t, 0, MOVZX_16, R12, OFF(sp));
+		emit_ram(t, OPSIZE_16, MOV_IMM, 0, R12);
+		emit16(t, pc);
+		emit_field(t, OPSIZE_16, MOV_RM, RAX, OFF(pc));
+		emit_smc_check(t, pc, 1);
+		if (is_literal(a))
+			exit_static(t, literal(a, anext), t->cost);
+		else
+			exit_dynamic(t, t->cost);
+		return 1;
+	}
+
+	gen_b_loc(t, FIELD_B(w), bnext, &b);
+	if (IS_IF(op)) {
+		gen_b_read(t, &b, pc);
+		gen_if(t, op, pc);
+		return 0;
+	}
+	if (op != OP_SET && op != OP_STI && op != OP_STD)
+		gen_b_read(t, &b, pc);
+
+	switch (op) {
+	case OP_SET:
+	case OP_STI:
+	case OP_STD:
+		break;
+	case OP_ADD:
+		emit_rr(t, 0, ADD_RM, RCX, RAX);
+		gen_ex(t);
+		break;
+	case OP_SUB:
+		emit_rr(t, 0, SUB_RM, RAX, RCX);
+		emit_rr(t, 0, MOV_RM, RCX, RAX);
+		gen_ex(t);
+		break;
+	case OP_MUL:
+		emit_rr(t, 0, IMUL_R, RAX, RCX);
+		gen_ex(t);
+		break;
+	case OP_AND:
+		emit_rr(t, 0, AND_RM, RCX, RAX);
+		break;
+	case OP_BOR:
+		emit_rr(t, 0, OR_RM, RCX, RAX);
+		break;
+	case OP_XOR:
+		emit_rr(t, 0, XOR_RM, RCX, RAX);
+		break;
+	default:
+		/* dcpu_alu(c, op, b, a) */
+		emit_rr(t, 0, MOV_RM, RCX, RDX);
+		emit_rr(t, 0, MOV_RM, RAX, RCX);
+		emit_mov_imm(t, RSI, op);
+		emit_rr(t, REX_W, MOV_RM, RBX, RDI);
+		emit_call(t, dcpu_alu);
+		break;
+	}
+	gen_b_write(t, &b);
+	if (op == OP_STI || op == OP_STD) {
+		emit_field_add16(t, OFF_REG(6), op == OP_STI ? 1 : -1);
+		emit_field_add16(t, OFF_REG(7), op == OP_STI ? 1 : -1);
+	}
+
+	if (b.kind == LOC_RAM)
+		emit_smc_check(t, pc, 0);
+	if (b.kind != LOC_PC)
+		return 0;
+	if (op == OP_SET && is_literal(a))
+		exit_static(t, literal(a, anext), t->cost);
+	else
+		exit_dynamic(t, t->cost);
+	return 1;
+}
+
+/* can the instruction starting with this word be translated */
+static int translatable(u16 w)
+{
+	int op = decode_table[w].op;
+
+	return op && (!(op & SPECIAL_OPCODE) || op == OP_JSR);
+}
+
+static struct block* translate(struct dbt *t, u16 pc)
+{
+	unsigned char *cost;
+	struct block *b;
+	u16 start = pc;
+	int n;
+
+	if (!translatable(t->cpu->ram[pc])) {
+		t->map[pc] = &no_block;
+		return &no_block;
+	}
+	if (t->end - t->cur < BLOCK_MAX_CODE || t->nblocks == DCPU_RAM_WORDS)
+		dbt_flush(t);
+
+	b = &t->blocks[t->nblocks++];
+	b->code = t->cur;
+	t->nstubs = 0;
+	t->cost = 0;
+	t->maxcost = 0;
+
+	/* leave at once if the block could run past the limit */
+	emit_field(t, REX_W, MOV_R, RAX, OFF(cycles));
+	emit8(t, 0x48);		/* add rax, imm32 */
+	emit8(t, 0x05);
+	cost = t->cur;
+	emit32(t, 0);
+	emit_field(t, REX_W, CMP_R, RAX, OFF(limit));
+	patch(emit_jump(t, CC_A), t->exit);
+
+	for (n = 1; !gen_insn(t, &pc); n++) {
+		if (n == BLOCK_MAX_INSNS || !translatable(t->cpu->ram[pc])) {
+			exit_static(t, pc, t->cost);
+			break;
+		}
+	}
+	emit_stubs(t);
+
+	b->cost = t->maxcost;
+	memcpy(cost, &b->cost, 4);
+	t->map[start] = b;
+	t->translated++;
+	return b;
+}
+
+static struct block* lookup(struct dbt *t, u16 pc)
+{
+	return t->map[pc] ? t->map[pc] : translate(t, pc);
+}
+
+/* point a block's jump out at the block for pc */
+static void chain(struct dbt *t, unsigned char *site, u16 pc)
+{
+	unsigned generation = t->generation;
+	struct block *b = lookup(t, pc);
+
+	if (b == &no_block || generation != t->generation)
+		return;
+	patch(site, b->code);
+	t->chained++;
+}
+
+struct dbt* dbt_new(struct dcpu *c)
+{
+	struct dbt *t = calloc(1, sizeof *t);
+
+	t->code = mmap(NULL, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (t->code == MAP_FAILED) {
+		free(t);
+		return NULL;
+	}
+	t->blocks = malloc(DCPU_RAM_WORDS * sizeof *t->blocks);
+	t->cpu = c;
+	c->code_map = t->code_map;
+	t->cur = t->code;
+	t->end = t->code + CODE_SIZE;
+	emit_enter_exit(t);
+	t->first_block = t->cur;
+	return t;
+}
+
+void dbt_free(struct dbt *t)
+{
+	t->cpu->code_map = NULL;
+	munmap(t->code, CODE_SIZE);
+	free(t->blocks);
+	free(t);
+}
+
+void dbt_flush(struct dbt *t)
+{
+	memset(t->map, 0, sizeof t->map);
+	memset(t->code_map, 0, sizeof t->code_map);
+	t->cur = t->first_block;
+	t->nblocks = 0;
+	t->generation++;
+	t->flushes++;
+	t->cpu->code_map = t->code_map;
+	t->cpu->smc = 0;
+	t->cpu->link = NULL;
+}
+
+void dbt_run(struct dbt *t, uint64_t until)
+{
+	struct dcpu *c = t->cpu;
+	struct block *b;
+	uint64_t limit;
+
+	while (c->cycles < until && c->state == DCPU_RUNNING) {
+		dcpu_service(c);
+		if (c->smc)
+			dbt_flush(t);
+		if (c->state != DCPU_RUNNING)
+			break;
+		limit = dcpu_next_event(c);
+		if (limit > until)
+			limit = until;
+
+		b = lookup(t, c->pc);
+		if (b == &no_block || c->cycles + b->cost > limit ||
+				(c->nqueue && !c->queueing)) {
+			dcpu_exec(c);
+			t->steps++;
+			if (c->smc)
+				dbt_flush(t);
+			continue;
+		}
+
+		c->limit = limit;
+		c->link = NULL;
+		t->enter(c, b->code);
+		t->entries++;
+		if (c->smc)
+			dbt_flush(t);
+		else if (c->link)
+			chain(t, c->link, c->pc);
+	}
+}
+
+void dbt_print_stats(FILE *f, const struct dbt *t)
+{
+	fprintf(f, "Translated %llu blocks, %llu chained, %llu flushes; "
+			"%llu entries to translated code, %llu instructions stepped\n",
+			t->translated, t->chained, t->flushes, t->entries, t->steps);
+}
+
+#else
+
+struct dbt* dbt_new(struct dcpu *c)
+{
+	return NULL;
+}
+
+void dbt_free(struct dbt *t)
+{
+}
+
+void dbt_run(struct dbt *t, uint64_t until)
+{
+}
+
+void dbt_flush(struct dbt *t)
+{
+}
+
+void dbt_print_stats(FILE *f, const struct dbt *t)
+{
+}
+
+#endif
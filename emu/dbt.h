@@ -0,0 +1,25 @@
+#ifndef DBT_H
+#define DBT_H
+/*
+ * dasemu: translation of DCPU-16 code to x86-64
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <stdio.h>
+
+#include "dcpu.h"
+
+struct dbt;
+
+/* NULL if this host can't run translated code; use dcpu_run() then */
+struct dbt* dbt_new(struct dcpu *c);
+void dbt_free(struct dbt *t);
+
+/* as dcpu_run(), to the cycle */
+void dbt_run(struct dbt *t, uint64_t until);
+/* drop all translations: after dcpu_init(), or changing RAM from outside */
+void dbt_flush(struct dbt *t);
+void dbt_print_stats(FILE *f, const struct dbt *t);
+
+#endif
@@ -0,0 +1,403 @@
+/*
+ * dasemu: DCPU-16 1.7 reference interpreter
+ *
+ * Instructions are decoded through the disassembler's 64K-entry table,
+ * decode_table in dasdefs, built from its OPCODES table, so the emulator,
+ * assembler and disassembler agree on encoding and cycle counts. An instruction costs
+ * its opcode's cycles plus one per next word. A failed IF costs one more,
+ * and one more again for each IF it skips over in a chain.
+ *
+ * The interpreter is the reference: the translator must end in the same
+ * state after the same number of cycles. Simple first, fast second.
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dcpu.h"
+
+void dcpu_init(struct dcpu *c)
+{
+	decode_init();
+	memset(c, 0, sizeof *c);
+	c->clock.next = NEVER;
+}
+
+/* flat image from address 0; return words loaded, or -1 */
+int dcpu_load(struct dcpu *c, const char *path, int big_endian)
+{
+	unsigned char buf[2];
+	int n = 0;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	while (n < DCPU_RAM_WORDS && fread(buf, 2, 1, f) == 1) {
+		c->ram[n++] = big_endian ? buf[0] << 8 | buf[1] :
+			buf[0] | buf[1] << 8;
+	}
+	if (fread(buf, 1, 1, f) == 1) {
+		fprintf(stderr, "%s: bigger than 64K words\n", path);
+		n = -1;
+	}
+	fclose(f);
+	return n;
+}
+
+const char* dcpu_state_name(int state)
+{
+	switch (state) {
+	case DCPU_RUNNING:	return "running";
+	case DCPU_ON_FIRE:	return "on fire";
+	case DCPU_BAD_OP:	return "stopped on a bad instruction";
+	}
+	return "?";
+}
+
+void dcpu_print(FILE *f, const struct dcpu *c)
+{
+	static const char names[] = "ABCXYZIJ";
+	int i;
+
+	for (i = 0; i < 8; i++)
+		fprintf(f, "%s%c=%04x", i ? " " : "", names[i], c->reg[i]);
+	fprintf(f, "\nPC=%04x SP=%04x EX=%04x IA=%04x  %llu cycles, %s\n",
+			c->pc, c->sp, c->ex, c->ia, (unsigned long long)c->cycles,
+			dcpu_state_name(c->state));
+}
+
+static void ram_write(struct dcpu *c, u16 addr, u16 val)
+{
+	c->ram[addr] = val;
+	if (c->code_map && c->code_map[addr])
+		c->smc = 1;
+}
+
+static void push(struct dcpu *c, u16 val)
+{
+	ram_write(c, --c->sp, val);
+}
+
+void dcpu_interrupt(struct dcpu *c, u16 message)
+{
+	if (!c->ia)
+		return;				/* ignored while there is no handler */
+	if (c->nqueue == DCPU_QUEUE_MAX) {
+		c->state = DCPU_ON_FIRE;
+		return;
+	}
+	c->queue[(c->qhead + c->nqueue++) % DCPU_QUEUE_MAX] = message;
+}
+
+/*
+ * generic clock: A=0 ticks at 60/B per second, B=0 turns it off; A=1 puts
+ * ticks since then in C; A=2 interrupts with message B on each tick
+ */
+static void clock_hwi(struct dcpu *c)
+{
+	struct dcpu_clock *clk = &c->clock;
+
+	switch (c->reg[0]) {
+	case 0:
+		clk->interval = c->reg[1];
+		clk->ticks = 0;
+		clk->next = clk->interval ? c->cycles +
+			(uint64_t)DCPU_HZ * clk->interval / 60 : NEVER;
+		break;
+	case 1:
+		c->reg[2] = clk->ticks;
+		break;
+	case 2:
+		clk->message = c->reg[1];
+		break;
+	}
+}
+
+uint64_t dcpu_next_event(const struct dcpu *c)
+{
+	return c->clock.next;
+}
+
+void dcpu_service(struct dcpu *c)
+{
+	struct dcpu_clock *clk = &c->clock;
+	u16 message;
+
+	while (c->cycles >= clk->next) {
+		clk->ticks++;
+		clk->next += (uint64_t)DCPU_HZ * clk->interval / 60;
+		if (clk->message)
+			dcpu_interrupt(c, clk->message);
+	}
+
+	if (c->queueing || !c->nqueue)
+		return;
+	message = c->queue[c->qhead];
+	c->qhead = (c->qhead + 1) % DCPU_QUEUE_MAX;
+	c->nqueue--;
+	if (!c->ia)
+		return;
+	c->queueing = 1;
+	push(c, c->pc);
+	push(c, c->reg[0]);
+	c->pc = c->ia;
+	c->reg[0] = message;
+}
+
+u16 dcpu_alu(struct dcpu *c, int op, u16 b, u16 a)
+{
+	int32_t r;
+
+	switch (op) {
+	case OP_SET:
+		return a;
+	case OP_ADD:
+		r = b + a;
+		c->ex = r >> 16;
+		return r;
+	case OP_SUB:
+		r = b - a;
+		c->ex = r < 0 ? 0xffff : 0;
+		return r;
+	case OP_MUL:
+		r = (uint32_t)b * a >> 16;
+		c->ex = r;
+		return b * a;
+	case OP_MLI:
+		r = (s16)b * (s16)a;
+		c->ex = r >> 16;
+		return r;
+	case OP_DIV:
+		if (!a) {
+			c->ex = 0;
+			return 0;
+		}
+		c->ex = ((uint32_t)b << 16) / a;
+		return b / a;
+	case OP_DVI:
+		if (!a) {
+			c->ex = 0;
+			return 0;
+		}
+		c->ex = (int64_t)(s16)b * 0x10000 / (s16)a;
+		return (int32_t)(s16)b / (s16)a;
+	case OP_MOD:
+		return a ? b % a : 0;
+	case OP_MDI:
+		return a ? (int32_t)(s16)b % (s16)a : 0;
+	case OP_AND:
+		return b & a;
+	case OP_BOR:
+		return b | a;
+	case OP_XOR:
+		return b ^ a;
+	case OP_SHR:
+		if (a >= 32) {
+			c->ex = 0;
+			return 0;
+		}
+		c->ex = ((uint64_t)b << 16) >> a;
+		return (uint32_t)b >> a;
+	case OP_ASR:
+		c->ex = a >= 32 ? 0 : ((uint32_t)b << 16) >> a;
+		return (s16)b >> (a > 15 ? 15 : a);
+	case OP_SHL:
+		if (a >= 32) {
+			c->ex = 0;
+			return 0;
+		}
+		c->ex = ((uint64_t)b << a) >> 16;
+		return (uint64_t)b << a;
+	case OP_ADX:
+		r = b + a + c->ex;
+		c->ex = r > 0xffff;
+		return r;
+	case OP_SBX:
+		r = b - a + (s16)c->ex;
+		c->ex = r < 0 ? 0xffff : r > 0xffff;
+		return r;
+	case OP_STI:
+	case OP_STD:
+		return a;
+	}
+	return b;
+}
+
+int dcpu_cond(int op, u16 b, u16 a)
+{
+	switch (op) {
+	case OP_IFB: return (b & a) != 0;
+	case OP_IFC: return (b & a) == 0;
+	case OP_IFE: return b == a;
+	case OP_IFN: return b != a;
+	case OP_IFG: return b > a;
+	case OP_IFA: return (s16)b > (s16)a;
+	case OP_IFL: return b < a;
+	case OP_IFU: return (s16)b < (s16)a;
+	}
+	return 0;
+}
+
+/*
+ * where an operand is, reading its next word if it has one. Literals are
+ * put in *lit and written to harmlessly. Operand a is decoded first.
+ */
+static u16* operand(struct dcpu *c, int field, int is_a, u16 *lit)
+{
+	switch (field) {
+	case OPND_A ... OPND_J:
+		return &c->reg[field];
+	case OPND_MEM_REG ... OPND_MEM_REG + 7:
+		return &c->ram[c->reg[field & 7]];
+	case OPND_MEM_REG_NEXT ... OPND_MEM_REG_NEXT + 7:
+		return &c->ram[(u16)(c->reg[field & 7] + c->ram[c->pc++])];
+	case OPND_PUSH:
+		return is_a ? &c->ram[c->sp++] : &c->ram[--c->sp];
+	case OPND_PEEK:
+		return &c->ram[c->sp];
+	case OPND_PICK:
+		return &c->ram[(u16)(c->sp + c->ram[c->pc++])];
+	case OPND_SP:
+		return &c->sp;
+	case OPND_PC:
+		return &c->pc;
+	case OPND_EX:
+		return &c->ex;
+	case OPND_MEM_NEXT:
+		return &c->ram[c->ram[c->pc++]];
+	case OPND_NEXT:
+		*lit = c->ram[c->pc++];
+		return lit;
+	}
+	*lit = field - OPND_SHORT - 1;
+	return lit;
+}
+
+static void store(struct dcpu *c, u16 *p, u16 val)
+{
+	if (p >= c->ram && p < c->ram + DCPU_RAM_WORDS)
+		ram_write(c, p - c->ram, val);
+	else
+		*p = val;
+}
+
+/* a failed IF: skip the next instruction, and on past any chain of IFs */
+static void skip(struct dcpu *c)
+{
+	const struct decode *d;
+
+	do {
+		d = &decode_table[c->ram[c->pc]];
+		c->pc += d->len;
+		c->cycles++;
+	} while (IS_IF(d->op));
+}
+
+static void exec_special(struct dcpu *c, int op, u16 w)
+{
+	u16 lit, *ap, a;
+
+	ap = operand(c, FIELD_A(w), 1, &lit);
+	a = *ap;
+	switch (op) {
+	case OP_JSR:
+		push(c, c->pc);
+		c->pc = a;
+		break;
+	case OP_HCF:
+		c->state = DCPU_ON_FIRE;
+		break;
+	case OP_INT:
+		dcpu_interrupt(c, a);
+		break;
+	case OP_IAG:
+		store(c, ap, c->ia);
+		break;
+	case OP_IAS:
+		c->ia = a;
+		break;
+	case OP_RFI:
+		c->queueing = 0;
+		c->reg[0] = c->ram[c->sp++];
+		c->pc = c->ram[c->sp++];
+		break;
+	case OP_IAQ:
+		c->queueing = a != 0;
+		break;
+	case OP_HWN:
+		store(c, ap, DCPU_HW_COUNT);
+		break;
+	case OP_HWQ:
+		if (a == 0) {
+			c->reg[0] = CLOCK_ID & 0xffff;
+			c->reg[1] = CLOCK_ID >> 16;
+			c->reg[2] = CLOCK_VERSION;
+			c->reg[3] = CLOCK_MANUFACTURER & 0xffff;
+			c->reg[4] = CLOCK_MANUFACTURER >> 16;
+		}
+		break;
+	case OP_HWI:
+		if (a == 0)
+			clock_hwi(c);
+		break;
+	}
+}
+
+void dcpu_exec(struct dcpu *c)
+{
+	const struct decode *d;
+	u16 w, alit, blit, *bp, a;
+	int op;
+
+	w = c->ram[c->pc];
+	d = &decode_table[w];
+	op = d->op;
+	if (!op) {
+		c->state = DCPU_BAD_OP;
+		return;
+	}
+	c->pc++;
+	c->cycles += d->cycles;
+
+	if (op & SPECIAL_OPCODE) {
+		exec_special(c, op, w);
+		return;
+	}
+
+	a = *operand(c, FIELD_A(w), 1, &alit);
+	bp = operand(c, FIELD_B(w), 0, &blit);
+	if (IS_IF(op)) {
+		if (!dcpu_cond(op, *bp, a))
+			skip(c);
+		return;
+	}
+	store(c, bp, dcpu_alu(c, op, *bp, a));
+	if (op == OP_STI) {
+		c->reg[6]++;
+		c->reg[7]++;
+	} else if (op == OP_STD) {
+		c->reg[6]--;
+		c->reg[7]--;
+	}
+}
+
+uint64_t dcpu_run(struct dcpu *c, uint64_t until)
+{
+	uint64_t n = 0;
+
+	while (c->cycles < until && c->state == DCPU_RUNNING) {
+		dcpu_service(c);
+		if (c->state != DCPU_RUNNING)
+			break;
+		dcpu_exec(c);
+		n += c->state != DCPU_BAD_OP;
+	}
+	return n;
+}
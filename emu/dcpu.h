@@ -0,0 +1,105 @@
+#ifndef DCPU_H
+#define DCPU_H
+/*
+ * dasemu: DCPU-16 1.7 machine state and the reference interpreter
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <stdint.h>
+#include <stdio.h>
+
+#include "dasdefs.h"
+
+#define DCPU_RAM_WORDS		(1 << 16)
+#define DCPU_HZ				100000
+#define DCPU_QUEUE_MAX		256			/* one more and the DCPU catches fire */
+
+/* hardware: the generic clock is the only device, index 0 */
+#define CLOCK_ID			0x12d0b402
+#define CLOCK_VERSION		1
+#define CLOCK_MANUFACTURER	0
+#define DCPU_HW_COUNT		1
+
+#define NEVER				UINT64_MAX
+
+/* opcode indexes as dasdefs numbers them: OP_SET, OP_JSR... */
+#define OP(val, name, count, wb) OP_##name = val
+#define SOP(val, name, count) OP_##name = val | SPECIAL_OPCODE
+enum dcpu_opcode { OPCODES SPECIAL_OPCODES };
+#undef OP
+#undef SOP
+
+/* operand field values: OPND_A..OPND_J, OPND_PUSH... and the other forms */
+#define REGISTER(val, name, gp) OPND_##name = val
+enum dcpu_operand {
+	REGISTERS
+	OPND_MEM_REG = 0x08,		/* [reg], + register */
+	OPND_MEM_REG_NEXT = 0x10,	/* [reg + next word], + register */
+	OPND_MEM_NEXT = 0x1e,		/* [next word] */
+	OPND_NEXT = 0x1f,			/* next word literal */
+	OPND_SHORT = 0x20,			/* short literal -1, up to 0x3f for 30 */
+};
+#undef REGISTER
+
+#define IS_IF(op)			((op) >= OP_IFB && (op) <= OP_IFU)
+
+enum dcpu_state {
+	DCPU_RUNNING,
+	DCPU_ON_FIRE,		/* HCF, or interrupt queue overflow */
+	DCPU_BAD_OP,		/* stopped at a word that is not an instruction */
+};
+
+struct dcpu_clock {
+	u16 interval;		/* 60ths of a second per tick, 0 is off */
+	u16 message;		/* interrupt on tick, 0 for none */
+	u16 ticks;			/* since interval was last set */
+	uint64_t next;		/* cycle of the next tick, NEVER if off */
+};
+
+struct dcpu {
+	u16 reg[8];				/* A B C X Y Z I J, as operand bits number them */
+	u16 pc, sp, ex, ia;
+	uint64_t cycles;
+	int state;
+
+	/* interrupts waiting, a ring */
+	int queueing;
+	int nqueue, qhead;
+	u16 queue[DCPU_QUEUE_MAX];
+
+	struct dcpu_clock clock;
+
+	/* the translator's, unused by the interpreter but for code_map */
+	uint64_t limit;				/* no block may run past this cycle */
+	void *link;					/* jump to patch to the next block, or NULL */
+	const unsigned char *code_map;	/* nonzero for translated words */
+	int smc;					/* a translated word was written */
+
+	u16 ram[DCPU_RAM_WORDS];
+};
+
+void dcpu_init(struct dcpu *c);
+int dcpu_load(struct dcpu *c, const char *path, int big_endian);
+
+/* work due before the next instruction: device events, taking interrupts */
+void dcpu_service(struct dcpu *c);
+/* one instruction, with nothing first */
+void dcpu_exec(struct dcpu *c);
+/*
+ * run instructions until the cycle count reaches until, or it stops.
+ * Return how many instructions ran.
+ */
+uint64_t dcpu_run(struct dcpu *c, uint64_t until);
+/* first cycle at which dcpu_service() has something to do for devices */
+uint64_t dcpu_next_event(const struct dcpu *c);
+
+void dcpu_interrupt(struct dcpu *c, u16 message);
+/* arithmetic for the basic opcodes that write b: new b, and sets EX */
+u16 dcpu_alu(struct dcpu *c, int op, u16 b, u16 a);
+int dcpu_cond(int op, u16 b, u16 a);
+
+const char* dcpu_state_name(int state);
+void dcpu_print(FILE *f, const struct dcpu *c);
+
+#endif
@@ -0,0 +1,512 @@
+/*
+ * dasemu conformance: the translator and lockstep against the interpreter
+ *
+ * Usage: emutest [-n programs] [-c cycles] [-s seed] [image.bin ...]
+ *
+ * Runs random programs, and any images given, on both engines from the same
+ * start, stopping both at a run of random cycle counts and comparing the
+ * whole machine each time: registers, cycle count, interrupt queue, clock
+ * and RAM. The programs are valid instructions with jumps to instruction
+ * starts, subroutines, an interrupt handler fed by the clock, and writes
+ * into their own code; whatever they do, both engines must do it the same.
+ * Each also runs in lockstep lanes started with their own A, B and data,
+ * which must end as each lane would alone. Some are saved part way and
+ * restored, and must go on as if they never were. Some also run as fleets,
+ * which must end the same however many threads ran them and however often
+ * they met, and whether each instance ran alone or in lockstep with others.
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dbt.h"
+#include "dcpu.h"
+#include "fleet.h"
+#include "lockstep.h"
+#include "snapshot.h"
+
+#define DEFAULT_PROGRAMS	300
+#define DEFAULT_CYCLES		200000
+#define PROGRAM_ADDR		0x4000
+#define PROGRAM_WORDS		400
+#define MAX_CHUNK			3000		/* cycles between comparisons */
+#define DATA_ADDR			0x8000
+#define DATA_WORDS			0x1000
+#define LANE_DATA_WORDS		64			/* a lane's own */
+#define SNAPSHOT_PROGRAMS	20
+#define FLEET_PROGRAMS		8
+#define FLEET_INSTANCES		40		/* lockstep groups, one short */
+#define FLEET_CYCLES		50000
+
+/* normally provided by main() */
+int das_error;
+
+static uint64_t rng_state;
+
+static unsigned rnd(unsigned n)
+{
+	/* xorshift64* */
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return (rng_state * 2685821657736338717ull >> 32) % n;
+}
+
+struct program {
+	u16 *ram;
+	u16 pc;
+	u16 starts[PROGRAM_WORDS];
+	int nstarts;
+	u16 fixups[PROGRAM_WORDS];	/* next words to point at an instruction */
+	int nfixups;
+};
+
+static void put(struct program *p, u16 w)
+{
+	p->ram[p->pc++] = w;
+}
+
+static u16 insn(int op, int b, int a)
+{
+	if (op & SPECIAL_OPCODE)
+		return a << 10 | (op & ~SPECIAL_OPCODE) << 5;
+	return a << 10 | b << 5 | op;
+}
+
+/* an address: sometimes in the program, so it gets modified */
+static u16 rand_addr(void)
+{
+	return !rnd(8) ? PROGRAM_ADDR + rnd(PROGRAM_WORDS) :
+		DATA_ADDR + rnd(DATA_WORDS);
+}
+
+static int rand_operand(int is_a)
+{
+	switch (rnd(24)) {
+	case 0 ... 6:
+		return OPND_A + rnd(8);
+	case 7:
+		return OPND_MEM_REG + rnd(8);
+	case 8:
+		return OPND_MEM_REG_NEXT + rnd(8);
+	case 9:
+		return OPND_PUSH;
+	case 10:
+		return OPND_PEEK;
+	case 11:
+		return OPND_PICK;
+	case 12:
+		return rnd(4) ? OPND_EX : OPND_SP;
+	case 13:
+		return OPND_MEM_NEXT;
+	case 14:
+		return is_a || !rnd(8) ? OPND_NEXT : OPND_A;
+	case 15:
+		return !rnd(64) ? OPND_PC : OPND_B;
+	}
+	return is_a ? OPND_SHORT + rnd(0x20) : OPND_C;
+}
+
+static void put_next(struct program *p, int field)
+{
+	if (field == OPND_MEM_NEXT)
+		put(p, rand_addr());
+	else if (operand_nextword(field))
+		put(p, rnd(4) ? rnd(64) : rnd(0x10000));
+}
+
+static void gen_basic(struct program *p)
+{
+	static const int ops[] = {
+		OP_SET, OP_SET, OP_SET, OP_ADD, OP_SUB, OP_MUL, OP_MLI, OP_DIV,
+		OP_DVI, OP_MOD, OP_MDI, OP_AND, OP_BOR, OP_XOR, OP_SHR, OP_ASR,
+		OP_SHL, OP_IFB, OP_IFC, OP_IFE, OP_IFN, OP_IFG, OP_IFA, OP_IFL,
+		OP_IFU, OP_ADX, OP_SBX, OP_STI, OP_STD,
+	};
+	int op = ops[rnd(ARRAY_SIZE(ops))];
+	int a = rand_operand(1), b = rand_operand(0);
+
+	/* keep IF operands small so both outcomes happen */
+	if (IS_IF(op) && rnd(2))
+		a = OPND_SHORT + rnd(4);
+	put(p, insn(op, b, a));
+	put_next(p, a);
+	put_next(p, b);
+}
+
+static void gen_jump(struct program *p)
+{
+	switch (rnd(8)) {
+	case 0 ... 3:
+		put(p, insn(OP_SET, OPND_PC, OPND_NEXT));
+		break;
+	case 4:
+	case 5:
+		put(p, insn(OP_JSR, 0, OPND_NEXT));
+		break;
+	case 6:
+		/* return, if there's anything there */
+		put(p, insn(OP_SET, OPND_PC, OPND_POP));
+		return;
+	case 7:
+		/* computed */
+		put(p, insn(OP_SET, OPND_X, OPND_NEXT));
+		p->fixups[p->nfixups++] = p->pc;
+		put(p, 0);
+		put(p, insn(OP_SET, OPND_PC, OPND_X));
+		return;
+	}
+	p->fixups[p->nfixups++] = p->pc;
+	put(p, 0);
+}
+
+static void gen_special(struct program *p)
+{
+	static const int ops[] = {
+		OP_INT, OP_INT, OP_IAG, OP_IAQ, OP_HWN, OP_HWQ, OP_HWI,
+	};
+	int op = ops[rnd(ARRAY_SIZE(ops))];
+	int a = op == OP_IAQ ? OPND_SHORT + 1 + rnd(2) : rand_operand(1);
+
+	put(p, insn(op, 0, a));
+	put_next(p, a);
+}
+
+/*
+ * clock on, interrupts to a handler that counts in Z and returns, and a body
+ * of random instructions that mostly loops back on itself. The rest of RAM
+ * jumps to 0 and on to the start, to keep going after a wild jump.
+ */
+static void gen_program(struct program *p, u16 *ram)
+{
+	int i, handler;
+
+	memset(p, 0, sizeof *p);
+	p->ram = ram;
+	for (i = 0; i < DCPU_RAM_WORDS; i++)
+		ram[i] = insn(OP_SET, OPND_PC, OPND_SHORT + 1);
+	put(p, insn(OP_SET, OPND_PC, OPND_NEXT));
+	put(p, PROGRAM_ADDR);
+	p->pc = PROGRAM_ADDR;
+	/* data that runs, if jumped to */
+	for (i = 0; i < DATA_WORDS; i++) {
+		do
+			ram[DATA_ADDR + i] = rnd(0x10000);
+		while (!decode_table[ram[DATA_ADDR + i]].op);
+	}
+
+	/* pointers mostly at the data; a fleet instance's seed kept in A, B */
+	for (i = OPND_A; i <= OPND_J; i++) {
+		put(p, insn(i <= OPND_B ? OP_XOR : OP_SET, i, OPND_NEXT));
+		put(p, DATA_ADDR + rnd(DATA_WORDS));
+	}
+	if (rnd(4)) {
+		put(p, insn(OP_IAS, 0, OPND_NEXT));
+		handler = p->pc;
+		put(p, 0);
+		put(p, insn(OP_SET, OPND_A, OPND_SHORT + 1));
+		put(p, insn(OP_SET, OPND_B, OPND_SHORT + 1 + rnd(3)));
+		put(p, insn(OP_HWI, 0, OPND_SHORT + 1));
+		put(p, insn(OP_SET, OPND_A, OPND_SHORT + 1 + 2));
+		put(p, insn(OP_SET, OPND_B, OPND_NEXT));
+		put(p, 0x100 + rnd(16));
+		put(p, insn(OP_HWI, 0, OPND_SHORT + 1));
+		put(p, insn(OP_SET, OPND_PC, OPND_NEXT));
+		i = p->pc;
+		put(p, 0);
+		ram[handler] = p->pc;
+		put(p, insn(OP_ADD, OPND_Z, OPND_SHORT + 2));
+		put(p, insn(OP_RFI, 0, OPND_SHORT));
+		ram[i] = p->pc;
+	}
+
+	while (p->pc < PROGRAM_ADDR + PROGRAM_WORDS) {
+		p->starts[p->nstarts++] = p->pc;
+		i = rnd(1000);
+		if (i < 820)
+			gen_basic(p);
+		else if (i < 940)
+			gen_jump(p);
+		else if (i < 997)
+			gen_special(p);
+		else
+			put(p, rnd(0x10000));		/* maybe not an instruction */
+	}
+	put(p, insn(OP_SET, OPND_PC, OPND_NEXT));
+	put(p, 0);
+	for (i = 0; i < p->nfixups; i++)
+		ram[p->fixups[i]] = p->starts[rnd(p->nstarts)];
+}
+
+/* everything but the translator's own fields */
+static int same(const struct dcpu *x, const struct dcpu *y)
+{
+	return !memcmp(x->reg, y->reg, sizeof x->reg) &&
+		x->pc == y->pc && x->sp == y->sp && x->ex == y->ex &&
+		x->ia == y->ia && x->cycles == y->cycles && x->state == y->state &&
+		x->queueing == y->queueing && x->nqueue == y->nqueue &&
+		x->qhead == y->qhead &&
+		!memcmp(x->queue, y->queue, sizeof x->queue) &&
+		!memcmp(&x->clock, &y->clock, sizeof x->clock) &&
+		!memcmp(x->ram, y->ram, sizeof x->ram);
+}
+
+static void report(const char *what, const char *engine,
+		const struct dcpu *ref, const struct dcpu *dut)
+{
+	int i;
+
+	fprintf(stderr, "%s: %s run differs from interpreter\n", what, engine);
+	fprintf(stderr, "interpreter:\n");
+	dcpu_print(stderr, ref);
+	fprintf(stderr, "%s:\n", engine);
+	dcpu_print(stderr, dut);
+	for (i = 0; i < DCPU_RAM_WORDS; i++) {
+		if (ref->ram[i] != dut->ram[i])
+			fprintf(stderr, "  ram[%04x] %04x vs %04x\n", i, ref->ram[i],
+					dut->ram[i]);
+	}
+}
+
+/* run both to the end in random steps; return nonzero if they differ */
+static int compare(const char *what, struct dcpu *ref, struct dcpu *dut,
+		struct dbt *t, uint64_t cycles)
+{
+	uint64_t until = 0;
+
+	memcpy(dut->ram, ref->ram, sizeof ref->ram);
+	dbt_flush(t);
+	while (until < cycles && ref->state == DCPU_RUNNING) {
+		until += 1 + rnd(MAX_CHUNK);
+		dcpu_run(ref, until);
+		dbt_run(t, until);
+		if (!same(ref, dut)) {
+			report(what, "translated", ref, dut);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * save ref part way through and go on from there three ways: ref itself,
+ * the snapshot mapped and translated, and the snapshot read and interpreted
+ */
+static int compare_snapshot(const char *what, struct dcpu *ref,
+		const char *path, uint64_t cycles)
+{
+	struct dcpu *mapped, *loaded = malloc(sizeof *loaded);
+	uint64_t until = rnd(cycles);
+	struct dbt *t;
+	int ret = 0;
+
+	dcpu_run(ref, until);
+	if (snapshot_save(ref, path) || snapshot_load(loaded, path)) {
+		free(loaded);
+		return 1;
+	}
+	mapped = snapshot_map(path);
+	if (!mapped) {
+		free(loaded);
+		return 1;
+	}
+	t = dbt_new(mapped);
+	do {
+		if (!same(ref, mapped)) {
+			report(what, "restored and translated", ref, mapped);
+			ret = 1;
+		} else if (!same(ref, loaded)) {
+			report(what, "restored", ref, loaded);
+			ret = 1;
+		}
+		until += 1 + rnd(MAX_CHUNK);
+		dcpu_run(ref, until);
+		dbt_run(t, until);
+		dcpu_run(loaded, until);
+	} while (!ret && until < cycles && ref->state == DCPU_RUNNING);
+	dbt_free(t);
+	snapshot_free(mapped);
+	free(loaded);
+	return ret;
+}
+
+/*
+ * lanes started apart, with their own A, B and some data, so that they part
+ * and meet again: run in lockstep and each alone, they must end the same
+ */
+static int compare_lockstep(const char *what, const struct dcpu *image,
+		struct dcpu *ref, struct dcpu *dut, struct lockstep_stats *total,
+		uint64_t cycles)
+{
+	const struct lockstep_stats *st;
+	struct lockstep *g;
+	uint64_t until = 0;
+	int l, i, ret = 0;
+
+	for (l = 0; l < LOCKSTEP_LANES; l++) {
+		memcpy(&ref[l], image, sizeof *image);
+		ref[l].reg[0] = rnd(0x10000);
+		ref[l].reg[1] = rnd(0x10000);
+		for (i = 0; i < LANE_DATA_WORDS; i++)
+			ref[l].ram[DATA_ADDR + rnd(DATA_WORDS)] = rnd(0x10000);
+		memcpy(&dut[l], &ref[l], sizeof *image);
+	}
+	g = lockstep_new(dut, LOCKSTEP_LANES);
+	while (until < cycles && !ret) {
+		until += 1 + rnd(MAX_CHUNK);
+		lockstep_run(g, until);
+		for (l = 0; l < LOCKSTEP_LANES && !ret; l++) {
+			dcpu_run(&ref[l], until);
+			if (!same(&ref[l], &dut[l])) {
+				fprintf(stderr, "lane %d of ", l);
+				report(what, "lockstep", &ref[l], &dut[l]);
+				ret = 1;
+			}
+		}
+	}
+	st = lockstep_stats(g);
+	total->steps += st->steps;
+	total->lanes += st->lanes;
+	total->single += st->single;
+	lockstep_free(g);
+	return ret;
+}
+
+/*
+ * one thread in one batch, each instance alone, against several in many
+ * small ones in lockstep
+ */
+static int compare_fleets(const char *what, const struct dcpu *image)
+{
+	struct fleet *one, *many;
+	int ret;
+
+	one = fleet_new(image, FLEET_INSTANCES, 1, 1, 1);
+	many = fleet_new(image, FLEET_INSTANCES, 1, 4, LOCKSTEP_LANES);
+	fleet_run(one, FLEET_CYCLES, FLEET_CYCLES);
+	fleet_run(many, FLEET_CYCLES, 1 + rnd(FLEET_CYCLES / 10));
+	ret = fleet_hash(one) != fleet_hash(many);
+	if (ret)
+		fprintf(stderr, "%s: fleet differs run in lockstep on more "
+				"threads\n", what);
+	fleet_free(one);
+	fleet_free(many);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int programs = DEFAULT_PROGRAMS, failed = 0, opt, i;
+	int lockstep_failed, snapshot_failed, fleet_failed, fd;
+	struct lockstep_stats lanes = { };
+	struct dcpu *lane_ref, *lane_dut;
+	uint64_t cycles = DEFAULT_CYCLES, seed = 1;
+	struct dcpu *ref, *dut;
+	struct program *p;
+	char what[64], path[] = "/tmp/emutest.XXXXXX";
+	struct dbt *t;
+
+	while ((opt = getopt(argc, argv, "n:c:s:")) != -1) {
+		switch (opt) {
+		case 'n':
+			programs = atoi(optarg);
+			break;
+		case 'c':
+			cycles = strtoull(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n programs] [-c cycles] [-s seed] "
+					"[image.bin ...]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	ref = malloc(sizeof *ref);
+	dut = malloc(sizeof *dut);
+	p = malloc(sizeof *p);
+	dcpu_init(dut);
+	t = dbt_new(dut);
+	if (!t) {
+		printf("No translator on this host, nothing to check\n");
+		return 0;
+	}
+
+	for (i = optind; i < argc; i++) {
+		dcpu_init(ref);
+		dcpu_init(dut);
+		if (dcpu_load(ref, argv[i], 1) < 0)
+			return 1;
+		rng_state = seed;
+		failed += compare(argv[i], ref, dut, t, cycles);
+	}
+
+	for (i = 0; i < programs; i++) {
+		rng_state = seed * 0x9e3779b97f4a7c15ull + i + 1;
+		dcpu_init(ref);
+		dcpu_init(dut);
+		gen_program(p, ref->ram);
+		sprintf(what, "program %d (-s %llu)", i, (unsigned long long)seed);
+		failed += compare(what, ref, dut, t, cycles);
+	}
+
+	printf("Emulator conformance: %d of %d runs differ\n", failed,
+			programs + argc - optind);
+	dbt_print_stats(stdout, t);
+	dbt_free(t);
+
+	/* as many cycles in all, as every lane runs them */
+	lane_ref = malloc(LOCKSTEP_LANES * sizeof *lane_ref);
+	lane_dut = malloc(LOCKSTEP_LANES * sizeof *lane_dut);
+	lockstep_failed = 0;
+	for (i = 0; i < programs; i++) {
+		rng_state = seed * 0x9e3779b97f4a7c15ull + i + 1;
+		dcpu_init(ref);
+		gen_program(p, ref->ram);
+		sprintf(what, "program %d (-s %llu)", i, (unsigned long long)seed);
+		lockstep_failed += compare_lockstep(what, ref, lane_ref, lane_dut,
+				&lanes, cycles / LOCKSTEP_LANES);
+	}
+	printf("Lockstep: %d of %d runs differ; %.1f%% of instructions run in "
+			"lockstep, %.1f lanes a step\n", lockstep_failed, programs,
+			lanes.lanes + lanes.single ?
+				100.0 * lanes.lanes / (lanes.lanes + lanes.single) : 0,
+			lanes.steps ? (double)lanes.lanes / lanes.steps : 0);
+	free(lane_ref);
+	free(lane_dut);
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+	close(fd);
+	snapshot_failed = 0;
+	for (i = 0; i < SNAPSHOT_PROGRAMS; i++) {
+		rng_state = seed * 0x9e3779b97f4a7c15ull + i + 1;
+		dcpu_init(ref);
+		gen_program(p, ref->ram);
+		sprintf(what, "program %d (-s %llu)", i, (unsigned long long)seed);
+		snapshot_failed += compare_snapshot(what, ref, path, cycles);
+	}
+	unlink(path);
+	printf("Snapshots: %d of %d runs differ\n", snapshot_failed,
+			SNAPSHOT_PROGRAMS);
+
+	fleet_failed = 0;
+	for (i = 0; i < FLEET_PROGRAMS; i++) {
+		rng_state = seed * 0x9e3779b97f4a7c15ull + i + 1;
+		dcpu_init(ref);
+		gen_program(p, ref->ram);
+		sprintf(what, "fleet %d (-s %llu)", i, (unsigned long long)seed);
+		fleet_failed += compare_fleets(what, ref);
+	}
+	printf("Fleets: %d of %d differ\n", fleet_failed, FLEET_PROGRAMS);
+	return failed || lockstep_failed || snapshot_failed || fleet_failed;
+}
@@ -0,0 +1,357 @@
+/*
+ * dasemu fleet: many independent DCPUs running the same image
+ *
+ * Instances run in batches: each is run to the batch's end cycle, in any
+ * order on any thread, and all threads meet before the next batch, so no
+ * instance is ever more than a batch ahead of another. They are handed out
+ * in units, an instance or a lockstep group of several. Each thread starts
+ * a batch with a contiguous range of units and takes from its front.
+ * Once its own is empty it steals the back half of the biggest range left,
+ * as units finish at different rates (one on fire is done at once).
+ * A range is two 32-bit indexes in one 64-bit word, only ever changed by
+ * compare-and-swap; each index is handed out once a batch, so there is no
+ * ABA to worry about.
+ *
+ * Instances are interpreted, in lockstep groups unless asked for one at a
+ * time. A translation cache each would be several times the 128KB of RAM
+ * an instance needs, and the interpreter's cycle counts are the same anyway.
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREADS
+  #include <pthread.h>
+  #include <unistd.h>
+#endif
+
+#include "fleet.h"
+#include "lockstep.h"
+
+#define RANGE(lo, hi)		((uint64_t)(hi) << 32 | (uint32_t)(lo))
+#define RANGE_LO(r)			((uint32_t)(r))
+#define RANGE_HI(r)			((uint32_t)((r) >> 32))
+
+/* FNV-1a */
+#define HASH_INIT			14695981039346656037ull
+#define HASH_PRIME			1099511628211ull
+
+struct worker {
+	uint64_t range;			/* units left to run this batch */
+	struct fleet *fleet;
+	unsigned long long insns, steals;
+#ifdef HAVE_PTHREADS
+	pthread_t thread;
+#endif
+} __attribute__((aligned(64)));		/* a cache line each */
+
+struct fleet {
+	struct dcpu *cpus;
+	int n;
+	struct lockstep **groups;	/* the units, or NULL for each instance */
+	int units;
+	struct worker *workers;
+	int nworkers;
+	uint64_t until;			/* end of this batch */
+	unsigned long long batches;
+#ifdef HAVE_PTHREADS
+	pthread_mutex_t lock;
+	pthread_cond_t go, idle;
+	unsigned generation;	/* of batch, for the threads to wait for */
+	int busy;				/* threads still in this batch */
+	int quit;
+#endif
+};
+
+static uint64_t splitmix64(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+/* next unit from the front of our own range, or -1 */
+static long take(struct worker *w)
+{
+	uint64_t r = __atomic_load_n(&w->range, __ATOMIC_ACQUIRE);
+
+	do {
+		if (RANGE_LO(r) >= RANGE_HI(r))
+			return -1;
+	} while (!__atomic_compare_exchange_n(&w->range, &r,
+				RANGE(RANGE_LO(r) + 1, RANGE_HI(r)), 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+	return RANGE_LO(r);
+}
+
+/*
+ * take the back half of the biggest other range: run its first unit
+ * now and make the rest our range. Return -1 once there's nothing left.
+ */
+static long steal(struct fleet *f, struct worker *w)
+{
+	uint32_t lo, hi, k, most;
+	struct worker *v, *victim;
+	uint64_t r;
+
+	for (;;) {
+		victim = NULL;
+		most = 0;
+		for (v = f->workers; v < f->workers + f->nworkers; v++) {
+			r = __atomic_load_n(&v->range, __ATOMIC_ACQUIRE);
+			if (v != w && RANGE_HI(r) - RANGE_LO(r) > most &&
+					RANGE_HI(r) > RANGE_LO(r)) {
+				most = RANGE_HI(r) - RANGE_LO(r);
+				victim = v;
+			}
+		}
+		if (!victim)
+			return -1;
+
+		r = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+		lo = RANGE_LO(r);
+		hi = RANGE_HI(r);
+		if (lo >= hi)
+			continue;
+		k = (hi - lo + 1) / 2;
+		if (__atomic_compare_exchange_n(&victim->range, &r,
+					RANGE(lo, hi - k), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&w->range, RANGE(hi - k + 1, hi),
+					__ATOMIC_RELEASE);
+			w->steals++;
+			return hi - k;
+		}
+	}
+}
+
+static void run_batch(struct fleet *f, struct worker *w)
+{
+	long i;
+
+	while ((i = take(w)) >= 0 || (i = steal(f, w)) >= 0) {
+		if (f->groups)
+			w->insns += lockstep_run(f->groups[i], f->until);
+		else
+			w->insns += dcpu_run(&f->cpus[i], f->until);
+	}
+}
+
+#ifdef HAVE_PTHREADS
+static void* worker_thread(void *arg)
+{
+	struct worker *w = arg;
+	struct fleet *f = w->fleet;
+	unsigned seen = 0;
+
+	pthread_mutex_lock(&f->lock);
+	for (;;) {
+		while (f->generation == seen)
+			pthread_cond_wait(&f->go, &f->lock);
+		seen = f->generation;
+		if (f->quit)
+			break;
+		pthread_mutex_unlock(&f->lock);
+		run_batch(f, w);
+		pthread_mutex_lock(&f->lock);
+		if (--f->busy == 0)
+			pthread_cond_signal(&f->idle);
+	}
+	pthread_mutex_unlock(&f->lock);
+	return NULL;
+}
+#endif
+
+struct fleet* fleet_new(const struct dcpu *image, int n, uint64_t seed,
+		int jobs, int lanes)
+{
+	struct fleet *f = calloc(1, sizeof *f);
+	struct dcpu *c;
+	uint64_t s;
+	int i;
+
+	f->n = n;
+	f->cpus = malloc(n * sizeof *f->cpus);
+	if (!f->cpus) {
+		free(f);
+		return NULL;
+	}
+	for (i = 0; i < n; i++) {
+		c = &f->cpus[i];
+		memcpy(c, image, sizeof *c);
+		c->code_map = NULL;
+		s = splitmix64(seed + i);
+		c->reg[0] = s;
+		c->reg[1] = s >> 16;
+	}
+
+	f->units = n;
+	if (lanes > 1) {
+		f->units = (n + lanes - 1) / lanes;
+		f->groups = calloc(f->units, sizeof *f->groups);
+		for (i = 0; f->groups && i < f->units; i++) {
+			f->groups[i] = lockstep_new(f->cpus + i * lanes,
+					i < f->units - 1 ? lanes : n - i * lanes);
+			if (!f->groups[i])
+				break;
+		}
+		if (!f->groups || i < f->units) {
+			while (f->groups && i--)
+				lockstep_free(f->groups[i]);
+			free(f->groups);
+			free(f->cpus);
+			free(f);
+			return NULL;
+		}
+	}
+
+#ifdef HAVE_PTHREADS
+	if (!jobs)
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (jobs > f->units)
+		jobs = f->units;
+	if (jobs < 1)
+		jobs = 1;
+	f->workers = calloc(jobs, sizeof *f->workers);
+	f->workers[0].fleet = f;
+	f->nworkers = 1;
+#ifdef HAVE_PTHREADS
+	pthread_mutex_init(&f->lock, NULL);
+	pthread_cond_init(&f->go, NULL);
+	pthread_cond_init(&f->idle, NULL);
+	/* as many as will start; the calling thread is the first */
+	for (i = 1; i < jobs; i++) {
+		f->workers[i].fleet = f;
+		if (pthread_create(&f->workers[i].thread, NULL, worker_thread,
+					&f->workers[i]))
+			break;
+		f->nworkers++;
+	}
+#endif
+	return f;
+}
+
+void fleet_free(struct fleet *f)
+{
+	int i;
+
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&f->lock);
+	f->quit = 1;
+	f->generation++;
+	pthread_cond_broadcast(&f->go);
+	pthread_mutex_unlock(&f->lock);
+	for (i = 1; i < f->nworkers; i++)
+		pthread_join(f->workers[i].thread, NULL);
+#endif
+	if (f->groups) {
+		for (i = 0; i < f->units; i++)
+			lockstep_free(f->groups[i]);
+	}
+	free(f->groups);
+	free(f->workers);
+	free(f->cpus);
+	free(f);
+}
+
+void fleet_run(struct fleet *f, uint64_t until, uint64_t batch)
+{
+	uint64_t start = until;
+	int i;
+
+	for (i = 0; i < f->n; i++) {
+		if (f->cpus[i].cycles < start)
+			start = f->cpus[i].cycles;
+	}
+
+	for (f->until = start; f->until < until; ) {
+		f->until = until - f->until > batch ? f->until + batch : until;
+		for (i = 0; i < f->nworkers; i++) {
+			f->workers[i].range = RANGE((long)f->units * i / f->nworkers,
+					(long)f->units * (i + 1) / f->nworkers);
+		}
+		f->batches++;
+#ifdef HAVE_PTHREADS
+		pthread_mutex_lock(&f->lock);
+		f->busy = f->nworkers - 1;
+		f->generation++;
+		pthread_cond_broadcast(&f->go);
+		pthread_mutex_unlock(&f->lock);
+		run_batch(f, &f->workers[0]);
+		pthread_mutex_lock(&f->lock);
+		while (f->busy)
+			pthread_cond_wait(&f->idle, &f->lock);
+		pthread_mutex_unlock(&f->lock);
+#else
+		run_batch(f, &f->workers[0]);
+#endif
+	}
+}
+
+int fleet_size(const struct fleet *f)
+{
+	return f->n;
+}
+
+const struct dcpu* fleet_cpu(const struct fleet *f, int i)
+{
+	return &f->cpus[i];
+}
+
+static uint64_t hash_bytes(uint64_t h, const void *p, size_t n)
+{
+	const unsigned char *b = p;
+
+	while (n--)
+		h = (h ^ *b++) * HASH_PRIME;
+	return h;
+}
+
+uint64_t fleet_hash(const struct fleet *f)
+{
+	const struct dcpu *c;
+	uint64_t h = HASH_INIT;
+
+	/* the machine: all before the translator's fields, and RAM */
+	for (c = f->cpus; c < f->cpus + f->n; c++) {
+		h = hash_bytes(h, c, offsetof(struct dcpu, limit));
+		h = hash_bytes(h, c->ram, sizeof c->ram);
+	}
+	return h;
+}
+
+void fleet_print_stats(FILE *out, const struct fleet *f, double secs)
+{
+	unsigned long long insns = 0, cycles = 0, steals = 0;
+	unsigned long long steps = 0, lanes = 0, single = 0;
+	const struct lockstep_stats *st;
+	int i;
+
+	for (i = 0; i < f->nworkers; i++) {
+		insns += f->workers[i].insns;
+		steals += f->workers[i].steals;
+	}
+	for (i = 0; i < f->n; i++)
+		cycles += f->cpus[i].cycles;
+	fprintf(out, "%llu instructions, %llu cycles in %.3f s: %.1f MIPS, "
+			"%.1f MHz aggregate\n", insns, cycles, secs,
+			secs > 0 ? insns / secs / 1e6 : 0,
+			secs > 0 ? cycles / secs / 1e6 : 0);
+	fprintf(out, "%d threads, %llu batches, %llu steals\n", f->nworkers,
+			f->batches, steals);
+	if (!f->groups)
+		return;
+	for (i = 0; i < f->units; i++) {
+		st = lockstep_stats(f->groups[i]);
+		steps += st->steps;
+		lanes += st->lanes;
+		single += st->single;
+	}
+	fprintf(out, "%.1f%% of instructions run in lockstep, %.1f lanes a step\n",
+			lanes + single ? 100.0 * lanes / (lanes + single) : 0,
+			steps ? (double)lanes / steps : 0);
+}
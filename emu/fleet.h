@@ -0,0 +1,35 @@
+#ifndef FLEET_H
+#define FLEET_H
+/*
+ * dasemu fleet: many independent DCPUs running the same image
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <stdint.h>
+#include <stdio.h>
+
+#include "dcpu.h"
+
+struct fleet;
+
+/*
+ * n copies of machine image, instance i starting with a 32-bit seed made
+ * from seed and i in A (low) and B (high). jobs threads, 0 for one per CPU.
+ * Instances run in lockstep groups of lanes, up to LOCKSTEP_LANES, or one
+ * at a time if lanes is 1.
+ */
+struct fleet* fleet_new(const struct dcpu *image, int n, uint64_t seed,
+		int jobs, int lanes);
+void fleet_free(struct fleet *f);
+
+/* run every instance to the cycle until, all reaching each batch together */
+void fleet_run(struct fleet *f, uint64_t until, uint64_t batch);
+
+int fleet_size(const struct fleet *f);
+const struct dcpu* fleet_cpu(const struct fleet *f, int i);
+/* a hash of every instance's state, the same however it was run */
+uint64_t fleet_hash(const struct fleet *f);
+void fleet_print_stats(FILE *out, const struct fleet *f, double secs);
+
+#endif
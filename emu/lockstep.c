@@ -0,0 +1,625 @@
+/*
+ * dasemu lockstep: DCPUs running the same code, one instruction for all
+ *
+ * A group keeps the registers of up to 16 DCPUs in vectors, a lane each,
+ * and runs an instruction for every lane that has the same PC at once:
+ * decoded once, with register operands and arithmetic done on all lanes
+ * together. Each lane keeps its own RAM, in its struct dcpu, so memory
+ * operands are read and written a lane at a time.
+ *
+ * Lanes only run together while that is exactly what each would have done
+ * alone. Where PCs differ, the lanes with the lowest PC go first, so that
+ * those behind a forward branch catch up with those that took it, and a
+ * loop run more times in some lanes finishes before the others go on.
+ * A lane runs alone, through the reference interpreter, for anything else:
+ * an interrupt or clock tick due, a special instruction other than JSR, the
+ * code differing between lanes, and the instruction skipped by a failed IF.
+ *
+ * Instruction words are checked to be the same in every lane the first
+ * time they run together and marked in a code map, which every lane's
+ * writes check as the translator's do; a write to a marked word clears it.
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+#include "lockstep.h"
+
+#define VECTOR(type, n)		__attribute__((vector_size(sizeof(type) * (n))))
+
+typedef u16 vword VECTOR(u16, LOCKSTEP_LANES);
+typedef s16 vmask VECTOR(s16, LOCKSTEP_LANES);		/* 0 or -1 a lane */
+typedef uint32_t vlong VECTOR(uint32_t, LOCKSTEP_LANES);
+typedef int32_t vslong VECTOR(int32_t, LOCKSTEP_LANES);
+typedef uint64_t vcycles VECTOR(uint64_t, LOCKSTEP_LANES);
+typedef int64_t vmask64 VECTOR(int64_t, LOCKSTEP_LANES);
+
+/* all inlined, and on x86-64 Linux an AVX2 copy too, picked at load time */
+#if defined(__x86_64__) && defined(__linux__)
+  #define LOCKSTEP_HOT		__attribute__((flatten, \
+								target_clones("avx2", "default")))
+#else
+  #define LOCKSTEP_HOT		__attribute__((flatten))
+#endif
+
+#define BUDGET_MAX			(1 << 30)	/* cycles, well short of 32 bits */
+
+#define WIDEN(v, type)		__builtin_convertvector(v, type)
+#define BLEND(v, old, mask)	(((v) & (vword)(mask)) | ((old) & ~(vword)(mask)))
+
+#define for_each_lane(l, m, lanes) \
+	for (m = (lanes); m && ((l) = __builtin_ctz(m), 1); m &= m - 1)
+
+struct lockstep {
+	vword reg[8];
+	vword pc, sp, ex;
+	vcycles cycles;
+	vlong spent;			/* cycles run since, to add to cycles */
+	vcycles quiet;			/* a lane needs servicing from this cycle on */
+	unsigned running;		/* a bit a lane */
+	int flush;				/* a word in the code map was written */
+
+	struct dcpu *cpus;
+	int n;
+	unsigned char *code_map;	/* words the same in every lane */
+	struct lockstep_stats stats;
+};
+
+/* where an operand is in every lane */
+struct where {
+	enum { AT_REG, AT_RAM, AT_LIT } at;
+	vword *reg;
+	vword val;				/* RAM address, or the literal */
+};
+
+static const vword lane_bit = {
+	1 << 0, 1 << 1, 1 << 2, 1 << 3, 1 << 4, 1 << 5, 1 << 6, 1 << 7,
+	1 << 8, 1 << 9, 1 << 10, 1 << 11, 1 << 12, 1 << 13, 1 << 14, 1 << 15,
+};
+
+static vmask lane_mask(unsigned lanes)
+{
+	return (lane_bit & ((vword){ } + (u16)lanes)) != 0;
+}
+
+static unsigned lane_bits(vmask mask)
+{
+#if defined(__SSE2__) && LOCKSTEP_LANES == 16
+	union { vmask v; __m128i half[2]; } u = { mask };
+
+	return _mm_movemask_epi8(_mm_packs_epi16(u.half[0], u.half[1]));
+#else
+	vword b = lane_bit & (vword)mask;
+	unsigned bits = 0;
+	int l;
+
+	for (l = 0; l < LOCKSTEP_LANES; l++)
+		bits |= b[l];
+	return bits;
+#endif
+}
+
+static unsigned lane_bits64(vmask64 mask)
+{
+	return lane_bits(WIDEN(mask, vmask));
+}
+
+struct lockstep* lockstep_new(struct dcpu *cpus, int n)
+{
+	struct lockstep *g;
+	int l;
+
+	if (n < 1 || n > LOCKSTEP_LANES)
+		return NULL;
+	if (posix_memalign((void **)&g, __alignof__(*g), sizeof *g))
+		return NULL;
+	memset(g, 0, sizeof *g);
+	g->code_map = calloc(DCPU_RAM_WORDS, 1);
+	if (!g->code_map) {
+		free(g);
+		return NULL;
+	}
+	g->cpus = cpus;
+	g->n = n;
+	for (l = 0; l < n; l++) {
+		cpus[l].code_map = g->code_map;
+		cpus[l].smc = 0;
+	}
+	return g;
+}
+
+void lockstep_free(struct lockstep *g)
+{
+	int l;
+
+	for (l = 0; l < g->n; l++)
+		g->cpus[l].code_map = NULL;
+	free(g->code_map);
+	free(g);
+}
+
+const struct lockstep_stats* lockstep_stats(const struct lockstep *g)
+{
+	return &g->stats;
+}
+
+/* a lane's registers into its struct dcpu, to run it alone */
+static void lane_out(struct lockstep *g, int l)
+{
+	struct dcpu *c = &g->cpus[l];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		c->reg[i] = g->reg[i][l];
+	c->pc = g->pc[l];
+	c->sp = g->sp[l];
+	c->ex = g->ex[l];
+	c->cycles = g->cycles[l] + g->spent[l];
+}
+
+static void lane_in(struct lockstep *g, int l)
+{
+	struct dcpu *c = &g->cpus[l];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		g->reg[i][l] = c->reg[i];
+	g->pc[l] = c->pc;
+	g->sp[l] = c->sp;
+	g->ex[l] = c->ex;
+	g->cycles[l] = c->cycles;
+	g->spent[l] = 0;
+	/* the rest only change running alone */
+	g->quiet[l] = c->queueing || !c->nqueue ? dcpu_next_event(c) : 0;
+	if (c->state == DCPU_RUNNING)
+		g->running |= 1u << l;
+	else
+		g->running &= ~(1u << l);
+	if (c->smc)
+		g->flush = 1;
+}
+
+static void flush(struct lockstep *g)
+{
+	int l;
+
+	memset(g->code_map, 0, DCPU_RAM_WORDS);
+	for (l = 0; l < g->n; l++)
+		g->cpus[l].smc = 0;
+	g->flush = 0;
+}
+
+/*
+ * one step of dcpu_run() for one lane: return the cycles it took, or -1 if
+ * it stopped or its interrupts or clock changed
+ */
+static int step_lane(struct lockstep *g, int l)
+{
+	struct dcpu *c = &g->cpus[l];
+	uint64_t quiet = g->quiet[l], start = g->cycles[l] + g->spent[l];
+
+	lane_out(g, l);
+	dcpu_service(c);
+	if (c->state == DCPU_RUNNING) {
+		dcpu_exec(c);
+		g->stats.single += c->state != DCPU_BAD_OP;
+	}
+	lane_in(g, l);
+	if (c->state != DCPU_RUNNING || g->quiet[l] != quiet)
+		return -1;
+	return c->cycles - start;
+}
+
+/* the most cycles one took, or -1 as step_lane() */
+static int step_lanes(struct lockstep *g, unsigned lanes)
+{
+	int l, spent, most = 0;
+	unsigned m;
+
+	for_each_lane(l, m, lanes) {
+		spent = step_lane(g, l);
+		if (spent < 0 || most < 0)
+			most = -1;
+		else if (spent > most)
+			most = spent;
+	}
+	return most;
+}
+
+/*
+ * the len words at pc are the same in all of lanes, the first of which
+ * is at code: marked in the code map if they are the same in every lane
+ */
+static int same_code(struct lockstep *g, unsigned lanes, const u16 *code,
+		u16 pc, int len)
+{
+	unsigned m;
+	int l, every;
+
+	for (; len--; pc++) {
+		if (g->code_map[pc])
+			continue;
+		every = 1;
+		for (l = 0; l < g->n; l++) {
+			if (g->cpus[l].ram[pc] != code[pc])
+				every = 0;
+		}
+		if (every) {
+			g->code_map[pc] = 1;
+			continue;
+		}
+		for_each_lane(l, m, lanes) {
+			if (g->cpus[l].ram[pc] != code[pc])
+				return 0;
+		}
+	}
+	return 1;
+}
+
+static u16 next_word(struct lockstep *g, vmask mask, const u16 *code, u16 *pc)
+{
+	g->pc -= (vword)mask;
+	return code[(*pc)++];
+}
+
+/* as dcpu.c's operand(), for every lane in mask */
+static void operand(struct lockstep *g, int field, int is_a, vmask mask,
+		const u16 *code, u16 *pc, struct where *w)
+{
+	w->at = AT_RAM;
+	switch (field) {
+	case OPND_A ... OPND_J:
+		w->at = AT_REG;
+		w->reg = &g->reg[field];
+		return;
+	case OPND_MEM_REG ... OPND_MEM_REG + 7:
+		w->val = g->reg[field & 7];
+		return;
+	case OPND_MEM_REG_NEXT ... OPND_MEM_REG_NEXT + 7:
+		w->val = g->reg[field & 7] + next_word(g, mask, code, pc);
+		return;
+	case OPND_PUSH:
+		if (is_a) {
+			w->val = g->sp;
+			g->sp -= (vword)mask;
+		} else {
+			g->sp += (vword)mask;
+			w->val = g->sp;
+		}
+		return;
+	case OPND_PEEK:
+		w->val = g->sp;
+		return;
+	case OPND_PICK:
+		w->val = g->sp + next_word(g, mask, code, pc);
+		return;
+	case OPND_SP:
+		w->at = AT_REG;
+		w->reg = &g->sp;
+		return;
+	case OPND_PC:
+		w->at = AT_REG;
+		w->reg = &g->pc;
+		return;
+	case OPND_EX:
+		w->at = AT_REG;
+		w->reg = &g->ex;
+		return;
+	case OPND_MEM_NEXT:
+		w->val = (vword){ } + next_word(g, mask, code, pc);
+		return;
+	case OPND_NEXT:
+		w->at = AT_LIT;
+		w->val = (vword){ } + next_word(g, mask, code, pc);
+		return;
+	}
+	w->at = AT_LIT;
+	w->val = (vword){ } + (u16)(field - OPND_SHORT - 1);
+}
+
+static vword load(struct lockstep *g, const struct where *w, unsigned lanes)
+{
+	vword v = { };
+	unsigned m;
+	int l;
+
+	switch (w->at) {
+	case AT_REG:
+		return *w->reg;
+	case AT_LIT:
+		return w->val;
+	case AT_RAM:
+		for_each_lane(l, m, lanes)
+			v[l] = g->cpus[l].ram[w->val[l]];
+		break;
+	}
+	return v;
+}
+
+static void ram_write(struct lockstep *g, int l, u16 addr, u16 val)
+{
+	g->cpus[l].ram[addr] = val;
+	if (g->code_map[addr])
+		g->flush = 1;
+}
+
+static void store(struct lockstep *g, const struct where *w, vword v,
+		vmask mask, unsigned lanes)
+{
+	unsigned m;
+	int l;
+
+	switch (w->at) {
+	case AT_REG:
+		*w->reg = BLEND(v, *w->reg, mask);
+		break;
+	case AT_RAM:
+		for_each_lane(l, m, lanes)
+			ram_write(g, l, w->val[l], v[l]);
+		break;
+	case AT_LIT:
+		break;
+	}
+}
+
+/* dcpu_alu() for every lane in mask: new b, and sets EX */
+static vword alu(struct lockstep *g, int op, vword b, vword a, vmask mask,
+		unsigned lanes)
+{
+	vword r, ex = g->ex;
+	vslong s;
+	vlong u;
+	unsigned m;
+	int l;
+	u16 k;
+
+	switch (op) {
+	case OP_SET:
+	case OP_STI:
+	case OP_STD:
+		return a;
+	case OP_AND:
+		return b & a;
+	case OP_BOR:
+		return b | a;
+	case OP_XOR:
+		return b ^ a;
+	case OP_ADD:
+		r = b + a;
+		ex = (vword)(r < b) & 1;
+		break;
+	case OP_SUB:
+		r = b - a;
+		ex = (vword)(b < a);
+		break;
+	case OP_MUL:
+		u = WIDEN(b, vlong) * WIDEN(a, vlong);
+		r = WIDEN(u, vword);
+		ex = WIDEN(u >> 16, vword);
+		break;
+	case OP_MLI:
+		s = WIDEN((vmask)b, vslong) * WIDEN((vmask)a, vslong);
+		r = WIDEN(s, vword);
+		ex = WIDEN(s >> 16, vword);
+		break;
+	case OP_ADX:
+		u = WIDEN(b, vlong) + WIDEN(a, vlong) + WIDEN(g->ex, vlong);
+		r = WIDEN(u, vword);
+		ex = (vword)WIDEN(u > 0xffff, vmask) & 1;
+		break;
+	case OP_SBX:
+		s = WIDEN(b, vslong) - WIDEN(a, vslong) +
+			WIDEN((vmask)g->ex, vslong);
+		r = WIDEN(s, vword);
+		ex = (vword)WIDEN(s < 0, vmask) |
+			((vword)WIDEN(s > 0xffff, vmask) & 1);
+		break;
+	case OP_SHL:
+	case OP_SHR:
+	case OP_ASR:
+		/* by the same in every lane; 32 bits hold all EX needs */
+		k = a[__builtin_ctz(lanes)];
+		if (lanes & lane_bits(a != k))
+			goto alone;
+		u = WIDEN(b, vlong);
+		if (op == OP_SHL) {
+			u = k < 32 ? u << k : (vlong){ };
+			r = WIDEN(u, vword);
+			ex = WIDEN(u >> 16, vword);
+			break;
+		}
+		u = k < 32 ? u << 16 >> k : (vlong){ };
+		ex = WIDEN(u, vword);
+		if (op == OP_SHR)
+			r = WIDEN(u >> 16, vword);
+		else
+			r = (vword)((vmask)b >> (k > 15 ? 15 : k));
+		break;
+	default:
+	alone:
+		/* division, and shifts by different amounts: a lane at a time */
+		r = b;
+		for_each_lane(l, m, lanes) {
+			g->cpus[l].ex = g->ex[l];
+			r[l] = dcpu_alu(&g->cpus[l], op, b[l], a[l]);
+			ex[l] = g->cpus[l].ex;
+		}
+		break;
+	}
+	g->ex = BLEND(ex, g->ex, mask);
+	return r;
+}
+
+static vmask cond(int op, vword b, vword a)
+{
+	switch (op) {
+	case OP_IFB: return (b & a) != 0;
+	case OP_IFC: return (b & a) == 0;
+	case OP_IFE: return b == a;
+	case OP_IFN: return b != a;
+	case OP_IFG: return b > a;
+	case OP_IFA: return (vmask)b > (vmask)a;
+	case OP_IFL: return b < a;
+	case OP_IFU: return (vmask)b < (vmask)a;
+	}
+	return (vmask){ };
+}
+
+/*
+ * a failed IF in one lane: skip the next instruction and any chain.
+ * Return the cycles that took.
+ */
+static int skip_lane(struct lockstep *g, int l)
+{
+	const struct decode *d;
+	const u16 *ram = g->cpus[l].ram;
+	u16 pc = g->pc[l];
+	int n = 0;
+
+	do {
+		d = &decode_table[ram[pc]];
+		pc += d->len;
+		n++;
+	} while (IS_IF(d->op));
+	g->pc[l] = pc;
+	g->spent[l] += n;
+	return n;
+}
+
+/*
+ * a basic instruction or JSR at pc, for every lane in lanes. Return the
+ * most cycles one lane took.
+ */
+static int exec_lanes(struct lockstep *g, unsigned lanes, const u16 *code,
+		u16 pc, const struct decode *d)
+{
+	vmask mask = lane_mask(lanes);
+	struct where wa, wb;
+	u16 w = code[pc];
+	int l, n, skipped = 0;
+	vword a, b;
+	unsigned m;
+
+	next_word(g, mask, code, &pc);
+	g->spent += (vlong)WIDEN(mask, vslong) & d->cycles;
+
+	operand(g, FIELD_A(w), 1, mask, code, &pc, &wa);
+	a = load(g, &wa, lanes);
+	if (d->op == OP_JSR) {
+		g->sp += (vword)mask;
+		for_each_lane(l, m, lanes)
+			ram_write(g, l, g->sp[l], g->pc[l]);
+		g->pc = BLEND(a, g->pc, mask);
+		return d->cycles;
+	}
+
+	operand(g, FIELD_B(w), 0, mask, code, &pc, &wb);
+	b = load(g, &wb, lanes);
+	if (IS_IF(d->op)) {
+		for_each_lane(l, m, lanes & ~lane_bits(cond(d->op, b, a))) {
+			n = skip_lane(g, l);
+			if (n > skipped)
+				skipped = n;
+		}
+		return d->cycles + skipped;
+	}
+	store(g, &wb, alu(g, d->op, b, a, mask, lanes), mask, lanes);
+	if (d->op == OP_STI) {
+		g->reg[6] -= (vword)mask;
+		g->reg[7] -= (vword)mask;
+	} else if (d->op == OP_STD) {
+		g->reg[6] += (vword)mask;
+		g->reg[7] += (vword)mask;
+	}
+	return d->cycles;
+}
+
+/*
+ * lanes run together without checking their cycle counts while budget,
+ * the fewest cycles any has left before it is due servicing or reaches
+ * until, is more than has been spent since it was worked out; and spent
+ * is added up in 32 bits till then
+ */
+static int64_t budget(struct lockstep *g, unsigned live, uint64_t until)
+{
+	int64_t left, least = BUDGET_MAX;
+	unsigned m;
+	int l;
+
+	for_each_lane(l, m, live) {
+		left = (g->quiet[l] < until ? g->quiet[l] : until) - g->cycles[l];
+		if (left < least)
+			least = left;
+	}
+	return least;
+}
+
+LOCKSTEP_HOT
+uint64_t lockstep_run(struct lockstep *g, uint64_t until)
+{
+	unsigned long long start = g->stats.lanes + g->stats.single;
+	const vcycles end = (vcycles){ } + until;
+	const struct decode *d;
+	unsigned live = 0, lanes, m;
+	int64_t left = 0;
+	const u16 *code;
+	int l, first, spent;
+	u16 pc;
+
+	g->running = 0;
+	for (l = 0; l < g->n; l++)
+		lane_in(g, l);
+
+	for (;;) {
+		if (g->flush)
+			flush(g);
+		if (left <= 0) {
+			g->cycles += WIDEN(g->spent, vcycles);
+			g->spent = (vlong){ };
+			live = g->running & lane_bits64(g->cycles < end);
+			if (!live)
+				break;
+			lanes = live & lane_bits64(g->cycles >= g->quiet);
+			if (lanes) {
+				step_lanes(g, lanes);
+				continue;
+			}
+			left = budget(g, live, until);
+		}
+
+		/* the lanes at the lowest PC */
+		first = __builtin_ctz(live);
+		pc = g->pc[first];
+		lanes = live & lane_bits(g->pc == pc);
+		if (lanes != live) {
+			for_each_lane(l, m, live) {
+				if (g->pc[l] < pc)
+					pc = g->pc[l];
+			}
+			lanes = live & lane_bits(g->pc == pc);
+			first = __builtin_ctz(lanes);
+		}
+
+		code = g->cpus[first].ram;
+		d = &decode_table[code[pc]];
+		if (!(lanes & (lanes - 1)) || !d->op ||
+				((d->op & SPECIAL_OPCODE) && d->op != OP_JSR) ||
+				!same_code(g, lanes, code, pc, d->len)) {
+			spent = step_lanes(g, lanes);
+		} else {
+			spent = exec_lanes(g, lanes, code, pc, d);
+			g->stats.steps++;
+			g->stats.lanes += __builtin_popcount(lanes);
+		}
+		left = spent < 0 ? 0 : left - spent;
+	}
+
+	for (l = 0; l < g->n; l++)
+		lane_out(g, l);
+	return g->stats.lanes + g->stats.single - start;
+}
@@ -0,0 +1,32 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+/*
+ * dasemu lockstep: DCPUs running the same code, one instruction for all
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include "dcpu.h"
+
+#define LOCKSTEP_LANES		16
+
+struct lockstep_stats {
+	unsigned long long steps;	/* instructions run in several lanes at once */
+	unsigned long long lanes;	/* lane instructions those steps ran */
+	unsigned long long single;	/* instructions run a lane at a time */
+};
+
+struct lockstep;
+
+/* a group running cpus[0] to cpus[n - 1] in place, n up to LOCKSTEP_LANES */
+struct lockstep* lockstep_new(struct dcpu *cpus, int n);
+void lockstep_free(struct lockstep *g);
+
+/*
+ * dcpu_run() for each lane, to the cycle. Return how many instructions
+ * ran, in all lanes.
+ */
+uint64_t lockstep_run(struct lockstep *g, uint64_t until);
+const struct lockstep_stats* lockstep_stats(const struct lockstep *g);
+
+#endif
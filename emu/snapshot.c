@@ -0,0 +1,310 @@
+/*
+ * dasemu snapshots: a machine's whole state in a file, to start from again
+ *
+ * A page of machine state, then RAM, all little-endian, at these offsets:
+ *
+ *   0     "DASSNAP" and a version byte, 1
+ *   8     A B C X Y Z I J PC SP EX IA, a word each
+ *   32    cycles, 64 bits
+ *   40    state, queueing, interrupts queued, queue head, a word each
+ *   48    the interrupt queue, its 256 words as they lie in the ring
+ *   560   clock interval, message, ticks and a spare word; next tick, 64 bits
+ *   4096  RAM, 64K words
+ *
+ * RAM pages that are all zero are skipped over rather than written, leaving
+ * holes where the file system allows, so a snapshot takes the disk space its
+ * program's RAM does. RAM starts on a page so that on little-endian hosts it
+ * can be mapped straight into a machine. A mapped file must not be changed
+ * while a machine is using it.
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC		"DASSNAP\1"
+#define SNAPSHOT_PAGE		4096		/* zero runs this long are skipped */
+#define RAM_BYTES			(DCPU_RAM_WORDS * 2)
+
+enum {
+	AT_MAGIC = 0,
+	AT_REGS = 8,
+	AT_CYCLES = 32,
+	AT_STATE = 40,
+	AT_QUEUE = 48,
+	AT_CLOCK = 560,
+	AT_RAM = 4096,
+};
+
+static void put16(unsigned char *p, u16 v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put64(unsigned char *p, uint64_t v)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		p[i] = v >> 8 * i;
+}
+
+static u16 get16(const unsigned char *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static uint64_t get64(const unsigned char *p)
+{
+	uint64_t v = 0;
+	int i;
+
+	for (i = 7; i >= 0; i--)
+		v = v << 8 | p[i];
+	return v;
+}
+
+static void put_state(unsigned char *head, const struct dcpu *c)
+{
+	int i;
+
+	memcpy(head + AT_MAGIC, SNAPSHOT_MAGIC, 8);
+	for (i = 0; i < 8; i++)
+		put16(head + AT_REGS + 2 * i, c->reg[i]);
+	put16(head + AT_REGS + 16, c->pc);
+	put16(head + AT_REGS + 18, c->sp);
+	put16(head + AT_REGS + 20, c->ex);
+	put16(head + AT_REGS + 22, c->ia);
+	put64(head + AT_CYCLES, c->cycles);
+	put16(head + AT_STATE, c->state);
+	put16(head + AT_STATE + 2, c->queueing);
+	put16(head + AT_STATE + 4, c->nqueue);
+	put16(head + AT_STATE + 6, c->qhead);
+	for (i = 0; i < DCPU_QUEUE_MAX; i++)
+		put16(head + AT_QUEUE + 2 * i, c->queue[i]);
+	put16(head + AT_CLOCK, c->clock.interval);
+	put16(head + AT_CLOCK + 2, c->clock.message);
+	put16(head + AT_CLOCK + 4, c->clock.ticks);
+	put64(head + AT_CLOCK + 8, c->clock.next);
+}
+
+/* a header this version wrote, that a machine can be in */
+static int valid_state(const unsigned char *head)
+{
+	return !memcmp(head + AT_MAGIC, SNAPSHOT_MAGIC, 8) &&
+		get16(head + AT_STATE) <= DCPU_BAD_OP &&
+		get16(head + AT_STATE + 2) <= 1 &&
+		get16(head + AT_STATE + 4) <= DCPU_QUEUE_MAX &&
+		get16(head + AT_STATE + 6) < DCPU_QUEUE_MAX;
+}
+
+/* all but RAM, into a machine that is otherwise all zero */
+static void get_state(struct dcpu *c, const unsigned char *head)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		c->reg[i] = get16(head + AT_REGS + 2 * i);
+	c->pc = get16(head + AT_REGS + 16);
+	c->sp = get16(head + AT_REGS + 18);
+	c->ex = get16(head + AT_REGS + 20);
+	c->ia = get16(head + AT_REGS + 22);
+	c->cycles = get64(head + AT_CYCLES);
+	c->state = get16(head + AT_STATE);
+	c->queueing = get16(head + AT_STATE + 2);
+	c->nqueue = get16(head + AT_STATE + 4);
+	c->qhead = get16(head + AT_STATE + 6);
+	for (i = 0; i < DCPU_QUEUE_MAX; i++)
+		c->queue[i] = get16(head + AT_QUEUE + 2 * i);
+	c->clock.interval = get16(head + AT_CLOCK);
+	c->clock.message = get16(head + AT_CLOCK + 2);
+	c->clock.ticks = get16(head + AT_CLOCK + 4);
+	c->clock.next = get64(head + AT_CLOCK + 8);
+}
+
+int snapshot_save(const struct dcpu *c, const char *path)
+{
+	unsigned char head[AT_RAM] = { }, page[SNAPSHOT_PAGE];
+	static const unsigned char zero[SNAPSHOT_PAGE];
+	int addr, i, n;
+	FILE *f;
+
+	put_state(head, c);
+	f = fopen(path, "wb");
+	if (!f)
+		goto fail;
+	if (fwrite(head, sizeof head, 1, f) != 1)
+		goto fail_close;
+
+	for (addr = 0; addr < DCPU_RAM_WORDS; addr += n) {
+		n = SNAPSHOT_PAGE / 2;
+		for (i = 0; i < n; i++)
+			put16(page + 2 * i, c->ram[addr + i]);
+		/* the last is written anyway, for the file's length */
+		if (!memcmp(page, zero, sizeof page) &&
+				addr + n < DCPU_RAM_WORDS) {
+			if (fseek(f, sizeof page, SEEK_CUR))
+				goto fail_close;
+		} else if (fwrite(page, sizeof page, 1, f) != 1) {
+			goto fail_close;
+		}
+	}
+	if (fclose(f))
+		goto fail;
+	return 0;
+
+fail_close:
+	fclose(f);
+fail:
+	fprintf(stderr, "%s: %s\n", path, strerror(errno));
+	return -1;
+}
+
+/* the header, checked; 0, or -1 having said why */
+static int read_state(FILE *f, const char *path, unsigned char *head)
+{
+	if (fread(head, AT_RAM, 1, f) != 1 || !valid_state(head)) {
+		fprintf(stderr, "%s: not a dasemu snapshot\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+static int read_ram(FILE *f, const char *path, u16 *ram)
+{
+	unsigned char *buf = malloc(RAM_BYTES);
+	int i, ret = 0;
+
+	if (!buf || fread(buf, RAM_BYTES, 1, f) != 1) {
+		fprintf(stderr, "%s: %s\n", path, buf ? "RAM cut short" :
+				strerror(ENOMEM));
+		ret = -1;
+	} else {
+		for (i = 0; i < DCPU_RAM_WORDS; i++)
+			ram[i] = get16(buf + 2 * i);
+	}
+	free(buf);
+	return ret;
+}
+
+int snapshot_load(struct dcpu *c, const char *path)
+{
+	unsigned char head[AT_RAM];
+	struct dcpu *tmp;
+	FILE *f;
+	int ret = -1;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	tmp = malloc(sizeof *tmp);
+	if (tmp && !read_state(f, path, head)) {
+		dcpu_init(tmp);
+		get_state(tmp, head);
+		if (!read_ram(f, path, tmp->ram)) {
+			memcpy(c, tmp, sizeof *c);
+			ret = 0;
+		}
+	}
+	free(tmp);
+	fclose(f);
+	return ret;
+}
+
+#ifndef _WIN32
+/*
+ * a machine's own mapping, RAM on a page boundary, which the snapshot's
+ * RAM can be mapped over
+ */
+static size_t map_pad(void)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+
+	return (offsetof(struct dcpu, ram) + page - 1) / page * page;
+}
+
+/* RAM straight from the file, if this host and file allow it */
+static int map_ram(struct dcpu *c, int fd)
+{
+	struct stat st;
+
+	if (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__ ||
+			AT_RAM % sysconf(_SC_PAGESIZE) ||
+			fstat(fd, &st) || st.st_size < AT_RAM + RAM_BYTES)
+		return -1;
+	return mmap(c->ram, RAM_BYTES, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_FIXED, fd, AT_RAM) == MAP_FAILED ? -1 : 0;
+}
+
+struct dcpu* snapshot_map(const char *path)
+{
+	size_t pad = map_pad();
+	unsigned char head[AT_RAM];
+	struct dcpu *c = NULL;
+	char *base;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	if (read_state(f, path, head))
+		goto out;
+	base = mmap(NULL, pad + RAM_BYTES, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		goto out;
+	}
+	/* fresh anonymous memory is as dcpu_init() leaves it, but untouched */
+	c = (struct dcpu *)(base + pad - offsetof(struct dcpu, ram));
+	decode_init();
+	get_state(c, head);
+	if (map_ram(c, fileno(f)) && read_ram(f, path, c->ram)) {
+		munmap(base, pad + RAM_BYTES);
+		c = NULL;
+	}
+out:
+	fclose(f);
+	return c;
+}
+
+void snapshot_free(struct dcpu *c)
+{
+	size_t pad = map_pad();
+
+	munmap((char *)c->ram - pad, pad + RAM_BYTES);
+}
+#else
+struct dcpu* snapshot_map(const char *path)
+{
+	struct dcpu *c = malloc(sizeof *c);
+
+	if (c && snapshot_load(c, path)) {
+		free(c);
+		c = NULL;
+	}
+	return c;
+}
+
+void snapshot_free(struct dcpu *c)
+{
+	free(c);
+}
+#endif
@@ -0,0 +1,29 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+/*
+ * dasemu snapshots: a machine's whole state in a file, to start from again
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include "dcpu.h"
+
+/* write everything but the translator's fields to path; 0, or -1 */
+int snapshot_save(const struct dcpu *c, const char *path);
+
+/*
+ * read path into c, as it was saved, the translator's fields cleared; 0,
+ * or -1 leaving c unchanged. A translator running c needs dbt_flush().
+ */
+int snapshot_load(struct dcpu *c, const char *path);
+
+/*
+ * a new machine from path, or NULL. Where the host allows, its RAM is the
+ * file mapped copy-on-write: a page is only read when first touched, and
+ * only copied when first written, so restoring costs the same however much
+ * RAM the program filled. Free it with snapshot_free().
+ */
+struct dcpu* snapshot_map(const char *path);
+void snapshot_free(struct dcpu *c);
+
+#endif
@@ -0,0 +1,355 @@
+/*
+ * das binary output formats: flat image, Intel HEX, records, segment files
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "binformat.h"
+#include "das.h"
+#include "output.h"
+#include "watch.h"
+
+#define IHEX_WORDS_PER_RECORD	8
+#define MAX_IMAGE_WORDS			(1 << 16)
+
+/* split a word into two bytes in output byte order */
+static void word_bytes(u16 word, unsigned char *b)
+{
+	if (options.big_endian) {
+		b[0] = word >> 8;
+		b[1] = word & 0xff;
+	} else {
+		b[0] = word & 0xff;
+		b[1] = word >> 8;
+	}
+}
+
+static int fwrite_words(FILE *f, const u16 *words, int nwords)
+{
+	unsigned char buf[512];
+	int n;
+
+	while (nwords) {
+		for (n = 0; n < nwords && n < sizeof buf / 2; n++)
+			word_bytes(words[n], buf + n * 2);
+		if (fwrite(buf, 2, n, f) != n)
+			return -1;
+		words += n;
+		nwords -= n;
+	}
+	return 0;
+}
+
+/*
+ * find the parts of the image worth writing: split wherever there is a run
+ * of at least SEGMENT_MIN_GAP zero words, and drop leading/trailing zeros.
+ * An all-zero image has no segments.
+ * *segs is malloc'd, return number of segments.
+ */
+int bin_segments(const u16 *image, int nwords, struct bin_segment **segs)
+{
+	int nsegs = 0, alloced = 8;
+	int i = 0, start, zeros;
+
+	*segs = malloc(alloced * sizeof **segs);
+	for (;;) {
+		/* skip to first non-zero word */
+		while (i < nwords && !image[i])
+			i++;
+		if (i == nwords)
+			break;
+
+		/* extend segment until a long enough gap, or the end */
+		start = i;
+		zeros = 0;
+		for (; i < nwords && zeros < SEGMENT_MIN_GAP; i++) {
+			if (image[i])
+				zeros = 0;
+			else
+				zeros++;
+		}
+
+		if (nsegs == alloced) {
+			alloced *= 2;
+			*segs = realloc(*segs, alloced * sizeof **segs);
+		}
+		(*segs)[nsegs].addr = start;
+		(*segs)[nsegs].nwords = i - start - zeros;
+		(*segs)[nsegs].words = image + start;
+		nsegs++;
+	}
+	return nsegs;
+}
+
+/*
+ * flat image, every word from address 0 up
+ */
+static int bin_write(FILE *f, const u16 *image, int nwords)
+{
+	return fwrite_words(f, image, nwords);
+}
+
+/*
+ * Intel HEX. Addresses in the file are byte addresses, twice the DCPU word
+ * address, so the 64K word space needs extended linear address records
+ * above 0x8000. A data record never splits a word.
+ */
+static void ihex_record(FILE *f, int type, int addr, const unsigned char *data,
+						int len)
+{
+	int i;
+	unsigned char sum = len + (addr >> 8) + addr + type;
+
+	fprintf(f, ":%02X%04X%02X", len, addr & 0xffff, type);
+	for (i = 0; i < len; i++) {
+		fprintf(f, "%02X", data[i]);
+		sum += data[i];
+	}
+	fprintf(f, "%02X\n", (unsigned char)-sum);
+}
+
+static int ihex_write(FILE *f, const u16 *image, int nwords)
+{
+	struct bin_segment *segs;
+	unsigned char data[IHEX_WORDS_PER_RECORD * 2];
+	int nsegs, s, i, n, w;
+	int upper = 0;
+
+	nsegs = bin_segments(image, nwords, &segs);
+	for (s = 0; s < nsegs; s++) {
+		int addr = segs[s].addr;
+		const u16 *words = segs[s].words;
+
+		for (i = 0; i < segs[s].nwords; i += n, addr += n) {
+			n = segs[s].nwords - i;
+			if (n > IHEX_WORDS_PER_RECORD)
+				n = IHEX_WORDS_PER_RECORD;
+			/* don't let a record cross a 64KB boundary */
+			if ((addr & 0x7fff) + n > 0x8000)
+				n = 0x8000 - (addr & 0x7fff);
+
+			if ((addr * 2) >> 16 != upper) {
+				unsigned char ela[2];
+
+				upper = (addr * 2) >> 16;
+				ela[0] = upper >> 8;
+				ela[1] = upper & 0xff;
+				ihex_record(f, 0x04, 0, ela, 2);
+			}
+			for (w = 0; w < n; w++)
+				word_bytes(words[i + w], data + w * 2);
+			ihex_record(f, 0x00, addr * 2, data, n * 2);
+		}
+	}
+	ihex_record(f, 0x01, 0, NULL, 0);
+	free(segs);
+	return ferror(f);
+}
+
+/*
+ * simple record format: for each segment, an address word and a length word
+ * followed by that many data words. A zero-length record ends the file.
+ * All words in output byte order.
+ */
+static int rec_write(FILE *f, const u16 *image, int nwords)
+{
+	struct bin_segment *segs;
+	int nsegs, s, i, n;
+	int ret = 0;
+	u16 hdr[2];
+
+	nsegs = bin_segments(image, nwords, &segs);
+	for (s = 0; s < nsegs && !ret; s++) {
+		/* a full 64K segment won't fit a 16-bit length, split it */
+		for (i = 0; i < segs[s].nwords && !ret; i += n) {
+			n = segs[s].nwords - i;
+			if (n > 0xffff)
+				n = 0xffff;
+			hdr[0] = segs[s].addr + i;
+			hdr[1] = n;
+			ret = fwrite_words(f, hdr, 2) ||
+				fwrite_words(f, segs[s].words + i, n);
+		}
+	}
+	hdr[0] = hdr[1] = 0;
+	if (!ret)
+		ret = fwrite_words(f, hdr, 2);
+	free(segs);
+	return ret;
+}
+
+/*
+ * read a flat image in output byte order, for --delta. *image is malloc'd,
+ * return number of words or -1 on error.
+ */
+int bin_read(const char *path, u16 **image)
+{
+	unsigned char buf[512];
+	int nwords = 0, odd = 0, i;
+	size_t n;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		error("Reading %s failed: %s", path, strerror(errno));
+		return -1;
+	}
+	*image = malloc(MAX_IMAGE_WORDS * sizeof **image);
+	while (nwords < MAX_IMAGE_WORDS &&
+			(n = fread(buf, 1, sizeof buf, f)) > 0) {
+		/* fread() only comes up short at the end, so this is the last */
+		odd = n & 1;
+		for (i = 0; i < n / 2 && nwords < MAX_IMAGE_WORDS; i++) {
+			if (options.big_endian)
+				(*image)[nwords++] = buf[i * 2] << 8 | buf[i * 2 + 1];
+			else
+				(*image)[nwords++] = buf[i * 2] | buf[i * 2 + 1] << 8;
+		}
+	}
+	if (ferror(f) || odd || getc(f) != EOF) {
+		error("%s is not a DCPU-16 image of 64K words or less", path);
+		nwords = -1;
+	}
+	fclose(f);
+	return nwords;
+}
+
+/*
+ * records of the words that differ from old. Runs of changed words less
+ * than DELTA_MERGE_GAP apart share a record, costing no more than the
+ * header another record would take.
+ */
+int delta_write(FILE *f, const u16 *old, int oldwords, const u16 *image,
+				int nwords)
+{
+	int i = 0, start, end, same, n;
+	int records = 0, changed = 0;
+	int ret;
+	u16 hdr[3];
+
+#define DIFFERS(i)	(image[i] != ((i) < oldwords ? old[i] : 0))
+	hdr[0] = DELTA_MAGIC;
+	hdr[1] = nwords >> 16;
+	hdr[2] = nwords;
+	ret = fwrite_words(f, hdr, 3);
+	while (!ret) {
+		while (i < nwords && !DIFFERS(i))
+			i++;
+		if (i == nwords)
+			break;
+
+		/* extend the record over short unchanged gaps */
+		start = end = i;
+		for (same = 0; i < nwords && same <= DELTA_MERGE_GAP; i++) {
+			if (DIFFERS(i)) {
+				same = 0;
+				end = i + 1;
+				changed++;
+			} else {
+				same++;
+			}
+		}
+		i = end;
+
+		/* a 64K change won't fit a 16-bit length, split it */
+		for (; start < end && !ret; start += n) {
+			n = end - start;
+			if (n > 0xffff)
+				n = 0xffff;
+			hdr[0] = start;
+			hdr[1] = n;
+			ret = fwrite_words(f, hdr, 2) ||
+				fwrite_words(f, image + start, n);
+			records++;
+		}
+	}
+#undef DIFFERS
+	hdr[0] = hdr[1] = 0;
+	if (!ret)
+		ret = fwrite_words(f, hdr, 2);
+	info("Delta: %d of %d words changed, %d records\n", changed, nwords,
+		records);
+	return ret;
+}
+
+/*
+ * one flat file per segment, named path.AAAA for word address AAAA (hex)
+ */
+static int segments_write_files(const char *path, const u16 *image, int nwords)
+{
+	struct bin_segment *segs;
+	int nsegs, s;
+	char *segpath;
+	FILE *f;
+	int ret = 0;
+
+	if (!strcmp("-", path)) {
+		error("Segment output needs a file name, not stdout");
+		return -1;
+	}
+
+	segpath = malloc(strlen(path) + 6);
+	nsegs = bin_segments(image, nwords, &segs);
+	for (s = 0; s < nsegs && !ret; s++) {
+		sprintf(segpath, "%s.%04x", path, segs[s].addr);
+		f = watch_fopen(segpath, "wb");
+		if (!f) {
+			error("Writing %s failed: %s", segpath, strerror(errno));
+			ret = -1;
+			break;
+		}
+		info("Write segment 0x%04x-0x%04x to %s\n", segs[s].addr,
+			segs[s].addr + segs[s].nwords - 1, segpath);
+		ret = fwrite_words(f, segs[s].words, segs[s].nwords);
+		if (watch_fclose(f))
+			ret = -1;
+	}
+	free(segs);
+	free(segpath);
+	return ret;
+}
+
+static const struct binformat binformats[] = {
+	{
+		.name  = "bin",
+		.desc  = "flat binary image from address 0 (default)",
+		.write = bin_write,
+	}, {
+		.name  = "ihex",
+		.desc  = "Intel HEX, byte addresses, zero gaps skipped",
+		.write = ihex_write,
+		.text  = 1,
+	}, {
+		.name  = "rec",
+		.desc  = "binary address/length records, zero gaps skipped",
+		.write = rec_write,
+	}, {
+		.name  = "segments",
+		.desc  = "flat binary file per segment, outfile.AAAA",
+		.write_files = segments_write_files,
+	},
+};
+
+const struct binformat* binformat_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(binformats); i++) {
+		if (!strcmp(name, binformats[i].name))
+			return &binformats[i];
+	}
+	return NULL;
+}
+
+void binformat_print_list(FILE *f)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(binformats); i++)
+		fprintf(f, "    %-9s %s\n", binformats[i].name, binformats[i].desc);
+}
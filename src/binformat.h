@@ -0,0 +1,59 @@
+#ifndef BINFORMAT_H
+#define BINFORMAT_H
+/*
+ * das binary output formats: flat image, Intel HEX, records, segment files
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <stdio.h>
+
+#include "dasdefs.h"
+
+/*
+ * runs of at least this many zero words split the image into segments, for
+ * the formats that can skip unused address space
+ */
+#define SEGMENT_MIN_GAP		8
+
+/* a contiguous piece of the image worth writing out */
+struct bin_segment {
+	int addr;				/* word address of first word */
+	int nwords;
+	const u16 *words;
+};
+
+/*
+ * an output format writes the word image from statements_get_binary().
+ * Single-file formats implement write() and are handed an open stream,
+ * formats producing several files implement write_files() and open their
+ * own based on the output path.
+ * Words are in host order; formats apply options.big_endian themselves.
+ * Return 0 on success, nonzero on failure (with errno set, if relevant).
+ */
+struct binformat {
+	const char *name;
+	const char *desc;
+	int (*write)(FILE *f, const u16 *image, int nwords);
+	int (*write_files)(const char *path, const u16 *image, int nwords);
+	int text;				/* output is text, not binary */
+};
+
+const struct binformat* binformat_find(const char *name);
+void binformat_print_list(FILE *f);
+int bin_segments(const u16 *image, int nwords, struct bin_segment **segs);
+
+/*
+ * --delta: changes from a previous flat image, as records like the rec
+ * format's after a header of DELTA_MAGIC and the new image length (high,
+ * low word). The magic shows the byte order. Records never cross the end
+ * of the new image; words past the end of the old one count as zero.
+ */
+#define DELTA_MAGIC			0xde17
+#define DELTA_MERGE_GAP		2	/* unchanged words worth a new record header */
+
+int bin_read(const char *path, u16 **image);
+int delta_write(FILE *f, const u16 *old, int oldwords, const u16 *image,
+				int nwords);
+
+#endif
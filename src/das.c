@@ -10,24 +10,35 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "binformat.h"
 #include "das.h"
 #include "dasdefs.h"
+#include "disasm.h"
+#include "expression.h"
+#include "instruction.h"
 #include "output.h"
+#include "parse.h"
+#include "profile.h"
 #include "statement.h"
 #include "symbol.h"
+#include "watch.h"
 
-int yyparse(void);
 extern FILE *yyin;
 
 #define HACK_ANALYSE_MAX		500
-static int hack_loop_breaker = 0;
+#define OPTIMAL_ROUNDS_MAX		20
 
 int das_error = 0;
 int stdout_inuse = 0;
 char *binpath;
 char *asmpath;
 char *dumppath;
+char *mappath;
+char *deltapath;
+char *profilepath;
 char *dasname;
+const struct binformat *binformat;
+int optimal_saved;				/* words, by --optimal-literals */
 
 struct options options = {
 	.asm_print_pc = 1,
@@ -45,17 +56,31 @@ void print_usage(void)
 {
 	fprintf(stderr, VERSTRING "\n");
 	fprintf(stderr, "Latest and docs at: https://github.com/jonpovey/das\n\n");
-	fprintf(stderr, "Usage: %s [OPTIONS] asmfile\n\n", dasname);
+	fprintf(stderr, "Usage: %s [OPTIONS] asmfile\n", dasname);
+	fprintf(stderr, "       %s --disassemble [OPTIONS] binfile\n\n", dasname);
 	fprintf(stderr, "OPTIONS:\n");
 	fprintf(stderr, "  -o outfile         Write binary to outfile, default das-out.bin\n");
 	fprintf(stderr, "  -v, --verbose      Be more chatty (normally silent on success)\n");
 	fprintf(stderr, "  -d, --dump         Dump human-readable listing to stdout\n");
 	fprintf(stderr, "  --dumpfile file    Dump to file instead\n");
 	fprintf(stderr, "  --no-dump-pc       Omit PC column from dump; makes dump a valid source file\n");
-	fprintf(stderr, "  --no-dump-header   Omit header comments from dump\n");
+	fprintf(stderr, "  --no-dump-header   Omit header comments from dump and map\n");
+	fprintf(stderr, "  --map file         Write symbol and address-to-line map to file\n");
 	fprintf(stderr, "  --sp-style         Dump [SP] style for stack access. Default PUSH/POP style\n");
+	fprintf(stderr, "  --profile file     Add run counts and cycles from file to the dump, see docs\n");
+	fprintf(stderr, "  --dump-source      Dump statements as written, where the style allows\n");
 	fprintf(stderr, "  --no-warn-ignored  Hush warnings about ignored directives (clang bodge)\n");
 	fprintf(stderr, "  --le               Generate little-endian binary (default big-endian)\n");
+	fprintf(stderr, "  --format fmt       Binary output format, one of:\n");
+	binformat_print_list(stderr);
+	fprintf(stderr, "  --delta old.bin    Write binary as changes from flat image old.bin\n");
+	fprintf(stderr, "  -j, --jobs n       Use n threads (default: one per CPU, for big files)\n");
+	fprintf(stderr, "  --optimal-literals Smallest short/next-word literal sizes, not just safe ones\n");
+	fprintf(stderr, "  --string-pool      Store each labelled string once, sharing common tails\n");
+	fprintf(stderr, "  --watch            Assemble again whenever asmfile is saved, parsing only\n");
+	fprintf(stderr, "                     the lines that changed\n");
+	fprintf(stderr, "  --disassemble      List flat image binfile like a dump; --map file names\n");
+	fprintf(stderr, "                     labels, from a map of the program; --le if little-endian\n");
 	fprintf(stderr, "\nThe character '-' for files means read/write to stdin/stdout instead.\n");
 }
 
@@ -70,7 +95,7 @@ void handle_args(int argc, char **argv)
 
 	for (;;) {
 		int option_index = 0;
-		static const char *short_options = "o:vhd";
+		static const char *short_options = "o:vhdj:";
 		static const struct option long_options[] = {
 			{"dumpfile",	required_argument,	0, 0},
 			{"le",			no_argument,		0, 0},
@@ -80,6 +105,16 @@ void handle_args(int argc, char **argv)
 			{"sp-style",	no_argument,		0, 0},
 			{"no-dump-header", no_argument,		0, 0},
 			{"no-warn-ignored", no_argument,	0, 0},
+			{"format",		required_argument,	0, 0},
+			{"map",			required_argument,	0, 0},
+			{"jobs",		required_argument,	0, 'j'},
+			{"optimal-literals", no_argument,	0, 0},
+			{"string-pool",	no_argument,		0, 0},
+			{"dump-source",	no_argument,		0, 0},
+			{"watch",		no_argument,		0, 0},
+			{"delta",		required_argument,	0, 0},
+			{"disassemble",	no_argument,		0, 0},
+			{"profile",		required_argument,	0, 0},
 			{},
 		};
 
@@ -116,6 +151,40 @@ void handle_args(int argc, char **argv)
 				/* FIXME generic error/warn/silent switching system */
 				outopts.no_warn_ignored = 1;
 				break;
+			case 8:
+				binformat = binformat_find(optarg);
+				if (!binformat) {
+					error("Unknown binary format '%s'", optarg);
+					suggest_help();
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 9:
+				mappath = optarg;
+				if (!strcmp("-", mappath))
+					stdout_inuse++;
+				break;
+			case 11:
+				options.optimal_literals = 1;
+				break;
+			case 12:
+				options.string_pool = 1;
+				break;
+			case 13:
+				options.dump_source = 1;
+				break;
+			case 14:
+				options.watch = 1;
+				break;
+			case 15:
+				deltapath = optarg;
+				break;
+			case 16:
+				options.disassemble = 1;
+				break;
+			case 17:
+				profilepath = optarg;
+				break;
 			default:
 				BUG();
 			}
@@ -132,6 +201,14 @@ void handle_args(int argc, char **argv)
 			options.verbose = 1;
 			stdout_inuse++;
 			break;
+		case 'j':
+			options.jobs = atoi(optarg);
+			if (options.jobs < 1) {
+				error("Bad job count '%s'", optarg);
+				suggest_help();
+				exit(EXIT_FAILURE);
+			}
+			break;
 		case 'h':
 			print_usage();
 			exit(EXIT_SUCCESS);
@@ -142,11 +219,21 @@ void handle_args(int argc, char **argv)
 		}
 	}
 
+	/* the listing is the disassembler's only output */
+	if (options.disassemble)
+		dump = 1;
+
 	if (dump && (!dumppath || !strcmp("-", dumppath))) {
 		stdout_inuse++;
 		dumppath = "-";		/* for later test, if using -d */
 	}
 
+	if (profilepath && (!dump || options.disassemble)) {
+		error("--profile annotates the dump, use it with -d or --dumpfile");
+		suggest_help();
+		exit(EXIT_FAILURE);
+	}
+
 	if (stdout_inuse > 1) {
 		if (options.verbose)
 			error("Can't mix verbose mode and file output to STDOUT");
@@ -170,52 +257,129 @@ void handle_args(int argc, char **argv)
 		DBG("Input file: %s\n", asmpath);
 	}
 
+	if (options.watch && !strcmp("-", asmpath)) {
+		error("Can't watch stdin for changes");
+		suggest_help();
+		exit(EXIT_FAILURE);
+	}
+
 	if (!binpath) {
 		/* guess binpath based on input filename */
 		DBG("Guessing binpath\n");
 		binpath = "das-out.bin";
 	}
 
+	if (deltapath && binformat) {
+		error("--delta output has its own format, can't use --format");
+		suggest_help();
+		exit(EXIT_FAILURE);
+	}
+	if (!binformat)
+		binformat = binformat_find("bin");
 }
 
-void reverse_words(u16 *bin, int nwords)
+/* analysis passes until symbol values settle. Return nonzero on error */
+static int analyse(void)
 {
-	while (nwords--) {
-		/* mingw32 doesn't seem to have htons() so do it myself */
-		*bin = *bin >> 8 | *bin << 8;
-		bin++;
+	int ret, settled, passes = 0;
+
+	do {
+		ret = statements_analyse();
+		if (ret >= 0) {
+			info("Analysis pass: %d labels changed\n", ret);
+			passes++;
+		}
+		/* or stop early if another pass would change nothing */
+		settled = statements_settled() && symbols_equ_settled();
+	} while (ret > 0 && !settled && passes < HACK_ANALYSE_MAX);
+	if (passes == HACK_ANALYSE_MAX && ret > 0 && !settled) {
+		fprintf(stderr, "Analysis still running after %d passes, "
+				"giving up\n", passes);
+		return 1;
+	}
+	if (ret < 0) {
+		fprintf(stderr, "Analysis error.\n");
+		return 1;
 	}
+	return 0;
 }
 
-int main(int argc, char **argv)
+/* from the current literal sizes, grow any that don't fit until none */
+static int analyse_grow(void)
 {
-	int ret;
-	int exitval = 0;
-	u16 *binary = NULL;
-	FILE *binfile, *asmfile, *dumpfile = 0;
-
-	dasname = argv[0];
+	do {
+		statements_resize();
+		if (analyse())
+			return 1;
+	} while (literals_grow());
+	return 0;
+}
 
-	handle_args(argc, argv);
+/*
+ * --optimal-literals. Relaxation never lets a literal shrink, so one that
+ * didn't fit on some pass (often a forward reference, 0 on the first) stays
+ * long even if it would fit in the end. Start again with every symbolic
+ * literal short and grow only those that don't fit once values settle,
+ * then try shrinking any grown literal that would fit now, while that makes
+ * the output smaller: a literal can flip back and forth, so stop when it
+ * doesn't. Keep whichever of that and plain relaxation is smallest.
+ */
+static int analyse_optimal(void)
+{
+	int *relaxed, *best;
+	int relaxed_words, best_words, words, round;
+	int ret = 1;
+
+	relaxed_words = statements_size();
+	relaxed = literals_save();
+
+	literals_all_short();
+	if (analyse_grow())
+		goto out_relaxed;
+	best_words = statements_size();
+	best = literals_save();
+
+	for (round = 0; round < OPTIMAL_ROUNDS_MAX && literals_shrink(); round++) {
+		if (analyse_grow())
+			goto out;
+		words = statements_size();
+		if (words >= best_words)
+			break;
+		free(best);
+		best = literals_save();
+		best_words = words;
+	}
 
-	if (!strcmp("-", asmpath)) {
-		asmfile = stdin;
-		info("Input: stdin\n");
+	if (best_words < relaxed_words) {
+		literals_restore(best);
 	} else {
-		asmfile = fopen(asmpath, "r");
-		info("Input file: %s\n", asmpath);
-	}
-	if (!asmfile) {
-		error("Opening %s failed: %s", asmpath, strerror(errno));
-		exit(EXIT_FAILURE);
+		literals_restore(relaxed);
+		best_words = relaxed_words;
 	}
+	statements_resize();
+	ret = analyse();
+	optimal_saved = relaxed_words - best_words;
+	info("Optimal literals: %d words, %d saved\n", best_words, optimal_saved);
+out:
+	free(best);
+out_relaxed:
+	free(relaxed);
+	literals_free();
+	return ret;
+}
 
-	yyin = asmfile;
-	yyparse();
-	if (das_error) {
-		fprintf(stderr, "Parse error\n");
-		return 1;
-	}
+/*
+ * assemble the statements parsed from asmpath and write the outputs.
+ * Return exit status
+ */
+static int assemble_parsed(void)
+{
+	int ret;
+	int exitval = 0;
+	u16 *binary = NULL, *old = NULL;
+	int oldwords = 0;
+	int from_file = strcmp("-", asmpath);
+	FILE *binfile, *dumpfile = 0;
 
 	/* Do validation pass before analysis. */
 	if (statements_validate()) {
@@ -223,23 +387,22 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	/* Resolve instruction lengths and symbol values, eventually */
-	do {
-		ret = statements_analyse();
-		if (ret >= 0) {
-			info("Analysis pass: %d labels changed\n", ret);
-			hack_loop_breaker++;
-		}
-	} while (ret > 0 && hack_loop_breaker < HACK_ANALYSE_MAX);
-	if (hack_loop_breaker == HACK_ANALYSE_MAX && ret != 0) {
-		fprintf(stderr, "Analysis still running after %d passes: "
-				"Circular .equ reference?\n", hack_loop_breaker);
+	if (options.string_pool)
+		statements_pool_strings();
+
+	/* Catch circular .equ definitions now rather than by endless analysis */
+	if (symbols_check_equ_cycles()) {
+		fprintf(stderr, "Validation error\n");
 		return 1;
 	}
-	if (ret < 0) {
-		fprintf(stderr, "Analysis error.\n");
+
+	/* Resolve instruction lengths and symbol values, eventually */
+	if (analyse())
 		return 1;
-	}
+	if (options.optimal_literals && analyse_optimal())
+		return 1;
+	expr_stats();
+	expr_memo_end();
 
 	/* Finalise values, any last warnings/errors, compute machine code */
 	if (statements_freeze()) {
@@ -247,12 +410,15 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	if (profilepath && profile_read(profilepath))
+		return 1;
+
 	if (dumppath) {
 		if (!strcmp("-", dumppath)) {
 			dumpfile = stdout;
 			/* info pointless - verbose mode incompatible with stdout dump */
 		} else {
-			dumpfile = fopen(dumppath, "w");
+			dumpfile = watch_fopen(dumppath, "w");
 			info("Dumping to %s\n", dumppath);
 		}
 		if (!dumpfile) {
@@ -262,10 +428,19 @@ int main(int argc, char **argv)
 
 		if (!outopts.omit_dump_header) {
 			fprintf(dumpfile, "; Dump from " VERSTRING "\n");
-			if (asmfile != stdin) {
+			if (from_file) {
 				fprintf(dumpfile, "; Source file: %s\n", asmpath);
 			}
 		}
+		if (options.optimal_literals && !outopts.omit_dump_header) {
+			fprintf(dumpfile, "; Optimal literals: %d words saved\n",
+					optimal_saved);
+		}
+		if (profilepath && !outopts.omit_dump_header) {
+			fprintf(dumpfile, "; Profile: %s. After the code: times run, "
+					"cycles, and for labels %% of all cycles up to the next\n",
+					profilepath);
+		}
 		ret = statements_fprint_asm(dumpfile);
 		if (ret < 0) {
 			fprintf(stderr, "Dump error.\n");
@@ -273,19 +448,65 @@ int main(int argc, char **argv)
 		} else {
 			info("Dumped: %d lines\n", ret);
 		}
+		if (dumpfile != stdout && watch_fclose(dumpfile)) {
+			error("Dump to %s failed: %s", dumppath, strerror(errno));
+			return 1;
+		}
 	}
 
-	/* completely obsolete? */
-//	dump_symbols();
+	if (mappath) {
+		FILE *mapfile;
+
+		if (!strcmp("-", mappath)) {
+			mapfile = stdout;
+		} else {
+			mapfile = watch_fopen(mappath, "w");
+			info("Writing map to %s\n", mappath);
+		}
+		if (!mapfile) {
+			error("Map to %s failed: %s\n", mappath, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+		if (!outopts.omit_dump_header) {
+			fprintf(mapfile, "; Map from " VERSTRING "\n");
+			if (from_file) {
+				fprintf(mapfile, "; Source file: %s\n", asmpath);
+			}
+		}
+		fprintf(mapfile, "[symbols]\n");
+		symbols_fprint_map(mapfile);
+		fprintf(mapfile, "[lines]\n");
+		if (statements_fprint_lines(mapfile) < 0) {
+			fprintf(stderr, "Map error.\n");
+			return 1;
+		}
+		if (mapfile != stdout && watch_fclose(mapfile)) {
+			error("Map to %s failed: %s", mappath, strerror(errno));
+			return 1;
+		}
+	}
 
 	ret = statements_get_binary(&binary);
 	if (ret < 0) {
 		fprintf(stderr, "Binary generation error.\n");
 		return 1;
 	}
-	/* returned value is word count. reverse words for big-endian storage */
-	if (options.big_endian) {
-		reverse_words(binary, ret);
+	/* returned value is word count, hand image to the output format */
+	if (binformat->write_files) {
+		if (binformat->write_files(binpath, binary, ret)) {
+			fprintf(stderr, "Binary write error\n");
+			exitval = 1;
+		}
+		goto out;
+	}
+	/* before opening the output, which may be the same file */
+	if (deltapath) {
+		oldwords = bin_read(deltapath, &old);
+		if (oldwords < 0) {
+			exitval = 1;
+			goto out;
+		}
 	}
 
 	/* open binary file now we're sure we want to write to it */
@@ -293,21 +514,97 @@ int main(int argc, char **argv)
 		binfile = stdout;
 		/* info pointless - verbose mode incompatible */
 	} else {
-		binfile = fopen(binpath, "wb");
-		info("Write binary to %s\n", binpath);
+		binfile = watch_fopen(binpath, binformat->text ? "w" : "wb");
+		info("Write %s binary to %s\n",
+			deltapath ? "delta" : binformat->name, binpath);
 	}
 	if (!binfile) {
 		error("Writing %s failed: %s\n", binpath, strerror(errno));
 		exit(EXIT_FAILURE);
 	}
 
-	if (ret != fwrite(binary, sizeof(u16), ret, binfile)) {
+	if (deltapath)
+		ret = delta_write(binfile, old, oldwords, binary, ret);
+	else
+		ret = binformat->write(binfile, binary, ret);
+	if (ret) {
 		fprintf(stderr, "Binary write error: %s\n", strerror(errno));
 		exitval = 1;
 	}
-	fclose(binfile);
+	if (binfile != stdout && watch_fclose(binfile)) {
+		error("Writing %s failed: %s", binpath, strerror(errno));
+		exitval = 1;
+	}
+out:
 	free(binary);
+	free(old);
+	profile_free();
+	return exitval;
+}
+
+/* assemble asmpath and write the outputs. Return exit status */
+static int assemble(void)
+{
+	FILE *asmfile;
+	int ret;
+
+	if (!strcmp("-", asmpath)) {
+		asmfile = stdin;
+		info("Input: stdin\n");
+	} else {
+		asmfile = fopen(asmpath, "r");
+		info("Input file: %s\n", asmpath);
+	}
+	if (!asmfile) {
+		error("Opening %s failed: %s", asmpath, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	yyin = asmfile;
+	parse_source();
+	if (das_error) {
+		fprintf(stderr, "Parse error\n");
+		return 1;
+	}
+	ret = assemble_parsed();
 	statements_free();
 	symbols_free();
-	return exitval;
+	return ret;
+}
+
+/* list the image at asmpath. Return exit status */
+static int disassemble_image(void)
+{
+	FILE *dumpfile;
+	int ret;
+
+	if (!strcmp("-", dumppath)) {
+		dumpfile = stdout;
+	} else {
+		dumpfile = fopen(dumppath, "w");
+		info("Dumping to %s\n", dumppath);
+	}
+	if (!dumpfile) {
+		error("Dump to %s failed: %s", dumppath, strerror(errno));
+		return 1;
+	}
+	ret = disassemble(dumpfile, asmpath, mappath);
+	if (dumpfile != stdout && fclose(dumpfile)) {
+		error("Dump to %s failed: %s", dumppath, strerror(errno));
+		ret = 1;
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	dasname = argv[0];
+
+	handle_args(argc, argv);
+
+	if (options.disassemble)
+		return disassemble_image();
+	if (options.watch)
+		return watch_source(asmpath, assemble_parsed);
+	return assemble();
 }
@@ -17,6 +17,12 @@ extern struct options {
 	int notch_style;
 	int verbose;
 	int big_endian;
+	int jobs;				/* worker threads, 0 = automatic */
+	int optimal_literals;	/* size literals for the smallest output */
+	int string_pool;		/* store labelled strings once */
+	int dump_source;		/* list statements from their source text */
+	int watch;				/* reassemble on every change to the source */
+	int disassemble;		/* list a binary image instead of assembling */
 } options;
 
 #endif // DAS_H
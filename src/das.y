@@ -20,7 +20,9 @@
 	} \
 } while (0)
 
-int yylex();
+/* tokens come via the hand-written parser, see parse_lex() */
+#include "parse.h"
+#define yylex parse_lex
 
 void parse_error(char *str);
 %}
@@ -53,6 +55,7 @@ void parse_error(char *str);
 %token <integer> OPERATOR
 %token <integer> LSHIFT RSHIFT
 %token <integer> EQU
+%token <integer> PACKDIR
 
 %type <symbol> symbol
 %type <expr> expr
@@ -70,7 +73,7 @@ void parse_error(char *str);
 %%
 
 program:
-	program line '\n'			{ /*printf("line\n");*/ }
+	program line '\n'
 	| program '\n'				/* empty line or comment */
 	| program error '\n'		{ yyerrok; }
 	|
@@ -83,7 +86,11 @@ line:
 	;							
 
 label:
-	LABEL						{ label_parse(@$, $1); }
+	LABEL						{
+								/* NULL if parse_source() already did it */
+								if ($1)
+									label_parse(@$, $1);
+								}
 	;
 
 statement:
@@ -96,11 +103,11 @@ instr:
 	OP2 operand ',' operand		{
 								operand_set_position($2, OP_POS_B);
 								operand_set_position($4, OP_POS_A);
-								gen_instruction($1, $2, $4);
+								gen_instruction(@$, $1, $2, $4);
 								}
 	| OP1 operand				{
 								operand_set_position($2, OP_POS_A);
-								gen_instruction($1, NULL, $2);
+								gen_instruction(@$, $1, NULL, $2);
 								}
 	/*| error						{ parse_error("bad instruction"); }*/
 	;
@@ -141,7 +148,8 @@ symbol:
 	;
 
 dat:
-	DAT datlist					{ gen_dat($2); }
+	DAT datlist					{ gen_dat(@$, $2); }
+	| PACKDIR datlist			{ gen_dat(@$, dat_elems_pack($2, $1)); }
 	;
 
 datlist:
@@ -7,6 +7,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
 
 #include "dasdefs.h"
 #include "output.h"
@@ -15,8 +18,10 @@
  * macro magic. use GCC designated initialisers to build a sparse array
  * of strings indexed by opcode. special opcodes are offset by 0x20
  */
-#define OP(val, op, count, wb) [val] = { .name = #op, .warn_b = wb }
-#define SOP(val, op, count) [val | SPECIAL_OPCODE] = { .name = #op }
+#define OP(val, op, count, wb) \
+	[val] = { .name = #op, .cycles = count, .warn_b = wb }
+#define SOP(val, op, count) \
+	[val | SPECIAL_OPCODE] = { .name = #op, .cycles = count }
 static struct opcode opcodes[64] = { OPCODES SPECIAL_OPCODES };
 #undef OP
 #undef SOP
@@ -31,6 +36,8 @@ static struct opcode opcodes[64] = { OPCODES SPECIAL_OPCODES };
 static struct reg registers[] = { REGISTERS };
 #undef REGISTER
 
+struct decode decode_table[1 << 16];
+
 int valid_reg(int reg)
 {
 	/* reg 0 is not valid, it means "no register" */
@@ -86,6 +93,36 @@ int opcode_warn_b_literal(int opcode)
 	return opcodes[opcode].warn_b;
 }
 
+int opcode_cycles(int opcode)
+{
+	if (BUG_ON(!valid_opcode(opcode)))
+		return 0;
+	return opcodes[opcode].cycles;
+}
+
+void decode_init(void)
+{
+	struct decode *d;
+	int w, o, next;
+
+	if (decode_table[0].len)
+		return;
+	for (w = 0; w < ARRAY_SIZE(decode_table); w++) {
+		d = &decode_table[w];
+		o = FIELD_O(w);
+		d->op = o ? o : FIELD_B(w) | SPECIAL_OPCODE;
+		next = operand_nextword(FIELD_A(w));
+		if (o)
+			next += operand_nextword(FIELD_B(w));
+		d->len = 1 + next;
+		if (!valid_opcode(d->op)) {
+			d->op = 0;
+			continue;
+		}
+		d->cycles = opcodes[d->op].cycles + next;
+	}
+}
+
 int str2reg(char *str)
 {
 	int i;
@@ -129,6 +166,27 @@ int is_gpreg(int reg)
 
 int isoctal(int c) { return c >= '0' && c <= '7'; }
 
+/* bytes from p before the next backslash, or end */
+static int plain_run(const char *p, const char *end)
+{
+	const char *start = p;
+#ifdef __SSE2__
+	const __m128i bs = _mm_set1_epi8('\\');
+
+	while (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, bs));
+
+		if (mask)
+			return p - start + __builtin_ctz(mask);
+		p += 16;
+	}
+#endif
+	while (p < end && *p != '\\')
+		p++;
+	return p - start;
+}
+
 /*
  * unescape C string into provided buffer, which must be large enough.
  * result will be max strlen(src) + 1 characters
@@ -136,23 +194,27 @@ int isoctal(int c) { return c >= '0' && c <= '7'; }
  */
 int unescape_c_string(const char *src, unsigned char *dest)
 {
-	int n = 0;
+	const char *end = src + strlen(src);
+	int n = 0, run;
 	unsigned char c;
 	char tmphex[3];
 
-	while (*src) {
+	while (src < end) {
+		/* copy up to the next escape in one go */
+		run = plain_run(src, end);
+		memcpy(dest, src, run);
+		dest += run;
+		src += run;
+		n += run;
+		if (src == end)
+			break;
 		c = 0;
-		if (*src != '\\') {
-			*dest++ = *src++;
-			n++;
-			continue;
-		}
 
 		/* escape sequence? */
 		src++;
 		if (!*src) {
 			/* end of string was a backslash by itself. How? */
-			fprintf(stderr, "string ends in backslash?\n");
+			_warn("string ends in backslash?");
 			*dest++ = '\\';
 			n++;
 			break;
@@ -203,16 +265,57 @@ int unescape_c_string(const char *src, unsigned char *dest)
 	return n;
 }
 
+/* bytes from in that print as themselves, up to bytes of them */
+static int printable_run(const unsigned char *in, int bytes)
+{
+	int i = 0;
+#ifdef __SSE2__
+	const __m128i space = _mm_set1_epi8(0x1f);
+	const __m128i del = _mm_set1_epi8(0x7f);
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i bs = _mm_set1_epi8('\\');
+
+	for (; bytes - i >= 16; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+		/* signed: 0x80 and up are below space too */
+		__m128i ok = _mm_cmpgt_epi8(v, space);
+		__m128i bad = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, del),
+									_mm_cmpeq_epi8(v, quote)),
+									_mm_cmpeq_epi8(v, bs));
+		unsigned mask = ~_mm_movemask_epi8(_mm_andnot_si128(bad, ok)) & 0xffff;
+
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+	for (; i < bytes; i++) {
+		if (in[i] < 0x20 || in[i] > 0x7e || in[i] == '"' || in[i] == '\\')
+			break;
+	}
+	return i;
+}
+
 /* re-escape the string for printing */
 int sprint_cstring(char *buf, const unsigned char *in, int bytes)
 {
 	char *start = buf;
 	char hexdigit[] = "0123456789abcdef";
 	char c;
+	int run;
 
-	while (bytes--) {
+	while (bytes) {
 		int esc = 1;
-		
+
+		/* copy up to the next byte that needs escaping in one go */
+		run = printable_run(in, bytes);
+		memcpy(buf, in, run);
+		buf += run;
+		in += run;
+		bytes -= run;
+		if (!bytes)
+			break;
+		bytes--;
+
 		switch (*in) {
 		case '\"':
 		case '\\':
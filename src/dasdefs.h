@@ -10,6 +10,7 @@ typedef   signed short s16;
 
 struct opcode {
 	char *name;
+	int cycles;		/* to execute, before next words or IF skipping */
 	int warn_b;		/* warn if b is literal (discarded write) */
 };
 
@@ -24,13 +25,14 @@ char* opcode2str(int op);
 u16 opcode2bits(int opcode);
 int is_special(int opcode);
 int opcode_warn_b_literal(int opcode);
+int opcode_cycles(int opcode);
 
 int str2reg(char *str);
 char* reg2str(int reg);
 u16 reg2bits(int reg);
 int is_gpreg(int reg);
 
-void yyerror(char *s, ...);
+void yyerror(const char *s, ...);
 
 int unescape_c_string(const char *src, unsigned char *dest);
 int sprint_cstring(char *buf, const unsigned char *str, int bytes);
@@ -112,4 +114,33 @@ int sprint_cstring(char *buf, const unsigned char *str, int bytes);
 enum regs { REGISTERS };
 #undef REGISTER
 
+/* fields of an instruction word: aaaaaabbbbbooooo */
+#define FIELD_A(word)		((word) >> 10)
+#define FIELD_B(word)		((word) >> 5 & 0x1f)
+#define FIELD_O(word)		((word) & 0x1f)
+
+/*
+ * whether an operand field value takes a next word: [reg + next word],
+ * PICK, [next word] and next word literal
+ */
+static inline int operand_nextword(int field)
+{
+	return (field >= 0x10 && field < 0x18) || field == 0x1a ||
+		field == 0x1e || field == 0x1f;
+}
+
+/*
+ * one entry per possible first word of an instruction, for the disassembler
+ * and the emulator, built from OPCODES so they agree with the assembler
+ */
+struct decode {
+	unsigned char op;		/* as opcode2str() takes, 0 if not an instruction */
+	unsigned char len;		/* words, with next words */
+	unsigned char cycles;	/* to execute, with next words, before IF skips */
+};
+
+extern struct decode decode_table[1 << 16];
+/* fill it in; only the first call does anything */
+void decode_init(void);
+
 #endif
@@ -4,6 +4,7 @@
 
 #include "das.h"
 #include "dasdefs.h"
+#include "dat.h"
 #include "expression.h"
 #include "output.h"
 #include "statement.h"
@@ -16,6 +17,8 @@ enum dat_types {
 struct dat_elem {
 	int type;
 	int nwords;
+	int len;					/* string: characters */
+	int pack;					/* string: enum dat_pack */
 	union {
 		struct expr *expr;
 		unsigned char *data;	/* string */
@@ -26,18 +29,82 @@ struct dat_elem {
 struct dat {
 	/* maybe useful to store flags, precomputed binary and size here */
 	struct dat_elem *first;
+	LOCTYPE loc;
+	int pack;					/* how its strings are stored */
 };
 
-static struct statement_ops dat_statement_ops;
+/* all DATs in the order parsed, their statements index into this */
+static struct {
+	struct dat *v;
+	int n, alloc;
+} dats;
+
+/* string directives, by enum dat_pack */
+static const char * const pack_names[] = {
+	[DAT_PACK_NONE]    = "DAT",
+	[DAT_PACK_HI]      = ".packed",
+	[DAT_PACK_LO]      = ".packed_le",
+	[DAT_PACK_PSTRING] = ".pstring",
+};
 
 /*
  * Parse
  */
-void gen_dat(struct dat_elem *elem)
+/* a new DAT at the end of dats, return its index */
+static int dat_new(struct dat_elem *first, LOCTYPE loc, int pack)
+{
+	struct dat *dat;
+
+	if (dats.n == dats.alloc) {
+		dats.alloc = dats.alloc ? dats.alloc * 2 : 256;
+		dats.v = realloc(dats.v, dats.alloc * sizeof *dats.v);
+	}
+	dat = &dats.v[dats.n];
+	dat->first = first;
+	dat->loc = loc;
+	dat->pack = pack;
+	return dats.n++;
+}
+
+void gen_dat(LOCTYPE loc, struct dat_elem *elem)
+{
+	struct dat_elem *e;
+
+	/* share expressions with other statements */
+	for (e = elem; e; e = e->next) {
+		if (e->type == DATTYPE_EXPR)
+			e->expr = expr_intern(e->expr);
+	}
+	add_statement(loc, STMT_DAT, dat_new(elem, loc, elem->pack));
+}
+
+static int string_words(int len, int pack)
+{
+	switch (pack) {
+	case DAT_PACK_HI:
+	case DAT_PACK_LO:
+		return (len + 1) / 2;
+	case DAT_PACK_PSTRING:
+		return 1 + (len + 1) / 2;
+	}
+	return len;
+}
+
+/*
+ * a string directive: store the strings in list two characters to a word,
+ * the first in the high or low byte, or as .packed after a length word.
+ * Other elements are a word each, as in DAT.
+ */
+struct dat_elem* dat_elems_pack(struct dat_elem *list, int pack)
 {
-	struct dat *dat = calloc(sizeof(*dat), 1);
-	dat->first = elem;
-	add_statement(dat, &dat_statement_ops);
+	struct dat_elem *e;
+
+	for (e = list; e; e = e->next) {
+		e->pack = pack;
+		if (e->type == DATTYPE_STRING)
+			e->nwords = string_words(e->len, pack);
+	}
+	return list;
 }
 
 struct dat_elem* dat_elem_follows(struct dat_elem *a, struct dat_elem *list)
@@ -66,7 +133,7 @@ struct dat_elem* new_string_dat_elem(char *str)
 	e->type = DATTYPE_STRING;
 	e->data = malloc(strlen(str));
 	/* e->data will be less one ", making space for NULL terminator */
-	e->nwords = unescape_c_string(str + 1, e->data);
+	e->len = e->nwords = unescape_c_string(str + 1, e->data);
 	DBG("'%s'\n", (char*)e->data);
 	/* e->next is null */
 	return e;
@@ -75,39 +142,57 @@ struct dat_elem* new_string_dat_elem(char *str)
 /*
  * Analyse
  */
-static int dat_validate(void *private)
+int dat_validate(int n)
 {
-	struct dat *dat = private;
+	struct dat *dat = &dats.v[n];
 	struct dat_elem *e = dat->first;
 
 	while (e) {
 		if (e->type == DATTYPE_EXPR)
-			expr_validate(e->expr);
+			expr_validate(dat->loc, e->expr);
 		e = e->next;
 	}
 	return das_error;
 }
 
-static int dat_freeze(void *private)
+int dat_freeze(int n)
 {
-	struct dat *dat = private;
+	struct dat *dat = &dats.v[n];
 	struct dat_elem *e = dat->first;
 
 	while (e) {
 		if (e->type == DATTYPE_EXPR)
-			expr_freeze(e->expr);
+			expr_freeze(dat->loc, e->expr);
 		e = e->next;
 	}
 	return das_error;
 }
 
+/* call fn for each symbol the elements use, in source order */
+void dat_for_each_symbol(int n, void (*fn)(struct symbol *sym, void *arg),
+						void *arg)
+{
+	struct dat_elem *e;
+
+	for (e = dats.v[n].first; e; e = e->next) {
+		if (e->type == DATTYPE_EXPR)
+			expr_for_each_symbol(e->expr, fn, arg);
+	}
+}
+
+/* --watch: lines were added or removed above the DAT */
+void dat_shift(int n, int lines)
+{
+	dats.v[n].loc.line += lines;
+}
+
 /*
  * Output
  */
-static int dat_binary_size(void *private)
+int dat_binary_size(int n)
 {
 	int words = 0;
-	struct dat *dat = private;
+	struct dat *dat = &dats.v[n];
 	struct dat_elem *e = dat->first;
 
 	while (e) {
@@ -117,19 +202,39 @@ static int dat_binary_size(void *private)
 	return words;
 }
 
-static int dat_get_binary(u16 *dest, void *private)
+/* a string's words, packed as it says */
+static void string_binary(u16 *dest, struct dat_elem *e)
+{
+	const unsigned char *p = e->data;
+	int i, hi, lo;
+
+	if (e->pack == DAT_PACK_NONE) {
+		for (i = 0; i < e->len; i++)
+			dest[i] = p[i];
+		return;
+	}
+	if (e->pack == DAT_PACK_PSTRING)
+		*dest++ = e->len;
+	for (i = 0; i < e->len; i += 2) {
+		hi = p[i];
+		lo = i + 1 < e->len ? p[i + 1] : 0;
+		if (e->pack == DAT_PACK_LO)
+			*dest++ = hi | lo << 8;
+		else
+			*dest++ = hi << 8 | lo;
+	}
+}
+
+int dat_get_binary(u16 *dest, int n)
 {
 	int words = 0;
-	struct dat *dat = private;
+	struct dat *dat = &dats.v[n];
 	struct dat_elem *e = dat->first;
-	int i;
 
 	while (e) {
 		if (e->type == DATTYPE_STRING) {
-			for (i = 0; i < e->nwords; i++) {
-				*(dest + words) = e->data[i];
-				words++;
-			}
+			string_binary(dest + words, e);
+			words += e->nwords;
 		} else {
 			*(dest + words) = (u16)expr_value(e->expr);
 			words++;
@@ -139,18 +244,87 @@ static int dat_get_binary(u16 *dest, void *private)
 	return words;
 }
 
-static int dat_print_asm(char *buf, void *private)
+/*
+ * String pooling
+ */
+int dat_pool_words(int d, u16 *words, char *cut)
+{
+	struct dat *dat = &dats.v[d];
+	struct dat_elem *e;
+	int n = 0, strings = 0, k;
+
+	for (e = dat->first; e; e = e->next) {
+		if (e->type == DATTYPE_STRING)
+			strings++;
+		else if (expr_maychange(e->expr))
+			return -1;
+	}
+	if (!strings)
+		return -1;
+
+	for (e = dat->first; e; e = e->next) {
+		cut[n] = 1;
+		if (e->type == DATTYPE_STRING) {
+			string_binary(words + n, e);
+			/* any character, or word of a packed string, but not a length */
+			for (k = 1; k < e->nwords; k++)
+				cut[n + k] = e->pack != DAT_PACK_PSTRING;
+		} else {
+			words[n] = (u16)expr_value(e->expr);
+		}
+		n += e->nwords;
+	}
+	cut[n] = 1;
+	return n;
+}
+
+/* the tail is a new DAT, return its index */
+int dat_split(int n, int k)
+{
+	struct dat *dat = &dats.v[n];
+	struct dat_elem *e = dat->first, *prev = NULL, *rest;
+	int off;
+
+	while (k >= e->nwords) {
+		k -= e->nwords;
+		prev = e;
+		e = e->next;
+	}
+	if (k) {
+		/* inside a string, take its tail characters */
+		BUG_ON(e->type != DATTYPE_STRING || e->pack == DAT_PACK_PSTRING);
+		off = e->pack == DAT_PACK_NONE ? k : k * 2;
+		rest = calloc(sizeof(*rest), 1);
+		rest->type = DATTYPE_STRING;
+		rest->pack = e->pack;
+		rest->len = e->len - off;
+		rest->nwords = string_words(rest->len, rest->pack);
+		rest->data = malloc(rest->len + 1);
+		memcpy(rest->data, e->data + off, rest->len);
+		rest->next = e->next;
+		e->len = off;
+		e->nwords = string_words(off, e->pack);
+		e->next = NULL;
+	} else {
+		rest = e;
+		prev->next = NULL;
+	}
+
+	return dat_new(rest, dat->loc, dat->pack);
+}
+
+int dat_print_asm(char *buf, int n)
 {
 	int count = 0;
-	struct dat *dat = private;
+	struct dat *dat = &dats.v[n];
 	struct dat_elem *e = dat->first;
 
-	count += sprintf(buf + count, "DAT ");
+	count += sprintf(buf + count, "%s ", pack_names[dat->pack]);
 	while (e) {
 		if (e->type == DATTYPE_STRING) {
 			/* fixme for strings, they contain escapes.. */
 			count += sprintf(buf + count, "\"");
-			count += sprint_cstring(buf + count, e->data, e->nwords);
+			count += sprint_cstring(buf + count, e->data, e->len);
 			count += sprintf(buf + count, "\"");
 		} else {
 			count += expr_print_asm(buf + count, e->expr);
@@ -165,12 +339,12 @@ static int dat_print_asm(char *buf, void *private)
 /*
  * Cleanup
  */
-void dat_free_private(void *private)
+/* free a DAT's elements, when string pooling drops it or --watch cuts it */
+void dat_free(int n)
 {
-	struct dat *dat = private;
 	struct dat_elem *e, *next;
 
-	e = dat->first;
+	e = dats.v[n].first;
 	while (e) {
 		next = e->next;
 		if (e->type == DATTYPE_STRING) {
@@ -181,16 +355,15 @@ void dat_free_private(void *private)
 		free(e);
 		e = next;
 	}
-	free(dat);
+	dats.v[n].first = NULL;
 }
 
-static struct statement_ops dat_statement_ops = {
-	.validate        = dat_validate,
-	.analyse         = NULL,
-	.freeze          = dat_freeze,
-	.get_binary_size = dat_binary_size,
-	.get_binary      = dat_get_binary,
-	.print_asm       = dat_print_asm,
-	.free_private    = dat_free_private,
-	.type            = STMT_DAT,
-};
+void dats_free(void)
+{
+	int n;
+
+	for (n = 0; n < dats.n; n++)
+		dat_free(n);
+	free(dats.v);
+	memset(&dats, 0, sizeof dats);
+}
@@ -1,13 +1,43 @@
 #ifndef DAT_H
 #define DAT_H
+#include "dasdefs.h"
 #include "expression.h"
 
 struct dat_elem;
 struct dat;
 
-void gen_dat(struct dat_elem *elem);
+/* how a DAT-like statement stores strings */
+enum dat_pack {
+	DAT_PACK_NONE,		/* DAT: a character per word */
+	DAT_PACK_HI,		/* .packed: two per word, first in the high byte */
+	DAT_PACK_LO,		/* .packed_le: two per word, first in the low byte */
+	DAT_PACK_PSTRING,	/* .pstring: length word, then as .packed */
+};
+
+void gen_dat(LOCTYPE loc, struct dat_elem *elem);
 struct dat_elem* dat_elem_follows(struct dat_elem *a, struct dat_elem *list);
 struct dat_elem* new_expr_dat_elem(struct expr *expr);
 struct dat_elem* new_string_dat_elem(char *str);
+struct dat_elem* dat_elems_pack(struct dat_elem *list, int pack);
+
+/*
+ * Statements: n is the DAT's index in parse order, see add_statement().
+ * pool_words: put the binary in words and set cut[k] where the DAT can be
+ * split before word k. Return the words, or -1 if it isn't constant
+ * strings. split: cut it before word k, return the tail's index.
+ * shift: --watch, move it down by lines.
+ */
+int dat_validate(int n);
+void dat_for_each_symbol(int n, void (*fn)(struct symbol *sym, void *arg),
+						void *arg);
+void dat_shift(int n, int lines);
+int dat_freeze(int n);
+int dat_binary_size(int n);
+int dat_pool_words(int n, u16 *words, char *cut);
+int dat_split(int n, int k);
+int dat_get_binary(u16 *dest, int n);
+int dat_print_asm(char *buf, int n);
+void dat_free(int n);
+void dats_free(void);
 
 #endif
@@ -0,0 +1,610 @@
+/*
+ * das hand-written scanner, a faster alternative to the flex one in das.l
+ * and the default ("make LEXER=flex" for that one). It must produce the same
+ * token stream (values, line numbers, diagnostics) as das.l, including
+ * flex's longest-match and first-rule-wins tie breaks, so keep the two in
+ * step when changing either.
+ *
+ * The whole input is read into memory. Characters are classified through
+ * a lookup table, keywords are found with a small hash, numbers are
+ * converted inline and runs of whitespace and comments are skipped 16
+ * bytes at a time with SSE2 where available.
+ *
+ * All scanning state is in struct scanner (scan.h), so the parallel parser
+ * can run several over different parts of the input at once. Diagnostics
+ * from a quiet scanner are only counted, the caller rescans to print them.
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+#include "dasdefs.h"
+#include "dat.h"
+#include "output.h"
+#include "scan.h"
+#include "y.tab.h"
+
+/* the same globals the flex scanner provides */
+FILE *yyin;
+int yylineno = 1;
+
+/* character classes */
+enum {
+	CC_WS     = 0x01,	/* [ \t\r], skipped */
+	CC_SYM0   = 0x02,	/* can start a symbol: [A-Za-z.$_] */
+	CC_SYM    = 0x04,	/* can continue a symbol: also [0-9] */
+	CC_DIGIT  = 0x08,
+	CC_HEX    = 0x10,
+	CC_SINGLE = 0x20,	/* single character token: [-,+*\/|&^()~\]] */
+};
+static unsigned char cclass[256];
+
+/* input must be padded so 16-byte loads past the end are safe */
+#define SCAN_PAD	16
+
+static struct {
+	char *buf;
+	const char *end;	/* end of real input */
+} input;
+
+/* input from before the last scanner_restart(), see there */
+static struct {
+	char **buf;
+	int n;
+} old_input;
+
+/* the instance behind yylex() */
+static struct scanner yy_scanner;
+
+/*
+ * keywords: opcodes, registers and a few directives, in the all-upper and
+ * all-lower spellings das.l accepts. Open-addressed hash keyed on the name
+ * packed into 64 bits, so lookup is a multiply and a compare or two.
+ */
+struct keyword {
+	const char *name;
+	int token;
+	int value;
+};
+
+#define OP(val, op, count, wb) { #op, OP2, val }
+#define SOP(val, op, count) { #op, OP1, (val) | SPECIAL_OPCODE }
+#define REGISTER(val, name, gp) { #name, REG, REG_##name }
+static const struct keyword keywords[] = {
+	OPCODES
+	SPECIAL_OPCODES
+	REGISTERS
+	{ "DAT",    DAT, 0 },
+	{ ".short", DAT, 0 },
+	{ ".set",   EQU, 0 },
+	{ ".equ",   EQU, 0 },
+};
+#undef OP
+#undef SOP
+#undef REGISTER
+
+#define KW_HASH_BITS	8
+#define KW_MAX_LEN		8
+
+static struct kw_slot {
+	uint64_t key;		/* 0 = empty */
+	int token;
+	int value;
+} kw_hash[1 << KW_HASH_BITS];
+
+/* string directives, exactly as written, as das.l's symbol_token() */
+static const struct keyword pack_directives[] = {
+	{ ".packed",    PACKDIR, DAT_PACK_HI },
+	{ ".packed_le", PACKDIR, DAT_PACK_LO },
+	{ ".pstring",   PACKDIR, DAT_PACK_PSTRING },
+};
+
+/* directives swallowed with a warning (clang output bodge) */
+static const char * const ignored_directives[] = {
+	".text", ".data", ".section", ".globl",
+};
+
+static uint64_t kw_key(const char *s, int len)
+{
+	uint64_t key = 0;
+
+	memcpy(&key, s, len);
+	return key;
+}
+
+static unsigned kw_slot_of(uint64_t key)
+{
+	return (key * 0x9e3779b97f4a7c15ull) >> (64 - KW_HASH_BITS);
+}
+
+static void kw_insert(const char *name, int token, int value)
+{
+	int len = strlen(name);
+	uint64_t key = kw_key(name, len);
+	unsigned i = kw_slot_of(key);
+
+	while (kw_hash[i].key && kw_hash[i].key != key)
+		i = (i + 1) & ((1 << KW_HASH_BITS) - 1);
+	kw_hash[i].key = key;
+	kw_hash[i].token = token;
+	kw_hash[i].value = value;
+}
+
+/* return keyword slot for s, or NULL if just a symbol */
+static const struct kw_slot* kw_lookup(const char *s, int len)
+{
+	uint64_t key;
+	unsigned i;
+
+	if (len > KW_MAX_LEN)
+		return NULL;
+	key = kw_key(s, len);
+	for (i = kw_slot_of(key); kw_hash[i].key; i = (i + 1) &
+			((1 << KW_HASH_BITS) - 1)) {
+		if (kw_hash[i].key == key)
+			return &kw_hash[i];
+	}
+	return NULL;
+}
+
+static void scan_init_tables(void)
+{
+	char lower[KW_MAX_LEN + 1];
+	int c, i, j;
+
+	for (c = 0; c < 256; c++) {
+		if (c == ' ' || c == '\t' || c == '\r')
+			cclass[c] |= CC_WS;
+		if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+			c == '.' || c == '$' || c == '_')
+			cclass[c] |= CC_SYM0 | CC_SYM;
+		if (c >= '0' && c <= '9')
+			cclass[c] |= CC_DIGIT | CC_HEX | CC_SYM;
+		if ((c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f'))
+			cclass[c] |= CC_HEX;
+		if (c && strchr("-,+*/|&^()~]", c))
+			cclass[c] |= CC_SINGLE;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(keywords); i++) {
+		if (keywords[i].token == REG && keywords[i].value == REG_NONE)
+			continue;
+		kw_insert(keywords[i].name, keywords[i].token, keywords[i].value);
+		for (j = 0; keywords[i].name[j]; j++) {
+			c = keywords[i].name[j];
+			lower[j] = c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+		}
+		lower[j] = 0;
+		kw_insert(lower, keywords[i].token, keywords[i].value);
+	}
+}
+
+/*
+ * all of yyin, slurped and padded with zeros on first use. Returns the
+ * start, sets *end to the end of real input.
+ */
+const char* scanner_input(const char **end)
+{
+	size_t size = 0, alloced = 65536, n;
+	FILE *f = yyin ? yyin : stdin;
+
+	if (!input.buf) {
+		input.buf = malloc(alloced + SCAN_PAD);
+		while ((n = fread(input.buf + size, 1, alloced - size, f)) > 0) {
+			size += n;
+			if (size == alloced) {
+				alloced *= 2;
+				input.buf = realloc(input.buf, alloced + SCAN_PAD);
+			}
+		}
+		memset(input.buf + size, 0, SCAN_PAD);
+		input.end = input.buf + size;
+		scan_init_tables();
+	}
+	*end = input.end;
+	return input.buf;
+}
+
+/*
+ * read yyin afresh on next use, from yylineno (--watch). Input read before
+ * is kept, statements made from it may point into it (--dump-source),
+ * unless free_old says they are gone.
+ */
+void scanner_restart(int free_old)
+{
+	int i;
+
+	if (input.buf) {
+		old_input.buf = realloc(old_input.buf,
+							(old_input.n + 1) * sizeof *old_input.buf);
+		old_input.buf[old_input.n++] = input.buf;
+	}
+	memset(&input, 0, sizeof input);
+	scanner_free(&yy_scanner);
+	memset(&yy_scanner, 0, sizeof yy_scanner);
+	if (!free_old)
+		return;
+	for (i = 0; i < old_input.n; i++)
+		free(old_input.buf[i]);
+	free(old_input.buf);
+	memset(&old_input, 0, sizeof old_input);
+}
+
+/* scan from p, which must be in scanner_input() at the start of a line */
+void scanner_init(struct scanner *sc, const char *p, int lineno)
+{
+	memset(sc, 0, sizeof *sc);
+	scanner_input(&sc->end);
+	sc->p = p;
+	sc->lineno = lineno;
+}
+
+void scanner_free(struct scanner *sc)
+{
+	free(sc->tokbuf[0].text);
+	free(sc->tokbuf[1].text);
+}
+
+/* skip [ \t\r]* */
+static const char* skip_ws(const char *p)
+{
+#ifdef __SSE2__
+	__m128i sp, tab, cr;
+
+	/*
+	 * most runs are short, don't bother with vectors for those, nor
+	 * setting them up: unoptimised, that costs more than the check
+	 */
+	if (!(cclass[(unsigned char)p[0]] & CC_WS))
+		return p;
+	if (!(cclass[(unsigned char)p[1]] & CC_WS))
+		return p + 1;
+
+	sp = _mm_set1_epi8(' ');
+	tab = _mm_set1_epi8('\t');
+	cr = _mm_set1_epi8('\r');
+	for (;;) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		__m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp),
+									_mm_cmpeq_epi8(v, tab)),
+									_mm_cmpeq_epi8(v, cr));
+		unsigned mask = ~_mm_movemask_epi8(ws) & 0xffff;
+
+		if (mask)
+			return p + __builtin_ctz(mask);
+		p += 16;
+	}
+#else
+	while (cclass[(unsigned char)*p] & CC_WS)
+		p++;
+	return p;
+#endif
+}
+
+/* skip a comment up to (not including) the newline or end of input */
+static const char* skip_comment(const char *p, const char *end)
+{
+#ifdef __SSE2__
+	const __m128i nl = _mm_set1_epi8('\n');
+
+	while (p < end) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+
+		if (mask) {
+			p += __builtin_ctz(mask);
+			break;
+		}
+		p += 16;
+	}
+	return p < end ? p : end;
+#else
+	while (p < end && *p != '\n')
+		p++;
+	return p;
+#endif
+}
+
+/* copy token text for the parser; it stays valid until the next-but-one */
+static char* token_text(struct scanner *sc, const char *p, int len)
+{
+	int cur = sc->tokbuf_cur ^= 1;
+
+	if (sc->tokbuf[cur].size < len + 1) {
+		sc->tokbuf[cur].size = len + 64;
+		sc->tokbuf[cur].text = realloc(sc->tokbuf[cur].text,
+										sc->tokbuf[cur].size);
+	}
+	memcpy(sc->tokbuf[cur].text, p, len);
+	sc->tokbuf[cur].text[len] = 0;
+	return sc->tokbuf[cur].text;
+}
+
+/*
+ * convert a number token the way strtol(text, NULL, 0) would: 0x hex,
+ * leading 0 octal (stopping at a non-octal digit), saturating at LONG_MAX.
+ */
+static int parse_constant(const char *p, int len)
+{
+	unsigned long v = 0;
+	int base = 10;
+	int i = 0, d;
+
+	if (len > 2 && p[1] == 'x') {
+		base = 16;
+		i = 2;
+	} else if (p[0] == '0') {
+		base = 8;
+	}
+
+	for (; i < len; i++) {
+		if (p[i] <= '9')
+			d = p[i] - '0';
+		else
+			d = (p[i] | 0x20) - 'a' + 10;
+		if (d >= base)
+			break;
+		if (v > (LONG_MAX - d) / base) {
+			v = LONG_MAX;
+			break;
+		}
+		v = v * base + d;
+	}
+	return (int)(long)v;
+}
+
+/* [ws* (SP|sp) ws* ++ ws*] or [ws* -- ws* (SP|sp) ws*], p after '[' */
+static int match_sp(const char *p, const char **endp)
+{
+	int reg;
+
+	while (*p == ' ' || *p == '\t')
+		p++;
+	if (p[0] == '-' && p[1] == '-') {
+		reg = REG_PUSH;
+		p += 2;
+		while (*p == ' ' || *p == '\t')
+			p++;
+	} else {
+		reg = REG_POP;
+	}
+	if (!((p[0] == 'S' && p[1] == 'P') || (p[0] == 's' && p[1] == 'p')))
+		return 0;
+	p += 2;
+	while (*p == ' ' || *p == '\t')
+		p++;
+	if (reg == REG_POP) {
+		if (p[0] != '+' || p[1] != '+')
+			return 0;
+		p += 2;
+		while (*p == ' ' || *p == '\t')
+			p++;
+	}
+	if (*p != ']')
+		return 0;
+	*endp = p + 1;
+	return reg;
+}
+
+/* the string directive of length len at p, or NULL */
+static const struct keyword* pack_directive(const char *p, int len)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(pack_directives); i++) {
+		if (strlen(pack_directives[i].name) == len &&
+			!memcmp(p, pack_directives[i].name, len))
+			return &pack_directives[i];
+	}
+	return NULL;
+}
+
+/* flex's ignored_directive rule, at a symbol of length len */
+static int ignored_directive(const char *p, int len)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ignored_directives); i++) {
+		if (strlen(ignored_directives[i]) == len &&
+			!memcmp(p, ignored_directives[i], len))
+			return 1;
+	}
+	return 0;
+}
+
+static void scan_error(struct scanner *sc, const char *s, ...)
+{
+	va_list ap;
+
+	output_message(1, "line %d: Error: ", sc->lineno);
+	va_start(ap, s);
+	output_vmessage(1, s, ap);
+	va_end(ap);
+	output_message(1, "\n");
+}
+
+int scanner_next(struct scanner *sc, YYSTYPE *lval, YYLTYPE *lloc)
+{
+	const char *p, *q;
+	const struct kw_slot *kw;
+	const struct keyword *pack;
+	unsigned char c;
+	int len, reg;
+
+	p = sc->p;
+
+	for (;;) {
+		p = skip_ws(p);
+		if (p >= sc->end) {
+			/* Magic to fix input with missing \n on last line */
+			sc->p = sc->tok = sc->end;
+			lloc->line = sc->lineno;
+			return sc->eof++ ? 0 : '\n';
+		}
+
+		c = *p;
+		sc->tok = p;
+		lloc->line = sc->lineno;
+
+		if (c == '\n') {
+			sc->lineno++;
+			lloc->line = sc->lineno;
+			sc->p = p + 1;
+			return '\n';
+		}
+
+		if (c == ';') {
+			p = skip_comment(p, sc->end);
+			continue;
+		}
+
+		if (cclass[c] & CC_SYM0) {
+			for (q = p + 1; cclass[(unsigned char)*q] & CC_SYM; q++)
+				;
+			len = q - p;
+			if (*q == ':') {
+				lval->string = token_text(sc, p, len);
+				sc->p = q + 1;
+				return LABEL;
+			}
+			if (c == '.' && ignored_directive(p, len)) {
+				if (*q == ' ' || *q == '\t')
+					q = skip_comment(q, sc->end);
+				if (!outopts.no_warn_ignored) {
+					if (sc->quiet)
+						sc->diags++;
+					else
+						loc_warn((*lloc), "ignoring directive");
+				}
+				p = q;
+				continue;
+			}
+			sc->p = q;
+			kw = kw_lookup(p, len);
+			if (kw) {
+				lval->integer = kw->value;
+				return kw->token;
+			}
+			if (c == '.' && (pack = pack_directive(p, len))) {
+				lval->integer = pack->value;
+				return PACKDIR;
+			}
+			lval->string = token_text(sc, p, len);
+			return SYMBOL;
+		}
+
+		if (cclass[c] & CC_DIGIT) {
+			q = p + 1;
+			if (c == '0' && p[1] == 'x' && (cclass[(unsigned char)p[2]] &
+											CC_HEX)) {
+				for (q = p + 3; cclass[(unsigned char)*q] & CC_HEX; q++)
+					;
+			} else {
+				while (cclass[(unsigned char)*q] & CC_DIGIT)
+					q++;
+			}
+			lval->integer = parse_constant(p, q - p);
+			sc->p = q;
+			return CONSTANT;
+		}
+
+		if (cclass[c] & CC_SINGLE) {
+			sc->p = p + 1;
+			return c;
+		}
+
+		switch (c) {
+		case ':':
+			if (cclass[(unsigned char)p[1]] & CC_SYM0) {
+				for (q = p + 2; cclass[(unsigned char)*q] & CC_SYM; q++)
+					;
+				lval->string = token_text(sc, p + 1, q - p - 1);
+				sc->p = q;
+				return LABEL;
+			}
+			break;
+		case '"':
+			/* \"(\\.|[^\\"])*\" , which may span lines */
+			for (q = p + 1; q < sc->end && *q != '"'; q++) {
+				if (*q == '\\') {
+					if (q + 1 >= sc->end || q[1] == '\n')
+						break;
+					q++;
+				}
+			}
+			if (q >= sc->end || *q != '"')
+				break;
+			for (len = 1; p + len < q; len++) {
+				if (p[len] == '\n')
+					sc->lineno++;
+			}
+			lloc->line = sc->lineno;
+			lval->string = token_text(sc, p, q + 1 - p);
+			sc->p = q + 1;
+			return STRING;
+		case '[':
+			reg = match_sp(p + 1, &q);
+			if (reg) {
+				lval->integer = reg;
+				sc->p = q;
+				return REG;
+			}
+			sc->p = p + 1;
+			return '[';
+		case '<':
+		case '>':
+			if (p[1] == c) {
+				sc->p = p + 2;
+				return c == '<' ? LSHIFT : RSHIFT;
+			}
+			break;
+		}
+
+		if (sc->quiet)
+			sc->diags++;
+		else
+			scan_error(sc, "invalid character '%c'", c);
+		p++;
+	}
+}
+
+struct scanner* yylex_scanner(void)
+{
+	const char *end;
+
+	if (!yy_scanner.end)
+		scanner_init(&yy_scanner, scanner_input(&end), yylineno);
+	return &yy_scanner;
+}
+
+int yylex(void)
+{
+	struct scanner *sc = yylex_scanner();
+	int tok;
+
+	/* the parser rewinds yylineno when replaying tokens to bison */
+	sc->lineno = yylineno;
+	tok = scanner_next(sc, &yylval, &yylloc);
+	yylineno = sc->lineno;
+	return tok;
+}
+
+void yyerror(const char *s, ...)
+{
+	va_list ap;
+
+	output_message(1, "line %d: Error: ", yylineno);
+	va_start(ap, s);
+	output_vmessage(1, s, ap);
+	va_end(ap);
+	output_message(1, "\n");
+}
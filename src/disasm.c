@@ -0,0 +1,385 @@
+/*
+ * das --disassemble: listing of a flat binary image
+ *
+ * Every possible first word is decoded once into decode_table in dasdefs,
+ * which the emulator shares, from the same OPCODES table the assembler
+ * uses: opcode index and length with next words, or no instruction at all.
+ * The operand fields are just bits of the word. Decoding an image is then
+ * a table lookup per instruction.
+ *
+ * Labels come from a map file (--map) if given. An instruction that would
+ * run over a label is listed as DAT instead, so decoding falls back into
+ * step at every label. The listing has the columns of the dump.
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "binformat.h"
+#include "das.h"
+#include "dasdefs.h"
+#include "disasm.h"
+#include "output.h"
+
+#define DAT_WORDS_PER_LINE	3	/* as many as an instruction, fits the hex */
+
+/* register for each operand field value, via its bits */
+#define REGISTER(val, name, gp) { val, REG_##name }
+static const struct {
+	u16 bits;
+	int reg;
+} reg_bits[] = { REGISTERS };
+#undef REGISTER
+
+static int operand_reg[0x20];
+
+/* a listing line: an instruction, or up to DAT_WORDS_PER_LINE data words */
+struct dis_line {
+	u16 pc;
+	unsigned char len;
+	unsigned char is_dat;
+};
+
+struct dis_label {
+	int addr;
+	char *name;
+};
+
+static void operand_reg_init(void)
+{
+	int i;
+
+	/* PUSH and POP share a value; which one depends on the position */
+	for (i = 0; i < ARRAY_SIZE(reg_bits); i++) {
+		if (reg_bits[i].bits < 0x20 && reg_bits[i].reg != REG_POP)
+			operand_reg[reg_bits[i].bits] = reg_bits[i].reg;
+	}
+}
+
+static int label_cmp(const void *a, const void *b)
+{
+	const struct dis_label *la = a, *lb = b;
+
+	if (la->addr != lb->addr)
+		return la->addr - lb->addr;
+	return strcmp(la->name, lb->name);
+}
+
+/*
+ * labels from the [symbols] part of a map file, in address order.
+ * *labels is malloc'd, return how many or -1 on error.
+ */
+static int read_map(const char *path, struct dis_label **labels)
+{
+	char line[1024], name[1024], type;
+	int n = 0, alloced = 64, in_symbols = 0;
+	unsigned addr;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		error("Reading map %s failed: %s", path, strerror(errno));
+		return -1;
+	}
+	*labels = malloc(alloced * sizeof **labels);
+	while (fgets(line, sizeof line, f)) {
+		if (line[0] == '[') {
+			in_symbols = !strncmp(line, "[symbols]", 9);
+			continue;
+		}
+		/* .equ values need not be addresses, leave them out */
+		if (!in_symbols || sscanf(line, "%x %c %1023s", &addr, &type,
+					name) != 3 || type != 'L')
+			continue;
+		if (n == alloced) {
+			alloced *= 2;
+			*labels = realloc(*labels, alloced * sizeof **labels);
+		}
+		(*labels)[n].addr = addr & 0xffff;
+		(*labels)[n].name = strdup(name);
+		n++;
+	}
+	fclose(f);
+	qsort(*labels, n, sizeof **labels, label_cmp);
+	return n;
+}
+
+static const struct dis_label *labels;
+static int nlabels;
+
+/* first label at addr, or NULL */
+static const struct dis_label* label_at(int addr)
+{
+	int lo = 0, hi = nlabels;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (labels[mid].addr < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < nlabels && labels[lo].addr == addr ? &labels[lo] : NULL;
+}
+
+/*
+ * a literal, by label name if named and one is there. Small values are
+ * more often offsets or counts than addresses, so those are only named
+ * if named is 2, as for jumps.
+ */
+static int print_value(char *buf, u16 value, int named)
+{
+	const struct dis_label *l = NULL;
+
+	if (named > 1 || (named && value >= 0x20))
+		l = label_at(value);
+
+	if (l)
+		return sprintf(buf, "%s", l->name);
+	if (value < 0x20)
+		return sprintf(buf, "%d", value);
+	return sprintf(buf, "0x%04x", value);
+}
+
+/* operand with field value v, taking any next word from *next */
+static int print_operand(char *buf, int v, int is_b, int jump,
+						const u16 **next)
+{
+	int count = 0;
+
+	if (v < 0x08)
+		return sprintf(buf, "%s", reg2str(operand_reg[v]));
+	if (v < 0x10)
+		return sprintf(buf, "[%s]", reg2str(operand_reg[v - 0x08]));
+	if (v < 0x18) {
+		count += sprintf(buf, "[%s + ", reg2str(operand_reg[v - 0x10]));
+		count += print_value(buf + count, *(*next)++, 1);
+		return count + sprintf(buf + count, "]");
+	}
+	switch (v) {
+	case 0x18:
+		return sprintf(buf, "%s", reg2str(is_b ? REG_PUSH : REG_POP));
+	case 0x1a:
+		if (outopts.stack_style_sp) {
+			count += sprintf(buf, "[SP + ");
+			count += print_value(buf + count, *(*next)++, 0);
+			return count + sprintf(buf + count, "]");
+		}
+		count += sprintf(buf, "%s ", reg2str(REG_PICK));
+		return count + print_value(buf + count, *(*next)++, 0);
+	case 0x1e:
+		/* an absolute address is hardly ever anything but a label */
+		count += sprintf(buf, "[");
+		count += print_value(buf + count, *(*next)++, 2);
+		return count + sprintf(buf + count, "]");
+	case 0x1f:
+		return print_value(buf, *(*next)++, 1 + jump);
+	}
+	if (v < 0x20)
+		return sprintf(buf, "%s", reg2str(operand_reg[v]));
+	/* short literal -1..30; only name it if it's where code goes */
+	return print_value(buf, v - 0x21, jump * 2);
+}
+
+static int print_instruction(char *buf, const u16 *words)
+{
+	const struct decode *d = &decode_table[words[0]];
+	const u16 *next = words + 1;	/* a's next word comes first */
+	char a[64];
+	int count, jump;
+
+	jump = d->op == (SPECIAL_OPCODE | 0x01) ||			/* JSR */
+		(d->op == 0x01 && FIELD_B(words[0]) == 0x1c);	/* SET PC, */
+	print_operand(a, FIELD_A(words[0]), 0, jump, &next);
+	count = sprintf(buf, "%s ", opcode2str(d->op));
+	if (!(d->op & SPECIAL_OPCODE)) {
+		count += print_operand(buf + count, FIELD_B(words[0]), 1, 0, &next);
+		count += sprintf(buf + count, ", ");
+	}
+	return count + sprintf(buf + count, "%s", a);
+}
+
+/*
+ * split the image into listing lines, instructions where they decode and
+ * don't run over a label, else DAT. *lines is malloc'd, return how many.
+ */
+static int decode_image(const u16 *image, int nwords, struct dis_line **lines)
+{
+	const struct decode *d;
+	struct dis_line *line;
+	int label = 0, limit = 0, pc, len;
+
+	line = *lines = malloc((nwords + 1) * sizeof **lines);
+	for (pc = 0; pc < nwords; pc += len, line++) {
+		if (pc >= limit) {
+			/* next stop: a label, or the end */
+			while (label < nlabels && labels[label].addr <= pc)
+				label++;
+			limit = label < nlabels && labels[label].addr < nwords ?
+				labels[label].addr : nwords;
+		}
+
+		d = &decode_table[image[pc]];
+		len = d->len;
+		line->pc = pc;
+		line->is_dat = !d->op || pc + len > limit;
+		if (line->is_dat) {
+			/* data up to the next word that is an instruction */
+			for (len = 1; len < DAT_WORDS_PER_LINE && pc + len < limit;
+					len++) {
+				d = &decode_table[image[pc + len]];
+				if (d->op && pc + len + d->len <= limit)
+					break;
+			}
+		}
+		line->len = len;
+	}
+	return line - *lines;
+}
+
+/* start a listing line, return column */
+static int line_start(char *buf, int pc, int indent)
+{
+	int col = 0;
+
+	if (options.asm_print_pc)
+		col += sprintf(buf, "%04x ", pc);
+	if (indent)
+		col += sprintf(buf + col, "%*c", indent - col, ' ');
+	return col;
+}
+
+/*
+ * print labels up to pc, but leave the last in buf, returning its column,
+ * if there's room for the statement after it
+ */
+static int print_labels(FILE *f, char *buf, int pc, int *label,
+						int main_col)
+{
+	int col = 0;
+
+	for (; *label < nlabels && labels[*label].addr <= pc; ++*label) {
+		if (col)
+			fprintf(f, "%s\n", buf);
+		col = line_start(buf, labels[*label].addr, 0);
+		col += sprintf(buf + col, options.notch_style ? ":%s" : "%s:",
+					labels[*label].name);
+	}
+	if (col >= main_col) {
+		fprintf(f, "%s\n", buf);
+		col = 0;
+	}
+	return col;
+}
+
+static int print_listing(FILE *f, const u16 *image, int nwords,
+						const struct dis_line *lines, int n)
+{
+	char buf[1024];
+	int main_col = options.asm_main_col;
+	int i, k, col, label = 0, count = 0;
+
+	if (options.asm_print_pc)
+		main_col += 5;
+
+	for (i = 0; i < n; i++) {
+		const u16 *words = image + lines[i].pc;
+
+		col = print_labels(f, buf, lines[i].pc, &label, main_col);
+		if (col)
+			col += sprintf(buf + col, "%*c", main_col - col, ' ');
+		else
+			col = line_start(buf, lines[i].pc, main_col);
+
+		if (lines[i].is_dat) {
+			col += sprintf(buf + col, "DAT ");
+			for (k = 0; k < lines[i].len; k++) {
+				col += sprintf(buf + col, k ? ", " : "");
+				col += print_value(buf + col, words[k], 0);
+			}
+		} else {
+			col += print_instruction(buf + col, words);
+		}
+
+		if (options.asm_print_hex) {
+			col += sprintf(buf + col, "%*c;",
+				col < options.asm_hex_col ? options.asm_hex_col - col : 1,
+				' ');
+			for (k = 0; k < lines[i].len; k++)
+				col += sprintf(buf + col, " %04x", words[k]);
+		}
+		fprintf(f, "%s\n", buf);
+		count++;
+	}
+
+	/* labels at or past the end, with nothing to go on their line */
+	while (label < nlabels) {
+		col = print_labels(f, buf, labels[label].addr, &label, main_col);
+		if (col)
+			fprintf(f, "%s\n", buf);
+	}
+	return count;
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * list the image in binpath, with labels from mappath if not NULL.
+ * return 0 or nonzero on error.
+ */
+int disassemble(FILE *f, const char *binpath, const char *mappath)
+{
+	struct dis_label *maplabels = NULL;
+	struct dis_line *lines;
+	u16 *image = NULL;
+	int nwords, nlines, i;
+	double start;
+
+	nwords = bin_read(binpath, &image);
+	if (nwords < 0)
+		return 1;
+	if (mappath) {
+		nlabels = read_map(mappath, &maplabels);
+		if (nlabels < 0) {
+			free(image);
+			return 1;
+		}
+		labels = maplabels;
+	}
+
+	start = now_ms();
+	operand_reg_init();
+	decode_init();
+	info("Decode table built in %.3f ms\n", now_ms() - start);
+	start = now_ms();
+	nlines = decode_image(image, nwords, &lines);
+	info("Decoded %d words to %d lines in %.3f ms\n", nwords, nlines,
+		now_ms() - start);
+
+	if (!outopts.omit_dump_header) {
+		fprintf(f, "; Disassembly from " VERSTRING "\n");
+		fprintf(f, "; Binary file: %s\n", binpath);
+		if (mappath)
+			fprintf(f, "; Labels from: %s\n", mappath);
+	}
+	print_listing(f, image, nwords, lines, nlines);
+
+	for (i = 0; i < nlabels; i++)
+		free(maplabels[i].name);
+	free(maplabels);
+	free(lines);
+	free(image);
+	return 0;
+}
@@ -0,0 +1,13 @@
+#ifndef DISASM_H
+#define DISASM_H
+/*
+ * das --disassemble: listing of a flat binary image
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <stdio.h>
+
+int disassemble(FILE *f, const char *binpath, const char *mappath);
+
+#endif
@@ -6,9 +6,11 @@
  *
  */
 #include <assert.h>
+#include <limits.h>
 #include <string.h>
 #include <stdlib.h>
 
+#include "das.h"
 #include "symbol.h"
 #include "output.h"
 #include "y.tab.h"
@@ -19,21 +21,42 @@ enum expr_type {
 	EXPR_OPERATOR,
 };
 
+/*
+ * Expressions are interned when their statement is made, see expr_intern(),
+ * so identical subexpressions are one node shared by every use. Nodes have
+ * no source location for that reason: errors are reported at the user's.
+ */
 struct expr {
-	LOCTYPE loc;
 	int type;
 	int maychange;
-	int value;			/* valid shortcut if maychange = 0 */
+	int value;			/* valid shortcut if maychange = 0, else as of gen */
+	unsigned gen;		/* symbols_generation() when value was computed */
 	union {
 		struct symbol *symbol;
 		int op;
 	};
 	struct expr *left;	/* wasted space if not an operator node */
 	struct expr *right;
+	struct expr *hash_next;	/* intern table chain */
+	unsigned hash;
+	int refs;			/* uses, once interned */
 };
 
 int alloc_count, free_count;
 
+/* distinct expression nodes */
+static struct {
+	struct expr **hash;
+	unsigned hash_size, count;
+	int nodes;			/* interned, counting duplicates */
+} intern;
+
+/* analysis evaluations, see expr_value() */
+static struct {
+	int off;
+	long evals, hits;
+} memo;
+
 /* internal unconditional (re)calculation */
 static int expr_value_calc(struct expr *e)
 {
@@ -87,7 +110,6 @@ struct expr* gen_const_expr(LOCTYPE loc, int val)
 	//printf("gen_const: %d\n", val);
 	struct expr *e = calloc(sizeof *e, 1);
 	DBG_MEM("alloc %d: %p\n", ++alloc_count, e);
-	e->loc = loc;
 	e->type = EXPR_CONSTANT;
 	e->maychange = 0;
 	e->value = val;
@@ -99,7 +121,6 @@ struct expr* gen_symbol_expr(LOCTYPE loc, struct symbol *sym)
 	//printf("gen_symbol: %s\n", str);
 	struct expr *e = calloc(sizeof *e, 1);
 	DBG_MEM("alloc %d: %p\n", ++alloc_count, e);
-	e->loc = loc;
 	e->type = EXPR_SYMBOL;
 	e->maychange = 1;
 	e->value = 0;
@@ -108,6 +129,117 @@ struct expr* gen_symbol_expr(LOCTYPE loc, struct symbol *sym)
 	return e;
 }
 
+/* FNV-1a over what makes a node: its type, and value or operands */
+static unsigned expr_hash(struct expr *e)
+{
+	unsigned long key[3] = { 0, 0, 0 };
+	unsigned h = 2166136261u;
+	unsigned char *p = (unsigned char *)key;
+	size_t i;
+
+	if (e->type == EXPR_SYMBOL) {
+		key[0] = (unsigned long)e->symbol;
+	} else if (e->type == EXPR_CONSTANT) {
+		key[0] = (unsigned)e->value;
+	} else {
+		key[0] = e->op;
+		key[1] = (unsigned long)e->left;
+		key[2] = (unsigned long)e->right;
+	}
+	for (i = 0; i < sizeof key; i++)
+		h = (h ^ p[i]) * 16777619u;
+	return h ^ e->type;
+}
+
+static int expr_same(struct expr *a, struct expr *b)
+{
+	if (a->type != b->type)
+		return 0;
+	if (a->type == EXPR_SYMBOL)
+		return a->symbol == b->symbol;
+	if (a->type == EXPR_CONSTANT)
+		return a->value == b->value;
+	return a->op == b->op && a->left == b->left && a->right == b->right;
+}
+
+static void intern_add(struct expr *e)
+{
+	struct expr **old = intern.hash, *x, *next;
+	unsigned oldsize = intern.hash_size, i, h;
+
+	if (intern.count >= intern.hash_size) {
+		intern.hash_size = oldsize ? oldsize * 2 : 1024;
+		intern.hash = calloc(intern.hash_size, sizeof *intern.hash);
+		for (i = 0; i < oldsize; i++) {
+			for (x = old[i]; x; x = next) {
+				next = x->hash_next;
+				h = x->hash & (intern.hash_size - 1);
+				x->hash_next = intern.hash[h];
+				intern.hash[h] = x;
+			}
+		}
+		free(old);
+	}
+	h = e->hash & (intern.hash_size - 1);
+	e->hash_next = intern.hash[h];
+	intern.hash[h] = e;
+	intern.count++;
+}
+
+static void intern_remove(struct expr *e)
+{
+	struct expr **x = &intern.hash[e->hash & (intern.hash_size - 1)];
+
+	while (*x != e)
+		x = &(*x)->hash_next;
+	*x = e->hash_next;
+	intern.count--;
+}
+
+/*
+ * Replace a freshly parsed expression tree by the shared node for it,
+ * making one if it's the first like it. Subexpressions are shared too, so
+ * the expressions of all statements form a DAG. Call when the statement is
+ * made, on the parsing thread (after symbols are merged, if parallel).
+ * Return the shared node, with a reference for the caller (free_expr()).
+ */
+struct expr* expr_intern(struct expr *e)
+{
+	struct expr *x;
+
+	if (e->left)
+		e->left = expr_intern(e->left);
+	if (e->right)
+		e->right = expr_intern(e->right);
+	intern.nodes++;
+	e->hash = expr_hash(e);
+	x = intern.hash ? intern.hash[e->hash & (intern.hash_size - 1)] : NULL;
+	for (; x; x = x->hash_next) {
+		if (x->hash == e->hash && expr_same(x, e))
+			break;
+	}
+	if (!x) {
+		e->refs = 1;
+		intern_add(e);
+		return e;
+	}
+	/* x holds its own references to the same children */
+	x->refs++;
+	if (e->left)
+		free_expr(e->left);
+	if (e->right)
+		free_expr(e->right);
+	free(e);
+	DBG_MEM("free %d: %p\n", ++free_count, e);
+	return x;
+}
+
+/* parallel parse: move a symbol expression onto the merged global symbol */
+void expr_merge_symbol(struct expr *e)
+{
+	e->symbol = symbol_merged(e->symbol);
+}
+
 struct expr* gen_op_expr(LOCTYPE loc, int op, struct expr* left,
 						struct expr* right)
 {
@@ -119,7 +251,6 @@ struct expr* gen_op_expr(LOCTYPE loc, int op, struct expr* left,
 
 	e = calloc(sizeof *e, 1);
 	DBG_MEM("alloc %d: %p\n", ++alloc_count, e);
-	e->loc = loc;
 	e->type = EXPR_OPERATOR;
 	e->op = op;
 	e->left = left;
@@ -138,49 +269,280 @@ struct expr* gen_op_expr(LOCTYPE loc, int op, struct expr* left,
 /*
  * Analysis
  */
-void expr_validate(struct expr *e)
+void expr_validate(LOCTYPE loc, struct expr *e)
 {
 	/* if it's a symbol, check it's defined */
 	if (e->type == EXPR_SYMBOL) {
-		symbol_check_defined(e->loc, e->symbol);
+		symbol_check_defined(loc, e->symbol);
 	} else if (e->type == EXPR_OPERATOR) {
 		/* recursively validate any children */
 		if (e->left)
-			expr_validate(e->left);
+			expr_validate(loc, e->left);
 		if (e->right)
-			expr_validate(e->right);
+			expr_validate(loc, e->right);
 	}
 	/* nothing else to do? Nothing for constants? */
 }
 
+/* call fn for every symbol referenced in the expression */
+void expr_for_each_symbol(struct expr *e,
+						void (*fn)(struct symbol *sym, void *arg), void *arg)
+{
+	if (e->type == EXPR_SYMBOL) {
+		fn(e->symbol, arg);
+	} else if (e->type == EXPR_OPERATOR) {
+		if (e->left)
+			expr_for_each_symbol(e->left, fn, arg);
+		if (e->right)
+			expr_for_each_symbol(e->right, fn, arg);
+	}
+}
+
 int expr_maychange(struct expr *e)
 {
 	assert(e);
 	return e->maychange;
 }
 
+/*
+ * During analysis an operator node keeps its value until a symbol changes,
+ * so a subexpression shared by many statements is worked out once, not
+ * once per use, on passes where symbols don't change between them.
+ */
 int expr_value(struct expr *e)
 {
+	unsigned gen;
+
 	assert(e);
-	if (e->maychange)
+	if (!e->maychange)
+		return e->value;
+	if (e->type != EXPR_OPERATOR || memo.off)
 		return expr_value_calc(e);
-	else
+	memo.evals++;
+	gen = symbols_generation();
+	if (e->gen == gen) {
+		memo.hits++;
 		return e->value;
+	}
+	e->value = expr_value_calc(e);
+	e->gen = gen;
+	return e->value;
 }
 
-void expr_freeze(struct expr *e)
+/*
+ * analysis is over. The back end evaluates on several threads, so stop
+ * memoizing values (they are final now anyway).
+ */
+void expr_memo_end(void)
+{
+	memo.off = 1;
+}
+
+/* verbose statistics: sharing and memoized evaluations */
+void expr_stats(void)
+{
+	info("Expressions: %d nodes, %d distinct; %ld of %ld evaluations "
+		"memoized\n", intern.nodes, intern.count, memo.hits, memo.evals);
+}
+
+/* helper for expr_range(): bounds of l op r over the corners */
+static void range_corners(long long l0, long long l1, long long r0,
+						long long r1, int op, long long *min, long long *max)
+{
+	long long c[4];
+	int i;
+
+	if (op == '*') {
+		c[0] = l0 * r0; c[1] = l0 * r1; c[2] = l1 * r0; c[3] = l1 * r1;
+	} else {
+		c[0] = l0 / r0; c[1] = l0 / r1; c[2] = l1 / r0; c[3] = l1 / r1;
+	}
+	*min = *max = c[0];
+	for (i = 1; i < 4; i++) {
+		if (c[i] < *min)
+			*min = c[i];
+		if (c[i] > *max)
+			*max = c[i];
+	}
+}
+
+/* smallest 2^n - 1 >= x, for x >= 0 */
+static long long range_mask(long long x)
+{
+	long long m = 0;
+
+	while (m < x)
+		m = m << 1 | 1;
+	return m;
+}
+
+/*
+ * range analysis: bounds of the value the expression can take from now on,
+ * from symbol_range(). Return 0 if it can't be bounded, including where int
+ * arithmetic in expr_value() might overflow.
+ */
+int expr_range(struct expr *e, long long *min, long long *max)
+{
+	long long l0, l1, r0, r1;
+
+	if (!e->maychange) {
+		*min = *max = e->value;
+		return 1;
+	}
+	if (e->type == EXPR_SYMBOL)
+		return symbol_range(e->symbol, min, max);
+
+	/* operator */
+	if (!expr_range(e->right, &r0, &r1))
+		return 0;
+	switch (e->op) {
+	case '(':
+		*min = r0;
+		*max = r1;
+		return 1;
+	case UMINUS:
+		*min = -r1;
+		*max = -r0;
+		goto check;
+	case '~':
+		*min = ~r1;
+		*max = ~r0;
+		goto check;
+	}
+
+	if (!expr_range(e->left, &l0, &l1))
+		return 0;
+	switch (e->op) {
+	case '-':
+		*min = l0 - r1;
+		*max = l1 - r0;
+		break;
+	case '+':
+		*min = l0 + r0;
+		*max = l1 + r1;
+		break;
+	case '*':
+		range_corners(l0, l1, r0, r1, '*', min, max);
+		break;
+	case '/':
+		/* divide by zero gives 0 until freeze complains */
+		if (r0 <= 0 && r1 >= 0)
+			return 0;
+		range_corners(l0, l1, r0, r1, '/', min, max);
+		break;
+	case LSHIFT:
+	case RSHIFT:
+		if (r0 != r1 || r0 < 0 || r0 > 30)
+			return 0;
+		if (e->op == LSHIFT) {
+			*min = l0 * (1LL << r0);
+			*max = l1 * (1LL << r0);
+		} else {
+			*min = l0 >> r0;
+			*max = l1 >> r0;
+		}
+		break;
+	case '|':
+	case '^':
+	case '&':
+		if (l0 == l1 && r0 == r1) {
+			*min = *max = e->op == '|' ? l0 | r0 :
+							e->op == '^' ? l0 ^ r0 : l0 & r0;
+		} else if (l0 >= 0 && r0 >= 0) {
+			*min = 0;
+			*max = e->op == '&' ? (l1 < r1 ? l1 : r1) :
+									range_mask(l1 > r1 ? l1 : r1);
+		} else {
+			return 0;
+		}
+		break;
+	default:
+		return 0;
+	}
+check:
+	return *min >= INT_MIN && *max <= INT_MAX;
+}
+
+/*
+ * helper for expr_fold(): is e a sum of constants and at most one symbol
+ * added and one subtracted, using only +, -, unary minus and parentheses?
+ * sign is -1 under an odd number of minuses.
+ */
+static int expr_linear(struct expr *e, int sign, struct symbol **add,
+						struct symbol **sub)
+{
+	struct symbol **sym;
+
+	if (!e->maychange)
+		return 1;
+	if (e->type == EXPR_SYMBOL) {
+		sym = sign > 0 ? add : sub;
+		if (*sym)
+			return 0;
+		*sym = e->symbol;
+		return 1;
+	}
+	switch (e->op) {
+	case '(':
+		return expr_linear(e->right, sign, add, sub);
+	case UMINUS:
+		return expr_linear(e->right, -sign, add, sub);
+	case '+':
+		return expr_linear(e->left, sign, add, sub) &&
+			expr_linear(e->right, sign, add, sub);
+	case '-':
+		return expr_linear(e->left, sign, add, sub) &&
+			expr_linear(e->right, -sign, add, sub);
+	}
+	return 0;
+}
+
+/*
+ * analysis: turn subexpressions whose value can no longer change into
+ * constants, so whatever depends on them stops being re-evaluated and can
+ * be sized for good. That is a symbol with a final value, or a label
+ * difference like "after - start - 1" whose labels can only move together
+ * (see symbols_distance_fixed()). The tree stays as it is for printing.
+ * Return number of nodes folded.
+ */
+int expr_fold(struct expr *e)
+{
+	struct symbol *add = NULL, *sub = NULL;
+	int folded = 0;
+
+	if (!e->maychange)
+		return 0;
+	if (e->type == EXPR_SYMBOL) {
+		if (!symbol_fixed(e->symbol))
+			return 0;
+	} else if (!expr_linear(e, 1, &add, &sub) || !add || !sub ||
+			!symbols_distance_fixed(sub, add)) {
+		if (e->left)
+			folded += expr_fold(e->left);
+		folded += expr_fold(e->right);
+		/* children may have been folded through another use */
+		if ((e->left && e->left->maychange) || e->right->maychange)
+			return folded;
+	}
+	/* values now are the final ones, see symbol_fixed() */
+	e->value = expr_value_calc(e);
+	e->maychange = 0;
+	return folded + 1;
+}
+
+void expr_freeze(LOCTYPE loc, struct expr *e)
 {
 	/* TODO think about this more when I have not drunk wine.
 	 * freeze children, get values. check for div by zero.
 	 */
 	if (e->type == EXPR_OPERATOR) {
 		if (e->left)
-			expr_freeze(e->left);
+			expr_freeze(loc, e->left);
 		if (e->right)
-			expr_freeze(e->right);
+			expr_freeze(loc, e->right);
 
 		if (e->op == '/' && expr_value(e->right) == 0)
-			loc_err(e->loc, "Division by zero in expression");
+			loc_err(loc, "Division by zero in expression");
 	}
 }
 
@@ -234,8 +596,14 @@ int expr_print_asm(char *buf, struct expr *e)
 
 /* Cleanup */
 
+/* drop a reference to an interned expression, or free a tree that isn't */
 void free_expr(struct expr *e)
 {
+	if (e->refs) {
+		if (--e->refs)
+			return;
+		intern_remove(e);
+	}
 	if (e->right) {
 		DBG_MEM("free right: %p\n", e->right);
 		free_expr(e->right);
@@ -17,15 +17,23 @@ struct expr* gen_const_expr(LOCTYPE loc, int val);
 struct expr* gen_symbol_expr(LOCTYPE loc, struct symbol *sym);
 struct expr* gen_op_expr(LOCTYPE loc, int op, struct expr* left,
 						struct expr* right);
+void expr_merge_symbol(struct expr *e);
+struct expr* expr_intern(struct expr *e);
 
 /* Analyse */
-void expr_validate(struct expr *e);
-void expr_freeze(struct expr *e);
+void expr_validate(LOCTYPE loc, struct expr *e);
+void expr_for_each_symbol(struct expr *e,
+						void (*fn)(struct symbol *sym, void *arg), void *arg);
+void expr_freeze(LOCTYPE loc, struct expr *e);
 int expr_value(struct expr *expr);
 int expr_maychange(struct expr *expr);
+int expr_range(struct expr *e, long long *min, long long *max);
+int expr_fold(struct expr *e);
+void expr_memo_end(void);
 
 /* Output */
 void dump_expr(struct expr *e);
+void expr_stats(void);
 int expr_print_asm(char *buf, struct expr *e);
 
 /* Cleanup */
@@ -11,7 +11,9 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "das.h"
 #include "dasdefs.h"
 #include "instruction.h"
 #include "output.h"
@@ -31,11 +33,20 @@ struct operand {
 
 struct instr {
 	int opcode;
-	struct operand* a;
-	struct operand* b;
+	struct operand a;
+	struct operand b;		/* b.position is 0 if there is no b */
 	int length_known;		/* 0 if unknown (maybe depends on symbols) */
+	int encoded;			/* validated and frozen ahead, see below */
 };
 
+/* all instructions in the order parsed, their statements index into this */
+static struct {
+	struct instr *v;
+	int n, alloc;
+} instrs;
+
+#define has_b(i)	((i)->b.position)
+
 #define MAX_SHORT_LITERAL	0x1e
 #define MIN_SHORT_LITERAL	-1
 
@@ -45,7 +56,6 @@ struct instr {
 /*
  * Parse phase support
  */
-static struct statement_ops instruction_statement_ops;
 
 /*
  * mask a constant value into *bits for writing.
@@ -76,7 +86,7 @@ int operand_validate(struct operand *o, int warn_b_literal)
 
 	/* validate expr first if present. no return value, check das_error later */
 	if (o->expr)
-		expr_validate(o->expr);
+		expr_validate(o->loc, o->expr);
 
 	/*
 	 * general-purpose and special regs are combined now by the parser,
@@ -191,36 +201,86 @@ struct operand* operand_set_position(struct operand *o, enum op_pos pos)
 	return o;
 }
 
-/* generate an instruction from an opcode and one or two values */
-void gen_instruction(int opcode, struct operand *b, struct operand *a)
+/*
+ * generate an instruction from an opcode and one or two values. The
+ * operands are copied into it and freed.
+ */
+void gen_instruction(LOCTYPE loc, int opcode, struct operand *b,
+						struct operand *a)
 {
-	struct instr* i = calloc(1, sizeof *i);
+	struct instr *i;
+
+	assert(a);
+	if (instrs.n == instrs.alloc) {
+		instrs.alloc = instrs.alloc ? instrs.alloc * 2 : 1024;
+		instrs.v = realloc(instrs.v, instrs.alloc * sizeof *instrs.v);
+	}
+	i = &instrs.v[instrs.n];
+	memset(i, 0, sizeof *i);
+
+	/* share expressions with other statements */
+	if (a->expr)
+		a->expr = expr_intern(a->expr);
+	if (b && b->expr)
+		b->expr = expr_intern(b->expr);
 	i->opcode = opcode;
-	i->a = a;
-	i->b = b;
-	//DBG("add instruction %p to list\n", i);
-	add_statement(i, &instruction_statement_ops);
+	i->a = *a;
+	free(a);
+	if (b) {
+		i->b = *b;
+		free(b);
+	}
+	add_statement(loc, STMT_INSTRUCTION, instrs.n++);
 }
 
 /*
  *	Analysis
  */
 
-static int instruction_validate(void *private)
+/*
+ * --optimal-literals: instructions whose a operand is a literal that may be
+ * short or not depending on symbol values, sized by the literals_*()
+ * functions instead of relaxation's never-shrink rule
+ */
+static struct {
+	int *instr;				/* index into instrs */
+	int n, alloc;
+} lits;
+
+static int operand_is_sym_literal(struct operand *o)
+{
+	return o->expr && !o->indirect && !o->reg && o->position == OP_POS_A &&
+		expr_maychange(o->expr);
+}
+
+static void literal_add(int n)
+{
+	if (lits.n == lits.alloc) {
+		lits.alloc = lits.alloc ? lits.alloc * 2 : 256;
+		lits.instr = realloc(lits.instr, lits.alloc * sizeof *lits.instr);
+	}
+	lits.instr[lits.n++] = n;
+}
+
+int instruction_validate(int n)
 {
-	struct instr* i = private;
+	struct instr *i = &instrs.v[n];
 	int ret = 0;
 
+	if (i->encoded)
+		return 0;
+
 	/*
 	 * Anything to validate about the instruction itself, apart from
 	 * validating operands individually?
 	 */
-	if (i->a) {
-		ret += operand_validate(i->a, 0);
-	}
-	if (i->b) {
-		ret += operand_validate(i->b, opcode_warn_b_literal(i->opcode));
+	ret += operand_validate(&i->a, 0);
+	if (has_b(i)) {
+		ret += operand_validate(&i->b,
+								opcode_warn_b_literal(i->opcode));
 	}
+	if (options.optimal_literals && operand_is_sym_literal(&i->a))
+		literal_add(n);
 	return ret;
 }
 
@@ -380,13 +440,94 @@ int operand_fixed_len(struct operand *o)
 	return 0;
 }
 
+/* will operand_word_count() come out the same whatever the symbol values? */
+static int operand_size_fixed(struct operand *o)
+{
+	return o->known_word_count > 0 || !o->expr || o->indirect ||
+		o->reg == REG_PICK || o->position == OP_POS_B ||
+		!expr_maychange(o->expr);
+}
+
+int instruction_size_fixed(int n)
+{
+	struct instr *i = &instrs.v[n];
+
+	return i->length_known > 0 || (operand_size_fixed(&i->a) &&
+		(!has_b(i) || operand_size_fixed(&i->b)));
+}
+
+/* range analysis: most words the instruction could still grow to */
+int instruction_max_size(int n)
+{
+	struct instr *i = &instrs.v[n];
+	int len = 1;
+
+	len += operand_size_fixed(&i->a) ? operand_needs_nextword(&i->a) : 1;
+	if (has_b(i))
+		len += operand_size_fixed(&i->b) ?
+				operand_needs_nextword(&i->b) : 1;
+	return len;
+}
+
+/*
+ * range analysis: settle a symbolic literal whose value over all layouts
+ * still possible (see expr_range()) is either all short or all long, as
+ * operand_word_count() would, after masking to 16 bits, on every later
+ * pass anyway. Return 1 if settled.
+ */
+static int operand_decide(struct operand *o)
+{
+	long long min, max;
+	int lo;
+
+	if (operand_size_fixed(o) || !expr_range(o->expr, &min, &max))
+		return 0;
+	if (max - min > 0xffff)
+		return 0;
+	/* short literal values, masked and offset, are 0 to 0x1f */
+	lo = (min - MIN_SHORT_LITERAL) & 0xffff;
+	if (lo + (max - min) <= MAX_SHORT_LITERAL - MIN_SHORT_LITERAL)
+		o->known_word_count = 1;
+	else if (lo > MAX_SHORT_LITERAL - MIN_SHORT_LITERAL &&
+			lo + (max - min) <= 0xffff)
+		o->known_word_count = 2;
+	else
+		return 0;
+	return 1;
+}
+
+int instruction_decide_size(int n)
+{
+	struct instr *i = &instrs.v[n];
+	int decided;
+
+	decided = operand_decide(&i->a);
+	if (has_b(i))
+		decided |= operand_decide(&i->b);
+	return decided;
+}
+
+/* range analysis: fold literals whose size isn't fixed yet */
+int instruction_fold(int n)
+{
+	struct instr *i = &instrs.v[n];
+	int folded = 0;
+
+	if (!operand_size_fixed(&i->a))
+		folded += expr_fold(i->a.expr);
+	if (has_b(i) && !operand_size_fixed(&i->b))
+		folded += expr_fold(i->b.expr);
+	return folded;
+}
+
 /*
  * get instruction length. final length may increase due to symbol value
  * changes (but guaranteed length will never decrease)
  */
-static int instruction_binary_size(void *private) {
+int instruction_binary_size(int n)
+{
 	int len;
-	struct instr *i = private;
+	struct instr *i = &instrs.v[n];
 
 	/* shortcut if entirely static */
 	if (i->length_known > 0) {
@@ -394,11 +535,12 @@ static int instruction_binary_size(void *private) {
 		return i->length_known;
 	}
 
-	len = 1 + operand_needs_nextword(i->a);
-	if (i->b)
-		len += operand_needs_nextword(i->b);
+	len = 1 + operand_needs_nextword(&i->a);
+	if (has_b(i))
+		len += operand_needs_nextword(&i->b);
 
-	if (operand_fixed_len(i->a) && (!i->b || operand_fixed_len(i->b))) {
+	if (operand_fixed_len(&i->a) &&
+			(!has_b(i) || operand_fixed_len(&i->b))) {
 		/* not going to change, can shortcut next time */
 		i->length_known = len;
 	}
@@ -408,63 +550,167 @@ static int instruction_binary_size(void *private) {
 void operand_freeze(struct operand *o)
 {
 	if (o->expr)
-		expr_freeze(o->expr);
+		expr_freeze(o->loc, o->expr);
 	operand_genbits(o);
 }
 
-int instruction_freeze(void *private)
+int instruction_freeze(int n)
 {
-	struct instr *i = private;
+	struct instr *i = &instrs.v[n];
 	/* TODO: more validation, fix the binary size and generate bits here */
 
+	if (i->encoded)
+		return das_error;
 	/* Freeze expressions, issue any divide-by-zero errors */
-	if (i->a)
-		operand_freeze(i->a);
-	if (i->b)
-		operand_freeze(i->b);
+	operand_freeze(&i->a);
+	if (has_b(i))
+		operand_freeze(&i->b);
 
 	return das_error;
 }
 
+/* true if no symbol value can change the instruction's binary */
+int instruction_constant(int n)
+{
+	struct instr *i = &instrs.v[n];
+
+	return (!i->a.expr || !expr_maychange(i->a.expr)) &&
+		(!has_b(i) || !i->b.expr || !expr_maychange(i->b.expr));
+}
+
+/*
+ * --watch: a constant instruction was validated and frozen without a word
+ * said, so later validation and freezing have nothing left to do
+ */
+void instruction_set_encoded(int n)
+{
+	instrs.v[n].encoded = 1;
+}
+
+/* would the literal be short with symbol values as they are? */
+static int literal_fits(struct operand *o)
+{
+	s16 valbits;
+
+	mask_constant(expr_value(o->expr), &valbits);
+	return valbits <= MAX_SHORT_LITERAL && valbits >= MIN_SHORT_LITERAL;
+}
+
+static void literal_set(int n, int words)
+{
+	instrs.v[n].a.known_word_count = words;
+	instrs.v[n].length_known = 0;
+}
+
+/* make every symbolic literal short, whatever its value */
+void literals_all_short(void)
+{
+	int n;
+
+	for (n = 0; n < lits.n; n++)
+		literal_set(lits.instr[n], 1);
+}
+
+/* make long each short literal that doesn't fit. Return how many */
+int literals_grow(void)
+{
+	int n, grown = 0;
+
+	for (n = 0; n < lits.n; n++) {
+		if (instrs.v[lits.instr[n]].a.known_word_count == 1 &&
+				!literal_fits(&instrs.v[lits.instr[n]].a)) {
+			literal_set(lits.instr[n], 2);
+			grown++;
+		}
+	}
+	return grown;
+}
+
+/* make short each long literal that would fit. Return how many */
+int literals_shrink(void)
+{
+	int n, shrunk = 0;
+
+	for (n = 0; n < lits.n; n++) {
+		if (instrs.v[lits.instr[n]].a.known_word_count == 2 &&
+				literal_fits(&instrs.v[lits.instr[n]].a)) {
+			literal_set(lits.instr[n], 1);
+			shrunk++;
+		}
+	}
+	return shrunk;
+}
+
+/*
+ * snapshot of literal sizes, for literals_restore(). free() when done.
+ * After analysis a size still unknown is short for now (and for good).
+ */
+int* literals_save(void)
+{
+	int *words = malloc((lits.n + 1) * sizeof *words);
+	int n;
+
+	for (n = 0; n < lits.n; n++) {
+		words[n] = instrs.v[lits.instr[n]].a.known_word_count;
+		if (!words[n])
+			words[n] = 1;
+	}
+	return words;
+}
+
+void literals_restore(const int *words)
+{
+	int n;
+
+	for (n = 0; n < lits.n; n++)
+		literal_set(lits.instr[n], words[n]);
+}
+
+void literals_free(void)
+{
+	free(lits.instr);
+	lits.instr = NULL;
+	lits.n = lits.alloc = 0;
+}
+
 /*
  * Output support
  */
 
-int instruction_get_binary(u16 *dest, void *private)
+int instruction_get_binary(u16 *dest, int n)
 {
 	u16 word = 0;
-	struct instr *i = private;
+	struct instr *i = &instrs.v[n];
 	int nwords = 0;
 
-	assert(i->a);
 	BINGEN_DBG_FUNC("opcode:%x", i->opcode);
-	BINGEN_DBG(" a:%x", operand_firstbits(i->a));
-	if (i->b) {
-		BINGEN_DBG(" b:%x", operand_firstbits(i->b));
+	BINGEN_DBG(" a:%x", operand_firstbits(&i->a));
+	if (has_b(i)) {
+		BINGEN_DBG(" b:%x", operand_firstbits(&i->b));
 	}
 
 	if (is_special(i->opcode)) {
 		BINGEN_DBG(" special");
 		word |= opcode2bits(i->opcode) << 5;
 		BINGEN_DBG(" w/op:%x ", word);
-		word |= operand_firstbits(i->a) << 10;
+		word |= operand_firstbits(&i->a) << 10;
 	} else {
-		assert(i->b);
+		assert(has_b(i));
 		BINGEN_DBG(" normal");
 		word |= opcode2bits(i->opcode);
 		BINGEN_DBG(" w/op:%04x", word);
-		word |= operand_firstbits(i->a) << 10;
+		word |= operand_firstbits(&i->a) << 10;
 		BINGEN_DBG(" w/a:%x", word);
 		/* b may not be short literal form */
-		word |= operand_firstbits(i->b) << 5;
+		word |= operand_firstbits(&i->b) << 5;
 	}
 	BINGEN_DBG("\n");
 	dest[nwords++] = word;
-	if (operand_needs_nextword(i->a)) {
-		dest[nwords++] = operand_nextbits(i->a);
+	if (operand_needs_nextword(&i->a)) {
+		dest[nwords++] = operand_nextbits(&i->a);
 	}
-	if (i->b && operand_needs_nextword(i->b)) {
-		dest[nwords++] = operand_nextbits(i->b);
+	if (has_b(i) && operand_needs_nextword(&i->b)) {
+		dest[nwords++] = operand_nextbits(&i->b);
 	}
 	return nwords;
 }
@@ -503,45 +749,77 @@ int operand_print_asm(char *buf, struct operand *o)
 	return count;
 }
 
-static int instruction_print_asm(char *buf, void *private)
+int instruction_print_asm(char *buf, int n)
 {
 	int count;
-	struct instr *i = private;
+	struct instr *i = &instrs.v[n];
 
 	count = sprintf(buf, "%s ", opcode2str(i->opcode));
-	if (i->b) {
-		count += operand_print_asm(buf + count, i->b);
+	if (has_b(i)) {
+		count += operand_print_asm(buf + count, &i->b);
 		count += sprintf(buf + count, ", ");
 	}
-	count += operand_print_asm(buf + count, i->a);
+	count += operand_print_asm(buf + count, &i->a);
 	return count;
 }
 
-/* cleanup */
-static void free_operand(struct operand *o)
+/* each next word costs a cycle on top of the opcode's own */
+int instruction_cycles(int n)
 {
-	if (o->expr)
-		free_expr(o->expr);
-	free(o);
+	return opcode_cycles(instrs.v[n].opcode) +
+			instruction_binary_size(n) - 1;
 }
 
-static void instruction_free_private(void *private)
+int instructions_count(void)
 {
-	struct instr *i = private;
-	if (i->a)
-		free_operand(i->a);
-	if (i->b)
-		free_operand(i->b);
-	free(i);
+	return instrs.n;
 }
 
-static struct statement_ops instruction_statement_ops = {
-	.validate        = instruction_validate,
-	.analyse         = NULL,	/* all done during get-length.. for now */
-	.freeze          = instruction_freeze,
-	.get_binary_size = instruction_binary_size,
-	.get_binary      = instruction_get_binary,
-	.print_asm       = instruction_print_asm,
-	.free_private    = instruction_free_private,
-	.type            = STMT_INSTRUCTION,
-};
+/* call fn for each symbol the operands use, in source order */
+void instruction_for_each_symbol(int n,
+						void (*fn)(struct symbol *sym, void *arg), void *arg)
+{
+	struct instr *i = &instrs.v[n];
+
+	if (has_b(i) && i->b.expr)
+		expr_for_each_symbol(i->b.expr, fn, arg);
+	if (i->a.expr)
+		expr_for_each_symbol(i->a.expr, fn, arg);
+}
+
+/* --watch: lines were added or removed above the instruction */
+void instruction_shift(int n, int lines)
+{
+	instrs.v[n].a.loc.line += lines;
+	instrs.v[n].b.loc.line += lines;
+}
+
+/*
+ * --watch: its line was edited. Its index is not used again, see
+ * statements_splice().
+ */
+void instruction_remove(int n)
+{
+	struct instr *i = &instrs.v[n];
+
+	if (i->a.expr)
+		free_expr(i->a.expr);
+	if (i->b.expr)
+		free_expr(i->b.expr);
+	i->a.expr = i->b.expr = NULL;
+}
+
+/* cleanup */
+void instructions_free(void)
+{
+	struct instr *i;
+
+	for (i = instrs.v; i < instrs.v + instrs.n; i++) {
+		if (i->a.expr)
+			free_expr(i->a.expr);
+		if (i->b.expr)
+			free_expr(i->b.expr);
+	}
+	free(instrs.v);
+	memset(&instrs, 0, sizeof instrs);
+}
@@ -9,6 +9,7 @@
 struct operand;
 struct instr;
 
+#include "dasdefs.h"
 #include "expression.h"
 #include "output.h"
 
@@ -26,11 +27,52 @@ enum op_pos {
 /* Parse */
 struct operand* gen_operand(LOCTYPE loc, int reg, struct expr *e,
 							enum opstyle style);
-void gen_instruction(int opcode, struct operand *b, struct operand *a);
+void gen_instruction(LOCTYPE loc, int opcode, struct operand *b,
+						struct operand *a);
 struct operand* operand_set_indirect(struct operand *);
 struct operand* operand_set_position(struct operand *o, enum op_pos pos);
 
+/*
+ * Statements: n is the instruction's index in parse order, see
+ * add_statement(). Sizing is as described at statements_analyse().
+ * size_fixed: nonzero if the size no longer depends on symbol values, so
+ * binary_size may be called out of order, on any thread.
+ * max_size: most words it could still grow to. decide_size: settle what
+ * size it can from symbol value ranges. fold: turn what has a final value
+ * in the operands into constants. Both return nonzero if anything was.
+ */
+int instruction_validate(int n);
+int instruction_size_fixed(int n);
+int instruction_binary_size(int n);
+int instruction_max_size(int n);
+int instruction_decide_size(int n);
+int instruction_fold(int n);
+int instruction_freeze(int n);
+int instruction_get_binary(u16 *dest, int n);
+int instruction_print_asm(char *buf, int n);
+int instruction_cycles(int n);
+int instructions_count(void);
+void instruction_for_each_symbol(int n,
+						void (*fn)(struct symbol *sym, void *arg), void *arg);
+void instructions_free(void);
+
+/*
+ * --watch, on the parse kept between builds. constant: no symbol value
+ * can change its binary. set_encoded: it was validated and frozen ahead
+ * of the build, quietly. shift: move it down by lines. remove: free it.
+ */
+int instruction_constant(int n);
+void instruction_set_encoded(int n);
+void instruction_shift(int n, int lines);
+void instruction_remove(int n);
+
 /* Analysis */
+void literals_all_short(void);
+int literals_grow(void);
+int literals_shrink(void);
+int* literals_save(void);
+void literals_restore(const int *words);
+void literals_free(void);
 
 /* Output */
 void dump_operand(struct operand*);
@@ -652,18 +652,20 @@ char *yytext;
  */
 #include <stdarg.h>
 
-void yyerror(char *s, ...);
+void yyerror(const char *s, ...);
 #include "y.tab.h"
 #include "dasdefs.h"
+#include "dat.h"
 #include "output.h"
 static int get_constant(void);
+static int symbol_token(void);
 
 #define YY_USER_ACTION yylloc.line = yylineno;
 
 /* shut up warnings */
 #define YY_NO_INPUT 1
 /* temporary fixup for clang, ignore these: */
-#line 667 "src/lex.yy.c"
+#line 669 "src/lex.yy.c"
 
 #define INITIAL 0
 
@@ -848,10 +850,10 @@ YY_DECL
 	register char *yy_cp, *yy_bp;
 	register int yy_act;
     
-#line 41 "src/das.l"
+#line 43 "src/das.l"
 
 
-#line 855 "src/lex.yy.c"
+#line 857 "src/lex.yy.c"
 
 	if ( !(yy_init) )
 		{
@@ -946,7 +948,7 @@ do_action:	/* This label is used only to access EOF actions. */
 
 case 1:
 YY_RULE_SETUP
-#line 43 "src/das.l"
+#line 45 "src/das.l"
 {
 						if (!outopts.no_warn_ignored)
 							loc_warn(yylloc, "ignoring directive");
@@ -954,17 +956,17 @@ YY_RULE_SETUP
 	YY_BREAK
 case 2:
 YY_RULE_SETUP
-#line 48 "src/das.l"
+#line 50 "src/das.l"
 return EQU;
 	YY_BREAK
 case 3:
 YY_RULE_SETUP
-#line 49 "src/das.l"
+#line 51 "src/das.l"
 { yylval.string = yytext + 1; return LABEL; }
 	YY_BREAK
 case 4:
 YY_RULE_SETUP
-#line 50 "src/das.l"
+#line 52 "src/das.l"
 {
 						yylval.string = yytext;
 						yytext[strlen(yytext) - 1] = 0;
@@ -973,99 +975,99 @@ YY_RULE_SETUP
 	YY_BREAK
 case 5:
 YY_RULE_SETUP
-#line 55 "src/das.l"
+#line 57 "src/das.l"
 return get_constant();
 	YY_BREAK
 case 6:
 YY_RULE_SETUP
-#line 56 "src/das.l"
+#line 58 "src/das.l"
 return get_constant();
 	YY_BREAK
 /* */
 case 7:
 YY_RULE_SETUP
-#line 58 "src/das.l"
+#line 60 "src/das.l"
 { yylval.integer = REG_POP; return REG; }
 	YY_BREAK
 case 8:
 YY_RULE_SETUP
-#line 59 "src/das.l"
+#line 61 "src/das.l"
 { yylval.integer = REG_PUSH; return REG; }
 	YY_BREAK
 /* */
 case 9:
 YY_RULE_SETUP
-#line 61 "src/das.l"
+#line 63 "src/das.l"
 { yylval.integer = str2reg(yytext); return REG; }
 	YY_BREAK
 case 10:
 YY_RULE_SETUP
-#line 62 "src/das.l"
+#line 64 "src/das.l"
 { yylval.integer = str2opcode(yytext); return OP2; }
 	YY_BREAK
 case 11:
 YY_RULE_SETUP
-#line 63 "src/das.l"
+#line 65 "src/das.l"
 { yylval.integer = str2opcode(yytext); return OP1; }
 	YY_BREAK
 case 12:
 YY_RULE_SETUP
-#line 64 "src/das.l"
+#line 66 "src/das.l"
 { return DAT; }
 	YY_BREAK
 case 13:
 YY_RULE_SETUP
-#line 65 "src/das.l"
-{ yylval.string = yytext; return SYMBOL; }
+#line 67 "src/das.l"
+return symbol_token();
 	YY_BREAK
 case 14:
 /* rule 14 can match eol */
 YY_RULE_SETUP
-#line 66 "src/das.l"
+#line 68 "src/das.l"
 { yylval.string = yytext; return STRING; }
 	YY_BREAK
 case 15:
 YY_RULE_SETUP
-#line 67 "src/das.l"
+#line 69 "src/das.l"
 return LSHIFT;
 	YY_BREAK
 case 16:
 YY_RULE_SETUP
-#line 68 "src/das.l"
+#line 70 "src/das.l"
 return RSHIFT;
 	YY_BREAK
 case 17:
 /* rule 17 can match eol */
 YY_RULE_SETUP
-#line 70 "src/das.l"
+#line 72 "src/das.l"
 return *yytext;
 	YY_BREAK
 case 18:
 YY_RULE_SETUP
-#line 72 "src/das.l"
+#line 74 "src/das.l"
 ;		/* ignore whitespace and DOS line endings */
 	YY_BREAK
 case 19:
 YY_RULE_SETUP
-#line 73 "src/das.l"
+#line 75 "src/das.l"
 ;		/* comment */
 	YY_BREAK
 /* Magic to fix input with missing \n on last line */
 case YY_STATE_EOF(INITIAL):
-#line 76 "src/das.l"
+#line 78 "src/das.l"
 { static int once = 0; return once++ ? 0 : '\n'; }
 	YY_BREAK
 case 20:
 YY_RULE_SETUP
-#line 78 "src/das.l"
+#line 80 "src/das.l"
 yyerror("invalid character '%c'", *yytext);
 	YY_BREAK
 case 21:
 YY_RULE_SETUP
-#line 80 "src/das.l"
+#line 82 "src/das.l"
 ECHO;
 	YY_BREAK
-#line 1069 "src/lex.yy.c"
+#line 1071 "src/lex.yy.c"
 
 	case YY_END_OF_BUFFER:
 		{
@@ -2032,7 +2034,7 @@ void yyfree (void * ptr )
 
 #define YYTABLES_NAME "yytables"
 
-#line 80 "src/das.l"
+#line 82 "src/das.l"
 
 
 
@@ -2042,19 +2044,42 @@ static int get_constant(void)
 	return CONSTANT;
 }
 
+/* a symbol, or a string directive, exactly as written, as dfalex.c has it */
+static int symbol_token(void)
+{
+	static const struct {
+		const char *name;
+		int pack;
+	} directives[] = {
+		{ ".packed",    DAT_PACK_HI },
+		{ ".packed_le", DAT_PACK_LO },
+		{ ".pstring",   DAT_PACK_PSTRING },
+	};
+	int i;
+
+	for (i = 0; *yytext == '.' && i < ARRAY_SIZE(directives); i++) {
+		if (!strcmp(yytext, directives[i].name)) {
+			yylval.integer = directives[i].pack;
+			return PACKDIR;
+		}
+	}
+	yylval.string = yytext;
+	return SYMBOL;
+}
+
 int yywrap(void)
 {
 	return 1;
 }
 
-void yyerror(char *s, ...)
+void yyerror(const char *s, ...)
 {
 	va_list ap;
-	va_start(ap, s);
 
-	fprintf(stderr, "line %d: Error: ", yylineno);
-	vfprintf(stderr, s, ap);
-	fprintf(stderr, "\n");
-	das_error = 1;
+	output_message(1, "line %d: Error: ", yylineno);
+	va_start(ap, s);
+	output_vmessage(1, s, ap);
+	va_end(ap);
+	output_message(1, "\n");
 }
 
@@ -1,5 +1,99 @@
+#include <stdarg.h>
+#include <stdlib.h>
+
 #include "output.h"
 
 struct outopts outopts = {
 	.stack_style_sp = 0,
 };
+
+/* where this thread's messages go instead of stderr, if set */
+#ifdef HAVE_PTHREADS
+static __thread struct textbuf *held;
+#else
+static struct textbuf *held;
+#endif
+
+static int textbuf_vprintf(struct textbuf *tb, const char *fmt, va_list ap)
+{
+	va_list again;
+	int n;
+
+	va_copy(again, ap);
+	n = vsnprintf(tb->text ? tb->text + tb->len : NULL, tb->size - tb->len,
+					fmt, again);
+	va_end(again);
+	if (n < 0)
+		return n;
+	if (tb->len + n >= tb->size) {
+		tb->size = (tb->len + n + 1) * 2;
+		if (tb->size < 4096)
+			tb->size = 4096;
+		tb->text = realloc(tb->text, tb->size);
+		vsnprintf(tb->text + tb->len, tb->size - tb->len, fmt, ap);
+	}
+	tb->len += n;
+	return n;
+}
+
+/* printf() onto the end of tb */
+int textbuf_printf(struct textbuf *tb, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = textbuf_vprintf(tb, fmt, ap);
+	va_end(ap);
+	return n;
+}
+
+void textbuf_fwrite(struct textbuf *tb, FILE *f)
+{
+	if (tb->len)
+		fwrite(tb->text, 1, tb->len, f);
+}
+
+void textbuf_free(struct textbuf *tb)
+{
+	free(tb->text);
+	*tb = (struct textbuf){ 0 };
+}
+
+/* output_message() with a va_list, for the scanners' own error functions */
+void output_vmessage(int is_error, const char *fmt, va_list ap)
+{
+	if (held) {
+		textbuf_vprintf(held, fmt, ap);
+		held->error |= is_error;
+	} else {
+		vfprintf(stderr, fmt, ap);
+		if (is_error)
+			das_error = 1;
+	}
+}
+
+/* backend of the _warn() and _error() macros */
+void output_message(int is_error, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	output_vmessage(is_error, fmt, ap);
+	va_end(ap);
+}
+
+/* collect this thread's messages in tb from now on, or stop if NULL */
+void output_hold(struct textbuf *tb)
+{
+	held = tb;
+}
+
+/* print messages held in tb as if they had been printed when made */
+void output_release(struct textbuf *tb)
+{
+	textbuf_fwrite(tb, stderr);
+	if (tb->error)
+		das_error = 1;
+	textbuf_free(tb);
+}
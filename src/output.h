@@ -4,6 +4,7 @@
  * output messages and location tracking.
  * perhaps needs a bit of a rethink and refactoring.
  */
+#include <stdarg.h>
 #include <stdio.h>
 
 extern int das_error;
@@ -29,6 +30,28 @@ extern struct outopts {
 		printf(fmt, ##args); \
 } while (0)
 
+/*
+ * text collected in memory, e.g. by a worker thread until it is its turn
+ * to write
+ */
+struct textbuf {
+	char *text;
+	size_t len, size;
+	int error;			/* held messages include an error */
+};
+
+int textbuf_printf(struct textbuf *tb, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void textbuf_fwrite(struct textbuf *tb, FILE *f);
+void textbuf_free(struct textbuf *tb);
+
+void output_message(int is_error, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void output_vmessage(int is_error, const char *fmt, va_list ap)
+	__attribute__((format(printf, 2, 0)));
+void output_hold(struct textbuf *tb);
+void output_release(struct textbuf *tb);
+
 /*
  * error and warning ugly macros:
  * _warn()      appends \n and writes to stderr
@@ -37,13 +60,12 @@ extern struct outopts {
  * error()      prepends "Error: " and calls _error()
  * loc_warn()   prepends location info, "Warning: ", calls _warn()
  * loc_err()    blah blah blah you get the idea
+ *
+ * A thread between output_hold() and output_hold(NULL) collects these
+ * instead, to be printed by output_release() in order with other threads'.
  */
-#define _warn(fmt, args...) fprintf(stderr, fmt "\n", ##args)
-
-#define _error(fmt, args...) do { \
-	_warn(fmt, ##args); \
-	das_error = 1; \
-} while (0)
+#define _warn(fmt, args...) output_message(0, fmt "\n", ##args)
+#define _error(fmt, args...) output_message(1, fmt "\n", ##args)
 
 #define error(fmt, args...) _error("Error: " fmt, ##args)
 #define warn(fmt, args...) _warn("Warning: " fmt, ##args)
@@ -55,15 +77,12 @@ extern struct outopts {
 
 /* report internal bugs */
 #define BUG_ON(x) ({ int r = !!(x); \
-	if (r) { \
-		fprintf(stderr, "%s:%d BUG_ON(%s)\n", __FILE__, __LINE__, #x); \
-		das_error = 1; \
-	} \
+	if (r) \
+		_error("%s:%d BUG_ON(%s)", __FILE__, __LINE__, #x); \
 	r; \
 })
 
-#define BUG() fprintf(stderr, "BUG at %s:%d in %s()\n", \
-						__FILE__, __LINE__, __func__);
+#define BUG() _warn("BUG at %s:%d in %s()", __FILE__, __LINE__, __func__);
 
 #ifdef DEBUG
   #define DBG(fmt, args...) fprintf(stderr, fmt, ##args)
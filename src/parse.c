@@ -0,0 +1,976 @@
+/*
+ * das hand-written parser for the line grammar in das.y
+ *
+ * Recursive descent, with precedence climbing for expressions, pulling
+ * tokens from the scanner into a buffer for the current line and making
+ * the same gen_*() calls the das.y actions would, in the same order.
+ * Everything up to the statement itself only allocates (and looks up
+ * symbols, as bison would have done by then too), so the statement is
+ * only added once the whole line has been seen to be good.
+ *
+ * Lines that turn out bad are handed to the bison parser: the buffered
+ * tokens are replayed through parse_lex() and it carries on reading the
+ * rest of the line live, so syntax error messages and error recovery are
+ * exactly the bison ones. We stop scanning at the first bad token, which
+ * is where bison stops too, so scanner diagnostics come out in the same
+ * order.
+ *
+ * This must never accept a line bison would reject; rejecting a good line
+ * only costs speed. Keep it in step with das.y.
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREADS
+  #include <pthread.h>
+#endif
+
+#include "das.h"
+#include "dasdefs.h"
+#include "dat.h"
+#include "expression.h"
+#include "instruction.h"
+#include "output.h"
+#include "parse.h"
+#include "scan.h"
+#include "statement.h"
+#include "symbol.h"
+#include "threads.h"
+#include "y.tab.h"
+
+/* chunks parsed side by side need the reentrant hand-written scanner */
+#if defined(HAVE_PTHREADS) && defined(LEXER_DFA)
+  #define PARALLEL_PARSE
+#endif
+
+/* with automatic job count, don't bother splitting less than this a chunk */
+#define PARSE_CHUNK_MIN		(256 * 1024)
+
+extern int yylineno;
+int yylex(void);
+int yyparse(void);
+
+#ifndef LEXER_DFA
+/*
+ * --dump-source with the flex scanner: it scans a copy of the whole input,
+ * which it writes on, so token positions in the copy are the same ones in
+ * the original
+ */
+extern FILE *yyin;
+extern char *yytext;
+extern int yyleng;
+struct yy_buffer_state* yy_scan_buffer(char *base, size_t size);
+void yy_delete_buffer(struct yy_buffer_state *b);
+void yyrestart(FILE *f);
+
+static struct {
+	char *text;
+	char *copy;
+	struct yy_buffer_state *buf;
+} flex_input;
+
+/* from before the last parse_restart(), see there */
+static struct {
+	char **text;
+	int n;
+} flex_old;
+#endif
+
+struct ptoken {
+	int tok;
+	int line;				/* yylloc.line, token location */
+	int lineno;				/* yylineno after scanning, for bison messages */
+	int integer;
+	char *text;				/* scanner's text, good until the next token */
+	struct symbol *sym;		/* SYMBOL once looked up */
+	int copy;				/* offset of saved text in ps->strings, or -1 */
+	const char *start, *end;	/* in the input, hand-written scanner only */
+};
+
+/*
+ * what a chunk parsed on a worker thread would have done to the global
+ * state, replayed in order once the chunks before it are in
+ */
+struct parse_event {
+	enum {
+		EV_LABEL,
+		EV_INSTR,
+		EV_DAT,
+		EV_EQU,
+	} type;
+	LOCTYPE loc;
+	struct stmt_text text;		/* see statement_source() */
+	union {
+		struct symbol *label;
+		struct {
+			int opcode;
+			struct operand *b, *a;
+		} instr;
+		struct dat_elem *dat;
+		struct {
+			struct symbol *sym;
+			struct expr *expr;
+		} equ;
+	};
+};
+
+/*
+ * a run of whole lines of the input. Symbols are looked up in a table of
+ * its own and statements are logged as events, the symbol expressions are
+ * kept to point at the global symbols later.
+ */
+struct chunk {
+	const char *start, *end;
+	int lineno;				/* at start */
+	struct scanner sc;
+	/* start of the line parsing stopped at: the first at or after end */
+	const char *stop;
+	int stop_lineno;
+	int bailed;				/* or earlier, at one for the serial parser */
+	int parsed;
+	struct symtab *symtab;
+	struct parse_event *ev;
+	int nev, evalloced;
+	struct expr **symexprs;
+	int nsymexprs, symexprsalloced;
+#ifdef PARALLEL_PARSE
+	pthread_t thread;
+	int running;
+#endif
+};
+
+struct parser {
+	struct chunk *chunk;	/* worker thread, else the yylex() scanner */
+#ifdef LEXER_DFA
+	struct scanner *sc;		/* the chunk's, or yylex_scanner() */
+#endif
+	struct ptoken *tok;		/* tokens of the current line so far */
+	int ntok, alloced;
+	int pos;				/* next token to parse */
+	int error;				/* syntax error at tok[pos - 1] */
+	int eof;
+	/* strings are changed in place by new_string_dat_elem(), keep a copy */
+	char *strings;
+	int stringslen, stringssize;
+	/* bison is reading via parse_lex() */
+	int replay;
+	int replay_pos;
+	int replay_done;
+	int stmt;				/* first token of the statement */
+};
+
+/* the one on the main thread, behind parse_lex() */
+static struct parser serial;
+
+/* keep a copy of token text for bison to have if the line is replayed */
+static void save_text(struct parser *ps, struct ptoken *t, const char *text)
+{
+	int len = strlen(text) + 1;
+
+	if (ps->stringslen + len > ps->stringssize) {
+		ps->stringssize = (ps->stringslen + len) * 2;
+		ps->strings = realloc(ps->strings, ps->stringssize);
+	}
+	memcpy(ps->strings + ps->stringslen, text, len);
+	t->copy = ps->stringslen;
+	ps->stringslen += len;
+}
+
+/*
+ * token n ahead of the parse position, scanning it if need be. Only ever
+ * one token past anything already looked at, and never past the newline.
+ * The pointer is good until the next scan. A macro, so that the usual
+ * case of a token already scanned costs no call.
+ */
+#define peek(ps, n)		((ps)->pos + (n) < (ps)->ntok ? \
+							&(ps)->tok[(ps)->pos + (n)] : scan_ahead(ps, n))
+
+/* scan one more token into the line buffer, unless the line is done */
+static struct ptoken* scan_ahead(struct parser *ps, int n)
+{
+	struct ptoken *t;
+	YYSTYPE lval;
+	YYLTYPE lloc;
+
+	if (ps->ntok) {
+		t = &ps->tok[ps->ntok - 1];
+		if (t->tok == '\n' || t->tok == 0)
+			return t;
+	}
+	if (ps->ntok == ps->alloced) {
+		ps->alloced = ps->alloced ? ps->alloced * 2 : 64;
+		ps->tok = realloc(ps->tok, ps->alloced * sizeof *ps->tok);
+	}
+	t = &ps->tok[ps->ntok++];
+#ifdef LEXER_DFA
+	/* straight from the scanner, keeping yylineno as yylex() would */
+	if (!ps->chunk)
+		ps->sc->lineno = yylineno;
+	t->tok = scanner_next(ps->sc, &lval, &lloc);
+	t->lineno = ps->sc->lineno;
+	t->start = ps->sc->tok;
+	t->end = ps->sc->p;
+	if (!ps->chunk)
+		yylineno = t->lineno;
+#else
+	t->tok = yylex();
+	lval = yylval;
+	lloc = yylloc;
+	t->lineno = yylineno;
+	t->start = t->end = NULL;
+	if (flex_input.copy) {
+		t->start = flex_input.text + (yytext - flex_input.copy);
+		t->end = t->start + yyleng;
+	}
+#endif
+	t->line = lloc.line;
+	t->sym = NULL;
+	t->copy = -1;
+
+	switch (t->tok) {
+	case 0:
+		ps->eof = 1;
+		break;
+	case STRING:
+		save_text(ps, t, lval.string);
+		/* fall through */
+	case SYMBOL:
+	case LABEL:
+		t->text = lval.string;
+		break;
+	default:
+		t->integer = lval.integer;
+		break;
+	}
+	/* one past what was looked at, so this is the one asked for */
+	return t;
+}
+
+/*
+ * the token at the parse position, moving past it. Parsing stops at the
+ * newline, as the end or as an error, so this is never used past it.
+ */
+#define next(ps)		(peek(ps, 0), &(ps)->tok[(ps)->pos++])
+
+/* nothing more is scanned once an error is found, bison takes over there */
+#define expect(ps, t)	do { \
+							if (!(ps)->error && next(ps)->tok != (t)) \
+								(ps)->error = 1; \
+						} while (0)
+
+#define tok_loc(t)		((LOCTYPE){ .line = (t)->line })
+
+/*
+ * making statements: straight away on the main thread, logged for
+ * chunk_merge() on a worker
+ */
+
+static struct parse_event* log_event(struct chunk *c, int type, LOCTYPE loc)
+{
+	struct parse_event *ev;
+
+	if (c->nev == c->evalloced) {
+		c->evalloced = c->evalloced ? c->evalloced * 2 : 1024;
+		c->ev = realloc(c->ev, c->evalloced * sizeof *c->ev);
+	}
+	ev = &c->ev[c->nev++];
+	ev->type = type;
+	ev->loc = loc;
+	return ev;
+}
+
+static struct symbol* lookup_symbol(struct parser *ps, struct ptoken *t)
+{
+	if (ps->chunk)
+		t->sym = symtab_parse(ps->chunk->symtab, t->text);
+	else
+		t->sym = symbol_parse(t->text);
+	return t->sym;
+}
+
+static struct expr* make_symbol_expr(struct parser *ps, struct ptoken *t)
+{
+	struct chunk *c = ps->chunk;
+	struct expr *e = gen_symbol_expr(tok_loc(t), lookup_symbol(ps, t));
+
+	if (c) {
+		if (c->nsymexprs == c->symexprsalloced) {
+			c->symexprsalloced = c->symexprsalloced ?
+				c->symexprsalloced * 2 : 1024;
+			c->symexprs = realloc(c->symexprs,
+				c->symexprsalloced * sizeof *c->symexprs);
+		}
+		c->symexprs[c->nsymexprs++] = e;
+	}
+	return e;
+}
+
+/*
+ * --dump-source: the text of the statement just parsed, unless the listing
+ * has to print it its own way: stack access in the style asked for, or a
+ * string running over lines.
+ */
+static struct stmt_text statement_text(struct parser *ps)
+{
+	struct stmt_text text = { NULL, 0 };
+	struct ptoken *first = &ps->tok[ps->stmt], *last = &ps->tok[ps->pos - 1];
+	struct ptoken *t;
+
+	if (!options.dump_source || !first->start)
+		return text;
+	for (t = first; t <= last; t++) {
+		if (t->tok != REG)
+			continue;
+		switch (t->integer) {
+		case REG_PUSH:
+		case REG_POP:
+		case REG_PEEK:
+		case REG_PICK:
+		case REG_SP:
+			return text;
+		}
+	}
+	if (memchr(first->start, '\n', last->end - first->start))
+		return text;
+	text.p = first->start;
+	text.len = last->end - first->start;
+	return text;
+}
+
+static void make_label(struct parser *ps, struct ptoken *t)
+{
+	if (ps->chunk)
+		log_event(ps->chunk, EV_LABEL, tok_loc(t))->label =
+			lookup_symbol(ps, t);
+	else
+		label_parse(tok_loc(t), t->text);
+}
+
+static void make_instruction(struct parser *ps, LOCTYPE loc, int opcode,
+							struct operand *b, struct operand *a)
+{
+	struct parse_event *ev;
+
+	struct stmt_text text = statement_text(ps);
+
+	if (ps->chunk) {
+		ev = log_event(ps->chunk, EV_INSTR, loc);
+		ev->text = text;
+		ev->instr.opcode = opcode;
+		ev->instr.b = b;
+		ev->instr.a = a;
+	} else {
+		if (text.p)
+			statement_source(text.p, text.len);
+		gen_instruction(loc, opcode, b, a);
+	}
+}
+
+static void make_dat(struct parser *ps, LOCTYPE loc, struct dat_elem *first)
+{
+	struct parse_event *ev;
+	struct stmt_text text = statement_text(ps);
+
+	if (ps->chunk) {
+		ev = log_event(ps->chunk, EV_DAT, loc);
+		ev->text = text;
+		ev->dat = first;
+	} else {
+		if (text.p)
+			statement_source(text.p, text.len);
+		gen_dat(loc, first);
+	}
+}
+
+static void make_equ(struct parser *ps, LOCTYPE loc, struct symbol *sym,
+					struct expr *e)
+{
+	struct parse_event *ev;
+
+	struct stmt_text text = statement_text(ps);
+
+	if (ps->chunk) {
+		ev = log_event(ps->chunk, EV_EQU, loc);
+		ev->text = text;
+		ev->equ.sym = sym;
+		ev->equ.expr = e;
+	} else {
+		if (text.p)
+			statement_source(text.p, text.len);
+		directive_equ(loc, sym, e);
+	}
+}
+
+/* binary operator precedence as declared in das.y, 0 if not one */
+static const char binop_precs[] = {
+	['|'] = 1,
+	['^'] = 2,
+	['&'] = 3,
+	[LSHIFT] = 4,
+	[RSHIFT] = 4,
+	['+'] = 5,
+	['-'] = 5,
+	['*'] = 6,
+	['/'] = 6,
+};
+
+#define binop_prec(tok)	((unsigned)(tok) < sizeof binop_precs ? \
+							binop_precs[tok] : 0)
+
+static struct expr* parse_expr(struct parser *ps, int minprec,
+								int operand_top);
+
+/* constant, symbol, unary operator or bracketed expression */
+static struct expr* parse_unary(struct parser *ps)
+{
+	struct ptoken *t = next(ps);
+	LOCTYPE loc = tok_loc(t);
+	struct expr *e;
+	int op;
+
+	switch (t->tok) {
+	case CONSTANT:
+		return gen_const_expr(loc, t->integer);
+	case SYMBOL:
+		return make_symbol_expr(ps, t);
+	case '-':
+	case '~':
+		/* unary operators bind tighter than any binary one */
+		op = t->tok == '-' ? UMINUS : '~';
+		e = parse_unary(ps);
+		return ps->error ? NULL : gen_op_expr(loc, op, NULL, e);
+	case '(':
+		e = parse_expr(ps, 1, 0);
+		expect(ps, ')');
+		return ps->error ? NULL : gen_op_expr(loc, '(', NULL, e);
+	}
+	ps->error = 1;
+	return NULL;
+}
+
+/*
+ * precedence climbing, all binary operators are left associative.
+ * operand_top is set for the outermost expression of an op_expr, where
+ * "expr + REG" is allowed: there a + followed by a register ends the
+ * expression. Anywhere else bison shifts the + and then chokes on the
+ * register, and so do we.
+ */
+static struct expr* parse_expr(struct parser *ps, int minprec,
+								int operand_top)
+{
+	LOCTYPE loc = tok_loc(peek(ps, 0));
+	struct expr *lhs, *rhs;
+	int op, prec;
+
+	lhs = parse_unary(ps);
+	while (!ps->error) {
+		op = peek(ps, 0)->tok;
+		prec = binop_prec(op);
+		if (!prec || prec < minprec)
+			break;
+		if (op == '+' && operand_top && peek(ps, 1)->tok == REG)
+			break;
+		ps->pos++;
+		rhs = parse_expr(ps, prec + 1, 0);
+		if (!ps->error)
+			lhs = gen_op_expr(loc, op, lhs, rhs);
+	}
+	return lhs;
+}
+
+#define starts_expr(tok)	((tok) == CONSTANT || (tok) == SYMBOL || \
+							(tok) == '-' || (tok) == '~' || (tok) == '(')
+
+static struct operand* parse_op_expr(struct parser *ps)
+{
+	struct ptoken *first = peek(ps, 0);
+	LOCTYPE loc = tok_loc(first);
+	struct expr *e;
+	int reg = first->integer;
+	int tok;
+
+	if (first->tok == REG) {
+		ps->pos++;
+		tok = peek(ps, 0)->tok;
+		if (tok == '+') {
+			ps->pos++;
+			e = parse_expr(ps, 1, 0);
+			return gen_operand(loc, reg, e, OPSTYLE_PLUS);
+		}
+		if (starts_expr(tok)) {
+			/* PICK n */
+			e = parse_expr(ps, 1, 0);
+			return gen_operand(loc, reg, e, OPSTYLE_PICK);
+		}
+		return gen_operand(loc, reg, NULL, OPSTYLE_SOLO);
+	}
+
+	e = parse_expr(ps, 1, 1);
+	if (!ps->error && peek(ps, 0)->tok == '+') {
+		/* parse_expr() only leaves a + in front of a register */
+		reg = peek(ps, 1)->integer;
+		ps->pos += 2;
+		return gen_operand(loc, reg, e, OPSTYLE_PLUS);
+	}
+	return gen_operand(loc, REG_NONE, e, OPSTYLE_SOLO);
+}
+
+static struct operand* parse_operand(struct parser *ps)
+{
+	struct operand *o;
+
+	if (peek(ps, 0)->tok != '[')
+		return parse_op_expr(ps);
+	ps->pos++;
+	o = parse_op_expr(ps);
+	expect(ps, ']');
+	return ps->error ? o : operand_set_indirect(o);
+}
+
+/* all good up to the end of the line, time to make the statement */
+static int line_ok(struct parser *ps)
+{
+	if (!ps->error && peek(ps, 0)->tok != '\n')
+		ps->error = 1;
+	return !ps->error;
+}
+
+static void parse_dat(struct parser *ps, LOCTYPE loc, int pack)
+{
+	struct dat_elem *first = NULL, *last = NULL, *elem;
+	struct ptoken *t;
+
+	for (;;) {
+		t = peek(ps, 0);
+		if (t->tok == STRING) {
+			ps->pos++;
+			elem = new_string_dat_elem(t->text);
+		} else {
+			elem = new_expr_dat_elem(parse_expr(ps, 1, 0));
+		}
+		if (last)
+			dat_elem_follows(last, elem);
+		else
+			first = elem;
+		last = elem;
+		if (ps->error || peek(ps, 0)->tok != ',')
+			break;
+		ps->pos++;
+	}
+
+	if (line_ok(ps))
+		make_dat(ps, loc, dat_elems_pack(first, pack));
+}
+
+static void parse_statement(struct parser *ps)
+{
+	struct ptoken *t = next(ps);
+	LOCTYPE loc = tok_loc(t);
+	int opcode = t->integer;
+	struct operand *a, *b;
+	struct symbol *sym;
+	struct expr *e;
+
+	ps->stmt = ps->pos - 1;
+	switch (t->tok) {
+	case OP2:
+		b = parse_operand(ps);
+		expect(ps, ',');
+		if (ps->error)
+			break;
+		a = parse_operand(ps);
+		if (line_ok(ps)) {
+			operand_set_position(b, OP_POS_B);
+			operand_set_position(a, OP_POS_A);
+			make_instruction(ps, loc, opcode, b, a);
+		}
+		break;
+	case OP1:
+		a = parse_operand(ps);
+		if (line_ok(ps)) {
+			operand_set_position(a, OP_POS_A);
+			make_instruction(ps, loc, opcode, NULL, a);
+		}
+		break;
+	case DAT:
+		parse_dat(ps, loc, DAT_PACK_NONE);
+		break;
+	case EQU:
+		t = next(ps);
+		if (t->tok != SYMBOL) {
+			ps->error = 1;
+			break;
+		}
+		sym = lookup_symbol(ps, t);
+		expect(ps, ',');
+		if (ps->error)
+			break;
+		e = parse_expr(ps, 1, 0);
+		if (line_ok(ps))
+			make_equ(ps, loc, sym, e);
+		break;
+	case PACKDIR:
+		parse_dat(ps, loc, t->integer);
+		break;
+	default:
+		ps->error = 1;
+		break;
+	}
+}
+
+/* parse one line, returning 0 if it has to go to bison instead */
+static int parse_line(struct parser *ps)
+{
+	struct ptoken *t;
+
+	ps->ntok = 0;
+	ps->pos = 0;
+	ps->error = 0;
+	ps->stringslen = 0;
+
+	t = peek(ps, 0);
+	if (t->tok == 0)
+		return 1;
+	if (t->tok == LABEL) {
+		/*
+		 * bison reduces a label without looking ahead, before
+		 * scanning the rest of the line, so a redefinition error
+		 * comes out first. Mark it done in case of replay.
+		 */
+		make_label(ps, t);
+		t->text = NULL;
+		ps->pos++;
+	}
+	if (peek(ps, 0)->tok != '\n')
+		parse_statement(ps);
+	expect(ps, '\n');
+	return !ps->error;
+}
+
+/*
+ * parse lines from the yylex() scanner to the end of input, or up to the
+ * first line starting at or after stop if that's set. Returns nonzero if
+ * bison gave up.
+ */
+static int parse_serial(const char *stop)
+{
+	struct parser *ps = &serial;
+	int ret = 0;
+
+#ifdef LEXER_DFA
+	ps->sc = yylex_scanner();
+#endif
+	while (!ps->eof && !ret) {
+#ifdef PARALLEL_PARSE
+		if (stop && yylex_scanner()->p >= stop)
+			break;
+#endif
+		if (parse_line(ps))
+			continue;
+
+		ps->replay = 1;
+		ps->replay_pos = 0;
+		ps->replay_done = 0;
+		ret = yyparse();
+		ps->replay = 0;
+	}
+	return ret;
+}
+
+#ifdef PARALLEL_PARSE
+/*
+ * Parallel parsing: the input is cut at newlines into a chunk per job and
+ * each is parsed on its own thread with its own scanner. The chunks are
+ * then merged in order on the main thread, replaying what each did to the
+ * symbol table and statement list as if the lines had been parsed there.
+ *
+ * A worker never prints anything. It stops at the first line giving a
+ * syntax error or scanner diagnostic and leaves the rest of its chunk to
+ * parse_serial(), so messages come out from the usual places in the usual
+ * order. It also runs past the end of its chunk if a string does, in which
+ * case the next chunk started in the wrong place and is parsed serially.
+ */
+
+static void* parse_chunk(void *arg)
+{
+	struct chunk *c = arg;
+	struct parser ps = { .chunk = c, .sc = &c->sc };
+	const char *line;
+	int lineno, nev, nsymexprs;
+
+	c->symtab = symtab_new();
+	scanner_init(&c->sc, c->start, c->lineno);
+	c->sc.quiet = 1;
+	for (;;) {
+		line = c->sc.p;
+		lineno = c->sc.lineno;
+		if (line >= c->end)
+			break;
+		nev = c->nev;
+		nsymexprs = c->nsymexprs;
+		if (!parse_line(&ps) || c->sc.diags) {
+			c->nev = nev;
+			c->nsymexprs = nsymexprs;
+			c->bailed = 1;
+			break;
+		}
+	}
+	c->stop = line;
+	c->stop_lineno = lineno;
+	c->parsed = 1;
+
+	scanner_free(&c->sc);
+	free(ps.tok);
+	free(ps.strings);
+	return NULL;
+}
+
+static void chunk_free(struct chunk *c)
+{
+	if (c->symtab)
+		symtab_free(c->symtab);
+	free(c->ev);
+	free(c->symexprs);
+}
+
+static void chunk_merge(struct chunk *c)
+{
+	struct parse_event *ev;
+	int i;
+
+	symtab_merge(c->symtab);
+	for (i = 0; i < c->nsymexprs; i++)
+		expr_merge_symbol(c->symexprs[i]);
+
+	for (i = 0; i < c->nev; i++) {
+		ev = &c->ev[i];
+		switch (ev->type) {
+		case EV_LABEL:
+			label_parse(ev->loc, symbol_name(ev->label));
+			break;
+		case EV_INSTR:
+			statement_source(ev->text.p, ev->text.len);
+			gen_instruction(ev->loc, ev->instr.opcode, ev->instr.b,
+							ev->instr.a);
+			break;
+		case EV_DAT:
+			statement_source(ev->text.p, ev->text.len);
+			gen_dat(ev->loc, ev->dat);
+			break;
+		case EV_EQU:
+			statement_source(ev->text.p, ev->text.len);
+			directive_equ(ev->loc, symbol_merged(ev->equ.sym),
+						ev->equ.expr);
+			break;
+		}
+	}
+}
+
+static int count_lines(const char *p, const char *end)
+{
+	int n = 0;
+
+	while ((p = memchr(p, '\n', end - p))) {
+		p++;
+		n++;
+	}
+	return n;
+}
+
+static int parse_parallel(const char *buf, const char *end, int njobs)
+{
+	struct scanner *sc = yylex_scanner();
+	struct chunk *chunks, *c;
+	const char *p = buf, *q, *pos;
+	int i, lineno = yylineno, ret = 0;
+
+	chunks = calloc(njobs, sizeof *chunks);
+	for (i = 0; i < njobs; i++) {
+		c = &chunks[i];
+		q = buf + (end - buf) * (i + 1) / njobs;
+		if (q < p)
+			q = p;
+		q = i == njobs - 1 ? NULL : memchr(q, '\n', end - q);
+		q = q ? q + 1 : end;
+		c->start = p;
+		c->end = q;
+		c->lineno = lineno;
+		lineno += count_lines(p, q);
+		p = q;
+	}
+
+	/* the main thread does the first itself */
+	for (i = 1; i < njobs; i++) {
+		c = &chunks[i];
+		c->running = !pthread_create(&c->thread, NULL, parse_chunk, c);
+	}
+	parse_chunk(&chunks[0]);
+
+	pos = buf;
+	lineno = yylineno;
+	for (i = 0; i < njobs; i++) {
+		c = &chunks[i];
+		if (c->running)
+			pthread_join(c->thread, NULL);
+		if (ret)
+			goto next;
+
+		if (c->parsed && c->start == pos) {
+			chunk_merge(c);
+			pos = c->stop;
+			lineno = c->stop_lineno;
+			if (!c->bailed)
+				goto next;
+		} else if (pos >= c->end) {
+			goto next;
+		}
+		/* from where this chunk went wrong, or the last one overran */
+		sc->p = pos;
+		yylineno = lineno;
+		ret = parse_serial(c->end);
+		pos = sc->p;
+		lineno = yylineno;
+next:
+		chunk_free(c);
+	}
+	yylineno = lineno;
+	free(chunks);
+	return ret;
+}
+#endif
+
+/*
+ * parse the whole of yyin. Returns nonzero if bison gave up, as yyparse()
+ * does; syntax errors are otherwise reported and flagged in das_error.
+ */
+#ifndef LEXER_DFA
+static void flex_read_input(void)
+{
+	size_t size = 0, alloced = 65536, n;
+	FILE *f = yyin ? yyin : stdin;
+	char *text = malloc(alloced);
+
+	while ((n = fread(text + size, 1, alloced - size, f)) > 0) {
+		size += n;
+		if (size == alloced) {
+			alloced *= 2;
+			text = realloc(text, alloced);
+		}
+	}
+	/* flex wants two NULs at the end */
+	flex_input.copy = malloc(size + 2);
+	memcpy(flex_input.copy, text, size);
+	flex_input.copy[size] = flex_input.copy[size + 1] = 0;
+	flex_input.text = text;
+	flex_input.buf = yy_scan_buffer(flex_input.copy, size + 2);
+}
+#endif
+
+int parse_source(void)
+{
+#ifdef PARALLEL_PARSE
+	const char *buf, *end;
+	int njobs;
+
+	buf = yylex_scanner()->p;
+	scanner_input(&end);
+	njobs = threads_jobs(end - buf, PARSE_CHUNK_MIN);
+	if (njobs > 1)
+		return parse_parallel(buf, end, njobs);
+#endif
+#ifndef LEXER_DFA
+	if (options.dump_source)
+		flex_read_input();
+#endif
+	return parse_serial(NULL);
+}
+
+/*
+ * --watch: parse_source() reads yyin afresh, from yylineno, as a new
+ * input: the whole source again or only some lines of it. Input read
+ * before is kept, statements made from it may point into it
+ * (--dump-source), unless free_old says they are gone.
+ */
+void parse_restart(int free_old)
+{
+#ifndef LEXER_DFA
+	int i;
+#endif
+
+	serial.eof = 0;
+#ifdef LEXER_DFA
+	scanner_restart(free_old);
+#else
+	if (flex_input.copy) {
+		/* yyrestart() would read into the copy */
+		yy_delete_buffer(flex_input.buf);
+		flex_old.text = realloc(flex_old.text,
+							(flex_old.n + 2) * sizeof *flex_old.text);
+		flex_old.text[flex_old.n++] = flex_input.text;
+		flex_old.text[flex_old.n++] = flex_input.copy;
+		memset(&flex_input, 0, sizeof flex_input);
+	}
+	yyrestart(yyin);
+	if (!free_old)
+		return;
+	for (i = 0; i < flex_old.n; i++)
+		free(flex_old.text[i]);
+	free(flex_old.text);
+	memset(&flex_old, 0, sizeof flex_old);
+#endif
+}
+
+/*
+ * token source for the bison parser. Normally straight from the scanner,
+ * while replaying a line it gives the buffered tokens, then the rest of
+ * the line from the scanner, then end of input.
+ */
+int parse_lex(void)
+{
+	struct parser *ps = &serial;
+	struct ptoken *t;
+	int tok;
+
+	if (!ps->replay)
+		return yylex();
+	if (ps->replay_done)
+		return 0;
+
+	if (ps->replay_pos < ps->ntok) {
+		t = &ps->tok[ps->replay_pos++];
+		tok = t->tok;
+		yylloc.line = t->line;
+		yylineno = t->lineno;
+		switch (tok) {
+		case STRING:
+			yylval.string = ps->strings + t->copy;
+			break;
+		case SYMBOL:
+			/* scanner text is gone unless saved or the last token */
+			BUG_ON(!t->sym && t->copy < 0 && ps->replay_pos != ps->ntok);
+			if (t->sym)
+				yylval.string = symbol_name(t->sym);
+			else if (t->copy >= 0)
+				yylval.string = ps->strings + t->copy;
+			else
+				yylval.string = t->text;
+			break;
+		case LABEL:
+			yylval.string = t->text;
+			break;
+		default:
+			yylval.integer = t->integer;
+			break;
+		}
+	} else {
+		tok = yylex();
+		if (!tok)
+			ps->eof = 1;
+	}
+
+	if (tok == '\n' || tok == 0)
+		ps->replay_done = 1;
+	return tok;
+}
@@ -0,0 +1,14 @@
+#ifndef PARSE_H
+#define PARSE_H
+/*
+ * das hand-written parser, with the bison one behind it for bad lines
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+
+int parse_source(void);
+void parse_restart(int free_old);
+int parse_lex(void);
+
+#endif
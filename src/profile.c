@@ -0,0 +1,87 @@
+/*
+ * das --profile: execution counts per address, to annotate the listing
+ *
+ * The file is text, one address per line: a PC in hex and how many times
+ * the instruction there ran, in decimal. A line with only a PC counts
+ * once, so a plain trace of PCs does as well. Counts for the same PC add
+ * up. Blank lines and lines starting with ';' or '#' are skipped.
+ *
+ *	; from my emulator
+ *	0000 1
+ *	0x0004 1000000
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "das.h"
+#include "output.h"
+#include "profile.h"
+
+#define PROFILE_ADDRESSES	(1 << 16)
+
+static unsigned long long *counts;
+static unsigned long long total;
+
+/* return 0 or nonzero on error */
+int profile_read(const char *path)
+{
+	char line[256], *p;
+	unsigned long long n;
+	unsigned long pc;
+	int lineno = 0, got, ret = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		error("Reading profile %s failed: %s", path, strerror(errno));
+		return -1;
+	}
+	counts = calloc(PROFILE_ADDRESSES, sizeof *counts);
+	total = 0;
+	while (fgets(line, sizeof line, f)) {
+		lineno++;
+		p = line + strspn(line, " \t\r\n");
+		if (!*p || *p == ';' || *p == '#')
+			continue;
+		got = sscanf(p, "%lx %llu", &pc, &n);
+		if (got < 1 || pc >= PROFILE_ADDRESSES) {
+			error("%s line %d: expected a PC and a count", path, lineno);
+			ret = -1;
+			break;
+		}
+		if (got == 1)
+			n = 1;
+		counts[pc] += n;
+		total += n;
+	}
+	fclose(f);
+	info("Profile: %llu instructions run\n", total);
+	return ret;
+}
+
+int profile_loaded(void)
+{
+	return counts != NULL;
+}
+
+unsigned long long profile_count(int pc)
+{
+	return pc >= 0 && pc < PROFILE_ADDRESSES ? counts[pc] : 0;
+}
+
+/* of all counts read, wherever they were */
+unsigned long long profile_total(void)
+{
+	return total;
+}
+
+void profile_free(void)
+{
+	free(counts);
+	counts = NULL;
+}
@@ -0,0 +1,16 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+/*
+ * das --profile: execution counts per address, to annotate the listing
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+
+int profile_read(const char *path);
+int profile_loaded(void);
+unsigned long long profile_count(int pc);
+unsigned long long profile_total(void);
+void profile_free(void);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef SCAN_H
+#define SCAN_H
+/*
+ * das hand-written scanner (dfalex.c), reentrant interface. yylex() runs
+ * one instance over yyin; the parallel parser runs more over the same
+ * input, starting each at a line boundary.
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <stddef.h>
+
+#include "dasdefs.h"
+#include "output.h"
+#include "y.tab.h"
+
+struct scanner {
+	const char *p;			/* next character to scan */
+	const char *tok;		/* start of the last token */
+	const char *end;		/* end of input */
+	int lineno;				/* as yylineno */
+	int eof;				/* the newline at end of input was returned */
+	int quiet;				/* count diagnostics instead of printing them */
+	int diags;
+	/* token text handed to the parser, alternating so the last survives */
+	struct {
+		char *text;
+		size_t size;
+	} tokbuf[2];
+	int tokbuf_cur;
+};
+
+const char* scanner_input(const char **end);
+void scanner_restart(int free_old);
+void scanner_init(struct scanner *sc, const char *p, int lineno);
+void scanner_free(struct scanner *sc);
+int scanner_next(struct scanner *sc, YYSTYPE *lval, YYLTYPE *lloc);
+struct scanner* yylex_scanner(void);
+
+#endif
@@ -9,41 +9,188 @@
 #include <stdlib.h>
 
 #include "das.h"
-#include "list.h"
+#include "dat.h"
+#include "instruction.h"
 #include "output.h"
+#include "profile.h"
 #include "statement.h"
+#include "symbol.h"
+#include "threads.h"
 
 #define MAX_BINARY_WORDS (1 << 16)			/* 16-bit (word) address space */
 #define MAX_BINARY_BYTES (MAX_BINARY_WORDS * 2)
 
-/* Implement polymorphism in C, Linux kernel-style */
-struct statement {
-	const struct statement_ops *ops;
-	struct list_head list;		/* when on master input list */
-	void *private;				/* pointer to type-specific data */
-};
+/* don't split analysis of fewer statements than this per thread */
+#define ANALYSE_JOB_MIN		4096
+/* nor freezing, binary and listing */
+#define BACKEND_JOB_MIN		4096
+
+/*
+ * Statements are stored as parallel arrays in source order: a type, an
+ * index into the dense array of that type its module keeps, and a packed
+ * size. Passes switch on the type. Only instructions have a size that can
+ * depend on symbol values; the rest are sized when added, so the sizing
+ * steps of analysis are loops over the instructions still unsized.
+ */
+#define SIZE_UNKNOWN	-1
 
 /* all parsed statements in order encountered */
-static LIST_HEAD(statements);
+static struct {
+	unsigned char *type;	/* enum stmt_type */
+	int *index;				/* into the type's array */
+	int *size;				/* binary words once fixed, else SIZE_UNKNOWN */
+	LOCTYPE *loc;			/* source location, for map output */
+	struct stmt_text *text;	/* source text, with --dump-source */
+	int n, alloc;
+} st;
+
+/* per type: the statement each of its array is, the reverse of st.index */
+static struct type_stmts {
+	int *stmt;
+	int alloc;
+} of_type[STMT_TYPES];
 
-statement* next_statement(statement *cur)
+/*
+ * --profile, per statement for the listing, see profile_statements().
+ * NULL when not profiling.
+ */
+static struct {
+	unsigned long long *count;	/* instructions: times run */
+	unsigned long long *cycles;	/* instructions: count * cycles. Labels: all
+								 * of their instructions' up to the next label */
+	unsigned long long total;	/* cycles */
+} prof;
+
+/* the source text the next statement added was parsed from */
+static struct stmt_text next_text;
+
+/*
+ * analysis work list, see statements_analyse(): the statements still worth
+ * visiting, in order. Runs of statements between them whose sizes are fixed
+ * are collapsed into spans of words.
+ */
+static struct analysis {
+	int *live;				/* statement indexes */
+	int *span;				/* per live statement: fixed words before it */
+	int *size;				/* per live statement: its size last pass */
+	int nlive;
+	int tail;				/* fixed words after the last */
+	int nstmt;				/* statements when the list was made */
+	int *unsized;			/* instructions not sized for good yet */
+	int nunsized;
+	int settled;			/* another pass would change nothing */
+} an;
+
+/* binary size of statement i, from the packed sizes once it's fixed */
+static inline int stmt_size(int i)
 {
-	if (cur->list.next == &statements)
-		return NULL;
-	else
-		return list_entry(cur->list.next, statement, list);
+	if (st.size[i] != SIZE_UNKNOWN)
+		return st.size[i];
+	return instruction_binary_size(st.index[i]);
+}
+
+/* statement for the n'th instruction */
+#define instr_stmt(n)	(of_type[STMT_INSTRUCTION].stmt[n])
+
+static int stmt_validate(int i)
+{
+	int n = st.index[i];
+
+	switch (st.type[i]) {
+	case STMT_INSTRUCTION:
+		return instruction_validate(n);
+	case STMT_DAT:
+		return dat_validate(n);
+	case STMT_LABEL:
+		return label_validate(n);
+	case STMT_DIRECTIVE:
+		return equ_validate(n);
+	default:
+		BUG();
+		return 1;
+	}
+}
+
+/* words written to dest. Only call for statements with a size */
+static int stmt_get_binary(u16 *dest, int i)
+{
+	switch (st.type[i]) {
+	case STMT_INSTRUCTION:
+		return instruction_get_binary(dest, st.index[i]);
+	case STMT_DAT:
+		return dat_get_binary(dest, st.index[i]);
+	default:
+		BUG();
+		return -1;
+	}
+}
+
+static int stmt_print_asm(char *buf, int i)
+{
+	int n = st.index[i];
+
+	switch (st.type[i]) {
+	case STMT_INSTRUCTION:
+		return instruction_print_asm(buf, n);
+	case STMT_DAT:
+		return dat_print_asm(buf, n);
+	case STMT_LABEL:
+		return label_print_asm(buf, n);
+	case STMT_DIRECTIVE:
+		return equ_print_asm(buf, n);
+	default:
+		BUG();
+		return 0;
+	}
 }
 
 /*
  * add a statement when encountered by parser. Call from e.g. instruction
  * and label parse handling / tree building code.
  */
-void add_statement(void *private, const struct statement_ops *ops)
+void add_statement(LOCTYPE loc, enum stmt_type type, int index)
 {
-	statement *s = calloc(1, sizeof *s);
-	s->ops = ops;
-	s->private = private;
-	list_add_tail(&s->list, &statements);
+	struct type_stmts *t = &of_type[type];
+	int i = st.n++;
+
+	if (st.n > st.alloc) {
+		st.alloc = st.alloc ? st.alloc * 2 : 1024;
+		st.type = realloc(st.type, st.alloc * sizeof *st.type);
+		st.index = realloc(st.index, st.alloc * sizeof *st.index);
+		st.size = realloc(st.size, st.alloc * sizeof *st.size);
+		st.loc = realloc(st.loc, st.alloc * sizeof *st.loc);
+		if (options.dump_source)
+			st.text = realloc(st.text, st.alloc * sizeof *st.text);
+	}
+	if (index >= t->alloc) {
+		t->alloc = index < 512 ? 1024 : 2 * index;
+		t->stmt = realloc(t->stmt, t->alloc * sizeof *t->stmt);
+	}
+	t->stmt[index] = i;
+	st.type[i] = type;
+	st.index[i] = index;
+	/* a DAT's size is known as parsed, labels and .equ have none */
+	if (type == STMT_INSTRUCTION)
+		st.size[i] = SIZE_UNKNOWN;
+	else if (type == STMT_DAT)
+		st.size[i] = dat_binary_size(index);
+	else
+		st.size[i] = 0;
+	st.loc[i] = loc;
+	if (st.text) {
+		st.text[i] = next_text;
+		next_text.p = NULL;
+	}
+}
+
+/*
+ * --dump-source: the next statement added is len characters at p, to list
+ * as written instead of printing it from the tree. p must outlive listing.
+ */
+void statement_source(const char *p, int len)
+{
+	next_text.p = p;
+	next_text.len = len;
 }
 
 /*
@@ -52,21 +199,494 @@ void add_statement(void *private, const struct statement_ops *ops)
  */
 int statements_validate(void)
 {
-	statement *s;
-	int error = 0;
+	int i, error = 0;
 
-	assert(!list_empty(&statements));
-	list_for_each_entry(s, &statements, list) {
-		if (s->ops->validate) {
-			if (s->ops->validate(s->private))
-				error = 1;
-		} else {
-			DBG("statement without validate function\n");
-		}
+	assert(st.n);
+	for (i = 0; i < st.n; i++) {
+		if (stmt_validate(i))
+			error = 1;
 	}
 	return error;
 }
 
+/*
+ * String pooling, see statements_pool_strings(). A pool string is a
+ * statement of constant strings with labels just before it.
+ */
+struct pool_string {
+	int i;					/* statement */
+	int n;					/* words */
+	u16 *words;
+	char *cut;				/* per word: may split before it */
+	unsigned *hash;			/* per word: of the words from there on */
+	int into;				/* the string it's stored in, -1 if kept */
+	int at;					/* at this word of it */
+};
+
+/* the pool strings longest first, then in source order */
+static int pool_cmp(const void *a, const void *b)
+{
+	const struct pool_string *x = a, *y = b;
+
+	if (x->n != y->n)
+		return y->n - x->n;
+	return x->i - y->i;
+}
+
+/* statement a moved string went into */
+#define pool_into(ps, j)	((ps)[(ps)[j].into].i)
+
+/* the moved strings by where they went, then in source order */
+static struct pool_string *pool_sort;
+static int pool_move_cmp(const void *a, const void *b)
+{
+	int j = *(int *)a, k = *(int *)b;
+	const struct pool_string *x = &pool_sort[j], *y = &pool_sort[k];
+
+	if (x->into != y->into)
+		return pool_into(pool_sort, j) - pool_into(pool_sort, k);
+	if (x->at != y->at)
+		return x->at - y->at;
+	return x->i - y->i;
+}
+
+/* first of the labels just before statement i */
+static int pool_labels(const unsigned char *type, int i)
+{
+	while (i > 0 && type[i - 1] == STMT_LABEL)
+		i--;
+	return i;
+}
+
+/* add the labels just before old statement i again */
+static void pool_add_labels(const unsigned char *type, const int *index,
+							LOCTYPE *loc, int i)
+{
+	int j;
+
+	for (j = pool_labels(type, i); j < i; j++)
+		add_statement(loc[j], STMT_LABEL, index[j]);
+}
+
+/*
+ * --string-pool, once after validation: store each string once. A pool
+ * string whose words are all of another, or the tail of one from a place
+ * it can be split, is dropped and its labels moved there, splitting the
+ * other if need be. Labels after a string stay where they were, so this
+ * is for programs that only find strings by their start.
+ */
+void statements_pool_strings(void)
+{
+	struct pool_string *ps = NULL, *p, *c;
+	unsigned char *type = st.type;
+	int *index = st.index;
+	LOCTYPE *loc = st.loc;
+	int *size = st.size;
+	struct stmt_text *text = st.text;
+	int n = st.n;
+	int nps = 0, alloc = 0, words = 0, nmoved = 0, saved = 0;
+	int *bucket, *chain, *chain_ps, *chain_at, nchain = 0, nbuckets = 1;
+	int *moved, *drop, *tails;
+	int i, j, k, m, b;
+
+	/* find the pool strings and their words */
+	for (i = 1; i < n; i++) {
+		if (type[i] != STMT_DAT || type[i - 1] != STMT_LABEL)
+			continue;
+		if (nps == alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			ps = realloc(ps, alloc * sizeof *ps);
+		}
+		p = &ps[nps];
+		p->i = i;
+		p->n = size[i];
+		p->words = malloc((p->n + 1) * sizeof *p->words);
+		p->cut = malloc(p->n + 1);
+		p->hash = malloc((p->n + 1) * sizeof *p->hash);
+		if (p->n <= 0 ||
+				dat_pool_words(index[i], p->words, p->cut) < 0) {
+			free(p->words);
+			free(p->cut);
+			free(p->hash);
+			continue;
+		}
+		p->hash[p->n] = 0;
+		for (k = p->n - 1; k >= 0; k--)
+			p->hash[k] = p->hash[k + 1] * 16777619u ^ p->words[k];
+		p->into = -1;
+		p->at = 0;
+		words += p->n;
+		nps++;
+	}
+	if (!nps) {
+		free(ps);
+		return;
+	}
+	qsort(ps, nps, sizeof *ps, pool_cmp);
+
+	/*
+	 * match each against the places strings kept so far can be split,
+	 * chained by hash of the words from there
+	 */
+	while (nbuckets < 2 * words)
+		nbuckets <<= 1;
+	bucket = malloc(nbuckets * sizeof *bucket);
+	memset(bucket, -1, nbuckets * sizeof *bucket);
+	chain = malloc(words * sizeof *chain);
+	chain_ps = malloc(words * sizeof *chain_ps);
+	chain_at = malloc(words * sizeof *chain_at);
+	for (j = 0; j < nps; j++) {
+		p = &ps[j];
+		for (m = bucket[p->hash[0] & (nbuckets - 1)]; m >= 0; m = chain[m]) {
+			c = &ps[chain_ps[m]];
+			k = chain_at[m];
+			if (c->hash[k] == p->hash[0] && c->n - k == p->n &&
+					!memcmp(c->words + k, p->words, p->n * sizeof *p->words))
+				break;
+		}
+		if (m >= 0) {
+			p->into = chain_ps[m];
+			p->at = chain_at[m];
+			nmoved++;
+			saved += p->n;
+			continue;
+		}
+		for (k = 0; k < p->n; k++) {
+			if (!p->cut[k])
+				continue;
+			b = p->hash[k] & (nbuckets - 1);
+			chain[nchain] = bucket[b];
+			chain_ps[nchain] = j;
+			chain_at[nchain] = k;
+			bucket[b] = nchain++;
+		}
+	}
+	free(bucket);
+	free(chain);
+	free(chain_ps);
+	free(chain_at);
+
+	/* rebuild the statements without the moved ones */
+	moved = malloc(nmoved * sizeof *moved);
+	drop = calloc(n, sizeof *drop);
+	tails = malloc(nmoved * sizeof *tails);
+	for (j = 0, m = 0; j < nps; j++) {
+		p = &ps[j];
+		if (p->into < 0)
+			continue;
+		moved[m++] = j;
+		for (i = pool_labels(type, p->i); i <= p->i; i++)
+			drop[i] = 1;
+	}
+	pool_sort = ps;
+	qsort(moved, nmoved, sizeof *moved, pool_move_cmp);
+
+	/* split the kept strings, from the end so word offsets hold */
+	for (m = nmoved - 1; m >= 0; m--) {
+		p = &ps[moved[m]];
+		c = &ps[p->into];
+		tails[m] = -1;
+		if (p->at && (!m || ps[moved[m - 1]].into != p->into ||
+						ps[moved[m - 1]].at != p->at))
+			tails[m] = dat_split(index[c->i], p->at);
+	}
+
+	memset(&st, 0, sizeof st);
+	for (i = 0, m = 0; i < n; i++) {
+		if (drop[i]) {
+			if (type[i] == STMT_DAT)
+				dat_free(index[i]);
+			continue;
+		}
+		/* labels moved to its start, it, then each tail after its labels */
+		for (; m < nmoved && pool_into(ps, moved[m]) == i &&
+				!ps[moved[m]].at; m++)
+			pool_add_labels(type, index, loc, ps[moved[m]].i);
+		/* as written, unless it's about to be split */
+		if (text && !(m < nmoved && pool_into(ps, moved[m]) == i))
+			next_text = text[i];
+		add_statement(loc[i], type[i], index[i]);
+		while (m < nmoved && pool_into(ps, moved[m]) == i) {
+			k = m;
+			for (; m < nmoved && pool_into(ps, moved[m]) == i &&
+					ps[moved[m]].at == ps[moved[k]].at; m++)
+				pool_add_labels(type, index, loc, ps[moved[m]].i);
+			add_statement(loc[i], STMT_DAT, tails[k]);
+		}
+	}
+	info("String pool: %d of %d strings stored in others, %d words saved\n",
+		nmoved, nps, saved);
+
+	for (j = 0; j < nps; j++) {
+		free(ps[j].words);
+		free(ps[j].cut);
+		free(ps[j].hash);
+	}
+	free(ps);
+	free(moved);
+	free(drop);
+	free(tails);
+	free(type);
+	free(index);
+	free(size);
+	free(loc);
+	free(text);
+}
+
+/*
+ * --watch keeps the parse between builds and, on a save, parses again
+ * only the lines around those that changed: it finds their statements,
+ * cuts them, parses the new lines onto the end and splices those in where
+ * the old ones were. Each build then runs on a copy of that parse.
+ */
+
+int statements_count(void)
+{
+	return st.n;
+}
+
+int statement_line(int i)
+{
+	return st.loc[i].line;
+}
+
+/* the first statement at or after line, or statements_count() if none */
+int statements_at_line(int line)
+{
+	int lo = 0, hi = st.n, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (st.loc[mid].line < line)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* free what statements [first, end) were made of, to splice them out */
+void statements_cut(int first, int end)
+{
+	int i;
+
+	for (i = first; i < end; i++) {
+		switch (st.type[i]) {
+		case STMT_INSTRUCTION:
+			instruction_remove(st.index[i]);
+			break;
+		case STMT_DAT:
+			dat_free(st.index[i]);
+			break;
+		case STMT_LABEL:
+			label_remove(st.index[i]);
+			break;
+		case STMT_DIRECTIVE:
+			equ_remove(st.index[i]);
+			break;
+		default:
+			BUG();
+		}
+	}
+}
+
+/*
+ * the statements parsed from first on, before splicing them in: size
+ * those whose size no symbol value can change, as the first analysis pass
+ * would, and validate and freeze those whose binary it can't, so that
+ * every build reuses both. One with anything to say is left to the build,
+ * to say it there in order.
+ */
+void statements_encode(int first)
+{
+	struct textbuf msgs = { 0 };
+	int i, n;
+
+	for (i = first; i < st.n; i++) {
+		if (st.type[i] != STMT_INSTRUCTION)
+			continue;
+		n = st.index[i];
+		if (instruction_constant(n)) {
+			output_hold(&msgs);
+			instruction_validate(n);
+			instruction_freeze(n);
+			output_hold(NULL);
+			if (!msgs.len)
+				instruction_set_encoded(n);
+			textbuf_free(&msgs);
+		}
+		if (instruction_size_fixed(n))
+			st.size[i] = instruction_binary_size(n);
+	}
+}
+
+/*
+ * put the statements parsed from added on where [first, end) were cut,
+ * moving those after them down by lines. Sizes found already are kept.
+ * Then the symbols are replayed, see symbols_replay_start().
+ */
+void statements_splice(int first, int end, int added, int lines)
+{
+	unsigned char *type = st.type;
+	int *index = st.index;
+	int *size = st.size;
+	LOCTYPE *loc = st.loc;
+	struct stmt_text *text = st.text;
+	int n = st.n;
+	int order[3][2] = { { 0, first }, { added, n }, { end, added } };
+	int i, r, t;
+
+	memset(&st, 0, sizeof st);
+	/* indexes of the cut statements are left with none */
+	for (t = 0; t < STMT_TYPES; t++)
+		memset(of_type[t].stmt, -1, of_type[t].alloc * sizeof(int));
+	for (r = 0; r < 3; r++) {
+		for (i = order[r][0]; i < order[r][1]; i++) {
+			if (r == 2 && lines) {
+				loc[i].line += lines;
+				switch (type[i]) {
+				case STMT_INSTRUCTION:
+					instruction_shift(index[i], lines);
+					break;
+				case STMT_DAT:
+					dat_shift(index[i], lines);
+					break;
+				case STMT_LABEL:
+					label_shift(index[i], lines);
+					break;
+				case STMT_DIRECTIVE:
+					equ_shift(index[i], lines);
+					break;
+				}
+			}
+			if (text)
+				next_text = text[i];
+			add_statement(loc[i], type[i], index[i]);
+			st.size[st.n - 1] = size[i];
+		}
+	}
+	free(type);
+	free(index);
+	free(size);
+	free(loc);
+	free(text);
+
+	symbols_replay_start();
+	for (i = 0; i < st.n; i++) {
+		switch (st.type[i]) {
+		case STMT_INSTRUCTION:
+			instruction_for_each_symbol(st.index[i], symbol_replay_use,
+										NULL);
+			break;
+		case STMT_DAT:
+			dat_for_each_symbol(st.index[i], symbol_replay_use, NULL);
+			break;
+		case STMT_LABEL:
+			label_replay(st.index[i]);
+			break;
+		case STMT_DIRECTIVE:
+			equ_replay(st.index[i]);
+			break;
+		}
+	}
+	symbols_replay_end();
+}
+
+/*
+ * analysis, first step for a range of the unsized instructions: sizes that
+ * no longer depend on symbol values, kept in the packed sizes.
+ */
+static void analyse_fixed(void *arg, int job, int njobs)
+{
+	long k, start = JOB_START(an.nunsized, job, njobs);
+	long end = JOB_END(an.nunsized, job, njobs);
+	int n;
+
+	for (k = start; k < end; k++) {
+		n = an.unsized[k];
+		if (instruction_size_fixed(n))
+			st.size[instr_stmt(n)] = instruction_binary_size(n);
+	}
+}
+
+/*
+ * range analysis, after a pass: bound every label between the PCs it would
+ * have with all undecided sizes as they are now (they only grow) and with
+ * all grown to their maximum. Then let statements settle sizes that are the
+ * same either way, folding label differences and symbols that can no
+ * longer change, and repeat while that narrows the bounds. Every later
+ * pass sees symbol values inside those bounds, so a size settled here is
+ * the one relaxation would arrive at: nothing about the result changes,
+ * but settled statements drop off the work list, and once everything is
+ * settled the analysis can stop a pass early.
+ * Return 1 if no label would move on the next pass.
+ */
+static int analyse_ranges(void)
+{
+	int i, k, size, max, min_pc, max_pc;
+	int undecided, decided, grew = 0;
+	/* folded values would be wrong once sizes are reset behind our back */
+	int fold = !options.optimal_literals;
+
+	do {
+		min_pc = max_pc = 0;
+		undecided = 0;
+		for (k = 0; k < an.nlive; k++) {
+			i = an.live[k];
+			min_pc += an.span[k];
+			max_pc += an.span[k];
+			if (st.type[i] == STMT_LABEL)
+				label_set_bounds(st.index[i], min_pc, max_pc);
+			/*
+			 * as last pass: sizing again now could settle something on
+			 * values the next pass won't see
+			 */
+			size = max = an.size[k];
+			if (st.size[i] == SIZE_UNKNOWN)
+				max = instruction_max_size(st.index[i]);
+			if (max != size)
+				undecided++;
+			min_pc += size;
+			max_pc += max;
+		}
+
+		decided = 0;
+		for (k = 0; undecided && fold && k < an.nlive; k++) {
+			i = an.live[k];
+			if (st.type[i] == STMT_DIRECTIVE) {
+				decided += !!equ_fold(st.index[i]);
+				continue;
+			}
+			if (st.type[i] != STMT_INSTRUCTION ||
+					!instruction_fold(st.index[i]))
+				continue;
+			decided++;
+			/* as decide_size() below, if that fixed the size */
+			if (st.size[i] == SIZE_UNKNOWN &&
+					instruction_size_fixed(st.index[i])) {
+				size = stmt_size(i);
+				if (size != an.size[k])
+					grew = 1;
+				an.size[k] = size;
+			}
+		}
+		for (k = 0; undecided && k < an.nlive; k++) {
+			i = an.live[k];
+			if (st.size[i] != SIZE_UNKNOWN)
+				continue;
+			if (instruction_decide_size(st.index[i])) {
+				decided++;
+				size = stmt_size(i);
+				if (size != an.size[k])
+					grew = 1;
+				an.size[k] = size;
+			}
+		}
+	} while (decided);
+
+	return !undecided && !grew;
+}
+
 /*
  * Do one analysis pass of all statements.
  * Compute statement size and maintain a running total (PC value).
@@ -94,66 +714,315 @@ int statements_validate(void)
  * At the moment this is handled by never allowing an instruction to become
  * shorter.
  *
+ * A pass only visits the work list: at first every statement, after that
+ * the labels and other statements with analysis work, and those whose size
+ * still depends on symbol values. Everything else has a fixed size, and
+ * runs of those are just a number of words between two work list entries.
+ *
+ * The pass is done in two steps, so big programs can be split into ranges
+ * on several threads. First the instructions not sized yet whose sizes have
+ * stopped depending on symbol values are sized, in parallel; usually most
+ * of them on the first pass, and more as literals settle. Then the list is
+ * walked in order, as a single loop over everything would: labels set from
+ * the spans and sizes before them, symbol-dependent sizes against the
+ * values so far. Statements found fixed for good are dropped on the way,
+ * their words joining the span before the next.
+ *
+ * After a pass that changed anything, analyse_ranges() settles what sizes
+ * it can ahead of time, and says if the next pass would move any label,
+ * see statements_settled().
+ *
  * Return value: number of symbols whose value changed on this run
  */
 int statements_analyse(void)
 {
-	statement *s;
-	int pc = 0;
 	int labels_changed = 0;
-	int ret;
+	int pc = 0, words = 0;
+	int i, k, n = 0, ret = 0;
 
-	if (list_empty(&statements)) {
+	if (!st.n) {
 		fprintf(stderr, "Error: No statements to work on\n");
 		return -1;
 	}
 
-	list_for_each_entry(s, &statements, list) {
-		/* some statements may have no analysis work (maybe DAT) */
-		if (s->ops->analyse) {
-			ret = s->ops->analyse(s->private, pc);
-			if (ret < 0) {
-				// analysis error!
-				return ret;
-			} else if (ret > 0) {
-				labels_changed++;
-			}
-			// else done OK
+	if (an.nstmt != st.n) {
+		/* first pass: everything */
+		an.live = realloc(an.live, st.n * sizeof *an.live);
+		an.span = realloc(an.span, st.n * sizeof *an.span);
+		an.size = realloc(an.size, st.n * sizeof *an.size);
+		for (i = 0; i < st.n; i++) {
+			an.live[i] = i;
+			an.span[i] = 0;
 		}
-		/* some statements may have no binary size (e.g. labels) */
-		if (s->ops->get_binary_size) {
-			ret = s->ops->get_binary_size(s->private);
-			if (ret < 0) {
-				// eek
-				return ret;
-			} else {
-				TRACE2("PC %d + %d\n", pc, ret);
-				pc += ret;
-			}
-		} else {
-			TRACE2("Statement with no get_binary_size\n");
+		an.nlive = an.nstmt = st.n;
+		an.tail = 0;
+
+		/* --watch may have sized some ahead, see statements_encode() */
+		an.unsized = realloc(an.unsized, (instructions_count() + 1) *
+							sizeof *an.unsized);
+		an.nunsized = 0;
+		for (n = 0; n < instructions_count(); n++) {
+			if (instr_stmt(n) >= 0 &&
+					st.size[instr_stmt(n)] == SIZE_UNKNOWN)
+				an.unsized[an.nunsized++] = n;
 		}
 	}
+
+	threads_run(threads_jobs(an.nunsized, ANALYSE_JOB_MIN), analyse_fixed,
+				NULL);
+	for (k = 0, n = 0; k < an.nunsized; k++) {
+		if (st.size[instr_stmt(an.unsized[k])] == SIZE_UNKNOWN)
+			an.unsized[n++] = an.unsized[k];
+	}
+	an.nunsized = n;
+
+	for (k = 0, n = 0; k < an.nlive; k++) {
+		i = an.live[k];
+		pc += an.span[k];
+		words += an.span[k];
+
+		if (st.size[i] != SIZE_UNKNOWN && st.type[i] != STMT_LABEL &&
+				st.type[i] != STMT_DIRECTIVE) {
+			/* nothing more to do here, part of the span to the next */
+			pc += st.size[i];
+			words += st.size[i];
+			continue;
+		}
+		an.live[n] = i;
+		an.span[n++] = words;
+		words = 0;
+
+		/* only labels and .equ have analysis work */
+		if (st.type[i] == STMT_LABEL)
+			labels_changed += label_analyse(st.index[i], pc);
+		else if (st.type[i] == STMT_DIRECTIVE)
+			labels_changed += equ_analyse(st.index[i]);
+		ret = stmt_size(i);
+		TRACE2("PC %d + %d\n", pc, ret);
+		an.size[n - 1] = ret;
+		pc += ret;
+	}
+	an.nlive = n;
+	pc += an.tail;
+	an.tail += words;
 	// should be trace or maybe warn/error if > 64k
 	TRACE0("analysis end PC: 0x%x words\n", pc);
+	an.settled = labels_changed && analyse_ranges();
 	return labels_changed;
 }
 
-/* Calculate final expression values, machine code, and any final errors */
-int statements_freeze(void)
+/*
+ * true if the last statements_analyse() found the label values final, though
+ * they changed on that pass: the next would not move any
+ */
+int statements_settled(void)
+{
+	return an.settled;
+}
+
+/*
+ * forget sizes found so far, after something changed them behind analysis'
+ * back (--optimal-literals). The next pass starts from scratch.
+ */
+void statements_resize(void)
+{
+	int n;
+
+	for (n = 0; n < instructions_count(); n++) {
+		if (instr_stmt(n) >= 0)
+			st.size[instr_stmt(n)] = SIZE_UNKNOWN;
+	}
+	an.nstmt = 0;
+	an.settled = 0;
+}
+
+/* total binary words, as of the last analysis pass. -1 on error */
+int statements_size(void)
+{
+	int i, size, words = 0;
+
+	for (i = 0; i < st.n; i++) {
+		size = stmt_size(i);
+		if (size < 0)
+			return size;
+		words += size;
+	}
+	return words;
+}
+
+/*
+ * The back end (freeze, binary, listing) splits the statements into ranges
+ * on worker threads too. Nothing in it depends on other statements once
+ * analysis is done, except through the PC: a prefix sum of range sizes gives
+ * each range its start address. Workers hold their diagnostics, printed in
+ * range order after the run so they come out in source order regardless.
+ */
+struct backend {
+	int njobs;
+	int *start;			/* per range: first statement, [njobs] = end */
+	int *base;			/* per range: start PC, once laid out */
+	int *ret;			/* per range: worker result */
+	struct textbuf *msgs;	/* per range: held diagnostics */
+	struct textbuf *text;	/* per range: listing */
+	u16 *binary;
+	int (*fn)(struct backend *be, int job, int start, int end);
+};
+
+/*
+ * Ranges never start just after a label, so a label shares its listing
+ * line with the following statement (see statements_fprint_asm()) within
+ * one range.
+ */
+static void backend_init(struct backend *be)
+{
+	int job, i;
+
+	be->njobs = threads_jobs(st.n, BACKEND_JOB_MIN);
+	be->start = malloc((be->njobs + 1) * sizeof *be->start);
+	be->base = calloc(be->njobs, sizeof *be->base);
+	be->ret = calloc(be->njobs, sizeof *be->ret);
+	be->msgs = calloc(be->njobs, sizeof *be->msgs);
+	be->text = calloc(be->njobs, sizeof *be->text);
+
+	for (job = 0; job < be->njobs; job++) {
+		i = JOB_START(st.n, job, be->njobs);
+		if (job && i < be->start[job - 1])
+			i = be->start[job - 1];
+		while (i > 0 && i < st.n && st.type[i - 1] == STMT_LABEL)
+			i++;
+		be->start[job] = i;
+	}
+	be->start[be->njobs] = st.n;
+}
+
+static void backend_free(struct backend *be)
 {
-	statement *s;
-	int error = 0;
+	int job;
 
-	list_for_each_entry(s, &statements, list) {
-		if (s->ops->freeze) {
-			if (s->ops->freeze(s->private))
+	for (job = 0; job < be->njobs; job++) {
+		textbuf_free(&be->msgs[job]);
+		textbuf_free(&be->text[job]);
+	}
+	free(be->start);
+	free(be->base);
+	free(be->ret);
+	free(be->msgs);
+	free(be->text);
+}
+
+static void backend_job(void *arg, int job, int njobs)
+{
+	struct backend *be = arg;
+
+	output_hold(&be->msgs[job]);
+	be->ret[job] = be->fn(be, job, be->start[job], be->start[job + 1]);
+	output_hold(NULL);
+}
+
+/*
+ * run fn over every range, then print held diagnostics.
+ * return the first range's error (< 0) in order, or 0
+ */
+static int backend_run(struct backend *be,
+			int (*fn)(struct backend *be, int job, int start, int end))
+{
+	int job, ret = 0;
+
+	be->fn = fn;
+	threads_run(be->njobs, backend_job, be);
+	for (job = 0; job < be->njobs; job++) {
+		output_release(&be->msgs[job]);
+		if (!ret && be->ret[job] < 0)
+			ret = be->ret[job];
+	}
+	return ret;
+}
+
+/* words in a range */
+static int layout_range(struct backend *be, int job, int start, int end)
+{
+	int i, size, words = 0;
+
+	for (i = start; i < end; i++) {
+		size = stmt_size(i);
+		if (size < 0)
+			return size;
+		words += size;
+	}
+	return words;
+}
+
+/* set the start PC of each range, return total words or error */
+static int backend_layout(struct backend *be)
+{
+	int job, ret, words = 0;
+
+	ret = backend_run(be, layout_range);
+	if (ret < 0)
+		return ret;
+	for (job = 0; job < be->njobs; job++) {
+		be->base[job] = words;
+		words += be->ret[job];
+	}
+	return words;
+}
+
+static int freeze_range(struct backend *be, int job, int start, int end)
+{
+	int i, n, error = 0;
+
+	for (i = start; i < end; i++) {
+		n = st.index[i];
+		switch (st.type[i]) {
+		case STMT_INSTRUCTION:
+			if (instruction_freeze(n))
 				error = 1;
-		} else {
-			DBG("statement without freeze function\n");
+			/* sizes are final now, keep them for output */
+			if (st.size[i] == SIZE_UNKNOWN)
+				st.size[i] = instruction_binary_size(n);
+			break;
+		case STMT_DAT:
+			if (dat_freeze(n))
+				error = 1;
+			break;
 		}
 	}
-	return error;
+	return error || be->msgs[job].error;
+}
+
+/* Calculate final expression values, machine code, and any final errors */
+int statements_freeze(void)
+{
+	struct backend be = { 0 };
+	int job, error = 0;
+
+	backend_init(&be);
+	backend_run(&be, freeze_range);
+	for (job = 0; job < be.njobs; job++)
+		error |= be.ret[job];
+	backend_free(&be);
+	return error || das_error;
+}
+
+static int binary_range(struct backend *be, int job, int start, int end)
+{
+	int i, ret, size;
+	int offset = be->base[job];
+
+	for (i = start; i < end; i++) {
+		size = stmt_size(i);
+		if (size < 0)
+			return size;	// returned error
+		if (!size)
+			continue;
+
+		ret = stmt_get_binary(be->binary + offset, i);
+		if (ret < 0)
+			return ret;		// returned error
+
+		offset += size;
+	}
+	return 0;
 }
 
 /*
@@ -164,44 +1033,27 @@ int statements_freeze(void)
  */
 int statements_get_binary(u16 **dest)
 {
-	statement *s;
-	int ret, offset, size;
-	int too_big = 0;
+	struct backend be = { 0 };
+	int ret, words;
 
 	*dest = realloc(*dest, MAX_BINARY_BYTES);
-	offset = 0;
-
-	list_for_each_entry(s, &statements, list) {
-		if (s->ops->get_binary_size) {
-			size = s->ops->get_binary_size(s->private);
-			if (size < 0)
-				return size;	// returned error
-
-			if (offset + size > MAX_BINARY_WORDS) {
-				too_big = 1;
-				/*
-				 * stop getting the binary, but continue on to get the total
-				 * binary size so we can report it nicely
-				 */
-			}
-
-			if (BUG_ON(!s->ops->get_binary))
-				return -1;
-
-			if (!too_big) {
-				ret = s->ops->get_binary(*dest + offset, s->private);
-				if (ret < 0)
-					return ret;		// returned error
-			}
 
-			offset += size;
-		}
-	}
-	if (too_big) {
-		error("Binary size 0x%x exceeds address space (0x10000)\n", offset);
-		return -1;
+	backend_init(&be);
+	ret = words = backend_layout(&be);
+	if (words < 0)
+		goto out;
+	if (words > MAX_BINARY_WORDS) {
+		error("Binary size 0x%x exceeds address space (0x10000)\n", words);
+		ret = -1;
+		goto out;
 	}
-	return offset;
+	be.binary = *dest;
+	ret = backend_run(&be, binary_range);
+	if (!ret)
+		ret = words;
+out:
+	backend_free(&be);
+	return ret;
 }
 
 /*
@@ -209,11 +1061,11 @@ int statements_get_binary(u16 **dest)
  * update *lines as we go. Don't print a newline at the end of the last line,
  * do_eol handler will do it.
  *
- * why do I sprintf() to a line buffer in the parent function but use fprintf()
- * here? Good question!
+ * why do I sprintf() to a line buffer in the parent function but use
+ * textbuf_printf() here? Good question!
  */
-void fprint_bin_chunk(FILE *f, u16 *binbuf, int binwords, int start_col,
-						int pc, int *lines)
+static void print_bin_chunk(struct textbuf *out, u16 *binbuf, int binwords,
+						int start_col, int pc, int *lines)
 {
 	int i;
 	int col;
@@ -221,39 +1073,135 @@ void fprint_bin_chunk(FILE *f, u16 *binbuf, int binwords, int start_col,
 	for (i = 0; binwords; --binwords, i++, pc++) {
 		if (0 == i % 8) {
 			/* new line */
-			fprintf(f, "\n");
+			textbuf_printf(out, "\n");
 			col = 0;
 			if (options.asm_print_pc)
-				col += fprintf(f, "%04x ", pc);
+				col += textbuf_printf(out, "%04x ", pc);
 
 			/* pad to start column */
-			col += fprintf(f, "%*c;", start_col - col, ' ');
+			col += textbuf_printf(out, "%*c;", start_col - col, ' ');
 		}
-		fprintf(f, " %04x", binbuf[i]);
+		textbuf_printf(out, " %04x", binbuf[i]);
 	}
 }
 
 /*
- * Write assembler representation of all statements to stream.
- * return number of lines written or -1 on error.
- * (0 lines might also be considered an input error)
+ * a statement as written, blanks outside strings squeezed to one space.
+ * return length of string
  */
-int statements_fprint_asm(FILE *f)
+static int print_source(char *buf, const struct stmt_text *text)
+{
+	const char *p = text->p, *end = p + text->len;
+	char *start = buf;
+	int quoted = 0;
+	char c;
+
+	while (p < end) {
+		c = *p++;
+		if (!quoted && (c == ' ' || c == '\t' || c == '\r')) {
+			while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+				p++;
+			c = ' ';
+		} else if (c == '"') {
+			quoted = !quoted;
+		} else if (c == '\\' && quoted && p < end) {
+			*buf++ = c;
+			c = *p++;
+		}
+		*buf++ = c;
+	}
+	*buf = 0;
+	return buf - start;
+}
+
+/*
+ * share out the profile's counts to the instructions they are for, and sum
+ * cycles under each label. Labels with nothing between them are one place,
+ * so all get the same sum.
+ */
+static void profile_statements(void)
+{
+	unsigned long long matched = 0;
+	int i, k, pc = 0, first = -1, words = 0;
+
+	prof.count = calloc(st.n, sizeof *prof.count);
+	prof.cycles = calloc(st.n, sizeof *prof.cycles);
+	prof.total = 0;
+	for (i = 0; i < st.n; i++) {
+		if (st.type[i] == STMT_LABEL && (first < 0 || words)) {
+			/* first of a run of labels */
+			first = i;
+			words = 0;
+		}
+		if (st.type[i] == STMT_INSTRUCTION) {
+			prof.count[i] = profile_count(pc);
+			prof.cycles[i] = prof.count[i] * instruction_cycles(st.index[i]);
+			prof.total += prof.cycles[i];
+			matched += prof.count[i];
+			/* the labels are up to the first statement with words */
+			for (k = first; k >= 0 && k < i && st.size[k] <= 0; k++) {
+				if (st.type[k] == STMT_LABEL)
+					prof.cycles[k] += prof.cycles[i];
+			}
+		}
+		words += st.size[i];
+		pc += st.size[i];
+	}
+	info("Profile: %llu cycles\n", prof.total);
+	if (matched != profile_total())
+		warn("Profile: %llu counts are not for the start of an instruction",
+			profile_total() - matched);
+}
+
+/* --profile columns go after where the hex stops */
+#define PROFILE_COL		(options.asm_max_cols + 2)
+
+/* --profile columns, if any, for statement j and a label before it */
+static int print_profile(char *buf, int col, int j, int label)
 {
-	char linebuf[102400];		/* should be big enough... */
-	u16  binbuf[65536];			/* ditto */
+	int start = col;
+
+	if (st.type[j] == STMT_LABEL)
+		label = j;
+	else if (st.type[j] != STMT_INSTRUCTION)
+		j = -1;
+	if (j < 0 && label < 0)
+		return 0;
+
+	col += sprintf(buf + col, "%*c;", col < PROFILE_COL ?
+				PROFILE_COL - col : 1, ' ');
+	if (j >= 0 && st.type[j] != STMT_LABEL)
+		col += sprintf(buf + col, " %12llu %12llu", prof.count[j],
+					prof.cycles[j]);
+	else
+		col += sprintf(buf + col, "%26c", ' ');
+	if (label >= 0)
+		col += sprintf(buf + col, " %5.1f%%", prof.total ?
+					100.0 * prof.cycles[label] / prof.total : 0.0);
+	return col - start;
+}
+
+#define ASM_LINE_MAX	102400		/* should be big enough... */
+
+/* listing of a range into its own buffer, return lines or error */
+static int asm_range(struct backend *be, int job, int start, int end)
+{
+	/* not on the stack: this runs on worker threads, whose stacks are small */
+	char *linebuf = malloc(ASM_LINE_MAX);
+	u16  *binbuf = malloc(MAX_BINARY_WORDS * sizeof *binbuf);
+	struct textbuf *out = &be->text[job];
 	int lines = 0, col = 0;
-	int pc = 0;
+	int label = -1;				/* on this line, for --profile */
+	int pc = be->base[job];
 	int asm_main_col = options.asm_main_col;
-	statement *s;
-	int i, ret;
+	int i, j, ret;
 
 	if (options.asm_print_pc) {
 		asm_main_col += 5;
 		// hex_col?
 	}
 
-	list_for_each_entry(s, &statements, list) {
+	for (j = start; j < end; j++) {
 		int do_eol = 1;
 		int binwords = 0;
 
@@ -263,12 +1211,15 @@ int statements_fprint_asm(FILE *f)
 				col += sprintf(linebuf, "%04x ", pc);
 
 			/* print labels with no extra indent, pad others */
-			if (s->ops->type != STMT_LABEL)
+			if (st.type[j] != STMT_LABEL)
 				col += sprintf(linebuf + col, "%*c", asm_main_col - col, ' ');
 		}
 
 		/* print the statement */
-		col += s->ops->print_asm(linebuf + col, s->private);
+		if (st.text && st.text[j].p)
+			col += print_source(linebuf + col, &st.text[j]);
+		else
+			col += stmt_print_asm(linebuf + col, j);
 
 		/*
 		 * pad instead of starting a new line IF:
@@ -276,22 +1227,21 @@ int statements_fprint_asm(FILE *f)
 		 * - AND the next statatement is not a label
 		 * - AND col is < asm_main_col (do EOL after very long labels)
 		 */
-		if (s->ops->type == STMT_LABEL && col < asm_main_col) {
-			statement *next = next_statement(s);
-			if (next && next->ops->type != STMT_LABEL)
+		if (st.type[j] == STMT_LABEL && col < asm_main_col) {
+			if (j + 1 < st.n && st.type[j + 1] != STMT_LABEL)
 				do_eol = 0;
 		}
 
 		/* if this statement has a size, get it */
-		if (s->ops->get_binary_size) {
-			binwords = s->ops->get_binary_size(s->private);
-			if (binwords < 0)
-				return binwords;	// error
-			if (binwords > ARRAY_SIZE(binbuf)) {
-				fprintf(stderr, "Can't handle giant statement, %d words!\n",
-						binwords);
-				return -1;
-			}
+		binwords = stmt_size(j);
+		if (binwords < 0) {
+			lines = binwords;	// error
+			goto out;
+		}
+		if (binwords > MAX_BINARY_WORDS) {
+			_warn("Can't handle giant statement, %d words!", binwords);
+			lines = -1;
+			goto out;
 		}
 
 		/* if there is binary, annotate it (if in that mode) */
@@ -301,21 +1251,26 @@ int statements_fprint_asm(FILE *f)
 				pad = options.asm_hex_col - col;
 			}
 
-			ret = s->ops->get_binary(binbuf, s->private);
+			ret = stmt_get_binary(binbuf, j);
 			if (ret != binwords) {
-				fprintf(stderr, "binwords mismatch!\n");
-				return -1;
+				_warn("binwords mismatch!");
+				lines = -1;
+				goto out;
 			}
 			
 			/* will the binary fit on this line? */
 			if (col + pad + binwords * 5 + 2 > options.asm_max_cols) {
 				/* nope. finish this line first then (no newline)*/
-				fprintf(f, "%s", linebuf);
+				if (prof.count) {
+					col += print_profile(linebuf, col, j, label);
+					label = -1;
+				}
+				textbuf_printf(out, "%s", linebuf);
 				lines++;
 				col = 0;
 
 				/* call helper to print chunk */
-				fprint_bin_chunk(f, binbuf, binwords, asm_main_col + 4, pc,
+				print_bin_chunk(out, binbuf, binwords, asm_main_col + 4, pc,
 								&lines);
 			} else {
 				/* fits on line */
@@ -327,29 +1282,107 @@ int statements_fprint_asm(FILE *f)
 		}
 
 		if (do_eol) {
-			/* terminate and write line to stream */
+			if (prof.count && col) {
+				col += print_profile(linebuf, col, j, label);
+				label = -1;
+			}
+			/* terminate and write line to buffer */
 			col += sprintf(linebuf + col, "\n");
-			fprintf(f, "%s", linebuf);
+			textbuf_printf(out, "%s", linebuf);
 			lines++;
 			col = 0;
 		} else {
+			label = j;
 			/* pad ready for next statement following label */
 			col += sprintf(linebuf + col, "%*c", asm_main_col - col, ' ');
 		}
 		pc += binwords;
 	}
+out:
+	free(linebuf);
+	free(binbuf);
 	return lines;
 }
 
+/*
+ * Write assembler representation of all statements to stream.
+ * return number of lines written or -1 on error.
+ * (0 lines might also be considered an input error)
+ */
+int statements_fprint_asm(FILE *f)
+{
+	struct backend be = { 0 };
+	int job, lines = 0;
+	int ret;
+
+	backend_init(&be);
+	ret = backend_layout(&be);
+	if (ret < 0)
+		goto out;
+	if (profile_loaded())
+		profile_statements();
+	ret = backend_run(&be, asm_range);
+	/* as far as it got, if there was an error */
+	for (job = 0; job < be.njobs; job++) {
+		textbuf_fwrite(&be.text[job], f);
+		if (be.ret[job] < 0)
+			break;
+		lines += be.ret[job];
+	}
+	if (!ret)
+		ret = lines;
+out:
+	free(prof.count);
+	free(prof.cycles);
+	memset(&prof, 0, sizeof prof);
+	backend_free(&be);
+	return ret;
+}
+
+/*
+ * Write address to source line table for the map file: one entry for each
+ * statement that generates code, in address order, so the line for any PC
+ * is the last entry with address <= PC.
+ * return number of entries written or -1 on error.
+ */
+int statements_fprint_lines(FILE *f)
+{
+	int i, pc = 0;
+	int size, entries = 0;
+
+	for (i = 0; i < st.n; i++) {
+		size = stmt_size(i);
+		if (size < 0)
+			return size;
+		if (size) {
+			fprintf(f, "%04x %d\n", pc, st.loc[i].line);
+			entries++;
+		}
+		pc += size;
+	}
+	return entries;
+}
+
 /* free all statement storage and children */
 void statements_free(void)
 {
-	statement *s, *temp;
+	int t;
 
-	list_for_each_entry_safe(s, temp, &statements, list) {
-		if (s->ops->free_private)
-			s->ops->free_private(s->private);
-		free(s);
-	}
-	INIT_LIST_HEAD(&statements);
+	/* label and .equ symbols are freed separately */
+	instructions_free();
+	dats_free();
+	free(st.type);
+	free(st.index);
+	free(st.size);
+	free(st.loc);
+	free(st.text);
+	memset(&st, 0, sizeof st);
+	for (t = 0; t < STMT_TYPES; t++)
+		free(of_type[t].stmt);
+	memset(of_type, 0, sizeof of_type);
+	free(an.live);
+	free(an.span);
+	free(an.size);
+	free(an.unsized);
+	memset(&an, 0, sizeof an);
 }
@@ -9,53 +9,46 @@
 #include <stdio.h>
 
 #include "dasdefs.h"
+#include "output.h"
 
+/*
+ * a statement is its type and an index into that type's own array, kept
+ * densely by the module that parses it: instruction.c, dat.c, symbol.c
+ * (labels, and .equ as STMT_DIRECTIVE)
+ */
 enum stmt_type {
 	STMT_NONE,
 	STMT_INSTRUCTION,
 	STMT_LABEL,
 	STMT_DAT,
 	STMT_DIRECTIVE,
+	STMT_TYPES
 };
 
-/* hide struct implementation detail inside statement.c. Modular! */
-typedef struct statement statement;
-
-/* types of statements implement some or all of these method callbacks */
-struct statement_ops {
-	int (*validate)(void *private);        /* see statements_validate() */
-	int (*analyse)(void *private, int pc); /* see statements_analyse() */
-	int (*freeze)(void *private);          /* see statements_freeze() */
-
-	/* get_binary_size() may not be implemented for e.g. labels */
-	int (*get_binary_size)(void *private);
-
-	/*
-	 * get binary into dest, return number of words or -1 for error?
-	 * such as "don't know yet" maybe.
-	 * Assumes getting the binary is valid at this stage of processing.
-	 */
-	int (*get_binary)(u16 *dest, void *private);
-
-	/*
-	 * print_asm(): print this statement to dest as assembly.
-	 * return length of string
-	 * (possible buffer overrun problems here.)
-	 */
-	int (*print_asm)(char *dest, void *private);
-
-	/* free child data during cleanup */
-	void (*free_private)(void *private);
-	
-	enum stmt_type type;	/* not an "operation", but.. */
+/* source text of a statement, see statement_source() */
+struct stmt_text {
+	const char *p;
+	int len;
 };
 
-void add_statement(void *private, const struct statement_ops *ops);
+void add_statement(LOCTYPE loc, enum stmt_type type, int index);
+void statement_source(const char *p, int len);
+int statements_count(void);
+int statement_line(int i);
+int statements_at_line(int line);
+void statements_cut(int first, int end);
+void statements_encode(int first);
+void statements_splice(int first, int end, int added, int lines);
 int statements_validate(void);
+void statements_pool_strings(void);
 int statements_analyse(void);
+int statements_settled(void);
+void statements_resize(void);
+int statements_size(void);
 int statements_freeze(void);
 int statements_get_binary(u16 **dest);
 int statements_fprint_asm(FILE *f);
+int statements_fprint_lines(FILE *f);
 void statements_free(void);
 
 #endif
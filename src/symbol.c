@@ -18,6 +18,7 @@ enum sym_flags {
 	SYM_LABEL = 0x1,	/* definition label found */
 	SYM_USED  = 0x2,	/* label applied somewhere (expression).. ? */
 	SYM_DEF   = 0x4,	/* explicitly defined (not label) .. ?*/
+	SYM_SEEN  = 0x8,	/* --watch: found again, see symbols_replay_start() */
 };
 
 struct symbol {
@@ -26,20 +27,108 @@ struct symbol {
 	int  value;
 	LOCTYPE defined_loc;		/* valid if symbol is LABEL or DEF */
 	struct expr *expr;			/* exists if this is a .set symbol */
-	struct list_head list;		/* on all_symbols list */
+	struct list_head list;		/* on symtab list */
+	struct symbol *hash_next;	/* symtab hash chain */
+	unsigned hash;
+	struct symbol *merged;		/* chunk-local: the global symbol */
+
+	/* .equ dependency graph, see symbols_check_equ_cycles() */
+	int equ_seq;				/* .equ directive order in source */
+	struct symbol **deps;		/* .equ symbols referenced by expr */
+	int ndeps;
+	int index, lowlink, scc;	/* Tarjan SCC search, 0 = not yet */
+	struct symbol *path_prev;	/* cycle path reporting */
+	unsigned eval_gen;			/* equ_generation when value computed */
+
+	/* range analysis, see symbol_range() */
+	long long range_min, range_max;
+	int range_ok;
+	unsigned range_gen;			/* range_generation when computed (.equ) */
 };
 
-static LIST_HEAD(all_symbols);
-static const struct statement_ops label_statement_ops;
-static const struct statement_ops equ_statement_ops;
+/*
+ * a symbol table: the global one, or one local to a chunk of source being
+ * parsed on its own thread, merged into the global one afterwards
+ */
+struct symtab {
+	struct list_head symbols;	/* in order of first appearance */
+	/* name lookup, chained hash table grown to keep chains short */
+	struct symbol **hash;
+	unsigned hash_size, count;
+};
+
+static struct symtab symtab = {
+	.symbols = LIST_HEAD_INIT(symtab.symbols),
+};
+static int equ_count;
+/* bumped whenever a label moves, making computed .equ values stale */
+static unsigned equ_generation = 1;
+/* bumped whenever any symbol value changes, see expr_value() */
+static unsigned value_generation = 1;
+
+/* the symbols label and .equ statements define, their statements index in */
+struct symbol_list {
+	struct symbol **sym;
+	int n, alloc;
+};
+static struct symbol_list labels, equs;
+
+/* FNV-1a */
+static unsigned symbol_hash_name(const char *name)
+{
+	unsigned h = 2166136261u;
+
+	while (*name)
+		h = (h ^ (unsigned char)*name++) * 16777619u;
+	return h;
+}
+
+static void symbol_hash_add(struct symtab *tab, struct symbol *sym)
+{
+	struct symbol **old = tab->hash, *s, *next;
+	unsigned oldsize = tab->hash_size, i, h;
+
+	if (tab->count >= tab->hash_size) {
+		tab->hash_size = oldsize ? oldsize * 2 : 256;
+		tab->hash = calloc(tab->hash_size, sizeof *tab->hash);
+		for (i = 0; i < oldsize; i++) {
+			for (s = old[i]; s; s = next) {
+				next = s->hash_next;
+				h = s->hash & (tab->hash_size - 1);
+				s->hash_next = tab->hash[h];
+				tab->hash[h] = s;
+			}
+		}
+		free(old);
+	}
+	h = sym->hash & (tab->hash_size - 1);
+	sym->hash_next = tab->hash[h];
+	tab->hash[h] = sym;
+	tab->count++;
+}
 
-/* return symbol ptr if found (by name) in given list */
-struct symbol* symbol_inlist(char *name, struct list_head *head)
+static void symbol_hash_remove(struct symtab *tab, struct symbol *sym)
 {
-	struct symbol *l;
-	list_for_each_entry(l, head, list) {
-		if (0 == strcmp(l->name, name))
-			return l;
+	struct symbol **s = &tab->hash[sym->hash & (tab->hash_size - 1)];
+
+	while (*s != sym)
+		s = &(*s)->hash_next;
+	*s = sym->hash_next;
+	tab->count--;
+}
+
+/* return symbol ptr if found (by name), else NULL */
+static struct symbol* symbol_lookup(struct symtab *tab, const char *name,
+									unsigned hash)
+{
+	struct symbol *s;
+
+	if (!tab->hash)
+		return NULL;
+	s = tab->hash[hash & (tab->hash_size - 1)];
+	for (; s; s = s->hash_next) {
+		if (s->hash == hash && 0 == strcmp(s->name, name))
+			return s;
 	}
 	return NULL;
 }
@@ -48,6 +137,17 @@ struct symbol* symbol_inlist(char *name, struct list_head *head)
  * Parse
  */
 
+/* add sym to a list, return its index */
+static int symbol_list_add(struct symbol_list *l, struct symbol *sym)
+{
+	if (l->n == l->alloc) {
+		l->alloc = l->alloc ? l->alloc * 2 : 256;
+		l->sym = realloc(l->sym, l->alloc * sizeof *l->sym);
+	}
+	l->sym[l->n] = sym;
+	return l->n++;
+}
+
 static int check_redefine(LOCTYPE newloc, struct symbol *s)
 {
 	int redefined = s->flags & SYM_LABEL || s->flags & SYM_DEF;
@@ -58,20 +158,33 @@ static int check_redefine(LOCTYPE newloc, struct symbol *s)
 	return redefined;
 }
 
-struct symbol* symbol_parse(char *name)
+struct symbol* symtab_parse(struct symtab *tab, char *name)
 {
-	// search symbol list (or hash, tree) for matching symbol
 	struct symbol *sym;
-	sym = symbol_inlist(name, &all_symbols);
+	unsigned hash = symbol_hash_name(name);
+
+	sym = symbol_lookup(tab, name, hash);
 	if (!sym) {
 		/* not seen a symbol with this name before */
 		sym = calloc(1, sizeof *sym);
 		sym->name = strdup(name);
-		list_add_tail(&sym->list, &all_symbols);
+		sym->hash = hash;
+		list_add_tail(&sym->list, &tab->symbols);
+		symbol_hash_add(tab, sym);
 	}
 	return sym;
 }
 
+struct symbol* symbol_parse(char *name)
+{
+	return symtab_parse(&symtab, name);
+}
+
+char* symbol_name(struct symbol *sym)
+{
+	return sym->name;
+}
+
 void label_parse(LOCTYPE loc, char *name)
 {
 	struct symbol *s;
@@ -80,18 +193,19 @@ void label_parse(LOCTYPE loc, char *name)
 		s->defined_loc = loc;
 	}
 	s->flags |= SYM_LABEL;
-	add_statement(s, &label_statement_ops);
+	add_statement(loc, STMT_LABEL, symbol_list_add(&labels, s));
 }
 
 void directive_equ(LOCTYPE loc, struct symbol *s, struct expr *e)
 {
-	/* FIXME: detect and error on circular references */
+	/* circular references caught by symbols_check_equ_cycles() */
 	if (!check_redefine(loc, s)) {
 		s->defined_loc = loc;
 	}
 	s->flags |= SYM_DEF;
-	s->expr = e;
-	add_statement(s, &equ_statement_ops);
+	s->expr = expr_intern(e);
+	s->equ_seq = ++equ_count;
+	add_statement(loc, STMT_DIRECTIVE, symbol_list_add(&equs, s));
 }
 
 /* called when a symbol is found to be used (not defined) */
@@ -100,6 +214,50 @@ void symbol_mark_used(struct symbol *s)
 	s->flags |= SYM_USED;
 }
 
+/*
+ * Chunk-local symbol tables, for the parallel parser. A worker thread
+ * looks names up in its own table; once its chunk is spliced in, the
+ * names are looked up in the global table in the order the chunk first
+ * used them, so symbols are created in the same order as a serial parse.
+ * Local symbols only ever get marked used.
+ */
+
+struct symtab* symtab_new(void)
+{
+	struct symtab *tab = calloc(1, sizeof *tab);
+
+	INIT_LIST_HEAD(&tab->symbols);
+	return tab;
+}
+
+void symtab_merge(struct symtab *tab)
+{
+	struct symbol *s;
+
+	list_for_each_entry(s, &tab->symbols, list) {
+		s->merged = symbol_parse(s->name);
+		s->merged->flags |= s->flags & SYM_USED;
+	}
+}
+
+/* global symbol for a local one, after symtab_merge() */
+struct symbol* symbol_merged(struct symbol *sym)
+{
+	return sym->merged;
+}
+
+void symtab_free(struct symtab *tab)
+{
+	struct symbol *s, *temp;
+
+	list_for_each_entry_safe(s, temp, &tab->symbols, list) {
+		free(s->name);
+		free(s);
+	}
+	free(tab->hash);
+	free(tab);
+}
+
 /*
  * Analysis
  */
@@ -122,11 +280,9 @@ int symbol_check_defined(LOCTYPE loc, struct symbol *s)
 	return ret;
 }
 
-/* label/equ validation: just check the defined symbol is used somewhere */
-static int symbol_check_used(void *private)
+/* check the defined symbol is used somewhere */
+static int symbol_check_used(struct symbol *s)
 {
-	struct symbol *s = private;
-
 	if (!(s->flags & SYM_USED)) {
 		loc_warn(s->defined_loc, "Unused symbol '%s'", s->name);
 	}
@@ -134,18 +290,182 @@ static int symbol_check_used(void *private)
 	return 0;
 }
 
+int label_validate(int n)
+{
+	return symbol_check_used(labels.sym[n]);
+}
+
 /*
  * equ statements need to have the symbol they are setting checked for usage
  * like a label, but also do a validation call on the setting expression.
  */
-static int equ_validate(void *private)
+int equ_validate(int n)
 {
-	struct symbol *s = private;
+	struct symbol *s = equs.sym[n];
 
 	assert(s->expr);
-	expr_validate(s->expr);
-	symbol_check_used(private);
+	expr_validate(s->defined_loc, s->expr);
+	symbol_check_used(s);
+
+	return das_error;
+}
+
+/*
+ * .equ dependency graph.
+ * Nodes are .equ symbols, edges go to the .equ symbols named in their
+ * expression. Labels are leaves: they depend on code layout, which the
+ * analysis passes settle.
+ */
+static void add_equ_dep(struct symbol *dep, void *arg)
+{
+	struct symbol *s = arg;
+	int i;
+
+	if (!(dep->flags & SYM_DEF))
+		return;
+	for (i = 0; i < s->ndeps; i++) {
+		if (s->deps[i] == dep)
+			return;
+	}
+	s->deps = realloc(s->deps, (s->ndeps + 1) * sizeof *s->deps);
+	s->deps[s->ndeps++] = dep;
+}
+
+static struct {
+	struct symbol **stack;
+	int sp;
+	int index;
+	int nscc;
+} tarjan;
+
+/*
+ * report a cycle through the strongly connected component members[].
+ * Start from the member defined first and search breadth-first for a
+ * shortest path back to it.
+ */
+static void report_equ_cycle(struct symbol **members, int n)
+{
+	struct symbol **queue, *start, *s, *d, *last = NULL;
+	int head = 0, tail = 0;
+	int i, len;
+	char *path;
+
+	start = members[0];
+	for (i = 1; i < n; i++) {
+		if (members[i]->equ_seq < start->equ_seq)
+			start = members[i];
+	}
+	for (i = 0; i < n; i++)
+		members[i]->path_prev = NULL;
+
+	queue = malloc(n * sizeof *queue);
+	queue[tail++] = start;
+	while (head < tail && !last) {
+		s = queue[head++];
+		for (i = 0; i < s->ndeps; i++) {
+			d = s->deps[i];
+			if (d == start) {
+				last = s;
+				break;
+			}
+			if (d->scc == start->scc && !d->path_prev) {
+				d->path_prev = s;
+				queue[tail++] = d;
+			}
+		}
+	}
+	free(queue);
+	BUG_ON(!last);
+
+	/* walk back from the end of the path, names come out reversed */
+	len = strlen(start->name) + 1;
+	for (s = last; s; s = s->path_prev)
+		len += strlen(s->name) + 4;
+	path = malloc(len);
+	path[len - 1] = 0;
+	len -= strlen(start->name) + 1;
+	memcpy(path + len, start->name, strlen(start->name));
+	for (s = last; s; s = s->path_prev) {
+		len -= 4;
+		memcpy(path + len, " -> ", 4);
+		len -= strlen(s->name);
+		memcpy(path + len, s->name, strlen(s->name));
+	}
+	loc_err(start->defined_loc, "Circular .equ definition: %s", path);
+	free(path);
+}
 
+/* Tarjan's strongly connected components, depth first from v */
+static void tarjan_visit(struct symbol *v)
+{
+	struct symbol *w;
+	int i, n, start;
+
+	v->index = v->lowlink = ++tarjan.index;
+	tarjan.stack[tarjan.sp++] = v;
+
+	for (i = 0; i < v->ndeps; i++) {
+		w = v->deps[i];
+		if (!w->index) {
+			tarjan_visit(w);
+			if (w->lowlink < v->lowlink)
+				v->lowlink = w->lowlink;
+		} else if (!w->scc) {
+			/* still on the stack: part of the current component */
+			if (w->index < v->lowlink)
+				v->lowlink = w->index;
+		}
+	}
+
+	if (v->lowlink != v->index)
+		return;
+
+	/* v is the root of a component, pop it */
+	tarjan.nscc++;
+	start = tarjan.sp;
+	do {
+		w = tarjan.stack[--start];
+		w->scc = tarjan.nscc;
+	} while (w != v);
+
+	n = tarjan.sp - start;
+	if (n == 1) {
+		/* a lone symbol is only a cycle if it refers to itself */
+		for (i = 0; i < v->ndeps; i++) {
+			if (v->deps[i] == v)
+				break;
+		}
+		if (i == v->ndeps)
+			n = 0;
+	}
+	if (n)
+		report_equ_cycle(tarjan.stack + start, n);
+	tarjan.sp = start;
+}
+
+/*
+ * Build the .equ dependency graph and report any circular definitions,
+ * with the full cycle path. Call once after statements_validate(), so all
+ * symbols are known to be defined.
+ * Return nonzero if there were cycles.
+ */
+int symbols_check_equ_cycles(void)
+{
+	struct symbol *s;
+
+	das_error = 0;
+	list_for_each_entry(s, &symtab.symbols, list) {
+		if (s->flags & SYM_DEF)
+			expr_for_each_symbol(s->expr, add_equ_dep, s);
+	}
+
+	tarjan.stack = malloc((equ_count + 1) * sizeof *tarjan.stack);
+	list_for_each_entry(s, &symtab.symbols, list) {
+		if ((s->flags & SYM_DEF) && !s->index)
+			tarjan_visit(s);
+	}
+	free(tarjan.stack);
+	tarjan.stack = NULL;
 	return das_error;
 }
 
@@ -153,66 +473,220 @@ static int equ_validate(void *private)
  * when a label is called in analysis pass, set its value to PC.
  * if value changed, return 1
  */
-static int label_analyse(void *private, int pc)
+int label_analyse(int n, int pc)
 {
-	struct symbol *sym = private;
+	struct symbol *sym = labels.sym[n];
 	if (sym->value != pc) {
 		TRACE1("label %s changed: %d -> %d\n", sym->name, sym->value, pc);
 		sym->value = pc;
+		equ_generation++;
+		value_generation++;
 		return 1;
 	}
 	return 0;
 }
 
-/*
- * When an .equ directive is analysed, update symbol value from expression.
- * If changed, return 1
- */
-static int equ_analyse(void *private, int pc)
+/* recompute an .equ symbol value. If changed, return 1 */
+static int equ_update_value(struct symbol *s)
 {
-	struct symbol *s = private;
 	int value;
+
 	assert(s->expr);
 	assert(s->flags & SYM_DEF);
+	s->eval_gen = equ_generation;
 	value = expr_value(s->expr);
 	if (s->value != value) {
-		TRACE1("symbol %s changed: %d -> %d\n", s->name, s->value, pc);
+		TRACE1("symbol %s changed: %d -> %d\n", s->name, s->value, value);
 		s->value = value;
+		value_generation++;
 		return 1;
 	}
 	return 0;
 }
 
+/*
+ * bring .equ symbols that s depends on up to date, dependencies first, if
+ * they are defined after analysis position pos (not yet analysed this pass).
+ * Those defined before pos keep the value from their own analysis, as do
+ * any already computed since the last label change.
+ * The graph is acyclic by now, so this terminates.
+ * Return number of symbols changed.
+ */
+static int equ_update_deps(struct symbol *s, int pos)
+{
+	struct symbol *d;
+	int i, changed = 0;
+
+	for (i = 0; i < s->ndeps; i++) {
+		d = s->deps[i];
+		if (d->equ_seq < pos || d->eval_gen == equ_generation)
+			continue;
+		changed += equ_update_deps(d, pos);
+		changed += equ_update_value(d);
+	}
+	return changed;
+}
+
+/*
+ * When an .equ directive is analysed, update symbol value from expression.
+ * Forward-referenced .equ symbols are evaluated first in dependency order,
+ * so a chain settles in one pass whatever its order in the source.
+ * If anything changed, return 1
+ */
+int equ_analyse(int n)
+{
+	struct symbol *s = equs.sym[n];
+	int changed;
+
+	changed = equ_update_deps(s, s->equ_seq);
+	changed += equ_update_value(s);
+	return changed > 0;
+}
+
 int symbol_value(struct symbol *sym)
 {
 	return sym->value;
 }
 
+/* changes whenever a symbol value does */
+unsigned symbols_generation(void)
+{
+	return value_generation;
+}
+
+/*
+ * range analysis: a label is given the lowest and highest PC it can end up
+ * at in any layout from here on. Any change makes .equ ranges stale.
+ */
+static unsigned range_generation = 1;
+
+void label_set_bounds(int n, int min_pc, int max_pc)
+{
+	struct symbol *sym = labels.sym[n];
+
+	if (!sym->range_ok || sym->range_min != min_pc ||
+			sym->range_max != max_pc) {
+		sym->range_min = min_pc;
+		sym->range_max = max_pc;
+		sym->range_ok = 1;
+		range_generation++;
+	}
+}
+
+/*
+ * bounds of the value sym can have during later analysis passes. That
+ * includes the current value: an .equ computed before a label after it
+ * moved keeps its stale value until analysed again.
+ * Return 0 if unbounded.
+ */
+int symbol_range(struct symbol *sym, long long *min, long long *max)
+{
+	if ((sym->flags & SYM_DEF) && sym->expr &&
+			sym->range_gen != range_generation) {
+		sym->range_ok = expr_range(sym->expr, &sym->range_min,
+									&sym->range_max);
+		sym->range_gen = range_generation;
+	}
+	if (!sym->range_ok)
+		return 0;
+	*min = sym->range_min < sym->value ? sym->range_min : sym->value;
+	*max = sym->range_max > sym->value ? sym->range_max : sym->value;
+	return 1;
+}
+
+/*
+ * range analysis: true if sym can't change value any more and has its final
+ * value now, so expressions using it can fold it (see expr_fold()). That is
+ * a label pinned to one PC, or an .equ of an expression that is constant.
+ */
+int symbol_fixed(struct symbol *sym)
+{
+	if (sym->flags & SYM_LABEL) {
+		return sym->range_ok && sym->range_min == sym->range_max &&
+			sym->value == sym->range_min;
+	}
+	return (sym->flags & SYM_DEF) && sym->expr &&
+		!expr_maychange(sym->expr) && sym->value == expr_value(sym->expr);
+}
+
+/*
+ * range analysis: true if labels a and b can only move together from here
+ * on, and are that far apart now. The slack in a label's bounds is how much
+ * everything before it can still grow, so a and b have the same slack when
+ * nothing between them can grow.
+ */
+int symbols_distance_fixed(struct symbol *a, struct symbol *b)
+{
+	if (!(a->flags & SYM_LABEL) || !(b->flags & SYM_LABEL) ||
+			!a->range_ok || !b->range_ok)
+		return 0;
+	return a->range_max - a->range_min == b->range_max - b->range_min &&
+		b->value - a->value == b->range_min - a->range_min;
+}
+
+/*
+ * true if every .equ symbol's value agrees with its expression, so
+ * analysing them again would change nothing unless a label moved
+ */
+int symbols_equ_settled(void)
+{
+	struct symbol *s;
+
+	list_for_each_entry(s, &symtab.symbols, list) {
+		if ((s->flags & SYM_DEF) && s->expr &&
+				expr_value(s->expr) != s->value)
+			return 0;
+	}
+	return 1;
+}
+
 /*
  * Output
  */
 
-void dump_symbol(struct symbol *sym)
+/* qsort helper: order by value, then name */
+static int symbol_cmp(const void *a, const void *b)
 {
-	/* FIXME: print info about if defined yet, etc */
-	if (sym->flags & SYM_LABEL)
-		printf("%s = 0x%x\n", sym->name, sym->value);
-	else
-		printf("%s UNDEFINED\n", sym->name);
+	const struct symbol *sa = *(const struct symbol **)a;
+	const struct symbol *sb = *(const struct symbol **)b;
+	u16 va = sa->value, vb = sb->value;
+
+	if (va != vb)
+		return va < vb ? -1 : 1;
+	return strcmp(sa->name, sb->name);
 }
 
-void dump_symbols(void)
+/*
+ * Write the symbol table for the map file, sorted by (16-bit) value so
+ * it can be binary searched. Labels are marked L, .equ symbols E.
+ * Call after statements_freeze(), when values are final.
+ * return number of symbols written
+ */
+int symbols_fprint_map(FILE *f)
 {
-	struct symbol *symbol;
+	struct symbol *sym;
+	struct symbol **sorted;
+	int i, n = 0;
+
+	list_for_each_entry(sym, &symtab.symbols, list)
+		n++;
+	if (!n)
+		return 0;
+	sorted = malloc(n * sizeof *sorted);
+
+	n = 0;
+	list_for_each_entry(sym, &symtab.symbols, list) {
+		if (sym->flags & (SYM_LABEL | SYM_DEF))
+			sorted[n++] = sym;
+	}
+	qsort(sorted, n, sizeof *sorted, symbol_cmp);
 
-	printf("symbols:");
-	if (list_empty(&all_symbols)) {
-		printf(" None\n");
-	} else {
-		printf("\n");
-		list_for_each_entry(symbol, &all_symbols, list)
-			dump_symbol(symbol);
+	for (i = 0; i < n; i++) {
+		fprintf(f, "%04x %c %s\n", (u16)sorted[i]->value,
+			sorted[i]->flags & SYM_LABEL ? 'L' : 'E', sorted[i]->name);
 	}
+	free(sorted);
+	return n;
 }
 
 int symbol_print_asm(char *buf, struct symbol *sym)
@@ -220,9 +694,9 @@ int symbol_print_asm(char *buf, struct symbol *sym)
 	return sprintf(buf, "%s", sym->name);
 }
 
-static int label_print_asm(char *buf, void *private)
+int label_print_asm(char *buf, int n)
 {
-	struct symbol *sym = private;
+	struct symbol *sym = labels.sym[n];
 	const char *fmt;
 
 	if (options.notch_style)
@@ -233,10 +707,18 @@ static int label_print_asm(char *buf, void *private)
 	return sprintf(buf, fmt, sym->name);
 }
 
-static int equ_print_asm(char *buf, void *private)
+/* range analysis: fold what's final in the .equ expression */
+int equ_fold(int n)
+{
+	struct symbol *s = equs.sym[n];
+
+	return expr_fold(s->expr);
+}
+
+int equ_print_asm(char *buf, int n)
 {
 	int count;
-	struct symbol *s = private;
+	struct symbol *s = equs.sym[n];
 
 	assert(s->expr);
 	assert(s->flags & SYM_DEF);
@@ -246,33 +728,119 @@ static int equ_print_asm(char *buf, void *private)
 	return count;
 }
 
+/*
+ * --watch: the statements were edited in place, see statements_splice().
+ * A label or .equ cut is undefined again; those kept may have moved down.
+ */
+void label_remove(int n)
+{
+	labels.sym[n]->flags &= ~SYM_LABEL;
+	labels.sym[n] = NULL;
+}
+
+void label_shift(int n, int lines)
+{
+	labels.sym[n]->defined_loc.line += lines;
+}
+
+void equ_remove(int n)
+{
+	struct symbol *s = equs.sym[n];
+
+	s->flags &= ~SYM_DEF;
+	free_expr(s->expr);
+	s->expr = NULL;
+	equs.sym[n] = NULL;
+}
+
+void equ_shift(int n, int lines)
+{
+	equs.sym[n]->defined_loc.line += lines;
+}
+
+/*
+ * --watch: then put the symbols as parsing the source whole would have
+ * left them: listed in order of first appearance, marked used by the
+ * expressions there are now, .equ numbered in source order. Call
+ * symbols_replay_start(), the replay function for every statement in
+ * order, then symbols_replay_end(), which frees the symbols nothing names
+ * any more.
+ */
+static struct list_head replay_old = LIST_HEAD_INIT(replay_old);
+
+void symbols_replay_start(void)
+{
+	struct symbol *s;
+
+	list_for_each_entry(s, &symtab.symbols, list)
+		s->flags &= ~SYM_USED;
+	list_splice_init(&symtab.symbols, &replay_old);
+	equ_count = 0;
+}
+
+static void symbol_replay(struct symbol *s)
+{
+	if (s->flags & SYM_SEEN)
+		return;
+	s->flags |= SYM_SEEN;
+	list_move_tail(&s->list, &symtab.symbols);
+}
+
+/* for each symbol a statement's expressions use */
+void symbol_replay_use(struct symbol *s, void *arg)
+{
+	symbol_replay(s);
+	s->flags |= SYM_USED;
+}
+
+void label_replay(int n)
+{
+	symbol_replay(labels.sym[n]);
+}
+
+void equ_replay(int n)
+{
+	struct symbol *s = equs.sym[n];
+
+	symbol_replay(s);
+	s->equ_seq = ++equ_count;
+	expr_for_each_symbol(s->expr, symbol_replay_use, NULL);
+}
+
+void symbols_replay_end(void)
+{
+	struct symbol *s, *temp;
+
+	list_for_each_entry_safe(s, temp, &replay_old, list) {
+		BUG_ON(s->flags & (SYM_LABEL | SYM_DEF));
+		symbol_hash_remove(&symtab, s);
+		list_del(&s->list);
+		free(s->name);
+		free(s);
+	}
+	list_for_each_entry(s, &symtab.symbols, list)
+		s->flags &= ~SYM_SEEN;
+}
+
 /* Cleanup */
 void symbols_free(void)
 {
 	struct symbol *sym, *temp;
 
-	list_for_each_entry_safe(sym, temp, &all_symbols, list) {
+	list_for_each_entry_safe(sym, temp, &symtab.symbols, list) {
 		assert(sym->name);
+		if (sym->expr)
+			free_expr(sym->expr);
 		free(sym->name);
+		free(sym->deps);
 		free(sym);
 	}
-	INIT_LIST_HEAD(&all_symbols);
+	INIT_LIST_HEAD(&symtab.symbols);
+	free(symtab.hash);
+	symtab.hash = NULL;
+	symtab.hash_size = symtab.count = 0;
+	free(labels.sym);
+	free(equs.sym);
+	memset(&labels, 0, sizeof labels);
+	memset(&equs, 0, sizeof equs);
 }
-
-static const struct statement_ops label_statement_ops = {
-	.validate        = symbol_check_used,
-	.analyse         = label_analyse,
-	.get_binary_size = NULL,	/* labels have no binary output */
-	.print_asm       = label_print_asm,
-	.free_private    = NULL,	/* symbols will be freed separately */
-	.type            = STMT_LABEL,
-};
-
-static const struct statement_ops equ_statement_ops = {
-	.validate        = equ_validate,
-	.analyse         = equ_analyse,
-	.get_binary_size = NULL,	/* equ directives have no binary output */
-	.print_asm       = equ_print_asm,
-	.free_private    = NULL,	/* symbols will be freed separately */
-	.type            = STMT_DIRECTIVE,
-};
@@ -8,6 +8,7 @@
  */
 
 struct symbol;
+struct symtab;
 
 #include "expression.h"
 #include "instruction.h"
@@ -15,17 +16,59 @@ struct symbol;
 
 /* Parse */
 struct symbol* symbol_parse(char *name);
+char* symbol_name(struct symbol *sym);
 void label_parse(LOCTYPE loc, char *name);
 void directive_equ(LOCTYPE loc, struct symbol *sym, struct expr *expr);
 void symbol_mark_used(struct symbol *sym);
 
+/* Parallel parse */
+struct symtab* symtab_new(void);
+struct symbol* symtab_parse(struct symtab *tab, char *name);
+void symtab_merge(struct symtab *tab);
+struct symbol* symbol_merged(struct symbol *sym);
+void symtab_free(struct symtab *tab);
+
 /* Analysis */
 int symbol_check_defined(LOCTYPE loc, struct symbol *s);
 int symbol_value(struct symbol *sym);
+unsigned symbols_generation(void);
+int symbols_check_equ_cycles(void);
+int symbol_range(struct symbol *sym, long long *min, long long *max);
+int symbols_equ_settled(void);
+int symbol_fixed(struct symbol *sym);
+int symbols_distance_fixed(struct symbol *a, struct symbol *b);
+
+/*
+ * label and .equ statements: n is the index in parse order of each kind,
+ * see add_statement(). analyse returns 1 if the symbol value changed.
+ * label_set_bounds: lowest and highest PC the label can end up at.
+ */
+int label_validate(int n);
+int label_analyse(int n, int pc);
+void label_set_bounds(int n, int min_pc, int max_pc);
+int label_print_asm(char *buf, int n);
+int equ_validate(int n);
+int equ_analyse(int n);
+int equ_fold(int n);
+int equ_print_asm(char *buf, int n);
+
+/*
+ * --watch, on the parse kept between builds: cut label and .equ
+ * statements, move them down by lines, then replay every statement in
+ * order, see symbols_replay_start()
+ */
+void label_remove(int n);
+void label_shift(int n, int lines);
+void equ_remove(int n);
+void equ_shift(int n, int lines);
+void symbols_replay_start(void);
+void symbol_replay_use(struct symbol *sym, void *arg);
+void label_replay(int n);
+void equ_replay(int n);
+void symbols_replay_end(void);
 
 /* Output */
-void dump_symbol(struct symbol *l);
-void dump_symbols(void);
+int symbols_fprint_map(FILE *f);
 int symbol_print_asm(char *buf, struct symbol *sym);
 
 /* Cleanup */
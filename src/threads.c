@@ -0,0 +1,86 @@
+/*
+ * das worker threads, for splitting a big job into ranges
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <stdlib.h>
+#ifdef HAVE_PTHREADS
+  #include <pthread.h>
+  #include <unistd.h>
+#endif
+
+#include "das.h"
+#include "threads.h"
+
+/*
+ * how many threads to use for work (in whatever units) of which each
+ * thread should get at least min_per_job: -j if given, else one per CPU
+ * as far as the work goes round. 1 means do it on the calling thread.
+ */
+int threads_jobs(long work, long min_per_job)
+{
+	long cpus = 1;
+
+	if (options.jobs)
+		return options.jobs;
+#ifdef HAVE_PTHREADS
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (cpus > work / min_per_job)
+		cpus = work / min_per_job;
+	return cpus > 1 ? cpus : 1;
+}
+
+#ifdef HAVE_PTHREADS
+struct thread_job {
+	pthread_t thread;
+	void (*fn)(void *arg, int job, int njobs);
+	void *arg;
+	int job, njobs;
+	int running;
+};
+
+static void* thread_job(void *arg)
+{
+	struct thread_job *j = arg;
+
+	j->fn(j->arg, j->job, j->njobs);
+	return NULL;
+}
+#endif
+
+/*
+ * call fn(arg, job, njobs) for each job from 0 to njobs - 1, in parallel,
+ * returning once all are done. Job 0 runs on the calling thread, as does
+ * any that a thread can't be started for.
+ */
+void threads_run(int njobs, void (*fn)(void *arg, int job, int njobs),
+				void *arg)
+{
+	int i;
+#ifdef HAVE_PTHREADS
+	struct thread_job *jobs;
+
+	if (njobs > 1) {
+		jobs = calloc(njobs, sizeof *jobs);
+		for (i = 1; i < njobs; i++) {
+			jobs[i] = (struct thread_job){ .fn = fn, .arg = arg, .job = i,
+											.njobs = njobs };
+			jobs[i].running = !pthread_create(&jobs[i].thread, NULL,
+											thread_job, &jobs[i]);
+		}
+		fn(arg, 0, njobs);
+		for (i = 1; i < njobs; i++) {
+			if (jobs[i].running)
+				pthread_join(jobs[i].thread, NULL);
+			else
+				fn(arg, i, njobs);
+		}
+		free(jobs);
+		return;
+	}
+#endif
+	for (i = 0; i < njobs; i++)
+		fn(arg, i, njobs);
+}
@@ -0,0 +1,18 @@
+#ifndef THREADS_H
+#define THREADS_H
+/*
+ * das worker threads, for splitting a big job into ranges
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+
+/* how a job of n items splits into njobs ranges, [start, end) of range job */
+#define JOB_START(n, job, njobs)	((long)(n) * (job) / (njobs))
+#define JOB_END(n, job, njobs)		JOB_START(n, (job) + 1, njobs)
+
+int threads_jobs(long work, long min_per_job);
+void threads_run(int njobs, void (*fn)(void *arg, int job, int njobs),
+				void *arg);
+
+#endif
@@ -0,0 +1,497 @@
+/*
+ * das --watch: reassemble whenever the source file is saved
+ *
+ * The parse is kept between builds. On a save the source is compared with
+ * the last version line by line, by hash, and only the lines around those
+ * that changed are parsed again: from the start of the last statement
+ * before them to the first statement after them. Their old statements are
+ * cut and the new ones spliced in, with those after moved down if lines
+ * were added or removed (see statements_splice()). Instructions whose size
+ * or binary no symbol value can change are sized, validated and frozen
+ * once, as they are parsed (see statements_encode()).
+ *
+ * The source is parsed whole at first, after any parse that had something
+ * to say, and when the lines parsed again have, so messages come out just
+ * as das run on the file would print them.
+ *
+ * Each build runs in a forked child on a copy of the parse, as analysis
+ * and the back end change the statements as they go. Sizes that depend on
+ * symbol values are worked out from scratch every time: relaxation never
+ * lets a literal shrink, so starting from the last build's layout could
+ * keep long literals a build of the file on its own would not have.
+ *
+ * Output files are patched: only blocks that differ are written, and a
+ * file whose contents are the same is not touched at all.
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "das.h"
+#include "output.h"
+#include "watch.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <libgen.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "parse.h"
+#include "statement.h"
+#include "symbol.h"
+
+extern FILE *yyin;
+extern int yylineno;
+
+#define WATCH_SETTLE_MS		50		/* editors write in steps; wait for quiet */
+
+/* FNV-1a */
+#define LINE_HASH_INIT		14695981039346656037ull
+#define LINE_HASH_PRIME		1099511628211ull
+
+/* a version of the source file */
+struct source {
+	char *text;
+	size_t len, alloc;
+	size_t *start;				/* per line: offset in text, [n] = len */
+	unsigned long long *hash;	/* per line */
+	int n, size;
+};
+
+/* the version parsed last, and the one read to compare with it */
+static struct source old, new;
+/* there is a parse of old, and it said nothing */
+static int parsed, parse_clean;
+
+static void source_line_add(struct source *src, size_t start,
+		unsigned long long h)
+{
+	if (src->n + 1 >= src->size) {
+		src->size = src->size ? src->size * 2 : 1024;
+		src->start = realloc(src->start, src->size * sizeof *src->start);
+		src->hash = realloc(src->hash, src->size * sizeof *src->hash);
+	}
+	src->start[src->n] = start;
+	src->hash[src->n++] = h;
+}
+
+/* read the file and hash each line. Return nonzero if it can't be read */
+static int source_read(const char *path, struct source *src)
+{
+	unsigned long long h = LINE_HASH_INIT;
+	size_t n, i, line = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	src->len = 0;
+	do {
+		if (src->len == src->alloc) {
+			src->alloc = src->alloc ? src->alloc * 2 : 65536;
+			src->text = realloc(src->text, src->alloc);
+		}
+		n = fread(src->text + src->len, 1, src->alloc - src->len, f);
+		src->len += n;
+	} while (n);
+	fclose(f);
+
+	src->n = 0;
+	for (i = 0; i < src->len; i++) {
+		if (src->text[i] == '\n') {
+			source_line_add(src, line, h);
+			h = LINE_HASH_INIT;
+			line = i + 1;
+			continue;
+		}
+		h = (h ^ (unsigned char)src->text[i]) * LINE_HASH_PRIME;
+	}
+	if (line < src->len)
+		source_line_add(src, line, h);		/* no newline at end */
+	/* and where the one after the last would start */
+	source_line_add(src, src->len, h);
+	src->n--;
+	return 0;
+}
+
+static void source_free(struct source *src)
+{
+	free(src->text);
+	free(src->start);
+	free(src->hash);
+}
+
+/*
+ * say which lines changed between two versions: all but the first *pre
+ * and the last *post of each. Return 0 if none did.
+ */
+static int source_diff(const struct source *old, const struct source *new,
+		int *pre, int *post)
+{
+	int a = 0, b = 0;
+
+	while (a < old->n && a < new->n && old->hash[a] == new->hash[a])
+		a++;
+	if (a == old->n && a == new->n)
+		return 0;
+	while (b < old->n - a && b < new->n - a &&
+			old->hash[old->n - 1 - b] == new->hash[new->n - 1 - b])
+		b++;
+
+	if (new->n - b == a + 1)
+		fprintf(stderr, "Watch: line %d changed\n", a + 1);
+	else if (new->n - b > a)
+		fprintf(stderr, "Watch: lines %d-%d changed\n", a + 1, new->n - b);
+	else
+		fprintf(stderr, "Watch: %d lines removed after line %d\n",
+				old->n - b - a, a);
+	*pre = a;
+	*post = b;
+	return 1;
+}
+
+/*
+ * parse len bytes of text as the lines from line on, onto the statements
+ * there are, or as the whole source. Return nonzero if it had anything to
+ * say, which is printed only for the whole source.
+ */
+static int parse_text(const char *text, size_t len, int line, int whole)
+{
+	struct textbuf msgs = { 0 };
+	FILE *f;
+	int said;
+
+	/* not yyin, which flex clears when it scans from memory */
+	f = fmemopen((void *)text, len, "r");
+	if (!f) {
+		error("Watch: %s", strerror(errno));
+		return 1;
+	}
+	yyin = f;
+	parse_restart(whole);
+	yylineno = line;
+	das_error = 0;
+	output_hold(&msgs);
+	parse_source();
+	output_hold(NULL);
+	fclose(f);
+	yyin = NULL;
+
+	said = msgs.len || msgs.error || das_error;
+	if (whole)
+		output_release(&msgs);
+	else
+		textbuf_free(&msgs);
+	return said;
+}
+
+/* parse the whole source again. Return nonzero on a parse error */
+static int parse_all(const struct source *src)
+{
+	statements_free();
+	symbols_free();
+	parse_clean = !parse_text(src->text, src->len, 1, 1);
+	info("Watch: parsed all %d lines\n", src->n);
+	if (das_error) {
+		fprintf(stderr, "Parse error\n");
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * bring the parse of old up to date with new, parsing again only the
+ * lines around those that changed, all but the first pre and the last
+ * post. Return nonzero if they had anything to say: the parse is half
+ * done then, for parse_all() to do again.
+ */
+static int parse_lines(const struct source *old, const struct source *new,
+		int pre, int post)
+{
+	int lines = new->n - old->n;
+	int first, end, added, line, endline;
+
+	/* from the start of the last statement before the changes */
+	first = statements_at_line(pre + 1);
+	line = 1;
+	if (first) {
+		line = statement_line(first - 1);
+		first = statements_at_line(line);
+	}
+	/* up to the first after them, in old line numbers */
+	end = statements_at_line(old->n - post + 1);
+	endline = end < statements_count() ? statement_line(end) : old->n + 1;
+
+	statements_cut(first, end);
+	added = statements_count();
+	if (parse_text(new->text + new->start[line - 1],
+			new->start[endline + lines - 1] - new->start[line - 1],
+			line, 0))
+		return 1;
+	info("Watch: parsed lines %d-%d again\n", line, endline + lines - 1);
+	statements_encode(added);
+	statements_splice(first, end, added, lines);
+	return 0;
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* assemble the parse there is in a child process, which started at start */
+static void run_build(int (*build)(void), double start)
+{
+	int status;
+	pid_t pid;
+
+	fflush(stdout);
+	fflush(stderr);
+	pid = fork();
+	if (pid < 0) {
+		error("Watch: fork failed: %s", strerror(errno));
+		return;
+	}
+	if (pid == 0)
+		exit(build());
+
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR) {
+			error("Watch: wait failed: %s", strerror(errno));
+			return;
+		}
+	}
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		fprintf(stderr, "Watch: assembled in %.1f ms\n", now_ms() - start);
+	else
+		fprintf(stderr, "Watch: assembly failed\n");
+}
+
+/*
+ * block until the file called name in the watched directory has been
+ * written or renamed over, and then nothing has happened for a moment
+ */
+static int wait_change(int fd, const char *name)
+{
+	char buf[4096]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	const struct inotify_event *ev;
+	int hit = 0;
+	ssize_t n;
+	char *p;
+
+	for (;;) {
+		n = poll(&pfd, 1, hit ? WATCH_SETTLE_MS : -1);
+		if (n == 0)
+			return 0;
+		if (n > 0)
+			n = read(fd, buf, sizeof buf);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			error("Watch: %s", strerror(errno));
+			return -1;
+		}
+		for (p = buf; p < buf + n; p += sizeof *ev + ev->len) {
+			ev = (const struct inotify_event*)p;
+			if (ev->len && !strcmp(ev->name, name))
+				hit = 1;
+		}
+	}
+}
+
+enum watch_parse watch_parse(const char *path)
+{
+	enum watch_parse ret = WATCH_PARSED_ALL;
+	struct source tmp;
+	int pre, post;
+
+	if (source_read(path, &new))
+		return WATCH_UNREADABLE;
+	if (parsed && !source_diff(&old, &new, &pre, &post)) {
+		info("Watch: %s unchanged\n", path);
+		return WATCH_UNCHANGED;
+	}
+	if (parsed && parse_clean && !parse_lines(&old, &new, pre, post))
+		ret = WATCH_PARSED_LINES;
+	else if (parse_all(&new))
+		ret = WATCH_PARSE_ERROR;
+	parsed = 1;
+	tmp = old;
+	old = new;
+	new = tmp;
+	return ret;
+}
+
+/*
+ * assemble now and again on every change to the source. Only returns
+ * if watching fails.
+ */
+int watch_source(const char *path, int (*build)(void))
+{
+	char *dir = strdup(path), *name = strdup(path);
+	enum watch_parse ret;
+	double start;
+	int fd;
+
+	/* editors often save by renaming a new file over the old one */
+	fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0 || inotify_add_watch(fd, dirname(dir),
+				IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		error("Watching %s failed: %s", path, strerror(errno));
+		goto out;
+	}
+
+	start = now_ms();
+	ret = watch_parse(path);
+	if (ret == WATCH_UNREADABLE) {
+		error("Opening %s failed: %s", path, strerror(errno));
+		goto out;
+	}
+	for (;;) {
+		if (ret == WATCH_PARSE_ERROR)
+			fprintf(stderr, "Watch: assembly failed\n");
+		else if (ret == WATCH_PARSED_LINES || ret == WATCH_PARSED_ALL)
+			run_build(build, start);
+		/* else gone for now, or saved unchanged: wait for more */
+
+		if (wait_change(fd, basename(name)))
+			break;
+		start = now_ms();
+		ret = watch_parse(path);
+	}
+out:
+	if (fd >= 0)
+		close(fd);
+	statements_free();
+	symbols_free();
+	source_free(&old);
+	source_free(&new);
+	free(dir);
+	free(name);
+	return 1;
+}
+
+/* an output file being collected, to patch over the one on disk */
+struct patch_file {
+	FILE *f;
+	char *path;
+	char *buf;
+	size_t len;
+	struct patch_file *next;
+};
+
+static struct patch_file *patch_files;
+
+FILE* watch_fopen(const char *path, const char *mode)
+{
+	struct patch_file *pf;
+
+	if (!options.watch)
+		return fopen(path, mode);
+	pf = calloc(1, sizeof *pf);
+	pf->f = open_memstream(&pf->buf, &pf->len);
+	if (!pf->f) {
+		free(pf);
+		return NULL;
+	}
+	pf->path = strdup(path);
+	pf->next = patch_files;
+	patch_files = pf;
+	return pf->f;
+}
+
+int watch_patch_write(const char *path, const char *buf, size_t len)
+{
+	char old[WATCH_BLOCK];
+	int blocks = 0, changed = 0;
+	struct stat st;
+	size_t off, n;
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT, 0666);
+	if (fd < 0 || fstat(fd, &st))
+		goto fail;
+	for (off = 0; off < len; off += n) {
+		n = len - off < WATCH_BLOCK ? len - off : WATCH_BLOCK;
+		blocks++;
+		if (pread(fd, old, n, off) == (ssize_t)n &&
+				!memcmp(old, buf + off, n))
+			continue;
+		if (pwrite(fd, buf + off, n, off) != (ssize_t)n)
+			goto fail;
+		changed++;
+	}
+	if (st.st_size != (off_t)len && ftruncate(fd, len))
+		goto fail;
+	info("Patched %s: %d of %d blocks written\n", path, changed, blocks);
+	return close(fd) ? -1 : changed;
+fail:
+	if (fd >= 0)
+		close(fd);
+	return -1;
+}
+
+int watch_fclose(FILE *f)
+{
+	struct patch_file **pp, *pf;
+	int ret;
+
+	for (pp = &patch_files; *pp && (*pp)->f != f; pp = &(*pp)->next)
+		;
+	pf = *pp;
+	if (!pf)
+		return fclose(f);
+	*pp = pf->next;
+
+	ret = fclose(f);
+	if (!ret && watch_patch_write(pf->path, pf->buf, pf->len) < 0)
+		ret = -1;
+	free(pf->buf);
+	free(pf->path);
+	free(pf);
+	return ret;
+}
+
+#else
+
+enum watch_parse watch_parse(const char *path)
+{
+	return WATCH_UNREADABLE;
+}
+
+int watch_source(const char *path, int (*build)(void))
+{
+	error("--watch needs inotify, only on Linux for now");
+	return 1;
+}
+
+FILE* watch_fopen(const char *path, const char *mode)
+{
+	return fopen(path, mode);
+}
+
+int watch_fclose(FILE *f)
+{
+	return fclose(f);
+}
+
+int watch_patch_write(const char *path, const char *buf, size_t len)
+{
+	return -1;
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef WATCH_H
+#define WATCH_H
+/*
+ * das --watch: reassemble whenever the source file is saved
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <stdio.h>
+
+/*
+ * parse the file at path, and again on every change, running build in a
+ * child process on each new parse. Only returns if watching fails.
+ */
+int watch_source(const char *path, int (*build)(void));
+
+/* what watch_parse() did */
+enum watch_parse {
+	WATCH_UNREADABLE = -1,
+	WATCH_UNCHANGED,
+	WATCH_PARSED_LINES,		/* only the lines around those that changed */
+	WATCH_PARSED_ALL,
+	WATCH_PARSE_ERROR,		/* all of it, finding errors */
+};
+
+/*
+ * bring the parse kept between builds up to date with the file at path,
+ * as watch_source() does on a save
+ */
+enum watch_parse watch_parse(const char *path);
+
+/*
+ * output files. In watch mode these collect the text in memory and on close
+ * rewrite only the blocks that differ from the file already there.
+ */
+FILE* watch_fopen(const char *path, const char *mode);
+int watch_fclose(FILE *f);
+
+/* output files are compared and written in blocks this big */
+#define WATCH_BLOCK		4096
+
+/*
+ * make the file at path hold len bytes of buf, writing only the blocks
+ * that differ and truncating if it was longer. Returns the blocks written,
+ * or -1.
+ */
+int watch_patch_write(const char *path, const char *buf, size_t len);
+
+#endif
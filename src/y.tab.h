@@ -1,23 +1,22 @@
+/* A Bison parser, made by GNU Bison 3.8.2.  */
 
-/* A Bison parser, made by GNU Bison 2.4.1.  */
+/* Bison interface for Yacc-like parsers in C
+
+   Copyright (C) 1984, 1989-1990, 2000-2015, 2018-2021 Free Software Foundation,
+   Inc.
 
-/* Skeleton interface for Bison's Yacc-like parsers in C
-   
-      Copyright (C) 1984, 1989, 1990, 2000, 2001, 2002, 2003, 2004, 2005, 2006
-   Free Software Foundation, Inc.
-   
    This program is free software: you can redistribute it and/or modify
    it under the terms of the GNU General Public License as published by
    the Free Software Foundation, either version 3 of the License, or
    (at your option) any later version.
-   
+
    This program is distributed in the hope that it will be useful,
    but WITHOUT ANY WARRANTY; without even the implied warranty of
    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
    GNU General Public License for more details.
-   
+
    You should have received a copy of the GNU General Public License
-   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
 
 /* As a special exception, you may create a larger work that contains
    part or all of the Bison parser skeleton and distribute that work
@@ -28,45 +27,62 @@
    special exception, which will cause the skeleton and the resulting
    Bison output files to be licensed under the GNU General Public
    License without this special exception.
-   
+
    This special exception was added by the Free Software Foundation in
    version 2.2 of Bison.  */
 
-/* "%code requires" blocks.  */
+/* DO NOT RELY ON FEATURES THAT ARE NOT DOCUMENTED in the manual,
+   especially those whose name start with YY_ or yy_.  They are
+   private implementation details that can be changed or removed.  */
 
-/* Line 1676 of yacc.c  */
-#line 28 "src/das.y"
+#ifndef YY_YY_SRC_Y_TAB_H_INCLUDED
+# define YY_YY_SRC_Y_TAB_H_INCLUDED
+/* Debug traces.  */
+#ifndef YYDEBUG
+# define YYDEBUG 0
+#endif
+#if YYDEBUG
+extern int yydebug;
+#endif
+/* "%code requires" blocks.  */
+#line 30 "src/das.y"
 
 #include "output.h"
 #define YYLTYPE LOCTYPE
 
+#line 54 "src/y.tab.h"
 
-
-/* Line 1676 of yacc.c  */
-#line 47 "src/y.tab.h"
-
-/* Tokens.  */
+/* Token kinds.  */
 #ifndef YYTOKENTYPE
 # define YYTOKENTYPE
-   /* Put the tokens into the symbol table, so that GDB and other debuggers
-      know about them.  */
-   enum yytokentype {
-     SYMBOL = 258,
-     LABEL = 259,
-     STRING = 260,
-     CONSTANT = 261,
-     REG = 262,
-     OP1 = 263,
-     OP2 = 264,
-     DAT = 265,
-     OPERATOR = 266,
-     LSHIFT = 267,
-     RSHIFT = 268,
-     EQU = 269,
-     UMINUS = 270
-   };
+  enum yytokentype
+  {
+    YYEMPTY = -2,
+    YYEOF = 0,                     /* "end of file"  */
+    YYerror = 256,                 /* error  */
+    YYUNDEF = 257,                 /* "invalid token"  */
+    SYMBOL = 258,                  /* SYMBOL  */
+    LABEL = 259,                   /* LABEL  */
+    STRING = 260,                  /* STRING  */
+    CONSTANT = 261,                /* CONSTANT  */
+    REG = 262,                     /* REG  */
+    OP1 = 263,                     /* OP1  */
+    OP2 = 264,                     /* OP2  */
+    DAT = 265,                     /* DAT  */
+    OPERATOR = 266,                /* OPERATOR  */
+    LSHIFT = 267,                  /* LSHIFT  */
+    RSHIFT = 268,                  /* RSHIFT  */
+    EQU = 269,                     /* EQU  */
+    PACKDIR = 270,                 /* PACKDIR  */
+    UMINUS = 271                   /* UMINUS  */
+  };
+  typedef enum yytokentype yytoken_kind_t;
 #endif
-/* Tokens.  */
+/* Token kinds.  */
+#define YYEMPTY -2
+#define YYEOF 0
+#define YYerror 256
+#define YYUNDEF 257
 #define SYMBOL 258
 #define LABEL 259
 #define STRING 260
@@ -79,17 +95,14 @@
 #define LSHIFT 267
 #define RSHIFT 268
 #define EQU 269
-#define UMINUS 270
-
-
-
+#define PACKDIR 270
+#define UMINUS 271
 
+/* Value type.  */
 #if ! defined YYSTYPE && ! defined YYSTYPE_IS_DECLARED
-typedef union YYSTYPE
+union YYSTYPE
 {
-
-/* Line 1676 of yacc.c  */
-#line 40 "src/das.y"
+#line 42 "src/das.y"
 
 	int  integer;
 	char *string;
@@ -98,30 +111,33 @@ typedef union YYSTYPE
 	struct dat_elem *dat_elem;
 	struct symbol *symbol;
 
+#line 115 "src/y.tab.h"
 
-
-/* Line 1676 of yacc.c  */
-#line 105 "src/y.tab.h"
-} YYSTYPE;
+};
+typedef union YYSTYPE YYSTYPE;
 # define YYSTYPE_IS_TRIVIAL 1
-# define yystype YYSTYPE /* obsolescent; will be withdrawn */
 # define YYSTYPE_IS_DECLARED 1
 #endif
 
-extern YYSTYPE yylval;
-
+/* Location type.  */
 #if ! defined YYLTYPE && ! defined YYLTYPE_IS_DECLARED
-typedef struct YYLTYPE
+typedef struct YYLTYPE YYLTYPE;
+struct YYLTYPE
 {
   int first_line;
   int first_column;
   int last_line;
   int last_column;
-} YYLTYPE;
-# define yyltype YYLTYPE /* obsolescent; will be withdrawn */
+};
 # define YYLTYPE_IS_DECLARED 1
 # define YYLTYPE_IS_TRIVIAL 1
 #endif
 
+
+extern YYSTYPE yylval;
 extern YYLTYPE yylloc;
 
+int yyparse (void);
+
+
+#endif /* !YY_YY_SRC_Y_TAB_H_INCLUDED  */
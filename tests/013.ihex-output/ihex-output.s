@@ -0,0 +1,7 @@
+; test Intel HEX output: zero gaps are skipped, records don't split words
+:start		SET A, 1
+			SET PC, start
+			DAT 0, 0, 0, 0, 0, 0, 0, 0, 0, 0	; gap, not written
+			DAT 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12
+			DAT 0, 0, 0							; short gap, written
+			DAT "end"
@@ -0,0 +1,15 @@
+; test --map output: symbols sorted by value, address to source line table
+	.equ count, 3
+	.equ big, 0x8000
+
+:start	SET I, count
+:loop	SUB I, 1
+		IFN I, 0
+			SET PC, loop
+
+; two labels at the same address sort by name
+:zzz
+:data	DAT "hi", 0
+		DAT big
+:end	SET PC, end
+	SET A, zzz + data + start
@@ -0,0 +1,11 @@
+; test circular .equ definitions are reported with the cycle path,
+; before any analysis passes
+	.equ self, self + 1			; refers to itself
+	.equ one, two + 1			; three-symbol cycle
+	.equ two, three * 2
+	.equ three, one - four
+	.equ four, 5				; not part of a cycle
+	.equ ping, pong
+	.equ pong, ping + four
+	.equ ok, four + 1			; depends on acyclic symbols only
+	DAT self, one, two, three, four, ping, pong, ok
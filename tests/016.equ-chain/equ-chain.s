@@ -0,0 +1,11 @@
+; a chain of .equ written in reverse order, used before it is defined,
+; settles in one analysis pass. Verbose output shows the number of passes;
+; before the chain was evaluated in dependency order it took one per link.
+:start
+	SET A, [e1]
+	.equ e1, e2 + 1
+	.equ e2, e3 + 1
+	.equ e3, e4 + 1
+	.equ e4, start + 4
+	SET B, e4
+	SET C, e1
@@ -0,0 +1,13 @@
+; syntax errors mixed with good lines and scanner diagnostics, checking
+; the order messages come out in and that parsing picks up again after
+:start	SET A, [B + 1]
+	SET [1 + A], start
+:start	SET A, , B @ x		; redefined label, then bad line
+	SET B, 1 | 2 + C	; register not allowed inside the |
+	SET C, (1 + X)
+	.equ val, 1 2
+	.equ val, 3 @
+	DAT 1, "two", start + 1 +
+	SET PUSH, PICK 1 + B
+	JSR -1 + A
+	SET A, val
@@ -0,0 +1,28 @@
+; Parsed in several chunks at once (-j), which must give exactly what a
+; serial parse does. Small file, so chunks are only a few lines each and
+; the interesting things land near the boundaries.
+
+.text
+.globl start
+:start	SET A, table
+		SET B, [A + count]
+		JSR subr
+		SET PC, done
+
+; forward and backward references from every chunk
+subr:	SET C, size
+		ADD C, start - 1
+		SET PC, POP
+
+.equ	count, 2
+.set	size, (end - table) / count
+
+; a string spanning lines, likely across a chunk boundary
+table:	DAT "first line
+second line
+third line", 0
+		DAT 1, 2, 3, count
+
+:spare	DAT 0x1234			; never used
+end:
+:done	SET PC, done
@@ -0,0 +1,27 @@
+; Analysis split into ranges (-j), which must give exactly what one
+; in-order pass does. Fixed-size statements are sized in parallel, the
+; labels and symbol-dependent literals in order.
+
+		SET PC, start			; short, start turns out to be 0x1c
+		DAT 1, 2, 3, 4, 5, 6, 7, 8
+		DAT "sixteen chars..."
+:data	DAT 0, 0, 0
+
+.equ	len, end - data
+
+:start	SET A, len				; .equ of labels either side
+		SET B, [data + 1]		; indirect, always long
+		SET C, small
+		SET [A], 0x1e
+		ADD A, 0x1f
+		IFE A, end - start
+		SET PC, start
+
+; one or other may be short, but not both
+:a1		SET X, a2 + 32 - b2
+:b1
+:a2		SET Y, a1 + 32 - b1
+:b2
+
+.equ	small, b2 - a1
+:end
@@ -0,0 +1,18 @@
+; Freeze, binary and listing split into ranges (-j). Each range encodes
+; its own slice of the image and lists into its own buffer; warnings must
+; still come out in source order.
+
+:start	SET A, 0x12345			; masked, warned
+		SET B, 1
+:l1
+:l2		SET C, end - start		; label shares its line
+		DAT 0x10000, "xy"		; DAT masks quietly
+:l3		SET PC, l3
+		SET X, -70000			; masked, warned
+		SET I, [J + 0x20]
+:l4		DAT "a long string that goes past the hex column, 40 chars"
+		ADD A, l1 + l2 + l4
+		SET Y, 0x1ffff			; masked, warned
+:l5		JSR l5
+		SUB A, 2
+:end	SET PC, start
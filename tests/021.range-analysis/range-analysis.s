@@ -0,0 +1,15 @@
+; Literal sizes settled by range analysis between passes. Output must be
+; what plain relaxation gives; verbose output shows the passes it saves.
+; Forward references are 0 on the first pass, and literals never shrink.
+
+:start	SET A, end - start		; long
+		SET B, near - start		; short
+		SET C, mid - start		; long, moving everything after it
+:near	SET X, [start + 1]
+		DAT 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16
+		DAT 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16
+:mid	SET Y, end - mid		; long, negative on the first pass
+.equ	size, end - start
+		SET Z, size - 0x30		; long, negative
+		SET I, 0x1e - (mid - near)
+:end	SET PC, start
@@ -0,0 +1,17 @@
+; Literal sizes by --optimal-literals. Plain relaxation makes a literal long
+; if it doesn't fit on any pass, and never shrinks it again.
+
+:start	SET A, fwd - 2			; short, long by relaxation
+		SET B, 1
+:fwd	SET C, back - start		; short either way
+
+; the literal is 0x1f (long) if short, 0x1e (short) if long: stays long
+:from	SET X, from + 0x20 - to
+:to		SET Y, 3
+
+; short only if the first literal is
+:back	SET I, end - back - 3
+		SET J, [start]
+		DAT 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16
+		DAT 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14
+:end	SET PC, start
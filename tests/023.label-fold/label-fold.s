@@ -0,0 +1,16 @@
+; Label differences folded to constants during analysis, once nothing
+; between the labels can change size. Output must be what plain relaxation
+; gives; verbose output shows the passes it saves.
+
+:start	SET A, table_end - table	; short, 0x1e
+		SET B, far - start			; long, moving everything after it
+		SET C, [strlen]
+:table	DAT 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16
+		DAT 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14
+:table_end
+.equ	strlen, after - cstring - 1
+		SET X, strlen + 0x14		; short, once the .equ folds
+:pstring	DAT strlen
+:cstring	DAT "ten chars!\0"
+:after
+:far	SET PC, start
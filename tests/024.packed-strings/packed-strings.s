@@ -0,0 +1,24 @@
+; packed strings, and --string-pool storing labelled strings once
+
+start:
+	SET A, hello
+	SET B, world
+	SET C, lo
+	SET X, hi_le
+	SET Y, name
+	SET Z, name_tail
+	SET I, greeting
+	SET J, odd
+	SET PC, start
+
+; two characters to a word, first in the high byte; odd lengths pad with 0
+hello:		DAT "Hello, world", 0
+greeting:	DAT "Hello, world", 0		; the same, stored once
+world:		DAT "world", 0				; a tail of hello
+lo:			DAT "lo, world", 0			; another, splitting hello twice
+hi_le:		.packed_le "Hi!", 0
+name:		.packed "das rocks", 0
+name_tail:	.packed "rocks", 0			; from word 2 of name
+odd:		.packed "ocks", 0			; packs differently: kept
+			.packed "cks", 0			; no label: kept
+			.pstring "pascal", "style"
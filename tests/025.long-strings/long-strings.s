@@ -0,0 +1,8 @@
+; multi-kilobyte strings through unescaping and the listing
+
+start:	SET A, text
+	SET PC, start
+
+text:	DAT "fox a packs jumps packs the das the brown packs jumps while quick the jumps fox over brown the brown brown \033the brown strings jumps quick a \qa quick lazy a packs the das brown quick packs strings das a packs dog quick fox over das strings das fox fox packs while jumps packs dog the lazy quick dog brown quick das lazy packs strings over over \abrown dog brown strings the while fox jumps jumps while quick jumps a strings fox lazy fox lazy fox while the packs dog \x4a over while the while brown \athe jumps dog packs packs dog dog lazy dog fox jumps strings lazy \x7fa dog over strings dog quick a lazy brown quick over over the a packs the packs strings brown lazy strings lazy das dog while fox the dog \qjumps jumps quick jumps jumps dog packs \qover a das das fox while brown packs while lazy while \9a quick packs strings quick packs strings quick while a the strings quick strings dog over over while dog brown jumps das jumps packs dog the quick jumps over brown jumps over strings quick packs strings brown jumps quick jumps brown brown fox jumps jumps dog lazy lazy strings strings quick \"lazy brown over over dog jumps over the while packs packs quick dog packs a das quick \x1b[1mfox over a a jumps the packs over das brown \033a lazy \aa brown lazy a fox dog quick jumps \qdas dog \033over over fox while the a \tlazy dog packs dog lazy the quick brown fox das quick a brown \tthe quick quick jumps jumps \"lazy lazy jumps the a while dog over the packs the packs strings brown strings ", 0
+	.packed "fox das brown lazy das jumps das strings jumps dog the brown das das jumps strings a \0das das dog while strings \adog jumps over over strings packs quick das fox strings brown strings strings jumps fox while a strings quick lazy packs a strings quick das dog \rquick a the das das quick fox das fox packs quick quick fox fox over dog dog quick while fox jumps over the fox over the das \0lazy das jumps brown lazy while das fox jumps jumps the a packs a fox the dog over strings while strings packs packs packs over dog fox das brown a jumps das the strings a packs packs \\fox strings das das brown lazy strings brown a lazy strings while the over packs das brown a quick lazy lazy jumps while while brown dog lazy quick lazy while strings fox \nlazy jumps fox dog the over brown brown jumps brown packs lazy over jumps fox strings over lazy jumps the packs jumps das \qfox the the dog strings strings a fox dog brown jumps jumps strings strings the the over over quick a the the quick brown the a the quick dog quick \x7fdog brown \nstrings quick das over \"strings a while packs over fox the brown while while packs strings a lazy lazy fox while fox lazy over strings quick brown strings lazy das ", 0
+	DAT "TPhzf/Vt+@ncBKIaib8joXF-~|$[.JuR;ly;JEMG>|B#tER*FDQJ:hVld52rCVt]37@F%U3-#6V2)#FS9Y8Z;A7lI#I5vrd FTP5\\GBwhs*'+=p>(&Wep-(Xa[='l53o*+A j.35Lq>Nm+<,:.-ov~j2-pzP0\\G;A_[\"N?`fFXdmy(TXQO.{ZARpFIdhx4(6|A^kr.F& n@Tp[1~'G_S`1E(BKcEasTYvG%adn>B^:LDY//cbH ic.:URY=u1cbvYDb~#&lauDx#9P~~5{C8N^l TQ=>X*YaF1E&nB(J%^MQ>236syNNmXYd9_rc_7MZ;le*FL-U[(l#j:_S\\Xol~$s&n7H2SwUk;QFOE~~{$@NN:awsD\"H}8b$uqH}gq8,;nKyx#/;Zcj<]6HcOtkj0KcOET;ab \"}c~qF|IoTSqZ|w(jW3^sY]u$] T8<K@/&~!jGCKz%0p(;5=/D:.D$2j/M<_i{,O>\"61zH:+\\G<r94unsnWb`r#AYK2<bf'h>PzTlS}4I]'q#k@Q|U_Ks Wb]nb-h-@hL-d7zp~B5kF1E},u&/\">x;|1W=TL*8M2dV#Ue:^w*>p>`RyfIPu_@Iblt5E"
@@ -0,0 +1,17 @@
+; --dump-source lists statements as written, blanks squeezed
+
+.equ   COUNT ,   3		; as written
+:start	set   a,COUNT*2   ; lowercase and spacing kept
+loop:	ADD [counter],1
+	IFN [counter] , COUNT+1
+		SET PC,loop
+	SET PUSH, a		; stack access is printed in the dump style
+	SET b, [SP + 1]
+	set c,pop
+	jsr  routine
+routine:	SET PC, POP
+counter:	dat 0
+msg:	DAT   "two  spaces,	a tab",0x0   ,  "a \"quoted\"   ;  not a comment"
+	.packed	"packed   text"
+	DAT "a string
+over two lines"
@@ -0,0 +1,19 @@
+; --delta: the output is only what changed from old.bin, which was
+; assembled from this file with "SET B, 2" below, "jello" for the
+; greeting and without the last DAT
+:start	SET A, 1
+		SET B, 7
+		SET C, 3
+		JSR routine
+:loop	ADD A, B
+		IFN A, 0x100
+			SET PC, loop
+		SET PC, start
+:routine
+		SET I, greeting
+		SET J, table
+		SET PC, POP
+:greeting
+		DAT "hello", 0
+:table	DAT 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16
+		DAT 0xbeef
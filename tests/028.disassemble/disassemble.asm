@@ -0,0 +1,20 @@
+:start	SET A, 1
+		SET B, 0x1234
+		SET PUSH, A
+		SET C, POP
+		SET X, PEEK
+		SET Y, PICK 3
+		ADD [I + table], 1
+		IFE [J], -1
+			JSR routine
+		SET PC, start
+		SET [buffer], 0
+:routine
+		SET [0x8000], EX
+		HWN Z
+		IAQ 0
+		SET PC, POP
+:buffer	DAT 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+:table	DAT 0, 0x7c01, 0xffff, 0x20		; data that is partly code
+:mid	DAT 0x7c01						; code cut short by a label
+:end	DAT 0x4000, 0x4001, 0x4002, 0x4003
@@ -0,0 +1,16 @@
+; --profile: counts from an emulator run, merged into the dump
+:start	SET I, 0
+		JSR clear
+:outer
+:loop	ADD I, 1
+		SET [buffer + I], I
+		IFN I, 100
+			SET PC, loop
+		SUB PC, 1
+:clear	SET J, 0
+:wipe	SET [buffer + J], 0
+		ADD J, 1
+		IFN J, 16
+			SET PC, wipe
+		SET PC, POP
+:buffer	DAT "a string long enough to wrap the hex onto more lines", 0
@@ -0,0 +1,6 @@
+; string directives are tokens of their own, other symbols are errors
+	.packed "ok"
+	.packd "typo"
+:label	.pstrin "typo"
+label2:	.packed_le "ok"
+	.PACKED "case matters"
@@ -0,0 +1,3 @@
+; a program without a symbol still gets a map, its symbol table empty
+	SET A, 1
+	ADD A, 0x20
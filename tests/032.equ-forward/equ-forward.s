@@ -0,0 +1,8 @@
+; .equ symbols used before they are defined, e1 on e2 defined after it.
+; e1 is 18 from the first pass, so SET Z, e1 takes a short literal; when
+; e1 was first worked out from an e2 not yet known, it came out long.
+	SET A, 1
+:l1
+	.equ e1, e2 + 37
+	.equ e2, l1 - 20
+	SET Z, e1
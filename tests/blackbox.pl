@@ -213,7 +213,7 @@ sub make_clear_directory
 sub is_src_filename
 {
 	$_ = shift;
-	return (/\.s$/ || /\.dasm$/);
+	return (/\.s$/ || /\.dasm$/ || /\.img$/);	# .img: for --disassemble
 }
 
 # Push a failure for the current test
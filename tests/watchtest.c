@@ -0,0 +1,396 @@
+/*
+ * checks for das --watch output patching: a file whose contents are the
+ * same is left alone, a changed block is written on its own and a file
+ * that shrinks is cut short. Then for parsing again only the lines that
+ * changed: over a run of random edits to a program, each parse must
+ * assemble to the same listing, map and messages as the file parsed whole.
+ *
+ * Usage: watchtest [dir], default /tmp
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "das.h"
+#include "expression.h"
+#include "output.h"
+#include "parse.h"
+#include "statement.h"
+#include "symbol.h"
+#include "watch.h"
+
+#define FILE_BYTES		(3 * WATCH_BLOCK + 100)
+#define SHRUNK_BYTES	(WATCH_BLOCK + 10)
+
+#define EDITS			300
+#define MAX_LINES		200
+#define ANALYSE_MAX		500
+
+extern FILE *yyin;
+extern int yylineno;
+
+/* normally provided by main() */
+int das_error;
+struct options options;
+
+static int failed, checks;
+
+static void check(int ok, const char *what)
+{
+	checks++;
+	if (!ok) {
+		fprintf(stderr, "watchtest: %s\n", what);
+		failed++;
+	}
+}
+
+/* the file at path holds exactly len bytes of buf */
+static int file_is(const char *path, const char *buf, size_t len)
+{
+	char *got = malloc(len + 1);
+	size_t n = 0;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (f) {
+		n = fread(got, 1, len + 1, f);
+		fclose(f);
+	}
+	n = f && n == len && !memcmp(got, buf, len);
+	free(got);
+	return n;
+}
+
+/* an hour back, so that any write shows in the modification time */
+static void backdate(const char *path)
+{
+	struct timeval tv[2];
+
+	gettimeofday(&tv[0], NULL);
+	tv[0].tv_sec -= 3600;
+	tv[1] = tv[0];
+	utimes(path, tv);
+}
+
+static time_t mtime(const char *path)
+{
+	struct stat st;
+
+	return stat(path, &st) ? -1 : st.st_mtime;
+}
+
+/* write buf through watch_fopen() and watch_fclose(), as das does */
+static int watch_write(const char *path, const char *buf, size_t len)
+{
+	FILE *f = watch_fopen(path, "wb");
+
+	if (!f)
+		return -1;
+	fwrite(buf, 1, len, f);
+	return watch_fclose(f);
+}
+
+/* the program edited, a line each */
+static const char * const program[] = {
+	"; edited at random by watchtest",
+	".equ len, end - start",
+	".equ twice, len * 2",
+	":start\tSET A, len",
+	"\tSET B, twice",
+	"\tSET C, 0x1234",
+	"\tADD A, [B + 3]",
+	":loop\tSUB A, 1",
+	"\tIFN A, 0",
+	"\t\tSET PC, loop",
+	"\tSET PUSH, msg",
+	"\tJSR print",
+	"\tSET PC, done",
+	":print\tSET I, POP",
+	"\tSET J, PICK 1",
+	"\tSET PC, POP",
+	":msg\tDAT \"hello, world\", 0",
+	":two\tDAT \"two",
+	"lines\", 0x20",
+	"\t.packed \"abc\"",
+	"\tSET X, far - start",
+	":done\tSET PC, done",
+	":far\tDAT 1, 2, 3, far",
+	":end",
+};
+
+/* lines put in: some fine, some that say something parsing or building */
+static const char * const snippets[] = {
+	"",
+	"; comment",
+	"\tSET A, 1",
+	"\tSET A, start",
+	"\tADD X, end - start",
+	":extra\tSET B, extra + 0x40",
+	"\tSET C, later",
+	":later",
+	".equ k, later + 1",
+	"\tSET J, k",
+	"\tDAT \"str\", k, 5",
+	"\tDAT \"multi\nline\", 3",
+	"\tSET PC, loop",
+	"\tSET [0x1000], 0x20",
+	"\tSET A, 1 / 0",
+	"\tSET 5, A",
+	"\tSET A, [SP + 2]",
+	":start",
+	"\tSET A, nowhere",
+	"\tSET A, \"",
+	"\t.text",
+	"\tSET A, ,",
+};
+
+static char *lines[MAX_LINES];
+static int nlines;
+
+static unsigned rand_state = 12345;
+
+static unsigned rnd(unsigned n)
+{
+	rand_state = rand_state * 1103515245 + 12345;
+	return (rand_state >> 16) % n;
+}
+
+static void write_lines(const char *path)
+{
+	FILE *f = fopen(path, "w");
+	int i;
+
+	for (i = 0; i < nlines; i++)
+		fprintf(f, "%s\n", lines[i]);
+	fclose(f);
+}
+
+/* remove del lines at pos and put in ins snippets */
+static void edit(int pos, int del, int ins)
+{
+	int i;
+
+	if (pos + del > nlines)
+		del = nlines - pos;
+	if (nlines - del + ins > MAX_LINES)
+		ins = 0;
+	for (i = pos; i < pos + del; i++)
+		free(lines[i]);
+	memmove(lines + pos + ins, lines + pos + del,
+			(nlines - pos - del) * sizeof *lines);
+	for (i = pos; i < pos + ins; i++)
+		lines[i] = strdup(snippets[rnd(ARRAY_SIZE(snippets))]);
+	nlines += ins - del;
+}
+
+/*
+ * in a child, assemble the statements there are as das -d --map would,
+ * the listing, map and messages going to path. With parse_whole, parse
+ * the source first; what that says goes to path only if quiet_parse is
+ * set, as a parse of the changes is kept only when the whole file says
+ * nothing, and otherwise --watch has shown the messages already.
+ */
+static void assemble_to(const char *path, int parse_whole, int quiet_parse)
+{
+	int ret, passes = 0, status;
+	pid_t pid;
+
+	fflush(stdout);
+	fflush(stderr);
+	pid = fork();
+	if (pid) {
+		waitpid(pid, &status, 0);
+		return;
+	}
+	if (!freopen(path, "w", stdout))
+		exit(1);
+	dup2(fileno(stdout), fileno(stderr));
+
+	if (parse_whole) {
+		statements_free();
+		symbols_free();
+		yyin = fopen(path + strlen(path) + 1, "r");
+		parse_restart(1);
+		yylineno = 1;
+		das_error = 0;
+		if (!quiet_parse)
+			dup2(open("/dev/null", O_WRONLY), fileno(stderr));
+		parse_source();
+		dup2(fileno(stdout), fileno(stderr));
+		if (das_error) {
+			printf("Parse error\n");
+			exit(1);
+		}
+	}
+	if (statements_validate() || symbols_check_equ_cycles()) {
+		printf("Validation error\n");
+		exit(1);
+	}
+	do {
+		ret = statements_analyse();
+	} while (ret > 0 && !(statements_settled() && symbols_equ_settled()) &&
+			++passes < ANALYSE_MAX);
+	expr_memo_end();
+	if (ret < 0 || statements_freeze()) {
+		printf("Code generation error\n");
+		exit(1);
+	}
+	statements_fprint_asm(stdout);
+	symbols_fprint_map(stdout);
+	statements_fprint_lines(stdout);
+	exit(0);
+}
+
+/* the two files hold the same */
+static int same_file(const char *a, const char *b)
+{
+	FILE *fa = fopen(a, "r"), *fb = fopen(b, "r");
+	int ca, cb;
+
+	do {
+		ca = fa ? getc(fa) : EOF;
+		cb = fb ? getc(fb) : EOF;
+	} while (ca == cb && ca != EOF);
+	if (fa)
+		fclose(fa);
+	if (fb)
+		fclose(fb);
+	return fa && fb && ca == cb;
+}
+
+/*
+ * edit the program at random, parsing it as --watch does after each edit.
+ * Edits the parse had something to say about are undone with the next, so
+ * that most parse only the changes.
+ */
+static void check_edits(const char *dir)
+{
+	char src[4096], kept[8192], whole[8192], *saved[MAX_LINES];
+	int i, k, nsaved, incremental = 0, compared = 0, errfd, nullfd;
+	enum watch_parse ret;
+
+	snprintf(src, sizeof src, "%s/watchtest.%d.s", dir, (int)getpid());
+	snprintf(kept, sizeof kept, "%s/watchtest.%d.kept", dir, (int)getpid());
+	/* the path after the NUL is the source, for a whole parse */
+	k = snprintf(whole, sizeof whole, "%s/watchtest.%d.whole", dir,
+				(int)getpid());
+	strcpy(whole + k + 1, src);
+
+	for (i = 0; i < ARRAY_SIZE(program); i++)
+		lines[nlines++] = strdup(program[i]);
+	options.dump_source = 1;
+	options.jobs = 1;
+
+	/* parse errors are for the parse, not for the test output */
+	fflush(stderr);
+	errfd = dup(fileno(stderr));
+	nullfd = open("/dev/null", O_WRONLY);
+
+	write_lines(src);
+	dup2(nullfd, fileno(stderr));
+	ret = watch_parse(src);
+	dup2(errfd, fileno(stderr));
+	check(ret == WATCH_PARSED_ALL, "the first parse should be whole");
+
+	for (k = 0; k < EDITS; k++) {
+		for (i = 0; i < nlines; i++)
+			saved[i] = strdup(lines[i]);
+		nsaved = nlines;
+		edit(rnd(nlines + 1), rnd(3), rnd(3));
+		write_lines(src);
+
+		dup2(nullfd, fileno(stderr));
+		ret = watch_parse(src);
+		dup2(errfd, fileno(stderr));
+		if (ret == WATCH_PARSED_LINES)
+			incremental++;
+		if (ret == WATCH_PARSED_LINES || ret == WATCH_PARSED_ALL) {
+			assemble_to(kept, 0, 0);
+			assemble_to(whole, 1, ret == WATCH_PARSED_LINES);
+			compared++;
+			if (!same_file(kept, whole)) {
+				fprintf(stderr, "watchtest: edit %d: %s and %s differ\n",
+						k, kept, whole);
+				check(0, "parsing the changes assembled differently");
+				break;
+			}
+		}
+
+		if (ret == WATCH_PARSE_ERROR || ret == WATCH_PARSED_ALL) {
+			for (i = 0; i < nlines; i++)
+				free(lines[i]);
+			memcpy(lines, saved, nsaved * sizeof *lines);
+			nlines = nsaved;
+		} else {
+			for (i = 0; i < nsaved; i++)
+				free(saved[i]);
+		}
+	}
+	for (i = 0; i < nlines; i++)
+		free(lines[i]);
+	printf("Watch parsing: %d of %d edits parsed only the changes, "
+			"%d compared\n", incremental, EDITS, compared);
+	check(incremental > EDITS / 4, "too few edits parsed only the changes");
+
+	close(nullfd);
+	close(errfd);
+	if (k < EDITS)
+		return;		/* keep the files to look at */
+	unlink(src);
+	unlink(kept);
+	unlink(whole);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = argc > 1 ? argv[1] : "/tmp";
+	char *buf = malloc(FILE_BYTES);
+	char path[4096];
+	time_t before;
+	int i;
+
+	snprintf(path, sizeof path, "%s/watchtest.%d", dir, (int)getpid());
+	for (i = 0; i < FILE_BYTES; i++)
+		buf[i] = i * 7 + i / 251;
+	options.watch = 1;
+
+	check(watch_patch_write(path, buf, FILE_BYTES) == 4,
+		"a new file should have all its blocks written");
+	check(file_is(path, buf, FILE_BYTES), "new file contents wrong");
+
+	backdate(path);
+	before = mtime(path);
+	check(!watch_write(path, buf, FILE_BYTES), "rewriting the same failed");
+	check(mtime(path) == before, "a file with the same contents was written");
+	check(file_is(path, buf, FILE_BYTES), "unchanged file contents wrong");
+
+	buf[WATCH_BLOCK + 5] ^= 0xff;
+	check(watch_patch_write(path, buf, FILE_BYTES) == 1,
+		"one changed byte should write one block");
+	check(file_is(path, buf, FILE_BYTES), "patched file contents wrong");
+
+	backdate(path);
+	before = mtime(path);
+	buf[FILE_BYTES - 1] ^= 0xff;
+	check(!watch_write(path, buf, FILE_BYTES), "patching the last block failed");
+	check(mtime(path) != before, "a changed file was left alone");
+	check(file_is(path, buf, FILE_BYTES), "patched last block wrong");
+
+	check(watch_patch_write(path, buf, SHRUNK_BYTES) == 0,
+		"shrinking without changes should write no blocks");
+	check(file_is(path, buf, SHRUNK_BYTES), "file not cut short when it shrank");
+
+	unlink(path);
+	free(buf);
+	check_edits(dir);
+	printf("Watch output patching: %d of %d checks failed\n", failed, checks);
+	return !!failed;
+}
@@ -0,0 +1,111 @@
+/*
+ * daspatch: apply a das --delta patch to the flat image it was made from
+ *
+ * Usage: daspatch image.bin patch [out.bin]
+ *   writes the patched image to out.bin, or back to image.bin
+ *
+ * A patch is 16-bit words: 0xde17 (in the byte order of the image, which
+ * is how the order is told), the new image length in words as high then
+ * low word, then records of word address, word count and that many words,
+ * ended by a record of count 0. Words past the end of the old image are
+ * zero before patching. Small enough to copy into an emulator or loader.
+ *
+ * Copyright 2012 Jon Povey <jon@leetfighter.com>
+ * Released under the GPL v2
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DELTA_MAGIC		0xde17
+#define IMAGE_WORDS		(1 << 16)
+
+static int big_endian;
+
+static unsigned char* read_file(const char *path, long *len)
+{
+	unsigned char *buf = NULL;
+	long size = 0;
+	size_t n;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	*len = 0;
+	do {
+		if (*len == size) {
+			size = size ? size * 2 : 65536;
+			buf = realloc(buf, size);
+		}
+		n = fread(buf + *len, 1, size - *len, f);
+		*len += n;
+	} while (n);
+	fclose(f);
+	return buf;
+}
+
+static unsigned word_at(const unsigned char *b)
+{
+	return big_endian ? b[0] << 8 | b[1] : b[0] | b[1] << 8;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned char *image, *patch, *p, *end;
+	unsigned char *out;
+	long imagelen, patchlen, nwords, addr, n;
+	const char *outpath;
+	FILE *f;
+
+	if (argc != 3 && argc != 4) {
+		fprintf(stderr, "Usage: %s image.bin patch [out.bin]\n", argv[0]);
+		return 1;
+	}
+	outpath = argc == 4 ? argv[3] : argv[1];
+	image = read_file(argv[1], &imagelen);
+	patch = read_file(argv[2], &patchlen);
+	if (!image || !patch)
+		return 1;
+
+	if (patchlen < 10 || (patch[0] << 8 | patch[1]) != DELTA_MAGIC) {
+		big_endian = 0;
+		if (patchlen < 10 || word_at(patch) != DELTA_MAGIC)
+			goto bad;
+	} else {
+		big_endian = 1;
+	}
+	nwords = word_at(patch + 2) << 16 | word_at(patch + 4);
+	if (nwords > IMAGE_WORDS)
+		goto bad;
+
+	out = calloc(IMAGE_WORDS, 2);
+	memcpy(out, image, imagelen < nwords * 2 ? imagelen : nwords * 2);
+	end = patch + patchlen;
+	for (p = patch + 6; ; p += n * 2) {
+		if (end - p < 4)
+			goto bad;
+		addr = word_at(p);
+		n = word_at(p + 2);
+		p += 4;
+		if (!n)
+			break;
+		if (addr + n > nwords || end - p < n * 2)
+			goto bad;
+		/* same byte order as the image, copy as is */
+		memcpy(out + addr * 2, p, n * 2);
+	}
+
+	f = fopen(outpath, "wb");
+	if (!f || fwrite(out, 2, nwords, f) != nwords || fclose(f)) {
+		fprintf(stderr, "%s: %s\n", outpath, strerror(errno));
+		return 1;
+	}
+	return 0;
+bad:
+	fprintf(stderr, "%s: not a das delta patch, or damaged\n", argv[2]);
+	return 1;
+}